@@ -31,11 +31,23 @@ user_s* ue_create(uint userid)
 	new_ue->msg_control_queue = ringbuf_create(MAC_CTRL_MSG_BUF_SIZE);
 	new_ue->fragmenter = mac_frag_init();
 	new_ue->reassembler = mac_assmbl_init();
+	new_ue->hc = mac_hc_init();
+	mac_frag_set_hc(new_ue->fragmenter, new_ue->hc);
+	mac_frag_set_arq(new_ue->fragmenter, 1);
+	mac_assmbl_set_arq(new_ue->reassembler, 1);
 	new_ue->userid = userid;
 	new_ue->ul_queue = 0;
 	new_ue->dl_mcs = 0;
 	new_ue->ul_mcs = 0;
 	new_ue->fs = NULL;
+	// DL reports are filtered by the UE already
+	mac_la_init(&new_ue->la[DL], 1.0);
+	mac_la_init(&new_ue->la[UL], MAC_LA_SNR_ALPHA);
+	for (int sfn=0; sfn<FRAME_LEN; sfn++) {
+		atomic_init(&new_ue->harq_dl_ack[sfn], 0);
+		atomic_init(&new_ue->harq_dl_nack[sfn], 0);
+		atomic_init(&new_ue->harq_ul_nack[sfn], 0);
+	}
 
 	// init stats struct
     mac_stats_init(&new_ue->stats);
@@ -52,6 +64,9 @@ void ue_destroy(user_s* ue)
 	ringbuf_destroy(ue->msg_control_queue);
 	mac_frag_destroy(ue->fragmenter);
 	mac_assmbl_destroy(ue->reassembler);
+	mac_hc_destroy(ue->hc);
+	mac_harq_tx_reset(&ue->harq_dl);
+	phy_harq_free(ue->harq_ul, HARQ_PROCESSES);
 	ofdmframesync_destroy(ue->fs);
 	free(ue);
 }
@@ -67,14 +82,17 @@ MacBS mac_bs_init()
 	macinst->broadcast_data_fragmenter = mac_frag_init();
 
 #ifdef MAC_ENABLE_TAP_DEV
-	macinst->tapdevice = tap_init("tap0");
+	macinst->tap_pool = framepool_create(MAC_TAP_POOL_SIZE_BS, MAC_MTU);
 #endif
 
-    SLIST_INIT(&macinst->etheraddr_map);
+    macinst->etheraddr_map = mac_fwd_init();
+    macinst->proxy = mac_proxy_init();
 
 	macinst->last_added_rachuserid=-1;
 	macinst->last_added_userid=-1;
 
+	macinst->sched_type = MAC_SCHED_DRR;
+
 	return macinst;
 }
 
@@ -92,17 +110,18 @@ void mac_bs_destroy(MacBS mac)
 	ringbuf_destroy(mac->broadcast_ctrl_queue);
 	mac_frag_destroy(mac->broadcast_data_fragmenter);
 
-    while (!SLIST_EMPTY(&mac->etheraddr_map)) {
-        struct entry* n1 = SLIST_FIRST(&mac->etheraddr_map);
-        SLIST_REMOVE_HEAD(&mac->etheraddr_map, entries);
-        free(n1);
-    }
+    mac_fwd_destroy(mac->etheraddr_map);
+    mac_proxy_destroy(mac->proxy);
+	if (mac->tap_pool)
+		framepool_destroy(mac->tap_pool);
 	free(mac);
 }
 
 void mac_bs_set_phy_interface(MacBS mac, struct PhyBS_s* phy)
 {
 	mac->phy = phy;
+	for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++)
+		mac_la_set_tbs(mcs, get_tbs_size(phy->common, mcs));
 }
 
 void mac_bs_add_new_ue(MacBS mac, uint8_t rachuserid, uint8_t rach_try_cnt, ofdmframesync fs, int timing_diff)
@@ -137,6 +156,7 @@ void mac_bs_add_new_ue(MacBS mac, uint8_t rachuserid, uint8_t rach_try_cnt, ofdm
 			// create new UE struct
 			mac->UE[userid] = ue_create(userid);
 			mac->UE[userid]->fs = fs;
+			mac->UE[userid]->ul_cfo = ofdmframesync_get_cfo(fs);
 			mac->UE[userid]->last_seen = mac->subframe_cnt;
             mac->UE[userid]->timingadvance = timing_diff;
             response = mac_msg_create_associate_response(userid,rachuserid, assoc_resp_success, timing_diff);
@@ -179,6 +199,59 @@ void mac_bs_set_mcs(MacBS mac, uint userid, uint mcs, uint dl_ul)
 	}
 }
 
+// Run the link adaptation of a user for one link direction and request an MCS change if needed
+static void mac_bs_link_adapt(MacBS mac, user_s* ue, uint dl_ul)
+{
+	link_adapt_s* la = &ue->la[dl_ul];
+	long int pending_time = (dl_ul==DL) ? ue->dl_mcs_pending_time : ue->ul_mcs_pending_time;
+	if (!mac_la_is_enabled() || la->fixed || pending_time>0)
+		return;
+
+	uint cur_mcs = (dl_ul==DL) ? ue->dl_mcs : ue->ul_mcs;
+	uint mcs = mac_la_select(la, cur_mcs, mac->subframe_cnt);
+	if (mcs != cur_mcs) {
+		LOG(INFO,"[MAC BS] link adaptation: user %d %s MCS %d -> %d. SNR %.1fdB offset %.1fdB\n",
+			ue->userid, (dl_ul==DL) ? "DL" : "UL", cur_mcs, mcs, la->snr, la->offset);
+		mac_bs_set_mcs(mac, ue->userid, mcs, dl_ul);
+	}
+}
+
+// Called by PHY for every received UL slot of a user with the measured SNR.
+// crc_ok is the CRC result of data slots, -1 for ctrl slots, which always use MCS 0.
+// The SNR of slots with CRC error is not used, the UE might not have sent at all
+void mac_bs_ul_quality(MacBS mac, uint userid, float snr, int crc_ok)
+{
+	if (userid>=MAX_USER || mac->UE[userid]==NULL)
+		return;
+	user_s* ue = mac->UE[userid];
+	if (crc_ok)
+		mac_la_add_snr(&ue->la[UL], snr);
+	// slots sent while the UE switches the MCS say nothing about the new MCS
+	if (crc_ok>=0 && ue->ul_mcs_pending_time==0)
+		mac_la_add_crc(&ue->la[UL], crc_ok ? 1 : 0, crc_ok ? 0 : 1);
+	mac_bs_link_adapt(mac, ue, UL);
+}
+
+// Called by PHY with the HARQ result of a UL data slot. num_rx is the number of receptions
+// of the block. Failed blocks are retransmitted in the same slot HARQ_RTT subframes later
+void mac_bs_ul_harq_result(MacBS mac, uint userid, uint subframe, uint slot, int crc_ok, uint num_rx)
+{
+	if (userid>=MAX_USER || mac->UE[userid]==NULL)
+		return;
+	user_s* ue = mac->UE[userid];
+	harq_stats_s* st = &ue->harq_stats[UL];
+	if (num_rx==1)
+		st->blocks++;
+	else
+		st->retx++;
+	if (crc_ok)
+		st->ok[num_rx-1]++;
+	else if (mac_harq_is_enabled() && num_rx<HARQ_MAX_TX)
+		atomic_fetch_or(&ue->harq_ul_nack[subframe], 1<<slot);
+	else
+		st->failed++;
+}
+
 // Try to get the receiver object for the given userid
 // returns NULL if user does not exist
 ofdmframesync mac_bs_get_receiver(MacBS mac, uint userid)
@@ -202,11 +275,14 @@ int mac_bs_add_txdata(MacBS mac, uint8_t destUserID, MacDataFrame frame)
 		return 0;
 	}
 
+    uint size = frame->size;
     uint ret = mac_frag_add_frame(fragmenter,frame);
 	if (ret == 0) {
-		LOG(WARN,"[MAC BS] add_txdata: msg queue is full. dropping packet!\n");
+		LOG(DEBUG,"[MAC BS] add_txdata: msg queue is full. dropping packet!\n");
 		return 0;
 	}
+	if (destUserID != USER_BROADCAST)
+		sps_detect_record(&mac->UE[destUserID]->sps_det, mac->subframe_cnt, size);
 	LOG(INFO,"[MAC BS] added txdata frame for user %d\n",destUserID);
 	return 1;
 }
@@ -244,6 +320,103 @@ void mac_bs_handle_control_ack(MacBS mac, MacMessage msg, user_s* ue)
 	}
 }
 
+// Sum of the UL slot payload granted to a user in subframes after the
+// currently received one. The UE did not know about these grants when it
+// generated its buffer status report
+int mac_bs_ul_grants_in_flight(MacBS mac, user_s* ue)
+{
+	uint rx_sfn = mac->phy->common->rx_subframe % FRAME_LEN;
+	uint num = (mac->sched_sfn + FRAME_LEN - rx_sfn) % FRAME_LEN;
+	if (num >= FRAME_LEN/2)
+		return 0;	// scheduler did not run for the received subframe yet
+	int bytes = 0;
+	for (uint i=1; i<=num; i++)
+		bytes += ue->ul_grants[(rx_sfn+i) % FRAME_LEN];
+	return bytes;
+}
+
+// Handle a request for semi-persistent UL slots from a user
+void mac_bs_sps_handle_req(MacBS mac, user_s* ue, MacMessage msg)
+{
+	sps_grant_s* g = &ue->sps[UL];
+	MacSPSReq* req = &msg->hdr.SPSReq;
+	if (g->configured)
+		return;
+	if (req->num_slots==0 || req->period < MAC_SPS_MIN_PERIOD*SPS_Q) {
+		if (g->active)
+			LOG_SFN_MAC(INFO,"[MAC BS] release UL SPS of user %d\n",ue->userid);
+		g->active = 0;
+		return;
+	}
+	g->period = req->period;
+	g->slots = req->num_slots > MAC_SPS_MAX_SLOTS ? MAC_SPS_MAX_SLOTS : req->num_slots;
+	if (!g->active) {
+		g->active = 1;
+		g->idle = 0;
+		g->next = (mac->subframe_cnt+1)*SPS_Q;
+		g->rx_cnt = ue->sched_stats[UL].used;
+		LOG_SFN_MAC(INFO,"[MAC BS] UL SPS for user %d. period %.2f slots %d\n",
+					ue->userid, (float)g->period/SPS_Q, g->slots);
+	}
+	// positive shift moves the occasions earlier
+	long long int next = (long long int)g->next - req->shift*SPS_Q;
+	g->next = next > 0 ? next : 0;
+}
+
+// Deliver a reassembled UL frame of a user
+static void mac_bs_rx_frame(MacBS mac, user_s* user, MacDataFrame frame)
+{
+	frame = mac_hc_decompress(user->hc, frame);
+	if (frame == NULL)
+		return;
+	user->stats.bytes_rx+=frame->size;
+	LOG_SFN_MAC(INFO,"[MAC BS] received frame with %d bytes!\n",frame->size);
+	//PRINT_BIN(INFO,frame->data,frame->size); LOG(INFO,"\n");
+#ifdef MAC_TEST_DELAY
+	uint sfn;
+	memcpy(&sfn, frame->data,sizeof(uint));
+	if (sfn<num_simulated_subframes)
+		mac_ul_timestamps[sfn] += global_sfn*SUBFRAME_LEN + global_symbol;
+#endif
+
+#ifdef MAC_ENABLE_TAP_DEV
+	// learn the source EtherAddr of the frame
+	mac_fwd_learn(mac->etheraddr_map, frame->data+6, user->userid, mac->subframe_cnt);
+	mac_proxy_learn(mac->proxy, frame->data, frame->size, user->userid, mac->subframe_cnt);
+	// egress thread writes the frame to TAP and destroys it
+	tap_send_frame(mac->tapdevice,frame);
+#else
+	dataframe_destroy(frame);
+#endif
+}
+
+// Run the DL retransmission timers of all users
+void mac_bs_arq_update(MacBS mac)
+{
+	for (int userid=0; userid<MAX_USER; userid++) {
+		user_s* ue = mac->UE[userid];
+		if (ue==NULL || userid == USER_BROADCAST)
+			continue;
+		mac_frag_arq_update(ue->fragmenter, mac->subframe_cnt);
+	}
+}
+
+// Run the UL reordering timers of all users. Frames that were waiting for a missing
+// fragment are delivered when the fragment is given up. Runs in the thread that decodes
+// the UL data slots, which is the only one that delivers frames to the TAP device
+void mac_bs_rx_arq_update(MacBS mac)
+{
+	for (int userid=0; userid<MAX_USER; userid++) {
+		user_s* ue = mac->UE[userid];
+		if (ue==NULL || userid == USER_BROADCAST)
+			continue;
+		mac_assmbl_arq_update(ue->reassembler, mac->subframe_cnt);
+		MacDataFrame frame;
+		while ((frame = mac_assmbl_get_frame(ue->reassembler)) != NULL)
+			mac_bs_rx_frame(mac, ue, frame);
+	}
+}
+
 // Handle incoming messages from PHY layer
 int mac_bs_handle_message(MacBS mac, MacMessage msg, uint8_t userID)
 {
@@ -257,60 +430,55 @@ int mac_bs_handle_message(MacBS mac, MacMessage msg, uint8_t userID)
 	MacDataFrame frame;
 	switch (msg->type) {
 	case ul_req:
-		// Update the user uplink queue state
-		user->ul_queue=msg->hdr.ULreq.packetqueuesize;
+		// Update the user uplink queue state. The report does not include
+		// grants which were issued after the reporting slot was scheduled
+		user->ul_queue = msg->hdr.ULreq.packetqueuesize - mac_bs_ul_grants_in_flight(mac, user);
+		if (user->ul_queue < 0)
+			user->ul_queue = 0;
 		LOG_SFN_MAC(INFO,"[MAC BS] ul_req from user %d. Queuesize: %d\n", userID,user->ul_queue);
 		break;
 	case channel_quality:
-		LOG_SFN_MAC(DEBUG, "[MAC BS] channel quality measurement not implemented yet\n");
+		LOG_SFN_MAC(DEBUG, "[MAC BS] channel quality from user %d: SNR %ddB DL slots ok/fail %d/%d\n", userID,
+					msg->hdr.ChannelQuality.snr-CHANNEL_QUALITY_SNR_OFFSET,
+					msg->hdr.ChannelQuality.crc_ok, msg->hdr.ChannelQuality.crc_fail);
+		mac_la_add_snr(&user->la[DL], (int)msg->hdr.ChannelQuality.snr-CHANNEL_QUALITY_SNR_OFFSET);
+		if (user->dl_mcs_pending_time==0)
+			mac_la_add_crc(&user->la[DL], msg->hdr.ChannelQuality.crc_ok, msg->hdr.ChannelQuality.crc_fail);
+		mac_bs_link_adapt(mac, user, DL);
 		break;
-	case keepalive:
-		LOG_SFN_MAC(DEBUG,"[MAC BS] keepalive from user %d\n",userID);
+	case harq_ack:
+		LOG_SFN_MAC(DEBUG,"[MAC BS] harq_ack from user %d for subframe %d: ack %x nack %x\n",userID,
+					msg->hdr.HARQAck.sfn, msg->hdr.HARQAck.ack, msg->hdr.HARQAck.nack);
+		// the scheduler owns the stored blocks and applies the feedback
+		atomic_fetch_or(&user->harq_dl_ack[msg->hdr.HARQAck.sfn%FRAME_LEN], msg->hdr.HARQAck.ack);
+		atomic_fetch_or(&user->harq_dl_nack[msg->hdr.HARQAck.sfn%FRAME_LEN], msg->hdr.HARQAck.nack);
 		break;
 	case control_ack:
 		mac_bs_handle_control_ack(mac,msg,user);
 		break;
     case mcs_chance_req:
+        // the user asked for a fixed MCS. Stop adapting this link direction
+        user->la[msg->hdr.MCSChangeReq.ul_flag ? UL : DL].fixed = 1;
         mac_bs_set_mcs(mac,userID,msg->hdr.MCSChangeReq.mcs,msg->hdr.MCSChangeReq.ul_flag);
         LOG_SFN_MAC(INFO,"[MAC BS] mcs_change_request from user %d mcs: %d is_ul %d\n",userID,
                             msg->hdr.MCSChangeReq.mcs,msg->hdr.MCSChangeReq.ul_flag)
         break;
+	case sps_req:
+		mac_bs_sps_handle_req(mac, user, msg);
+		break;
 	case ul_data:
+		user->sched_stats[UL].used++;
 		frame = mac_assmbl_reassemble(user->reassembler,msg);
-		if (frame != NULL) {
-			user->stats.bytes_rx+=frame->size;
-			LOG_SFN_MAC(INFO,"[MAC BS] received frame with %d bytes!\n",frame->size);
-			//PRINT_BIN(INFO,frame->data,frame->size); LOG(INFO,"\n");
-#ifdef MAC_ENABLE_TAP_DEV
-            //check if source EtherAddr is already included in our address mapping
-            struct entry *np = NULL;
-            char* EtherSrcAddr = frame->data+6;
-            SLIST_FOREACH(np,&mac->etheraddr_map, entries) {
-                if (strncmp(np->EtherAddr,EtherSrcAddr,6)==0)
-                    break;
-            }
-            if (np==NULL) {
-                // EtherAddr not yet in list, add it
-                np = malloc(sizeof(struct entry));
-                strncpy(np->EtherAddr,EtherSrcAddr,6);
-                np->userid = userID;
-                SLIST_INSERT_HEAD(&mac->etheraddr_map,np,entries);
-                LOG(INFO, "[MAC] Add EtherAddr: %02x:%02x:%02x:%02x:%02x:%02x -> userid %d\n",
-                            EtherSrcAddr[0],EtherSrcAddr[1],EtherSrcAddr[2],EtherSrcAddr[3],
-                            EtherSrcAddr[4],EtherSrcAddr[5], userID);
-            }
-            tap_send(mac->tapdevice,frame->data,frame->size);
-#endif
-
-#ifdef MAC_TEST_DELAY
-			uint sfn;
-			memcpy(&sfn, frame->data,sizeof(uint));
-			if (sfn<num_simulated_subframes)
-				mac_ul_timestamps[sfn] += global_sfn*SUBFRAME_LEN + global_symbol;
-#endif
-			dataframe_destroy(frame);
+		while (frame != NULL) {
+			mac_bs_rx_frame(mac, user, frame);
+			frame = mac_assmbl_get_frame(user->reassembler);
 		}
 		break;
+	case ul_arq_status:
+		LOG_SFN_MAC(DEBUG,"[MAC BS] ARQ status from user %d: ack %d bitmap %x\n",userID,
+					msg->hdr.ARQStatus.ack_sn, msg->hdr.ARQStatus.bitmap);
+		mac_frag_arq_status(user->fragmenter, msg->hdr.ARQStatus.ack_sn, msg->hdr.ARQStatus.bitmap);
+		break;
 	default:
 		LOG_SFN_MAC(WARN,"[MAC BS] unexpected MacMsg ID: %d\n",msg->type);
 		mac_msg_destroy(msg);
@@ -362,25 +530,63 @@ user_s* get_next_user(MacBS mac, uint curr_user)
 int ue_has_dldata(user_s* ue)
 {
 	return (mac_frag_has_fragment(ue->fragmenter) ||
+			mac_assmbl_status_due(ue->reassembler) ||
 			!ringbuf_isempty(ue->msg_control_queue));
 }
 
-void mac_bs_map_slot(MacBS mac, uint subframe, uint slot, user_s* ue)
+// Fill a logical channel of tbs bits with the control messages, the ARQ status
+// and the next fragment of a user. used is set to the number of bytes used
+static LogicalChannel mac_bs_create_dl_chan(MacBS mac, user_s* ue, uint tbs, uint* used)
 {
-	// Generate logical channel
-	uint tbs = get_tbs_size(mac->phy->common, ue->dl_mcs);
 	LogicalChannel chan = lchan_create(tbs/8, CRC16);
 	lchan_add_all_msgs(chan, ue->msg_control_queue);
+	// ARQ status of the UL fragments
+	if (mac_assmbl_status_due(ue->reassembler)) {
+		MacMessage msg = mac_assmbl_get_status(ue->reassembler, 0);
+		if (msg->hdr_len <= lchan_unused_bytes(chan))
+			lchan_add_message(chan,msg);
+		mac_msg_destroy(msg);
+	}
 	if (mac_frag_has_fragment(ue->fragmenter)) {
 		uint payload_size = lchan_unused_bytes(chan);
 		MacMessage msg = mac_frag_get_fragment(ue->fragmenter, payload_size, 0);
-		lchan_add_message(chan,msg);
-		ue->stats.bytes_tx+=msg->payload_len;
-		mac_msg_destroy(msg);
+		if (msg) {
+			lchan_add_message(chan,msg);
+			ue->stats.bytes_tx+=msg->payload_len;
+			mac_msg_destroy(msg);
+		}
 	}
+	*used = tbs/8 - lchan_unused_bytes(chan);
 	lchan_calc_crc(chan);
+	return chan;
+}
+
+// Map DL data of a user to a slot
+// returns the number of bytes used in the logical channel
+uint mac_bs_map_slot(MacBS mac, uint subframe, uint slot, user_s* ue)
+{
+	uint used;
+	LogicalChannel chan = mac_bs_create_dl_chan(mac, ue, get_tbs_size(mac->phy->common, ue->dl_mcs), &used);
     phy_map_dlslot(mac->phy, chan, subframe%2, slot, ue->userid, ue->dl_mcs);
-    lchan_destroy(chan);
+    // keep the block until the UE acknowledged it
+    if (mac_harq_is_enabled())
+        mac_harq_tx_new(&ue->harq_dl, &ue->harq_stats[DL], subframe, slot, chan, ue->dl_mcs, mac->subframe_cnt);
+    else
+        lchan_destroy(chan);
+    return used;
+}
+
+// Map DL data of a user to mini-slot mini of a split slot. Mini-slots are sent
+// without HARQ, lost fragments are recovered by ARQ
+// returns the number of bytes used in the logical channel
+uint mac_bs_map_mini(MacBS mac, uint subframe, uint slot, uint mini, user_s* ue)
+{
+	uint used;
+	LogicalChannel chan = mac_bs_create_dl_chan(mac, ue, get_mini_tbs_size(mac->phy->common, ue->dl_mcs), &used);
+	phy_map_dlmini(mac->phy, chan, subframe%2, slot, mini, ue->dl_mcs);
+	lchan_destroy(chan);
+	mac->dl_mini_assignments[subframe][slot*NUM_MINI_SLOT+mini] = ue->userid;
+	return used;
 }
 
 // Find users which did not answer to any slot assignments
@@ -413,16 +619,8 @@ void mac_bs_remove_inactive_users(MacBS mac)
 				ue_destroy(ue);
 
                 // remove entries from etheraddr_map belonging to userid
-                struct entry* np = SLIST_FIRST(&mac->etheraddr_map);
-                struct entry* np_next = NULL;
-                while (np !=NULL) {
-                    np_next = SLIST_NEXT(np,entries);
-                    if (np->userid == userid) {
-                        SLIST_REMOVE(&mac->etheraddr_map,np,entry,entries);
-                        free(np);
-                    }
-                    np = np_next;
-                }
+                mac_fwd_remove_user(mac->etheraddr_map, userid);
+                mac_proxy_remove_user(mac->proxy, userid);
 			}
 		}
 	}
@@ -480,12 +678,26 @@ int dl_ul_overlap_check(MacBS mac, uint userid, int subframe, int slotnr, int is
         if (slotnr<2 && userid == mac->ul_data_assignments[(uint)(subframe-1)%FRAME_LEN][slotnr+2]){
             return 1; // there is an overlap
         }
+        // same for a resource block of the split UL slot
+        if (slotnr+2 == UL_RB_SLOT &&
+                num_slot_assigned(mac->ul_rb_assignments[(uint)(subframe-1)%FRAME_LEN], NUM_UL_RB, userid)>0) {
+            return 1;
+        }
+        // and for a mini-slot of a split UL slot
+        if (slotnr<2 && num_slot_assigned(&mac->ul_mini_assignments[(uint)(subframe-1)%FRAME_LEN][(slotnr+2)*NUM_MINI_SLOT],
+                                          NUM_MINI_SLOT, userid)>0) {
+            return 1;
+        }
     } else { // is uplink
         // ensure that the user is not already mapped to a DL slot at the same time from current scheduler iteration
         if (slotnr<2 && (userid == mac->dl_data_assignments[subframe][slotnr+2] ||
                             USER_BROADCAST==mac->dl_data_assignments[subframe][slotnr+2])){
             return 1; // there is an overlap
         }
+        if (slotnr<2 && num_slot_assigned(&mac->dl_mini_assignments[subframe][(slotnr+2)*NUM_MINI_SLOT],
+                                          NUM_MINI_SLOT, userid)>0) {
+            return 1;
+        }
         // ensure that UL slot does not overlap with Sync slot
         if (subframe==0 && slotnr==1)
             return 1;
@@ -499,6 +711,481 @@ int dl_ul_overlap_check(MacBS mac, uint userid, int subframe, int slotnr, int is
     return 0; // no overlap
 }
 
+// Update the backlog state of all users before a scheduler run.
+// Users that became backlogged start waiting, idle users lose their DRR deficit
+void mac_bs_sched_update_backlog(MacBS mac, uint subframe)
+{
+	mac->sched_sfn = subframe;
+	for (int userid=0; userid<MAX_USER; userid++) {
+		user_s* ue = mac->UE[userid];
+		if (ue==NULL)
+			continue;
+		ue->ul_grants[subframe] = 0;
+		int backlogged[2] = {ue_has_dldata(ue), ue->ul_queue > 0};
+		for (int dir=DL; dir<=UL; dir++) {
+			if (!backlogged[dir]) {
+				ue->waiting[dir] = 0;
+				ue->deficit[dir] = 0;
+			} else if (!ue->waiting[dir]) {
+				ue->waiting[dir] = 1;
+				ue->wait_since[dir] = mac->subframe_cnt;
+			}
+		}
+	}
+}
+
+// Record the bytes and the scheduling latency of an assignment
+static void mac_bs_sched_account_bytes(MacBS mac, user_s* ue, int dir, uint bytes)
+{
+	sched_stat_s* st = &ue->sched_stats[dir];
+	st->bytes += bytes;
+	if (ue->waiting[dir]) {
+		uint latency = mac->subframe_cnt - ue->wait_since[dir];
+		st->latency_sum += latency;
+		st->latency_cnt++;
+		if (latency > st->latency_max)
+			st->latency_max = latency;
+		// user is waiting again if it is still backlogged in the next run
+		ue->waiting[dir] = 0;
+	}
+}
+
+// Charge the DRR deficit of a user with the airtime of one of parts equal parts of a data
+// slot, i.e. that share of the slot payload at the user's MCS. Resource blocks and mini-slots
+// are assigned before the DRR scheduler, which otherwise would not see them
+static void mac_bs_sched_charge_part(MacBS mac, user_s* ue, int dir, uint parts)
+{
+	if (mac->sched_type != MAC_SCHED_DRR)
+		return;
+	uint mcs = (dir==DL) ? ue->dl_mcs : ue->ul_mcs;
+	ue->deficit[dir] -= (get_tbs_size(mac->phy->common, mcs)/8 - CRC16_LEN) / parts;
+}
+
+// Record a slot assignment in the scheduler statistics
+void mac_bs_sched_account(MacBS mac, user_s* ue, int dir, uint bytes)
+{
+	ue->sched_stats[dir].slots++;
+	mac->sched_slots[dir]++;
+	mac_bs_sched_account_bytes(mac, ue, dir, bytes);
+}
+
+// Check whether a user can be assigned to the given data slot
+int mac_bs_sched_eligible(MacBS mac, user_s* ue, uint subframe, uint slot, int dir)
+{
+	if (ue==NULL || ue->userid==USER_BROADCAST)
+		return 0;
+	if (dir==DL)
+		return ue_has_dldata(ue) && !dl_ul_overlap_check(mac,ue->userid,subframe,slot,1);
+	return ue->ul_queue > 0 && !dl_ul_overlap_check(mac,ue->userid,subframe,slot,0);
+}
+
+// Assign one UL data slot and update the UL queue len
+// returns the UL slot payload that was granted
+uint mac_bs_assign_ul_slot(MacBS mac, uint subframe, uint slot, user_s* ue)
+{
+	mac->ul_data_assignments[subframe][slot] = ue->userid;
+	int bytes = get_tbs_size(mac->phy->common, ue->ul_mcs)/8 - CRC16_LEN;
+	if (bytes > ue->ul_queue)
+		bytes = ue->ul_queue;
+	ue->ul_queue -= bytes;
+	ue->ul_grants[subframe] += bytes;
+	return bytes;
+}
+
+// Assign one UL resource block of slot UL_RB_SLOT and update the UL queue len
+// returns the UL payload that was granted
+uint mac_bs_assign_ul_rb(MacBS mac, uint subframe, uint rb, user_s* ue)
+{
+	mac->ul_rb_assignments[subframe][rb] = ue->userid;
+	int bytes = get_rb_tbs_size(mac->phy->common, ue->ul_mcs)/8 - CRC16_LEN;
+	if (bytes > ue->ul_queue)
+		bytes = ue->ul_queue;
+	ue->ul_queue -= bytes;
+	ue->ul_grants[subframe] += bytes;
+	return bytes;
+}
+
+// Split the UL slot UL_RB_SLOT into resource blocks if at least two users have only a
+// few bytes to send, which fit into one resource block. A full slot would mostly carry
+// padding for them. Users get the resource blocks round robin. Runs after HARQ and SPS,
+// so the slot is only split if it is still free
+void mac_bs_sched_ul_rb(MacBS mac, uint subframe, uint available_slots)
+{
+	uint8_t users[NUM_UL_RB];
+	int num_users = 0;
+
+	memset(mac->ul_rb_assignments[subframe], USER_UNUSED, NUM_UL_RB);
+	if (!ul_rb || UL_RB_SLOT>=available_slots ||
+			mac->ul_data_assignments[subframe][UL_RB_SLOT]!=USER_UNUSED)
+		return;
+
+	for (int i=0; i<MAX_USER && num_users<NUM_UL_RB; i++) {
+		user_s* ue = mac->UE[(mac->sched_next_rb+i) % MAX_USER];
+		if (!mac_bs_sched_eligible(mac, ue, subframe, UL_RB_SLOT, UL))
+			continue;
+		if (ue->ul_queue > get_rb_tbs_size(mac->phy->common, ue->ul_mcs)/8 - CRC16_LEN)
+			continue; // user needs a full slot
+		users[num_users++] = ue->userid;
+	}
+	if (num_users<2)
+		return;
+
+	for (int rb=0; rb<num_users; rb++) {
+		user_s* ue = mac->UE[users[rb]];
+		uint bytes = mac_bs_assign_ul_rb(mac, subframe, rb, ue);
+		ue->sched_stats[UL].rbs++;
+		mac_bs_sched_account_bytes(mac, ue, UL, bytes);
+		mac_bs_sched_charge_part(mac, ue, UL, NUM_UL_RB);
+	}
+	mac->sched_next_rb = (users[num_users-1]+1) % MAX_USER;
+	mac->ul_data_assignments[subframe][UL_RB_SLOT] = USER_RB;
+	mac->sched_slots[UL]++;
+}
+
+// Assign one UL mini-slot of a split slot and update the UL queue len
+// returns the UL payload that was granted
+uint mac_bs_assign_ul_mini(MacBS mac, uint subframe, uint slot, uint mini, user_s* ue)
+{
+	mac->ul_mini_assignments[subframe][slot*NUM_MINI_SLOT+mini] = ue->userid;
+	int bytes = get_mini_tbs_size(mac->phy->common, ue->ul_mcs)/8 - CRC16_LEN;
+	if (bytes > ue->ul_queue)
+		bytes = ue->ul_queue;
+	ue->ul_queue -= bytes;
+	ue->ul_grants[subframe] += bytes;
+	return bytes;
+}
+
+// Check whether the whole backlog of a user fits into one mini-slot.
+// Control messages are only sent in full slots
+static int mac_bs_fits_mini(MacBS mac, user_s* ue, int dir)
+{
+	if (dir==UL)
+		return ue->ul_queue <= get_mini_tbs_size(mac->phy->common, ue->ul_mcs)/8 - CRC16_LEN;
+	return ringbuf_isempty(ue->msg_control_queue) &&
+		   mac_frag_get_buffersize(ue->fragmenter) + mac_msg_get_hdrlen(dl_data) <=
+		   get_mini_tbs_size(mac->phy->common, ue->dl_mcs)/8 - CRC16_LEN;
+}
+
+// Split the first free data slot into mini-slots if at least two users have only a few
+// bytes to send, which fit into one mini-slot. Users get the mini-slots round robin.
+// Runs after HARQ and SPS (and the UL resource blocks), so the slot is only split if it is
+// still free. The DL ctrl slot signals one split slot per link direction
+void mac_bs_sched_mini(MacBS mac, uint subframe, uint available_slots, int dir)
+{
+	uint8_t* assignments = (dir==DL) ? mac->dl_data_assignments[subframe] : mac->ul_data_assignments[subframe];
+	uint8_t* minis = (dir==DL) ? mac->dl_mini_assignments[subframe] : mac->ul_mini_assignments[subframe];
+
+	memset(minis, USER_UNUSED, MAC_ULDATA_SLOTS*NUM_MINI_SLOT);
+	if (!mini_slots)
+		return;
+
+	for (uint slot=0; slot<available_slots; slot++) {
+		if (assignments[slot]!=USER_UNUSED)
+			continue;
+		uint8_t users[NUM_MINI_SLOT];
+		int num_users = 0;
+		for (int i=0; i<MAX_USER && num_users<NUM_MINI_SLOT; i++) {
+			user_s* ue = mac->UE[(mac->sched_next_mini[dir]+i) % MAX_USER];
+			if (!mac_bs_sched_eligible(mac, ue, subframe, slot, dir) || !mac_bs_fits_mini(mac, ue, dir))
+				continue;
+			users[num_users++] = ue->userid;
+		}
+		if (num_users<NUM_MINI_SLOT)
+			continue;
+
+		for (int mini=0; mini<NUM_MINI_SLOT; mini++) {
+			user_s* ue = mac->UE[users[mini]];
+			uint bytes;
+			if (dir==DL)
+				bytes = mac_bs_map_mini(mac, subframe, slot, mini, ue);
+			else
+				bytes = mac_bs_assign_ul_mini(mac, subframe, slot, mini, ue);
+			ue->sched_stats[dir].minis++;
+			mac_bs_sched_account_bytes(mac, ue, dir, bytes);
+			mac_bs_sched_charge_part(mac, ue, dir, NUM_MINI_SLOT);
+		}
+		mac->sched_next_mini[dir] = (users[NUM_MINI_SLOT-1]+1) % MAX_USER;
+		assignments[slot] = USER_MINI;
+		mac->sched_slots[dir]++;
+		return;
+	}
+}
+
+// Configure semi-persistent slots for a user, e.g. for a known periodic flow.
+// period in subframes. num_slots=0 removes the configuration.
+// Configured assignments are not released on inactivity
+void mac_bs_sps_configure(MacBS mac, uint userid, uint dl_ul, uint period, uint num_slots)
+{
+	if (userid>=MAX_USER || mac->UE[userid]==NULL) {
+		LOG(ERR,"[MAC BS] cannot find user %d to configure SPS\n",userid);
+		return;
+	}
+	sps_grant_s* g = &mac->UE[userid]->sps[dl_ul];
+	memset(g, 0, sizeof(sps_grant_s));
+	if (num_slots==0)
+		return;
+	g->active = 1;
+	g->configured = 1;
+	g->period = period*SPS_Q;
+	g->slots = num_slots > MAC_SPS_MAX_SLOTS ? MAC_SPS_MAX_SLOTS : num_slots;
+	g->next = mac->subframe_cnt*SPS_Q;
+	g->rx_cnt = mac->UE[userid]->sched_stats[UL].used;
+}
+
+// Start or stop DL SPS of a user depending on the periodic flow detection
+void mac_bs_sps_update_dl(MacBS mac, user_s* ue)
+{
+	sps_grant_s* g = &ue->sps[DL];
+	sps_detector_s* det = &ue->sps_det;
+	sps_detect_update(det, mac->subframe_cnt);
+	if (g->configured)
+		return;
+	if (det->active && !g->active) {
+		uint frag_payload = get_tbs_size(mac->phy->common, ue->dl_mcs)/8 - CRC16_LEN
+							- mac_msg_get_hdrlen(dl_data);
+		g->active = 1;
+		g->period = det->period;
+		g->slots = sps_num_slots(det->max_size, frag_payload);
+		g->next = det->last_arrival*SPS_Q;
+		LOG_SFN_MAC(INFO,"[MAC BS] DL SPS for user %d. period %.2f slots %d\n",
+					ue->userid, (float)g->period/SPS_Q, g->slots);
+	} else if (!det->active && g->active) {
+		LOG_SFN_MAC(INFO,"[MAC BS] release DL SPS of user %d\n",ue->userid);
+		g->active = 0;
+	}
+}
+
+// Assign the recurring slots of all due semi-persistent occasions.
+// Runs before the dynamic scheduler, which only uses the remaining slots.
+// UL occasions are granted regardless of the buffer status, so periodic frames
+// are sent without a preceding ul_req. DL occasions are re-anchored to the
+// frame arrivals and served with priority
+void mac_bs_sps_schedule(MacBS mac, uint subframe, uint available_slots, int dir)
+{
+	long long unsigned int now = mac->subframe_cnt*SPS_Q;
+	uint8_t* assignments = (dir==DL) ? mac->dl_data_assignments[subframe] : mac->ul_data_assignments[subframe];
+
+	for (int userid=0; userid<MAX_USER; userid++) {
+		user_s* ue = mac->UE[userid];
+		if (ue==NULL || userid==USER_BROADCAST)
+			continue;
+		if (dir==DL)
+			mac_bs_sps_update_dl(mac, ue);
+		sps_grant_s* g = &ue->sps[dir];
+		if (!g->active || now < g->next)
+			continue;
+
+		if (dir==DL && !ue_has_dldata(ue)) {
+			// frame is late. Check again in the next subframe
+			g->next = now + SPS_Q;
+			continue;
+		}
+
+		uint num = 0;
+		for (uint slot=0; slot<available_slots && num<g->slots; slot++) {
+			if (assignments[slot]!=USER_UNUSED || dl_ul_overlap_check(mac,ue->userid,subframe,slot,dir==DL))
+				continue;
+			uint bytes;
+			if (dir==DL) {
+				bytes = mac_bs_map_slot(mac, subframe, slot, ue);
+				assignments[slot] = ue->userid;
+			} else {
+				bytes = mac_bs_assign_ul_slot(mac, subframe, slot, ue);
+			}
+			mac_bs_sched_account(mac, ue, dir, bytes);
+			num++;
+			if (dir==DL && !ue_has_dldata(ue))
+				break;
+		}
+		if (num==0)
+			continue; // blocked by half-duplex constraints. Retry in the next subframe
+
+		g->occasions++;
+		if (dir==DL) {
+			g->used++;
+			g->next = ue->sps_det.last_arrival*SPS_Q + g->period;
+		} else {
+			// check whether data was received since the previous occasion
+			if (ue->sched_stats[UL].used != g->rx_cnt) {
+				g->idle = 0;
+				g->used++;
+			} else {
+				g->idle++;
+			}
+			g->rx_cnt = ue->sched_stats[UL].used;
+			g->next += g->period;
+			if (!g->configured && g->idle >= MAC_SPS_IDLE_RELEASE) {
+				LOG_SFN_MAC(INFO,"[MAC BS] UL SPS of user %d idle. Release\n",ue->userid);
+				g->active = 0;
+			}
+		}
+		// do not catch up with missed occasions
+		if (g->next <= now)
+			g->next = now + g->period;
+	}
+}
+
+// Apply the DL HARQ feedback that arrived since the last scheduler run
+static void mac_bs_harq_apply_feedback(user_s* ue)
+{
+	for (int sfn=0; sfn<FRAME_LEN; sfn++) {
+		uint ack = atomic_exchange(&ue->harq_dl_ack[sfn], 0);
+		uint nack = atomic_exchange(&ue->harq_dl_nack[sfn], 0);
+		if (ack || nack)
+			mac_harq_tx_feedback(&ue->harq_dl, &ue->harq_stats[DL], sfn, ack, nack);
+	}
+}
+
+// Assign the HARQ retransmissions of one subframe and link direction. Runs before SPS and
+// the dynamic scheduler. A block can only be retransmitted in the slot it was sent in, blocks
+// whose slot is taken or blocked by half-duplex constraints are given up
+void mac_bs_harq_schedule(MacBS mac, uint subframe, uint available_slots, int dir)
+{
+	uint8_t* assignments = (dir==DL) ? mac->dl_data_assignments[subframe] : mac->ul_data_assignments[subframe];
+	uint prev_sfn = (subframe+FRAME_LEN-HARQ_RTT) % FRAME_LEN;
+	if (dir==UL)
+		mac->ul_harq_retx[subframe] = 0;
+
+	for (int userid=0; userid<MAX_USER; userid++) {
+		user_s* ue = mac->UE[userid];
+		if (ue==NULL || userid==USER_BROADCAST)
+			continue;
+		if (dir==DL)
+			mac_bs_harq_apply_feedback(ue);
+		for (uint slot=0; slot<NUM_SLOT; slot++) {
+			int blocked = slot>=available_slots || assignments[slot]!=USER_UNUSED ||
+						  dl_ul_overlap_check(mac,ue->userid,subframe,slot,dir==DL);
+			if (dir==DL) {
+				harq_tx_proc_s* p = mac_harq_tx_due(&ue->harq_dl, &ue->harq_stats[DL], subframe, slot,
+													mac->subframe_cnt);
+				if (p==NULL)
+					continue;
+				// the UE decodes with its current MCS
+				if (blocked || p->mcs!=ue->dl_mcs) {
+					mac_harq_tx_drop(p, &ue->harq_stats[DL]);
+					continue;
+				}
+				phy_map_dlslot(mac->phy, p->chan, subframe%2, slot, ue->userid, p->mcs);
+				mac_harq_tx_retransmit(p, &ue->harq_stats[DL], subframe, mac->subframe_cnt);
+			} else {
+				if (!(atomic_fetch_and(&ue->harq_ul_nack[prev_sfn], ~(1u<<slot)) & (1<<slot)))
+					continue;
+				if (blocked) {
+					ue->harq_stats[UL].failed++;
+					continue;
+				}
+				mac->ul_harq_retx[subframe] |= 1<<slot;
+			}
+			assignments[slot] = ue->userid;
+			ue->sched_stats[dir].slots++;
+			mac->sched_slots[dir]++;
+		}
+	}
+}
+
+// Users that wait for HARQ feedback of the DL subframe two subframes earlier and have no UL
+// slot in between get a free UL slot, so the feedback arrives before the retransmission is scheduled
+void mac_bs_harq_feedback_grant(MacBS mac, uint subframe, uint available_slots)
+{
+	uint dl_sfn = (subframe+FRAME_LEN-2) % FRAME_LEN;
+	uint prev_sfn = (subframe+FRAME_LEN-1) % FRAME_LEN;
+	for (int userid=0; userid<MAX_USER; userid++) {
+		user_s* ue = mac->UE[userid];
+		if (ue==NULL || userid==USER_BROADCAST || !mac_harq_tx_waiting(&ue->harq_dl, dl_sfn))
+			continue;
+		if (num_slot_assigned(mac->ul_data_assignments[prev_sfn], MAC_ULDATA_SLOTS, userid)>0 ||
+				num_slot_assigned(mac->ul_data_assignments[subframe], MAC_ULDATA_SLOTS, userid)>0 ||
+				num_slot_assigned(mac->ul_rb_assignments[prev_sfn], NUM_UL_RB, userid)>0 ||
+				num_slot_assigned(mac->ul_rb_assignments[subframe], NUM_UL_RB, userid)>0 ||
+				num_slot_assigned(mac->ul_mini_assignments[prev_sfn], MAC_ULDATA_SLOTS*NUM_MINI_SLOT, userid)>0 ||
+				num_slot_assigned(mac->ul_mini_assignments[subframe], MAC_ULDATA_SLOTS*NUM_MINI_SLOT, userid)>0)
+			continue;
+		for (uint slot=0; slot<available_slots; slot++) {
+			if (mac->ul_data_assignments[subframe][slot]==USER_UNUSED &&
+					!dl_ul_overlap_check(mac,userid,subframe,slot,0)) {
+				uint bytes = mac_bs_assign_ul_slot(mac, subframe, slot, ue);
+				mac_bs_sched_account(mac, ue, UL, bytes);
+				break;
+			}
+		}
+	}
+}
+
+// Deficit round robin over the data slots of one subframe and link direction.
+// Deficits and the position in the round are kept across subframes, thus every
+// backlogged user gets the same share of bytes independent of its userid.
+// A user keeps the turn until its deficit is used up. Users which cannot be
+// assigned due to half-duplex constraints keep their deficit
+void mac_bs_sched_drr(MacBS mac, uint subframe, uint available_slots, int dir)
+{
+	uint8_t* assignments = (dir==DL) ? mac->dl_data_assignments[subframe] : mac->ul_data_assignments[subframe];
+	for (uint slot=0; slot<available_slots; slot++) {
+		if (assignments[slot] != USER_UNUSED)
+			continue; // semi-persistent assignment
+		user_s* ue = NULL;
+		for (int round=0; round<MAC_SCHED_MAX_ROUNDS && ue==NULL; round++) {
+			int num_eligible = 0;
+			for (int i=0; i<MAX_USER; i++) {
+				user_s* cand = mac->UE[(mac->sched_next[dir]+i) % MAX_USER];
+				if (!mac_bs_sched_eligible(mac, cand, subframe, slot, dir))
+					continue;
+				num_eligible++;
+				if (cand->deficit[dir] > 0) {
+					ue = cand;
+					break;
+				}
+			}
+			if (num_eligible==0)
+				break;
+			if (ue==NULL) {
+				// all eligible users used up their deficit. Start a new round
+				for (int i=0; i<MAX_USER; i++) {
+					if (mac_bs_sched_eligible(mac, mac->UE[i], subframe, slot, dir))
+						mac->UE[i]->deficit[dir] += MAC_SCHED_QUANTUM;
+				}
+			}
+		}
+		if (ue==NULL)
+			continue; // slot stays unused
+
+		uint bytes;
+		if (dir==DL) {
+			bytes = mac_bs_map_slot(mac, subframe, slot, ue);
+			mac->dl_data_assignments[subframe][slot] = ue->userid;
+		} else {
+			bytes = mac_bs_assign_ul_slot(mac, subframe, slot, ue);
+		}
+		mac_bs_sched_account(mac, ue, dir, bytes);
+
+		ue->deficit[dir] -= bytes;
+		if (ue->deficit[dir] <= 0)
+			mac->sched_next[dir] = (ue->userid+1) % MAX_USER;
+		else
+			mac->sched_next[dir] = ue->userid;
+	}
+}
+
+// MCS for broadcast data: the lowest DL MCS of all users, so that the
+// weakest user can decode it, lowered by a margin
+static uint mac_bs_bcast_mcs(MacBS mac)
+{
+	int mcs = -1;
+	for (int userid=0; userid<MAX_USER; userid++) {
+		user_s* ue = mac->UE[userid];
+		if (ue == NULL || userid == USER_BROADCAST)
+			continue;
+		uint ue_mcs = ue->dl_mcs;
+		// a pending change is not applied by the UE yet
+		if (ue->dl_mcs_pending_time && ue->dl_mcs_pending < ue_mcs)
+			ue_mcs = ue->dl_mcs_pending;
+		if (mcs < 0 || ue_mcs < mcs)
+			mcs = ue_mcs;
+	}
+	if (mcs <= MAC_BCAST_MCS_MARGIN)
+		return 0;
+	return mcs - MAC_BCAST_MCS_MARGIN;
+}
+
 void mac_bs_run_scheduler(MacBS mac)
 {
 	uint slot_idx = 0;
@@ -514,6 +1201,9 @@ void mac_bs_run_scheduler(MacBS mac)
 	// Run unresponsive user detection
 	mac_bs_detect_inactive_users(mac);
 
+	// Run ARQ timers
+	mac_bs_arq_update(mac);
+
 	if (mac->phy->common->tx_symbol==0) {
 		// subframe just started. schedule for this one.
 		// TODO set rules when the scheduler should run
@@ -522,6 +1212,8 @@ void mac_bs_run_scheduler(MacBS mac)
 		next_sfn = (mac->phy->common->tx_subframe+1) % FRAME_LEN;
 	}
 
+    mac_bs_sched_update_backlog(mac, next_sfn);
+
     // assure that the sync slot is not assigned for user traffic
     uint available_slots = (next_sfn==0) ? (MAC_DLDATA_SLOTS-1):MAC_DLDATA_SLOTS;
 
@@ -536,14 +1228,17 @@ void mac_bs_run_scheduler(MacBS mac)
         mac->dl_data_assignments[next_sfn][i] = USER_UNUSED;
     }
     // 2.1 check Broadcast queue
-    // We allocate max 1 slot per subframe for broadcasting with priority
-    // over unicast traffic
-    // Map possible broadcast slot to the end of the subframe, since we can be
+    // Broadcast slots have priority over unicast traffic. Slots are added while
+    // the queue is not empty, up to MAC_BCAST_MAX_SLOTS per subframe.
+    // Map broadcast slots to the end of the subframe, since we can be
     // sure that there is no user assigned to a colliding UL slot yet
-    if (mac_frag_has_fragment(mac->broadcast_data_fragmenter) ||
-            !ringbuf_isempty(mac->broadcast_ctrl_queue)) {
+    uint bcast_mcs = ringbuf_isempty(mac->broadcast_ctrl_queue) ? mac_bs_bcast_mcs(mac) : 0;
+    for (int i=0; i<MAC_BCAST_MAX_SLOTS && available_slots>1; i++) {
+        if (!mac_frag_has_fragment(mac->broadcast_data_fragmenter) &&
+                ringbuf_isempty(mac->broadcast_ctrl_queue))
+            break;
         // Generate logical channel
-        uint tbs = get_tbs_size(mac->phy->common, 0);
+        uint tbs = get_tbs_size(mac->phy->common, bcast_mcs);
         LogicalChannel chan = lchan_create(tbs/8, CRC16);
         lchan_add_all_msgs(chan, mac->broadcast_ctrl_queue);
         if (mac_frag_has_fragment(mac->broadcast_data_fragmenter)) {
@@ -551,18 +1246,34 @@ void mac_bs_run_scheduler(MacBS mac)
             MacMessage msg = mac_frag_get_fragment(mac->broadcast_data_fragmenter, payload_size, 0);
             lchan_add_message(chan,msg);
             mac_msg_destroy(msg);
+            mac->bcast_data_slots++;
         }
+        mac->bcast_slots++;
+        mac->bcast_mcs_slots[bcast_mcs]++;
         lchan_calc_crc(chan);
-        phy_map_dlslot(mac->phy, chan, next_sfn%2, available_slots-1, USER_BROADCAST, 0);
+        phy_map_dlslot(mac->phy, chan, next_sfn%2, available_slots-1, USER_BROADCAST, bcast_mcs);
         lchan_destroy(chan);
         mac->dl_data_assignments[next_sfn][available_slots-1] = USER_BROADCAST;
         available_slots--;
     }
 
-    // 2.2. iterate over all remaining DL slots and assign it to the users
+    // 2.2. HARQ retransmissions
+    mac_bs_harq_schedule(mac, next_sfn, available_slots, DL);
+
+    // 2.3. recurring slots of periodic flows
+    mac_bs_sps_schedule(mac, next_sfn, available_slots, DL);
+
+    // 2.4. one slot split into mini-slots for users with small backlogs
+    mac_bs_sched_mini(mac, next_sfn, available_slots, DL);
+
+    // 2.5. iterate over all remaining DL slots and assign it to the users
 	// assign slots to active users
+	if (mac->sched_type == MAC_SCHED_DRR) {
+		mac_bs_sched_drr(mac, next_sfn, available_slots, DL);
+		slot_idx = available_slots;
+	}
 	// get first active user
-	// TODO if there is much traffic, users with high userid do not get assignments. Better do round robin over multiple subframes
+	// NOTE: if there is much traffic, users with high userid do not get assignments
 	ue = get_next_user(mac,0);
 	if (ue!=NULL) {
 		user_id = ue->userid;
@@ -573,12 +1284,17 @@ void mac_bs_run_scheduler(MacBS mac)
 			// no active user at all. stop
 			break;
 		}
+		if (mac->dl_data_assignments[next_sfn][slot_idx] != USER_UNUSED) {
+			slot_idx++; // semi-persistent assignment
+			continue;
+		}
 		// get next user. Round robin allocation
 		ue = get_next_user(mac,ue->userid);
 
         // check whether the user has DL data or DL ctrl data and we can assign it
         if (ue_has_dldata(ue) && !dl_ul_overlap_check(mac,ue->userid,next_sfn,slot_idx,1)) {
-			mac_bs_map_slot(mac,next_sfn,slot_idx,ue);
+			uint bytes = mac_bs_map_slot(mac,next_sfn,slot_idx,ue);
+			mac_bs_sched_account(mac, ue, DL, bytes);
 			mac->dl_data_assignments[next_sfn][slot_idx++] = ue->userid;
 			user_id = ue->userid; // update last active user
 		} else if (ue->userid == user_id) {
@@ -602,31 +1318,51 @@ void mac_bs_run_scheduler(MacBS mac)
     // force RA slot to be not assigned. (Slot 3 in subframe 0)
     available_slots = (next_sfn==0) ? (MAC_ULDATA_SLOTS-1):MAC_ULDATA_SLOTS;
 
+    mac_bs_harq_schedule(mac, next_sfn, available_slots, UL);
+    mac_bs_sps_schedule(mac, next_sfn, available_slots, UL);
+    mac_bs_sched_ul_rb(mac, next_sfn, available_slots);
+    mac_bs_sched_mini(mac, next_sfn, available_slots, UL);
+
+    if (mac->sched_type == MAC_SCHED_DRR) {
+        mac_bs_sched_drr(mac, next_sfn, available_slots, UL);
+        slot_idx = available_slots;
+    }
+
     while (slot_idx < available_slots) {
 		if (ue==NULL) {
 			// no active user at all. stop
 			break;
 		}
+		if (mac->ul_data_assignments[next_sfn][slot_idx] != USER_UNUSED) {
+			slot_idx++; // semi-persistent assignment
+			continue;
+		}
 		// get next user. Round robin allocation
 		ue = get_next_user(mac,ue->userid);
 
         // check whether the user has pending ul data
         if (ue->ul_queue > 0 && !dl_ul_overlap_check(mac,ue->userid,next_sfn,slot_idx,0)) {
-			mac->ul_data_assignments[next_sfn][slot_idx++] = ue->userid;
+			uint bytes = mac_bs_assign_ul_slot(mac,next_sfn,slot_idx++,ue);
+			mac_bs_sched_account(mac, ue, UL, bytes);
 			user_id = ue->userid; // update last active user
-			// update ul queue len:
-			ue->ul_queue -= get_tbs_size(mac->phy->common, ue->ul_mcs)/8-5;
-			if (ue->ul_queue<0)
-				ue->ul_queue = 0;
 		} else if (ue->userid == user_id) {
             // no user has data / can be assigned to this slot. Try next
             mac->ul_data_assignments[next_sfn][slot_idx++] = USER_UNUSED;
         }
 	}
 
+    // remaining UL slots carry HARQ feedback
+    if (mac_harq_is_enabled())
+        mac_bs_harq_feedback_grant(mac, next_sfn, available_slots);
+
     // 4. set slot assignments in PHY
 	phy_assign_dlctrl_dd(mac->phy, mac->dl_data_assignments[next_sfn]);
+	phy_assign_dlctrl_dl_mini(mac->phy, mac->dl_data_assignments[next_sfn], mac->dl_mini_assignments[next_sfn]);
+	phy_assign_dlctrl_bcast_mcs(mac->phy, bcast_mcs);
+	phy_assign_dlctrl_ul_retx(mac->phy, next_sfn%2, mac->ul_harq_retx[next_sfn]);
 	phy_assign_dlctrl_ud(mac->phy, next_sfn%2, mac->ul_data_assignments[next_sfn]);
+	phy_assign_dlctrl_ul_rb(mac->phy, next_sfn%2, mac->ul_rb_assignments[next_sfn]);
+	phy_assign_dlctrl_ul_mini(mac->phy, next_sfn%2, mac->ul_mini_assignments[next_sfn]);
 	phy_assign_dlctrl_uc(mac->phy, next_sfn%2, mac->ul_ctrl_assignments[next_sfn]);
 	// write the Downlink control channel to the subcarriers
 	phy_map_dlctrl(mac->phy, next_sfn%2);
@@ -638,46 +1374,139 @@ void mac_bs_run_scheduler(MacBS mac)
 	LOG(TRACE,"         UL data slots: %4d %4d %4d %4d\n", mac->ul_data_assignments[next_sfn][0],
 			mac->ul_data_assignments[next_sfn][1],mac->ul_data_assignments[next_sfn][2],mac->ul_data_assignments[next_sfn][3]);
 	LOG(TRACE,"         UL ctrl slots: %4d %4d\n", mac->ul_ctrl_assignments[next_sfn][0],mac->ul_ctrl_assignments[next_sfn][1]);
+	if (mac->ul_data_assignments[next_sfn][UL_RB_SLOT]==USER_RB)
+		LOG(TRACE,"         UL resource blocks: %4d %4d %4d %4d\n", mac->ul_rb_assignments[next_sfn][0],
+				mac->ul_rb_assignments[next_sfn][1],mac->ul_rb_assignments[next_sfn][2],mac->ul_rb_assignments[next_sfn][3]);
+	for (int i=0; i<NUM_SLOT; i++) {
+		if (mac->dl_data_assignments[next_sfn][i]==USER_MINI)
+			LOG(TRACE,"         DL mini-slots of slot %d: %4d %4d\n", i, mac->dl_mini_assignments[next_sfn][i*NUM_MINI_SLOT],
+					mac->dl_mini_assignments[next_sfn][i*NUM_MINI_SLOT+1]);
+		if (mac->ul_data_assignments[next_sfn][i]==USER_MINI)
+			LOG(TRACE,"         UL mini-slots of slot %d: %4d %4d\n", i, mac->ul_mini_assignments[next_sfn][i*NUM_MINI_SLOT],
+					mac->ul_mini_assignments[next_sfn][i*NUM_MINI_SLOT+1]);
+	}
 
 	// Remove inactive users
 	mac_bs_remove_inactive_users(mac);
 
+	// Remove aged Ethernet addresses
+	if (mac->subframe_cnt % MAC_FWD_AGING_INTERVAL == 0) {
+	    mac_fwd_age(mac->etheraddr_map, mac->subframe_cnt, MAC_FWD_AGING_TIME);
+	    mac_proxy_age(mac->proxy, mac->subframe_cnt, MAC_FWD_AGING_TIME);
+	}
+
 	// update mac subframe counter
 	// TODO: let phy handle this? What if scheduler is not called
 	mac->subframe_cnt++;
 }
 
+// Print scheduler statistics of a user: airtime share and scheduling latency
+// per link direction. Latency is given in subframes
+int mac_bs_sched_stats_print(char* buf, int buflen, MacBS mac, uint userid)
+{
+	user_s* ue = mac->UE[userid];
+	int len = 0;
+	const char* dir_name[2] = {"DL","UL"};
+	for (int dir=DL; dir<=UL && len<buflen; dir++) {
+		sched_stat_s* st = &ue->sched_stats[dir];
+		// resource blocks and mini-slots count as a fraction of a slot
+		float share = mac->sched_slots[dir] ? 100.0*(st->slots+(float)st->rbs/NUM_UL_RB+(float)st->minis/NUM_MINI_SLOT)/
+										   mac->sched_slots[dir] : 0;
+		float latency = st->latency_cnt ? (float)st->latency_sum/st->latency_cnt : 0;
+		len += snprintf(buf+len,buflen-len,"%s airtime: %5.1f%% slots: %6d mini-slots: %6d bytes: %7d latency avg/max: %.1f/%d\n",
+						dir_name[dir], share, st->slots, st->minis, st->bytes, latency, st->latency_max);
+		uint blocks = st->slots+st->rbs+st->minis;
+		if (dir==UL && len<buflen)
+			len += snprintf(buf+len,buflen-len,"UL resource blocks: %6d slots/blocks with data: %6d (%.1f%%)\n",
+							st->rbs, st->used, blocks ? 100.0*st->used/blocks : 0);
+		if (len<buflen)
+			len += snprintf(buf+len,buflen-len,"%s link ",dir_name[dir]);
+		if (len<buflen)
+			len += mac_la_stats_print(buf+len,buflen-len,&ue->la[dir]);
+		if (len<buflen)
+			len += snprintf(buf+len,buflen-len,"%s ",dir_name[dir]);
+		if (len<buflen)
+			len += mac_harq_stats_print(buf+len,buflen-len,&ue->harq_stats[dir]);
+		sps_grant_s* g = &ue->sps[dir];
+		if ((g->active || g->occasions>0) && len<buflen)
+			len += snprintf(buf+len,buflen-len,"%s SPS: %s period %.2f slots %d occasions %d with data %d\n",
+							dir_name[dir], g->active ? "active" : "released", (float)g->period/SPS_Q,
+							g->slots, g->occasions, g->used);
+	}
+	return len;
+}
+
+// Print the usage of the broadcast channel and the ARP/ND proxy statistics
+int mac_bs_bcast_stats_print(char* buf, int buflen, MacBS mac)
+{
+	int len = snprintf(buf,buflen,"Broadcast: %d frames from TAP, %d slots, %d with data. Slots per MCS:",
+					   mac->bcast_frames, mac->bcast_slots, mac->bcast_data_slots);
+	for (int mcs=0; mcs<NUM_MCS_SCHEMES && len<buflen; mcs++)
+		len += snprintf(buf+len,buflen-len," %d",mac->bcast_mcs_slots[mcs]);
+	if (len<buflen)
+		len += snprintf(buf+len,buflen-len,"\n");
+	if (len<buflen)
+		len += mac_proxy_stats_print(buf+len, buflen-len, mac->proxy);
+	return len;
+}
+
 void* mac_bs_tap_rx_th(void* arg)
 {
     MacBS mac = (MacBS)arg;
-	tap_dev dev = mac->tapdevice;
 
 	// wait until tap device is created
-	while (dev == NULL) {
+	while (mac->tapdevice == NULL) {
 		usleep(10000);
 	}
+	tap_dev dev = mac->tapdevice;
 	LOG(INFO,"[MAC/TAP] start TAP thread\n");
+	TIMECHECK_CREATE(timecheck_fwd_lookup);
+	TIMECHECK_INIT(timecheck_fwd_lookup,"bs.tap_fwd_lookup",10000);
 	while (1)
 	{
-		tap_receive(dev);
+		// Backpressure: stop reading from TAP if all frame buffers are in use
+		if (!framepool_wait(mac->tap_pool, 1000))
+			continue;
 
-		if (mac->tapdevice->bytes_rec>0) {
-			MacDataFrame frame = dataframe_create(dev->bytes_rec);
-			memcpy(frame->data,dev->buffer,dev->bytes_rec);
+		// wait for packets from TAP
+		if (!tap_wait(dev, 1000))
+			continue;
+
+		// drain pending frames directly into pooled buffers
+		for (int i=0; i<MAC_TAP_RX_BATCH; i++) {
+			MacDataFrame frame = framepool_get(mac->tap_pool);
+			if (frame == NULL)
+				break;
+			frame->size = tap_receive(dev, frame->data, frame->size);
+			if (frame->size == 0) {
+				dataframe_destroy(frame);
+				break;
+			}
 
             // find correct userid to forward EtherFrame to
             // if no entry is found, broadcast channel is used
-            struct entry * np = NULL;
-            uint userid = USER_BROADCAST;
-            SLIST_FOREACH(np, &mac->etheraddr_map, entries) {
-                if (strncmp(frame->data,np->EtherAddr, 6)==0) {
-                    userid = np->userid;
-                    break;
+            TIMECHECK_START(timecheck_fwd_lookup);
+            int userid = mac_fwd_lookup(mac->etheraddr_map, frame->data);
+            TIMECHECK_STOP(timecheck_fwd_lookup);
+            TIMECHECK_INFO(timecheck_fwd_lookup);
+            if (userid < 0) {
+                // answer ARP requests and neighbor solicitations for users locally
+                MacDataFrame reply = mac_proxy_reply(mac->proxy, frame->data, frame->size);
+                if (reply != NULL) {
+                    tap_send_local_frame(dev, reply);
+                    dataframe_destroy(frame);
+                    continue;
                 }
+                userid = mac_proxy_lookup(mac->proxy, frame->data, frame->size);
+            }
+            if (userid < 0) {
+                userid = USER_BROADCAST;
+                mac->bcast_frames++;
             }
+            frame->tclass = mac_classify_frame(frame->data, frame->size);
             if (!mac_bs_add_txdata(mac, userid, frame)) {
                 dataframe_destroy(frame);
-                LOG(ERR, "[MAC BS] could not add Ether frame to MAC\n");
+                LOG(DEBUG, "[MAC BS] could not add Ether frame to MAC\n");
             }
 		}
 	}
@@ -23,22 +23,46 @@
 #include "mac_fragmentation.h"
 #include "mac_common.h"
 #include "tap_dev.h"
+#include "mac_fwd_table.h"
+#include "mac_proxy.h"
+#include "mac_sps.h"
+#include "mac_la.h"
+#include "mac_harq.h"
 
 #include "../util/ringbuf.h"
 #include <liquid/liquid.h>
-#include <sys/queue.h>
+#include <stdatomic.h>
 #include "../phy/phy_bs.h"
 
 enum {DL=0, UL};
 
+// Scheduling policy of the BS
+// MAC_SCHED_RR: round robin that restarts at the lowest userid every subframe
+// MAC_SCHED_DRR: deficit round robin on bytes with state kept across subframes
+enum mac_sched_type {MAC_SCHED_RR=0, MAC_SCHED_DRR};
+
+// Scheduler statistics of a user for one link direction
+typedef struct {
+	uint slots;					// number of assigned data slots (airtime)
+	uint rbs;					// UL: number of assigned resource blocks
+	uint minis;					// number of assigned mini-slots
+	uint used;					// UL: slots in which data was received
+	uint bytes;					// bytes scheduled in these slots
+	uint latency_sum;			// sum of subframes from backlog to slot assignment
+	uint latency_max;
+	uint latency_cnt;
+} sched_stat_s;
+
 // Struct represents an associated user
 typedef struct {
 	ofdmframesync fs;			// framesync object. Stores freq offset etc.
 	uint8_t userid;
-	int ul_queue;
+	int ul_queue;				// UL slot payload in bytes which still has to be granted
+	int ul_grants[FRAME_LEN];	// UL slot payload granted per subframe
 	ringbuf msg_control_queue;
 	MacFrag fragmenter;
 	MacAssmbl reassembler;
+	MacHC hc;					// header compression contexts of this user
 
 	uint timingadvance;
 	uint8_t dl_mcs;				// The mcs schemes used for the user
@@ -51,6 +75,36 @@ typedef struct {
 
     MACstat_s stats;            // struct to collect statistics per user
 
+	// scheduler state per link direction, indexed with DL/UL
+	int deficit[2];						// DRR deficit counter in bytes
+	uint8_t waiting[2];					// user is backlogged and waits for a slot
+	long long unsigned int wait_since[2];	// subframe in which waiting started
+	sched_stat_s sched_stats[2];
+
+	// semi-persistent scheduling per link direction
+	sps_grant_s sps[2];
+	sps_detector_s sps_det;				// detects periodic DL frames
+
+	// link adaptation per link direction
+	link_adapt_s la[2];
+
+	// HARQ: DL blocks until they are acknowledged, soft bits of failed UL slots.
+	// Feedback and UL CRC results arrive in the receive threads, harq_dl is only
+	// modified by the scheduler, which applies the feedback before scheduling
+	harq_tx_s harq_dl;
+	atomic_uint harq_dl_ack[FRAME_LEN];	// DL feedback per subframe, not applied yet
+	atomic_uint harq_dl_nack[FRAME_LEN];
+	harq_rx_proc_s harq_ul[HARQ_PROCESSES];
+	atomic_uint harq_ul_nack[FRAME_LEN];	// UL slots per subframe that need a retransmission
+	harq_stats_s harq_stats[2];
+
+	// UL CFO tracking. The CFO is only updated with the residual phase drift of UL slots
+	// that were decoded, since failed or unused slots give a wrong phase estimate
+	float ul_cfo;				// CFO set in fs before each UL slot of the user
+	float ul_phase_drift;		// residual phase drift per symbol of the last UL slot
+	uint8_t ul_slot_done;		// an UL slot was decoded since the last update
+	uint8_t ul_slot_ok;			// crc of this slot was ok
+
     long unsigned int last_seen; // subframe No in which user has sent sth the last time
 	uint8_t will_end;			 // flag is set to indicate that the connection will be ended
 }user_s;
@@ -58,29 +112,42 @@ typedef struct {
 //forward declaration of phy struct that is needed in mac struct
 struct PhyBS_s;
 
-// Struct for linked list that contains etheraddr to userid mapping
-SLIST_HEAD(slisthead, entry);
-struct entry {
-    char EtherAddr[6];
-    uint userid;
-    SLIST_ENTRY(entry) entries;
-};
-
 struct MacBS_s {
 	ringbuf broadcast_ctrl_queue;
 	MacFrag broadcast_data_fragmenter;
 	user_s* UE[MAX_USER];
 
 	tap_dev tapdevice;
+	FramePool tap_pool;		// frame buffers for TAP ingress
 
 	uint8_t ul_ctrl_assignments[FRAME_LEN][MAC_ULCTRL_SLOTS];
 	uint8_t ul_data_assignments[FRAME_LEN][MAC_DLDATA_SLOTS];
 	uint8_t dl_data_assignments[FRAME_LEN][MAC_ULDATA_SLOTS];
+	uint8_t ul_harq_retx[FRAME_LEN];	// UL slots per subframe assigned for a retransmission
+	uint8_t ul_rb_assignments[FRAME_LEN][NUM_UL_RB];	// users of the resource blocks of UL_RB_SLOT
+	// users of the mini-slots of slots marked with USER_MINI. Index: slot*NUM_MINI_SLOT+mini
+	uint8_t dl_mini_assignments[FRAME_LEN][MAC_DLDATA_SLOTS*NUM_MINI_SLOT];
+	uint8_t ul_mini_assignments[FRAME_LEN][MAC_ULDATA_SLOTS*NUM_MINI_SLOT];
 
 	struct PhyBS_s* phy;
 
+	enum mac_sched_type sched_type;
+	uint sched_next[2];			// DRR: userid whose turn it is, per link direction
+	uint sched_slots[2];		// total number of data slots assigned to users
+	uint sched_next_rb;			// userid whose turn it is for the next UL resource block
+	uint sched_next_mini[2];	// userid whose turn it is for the next mini-slot, per link direction
+	uint sched_sfn;				// subframe the scheduler ran for the last time
+
     // Store mapping of EtherAddr to userid
-    struct slisthead etheraddr_map;
+    MacFwdTbl etheraddr_map;
+    // ARP/ND proxy, IP addresses of the users
+    MacProxy proxy;
+
+    // broadcast channel usage
+    uint bcast_slots;			// DL slots used for broadcast
+    uint bcast_data_slots;		// broadcast slots that carried a data fragment
+    uint bcast_mcs_slots[NUM_MCS_SCHEMES];	// broadcast slots per MCS
+    uint bcast_frames;			// frames from TAP that were added to the broadcast queue
 
 	int last_added_rachuserid;
 	int last_added_userid;
@@ -102,11 +169,17 @@ ofdmframesync mac_bs_get_receiver(MacBS mac, uint userid);
 void mac_bs_add_new_ue(MacBS mac, uint8_t rachuserid, uint8_t rach_try_cnt, ofdmframesync fs, int timing_diff);
 void mac_bs_update_timingadvance(MacBS mac, uint userid, int timing_diff);
 int mac_bs_rx_channel(MacBS mac, LogicalChannel chan, uint userid);
+void mac_bs_ul_quality(MacBS mac, uint userid, float snr, int crc_ok);
+void mac_bs_ul_harq_result(MacBS mac, uint userid, uint subframe, uint slot, int crc_ok, uint num_rx);
+void mac_bs_rx_arq_update(MacBS mac);
 
 // ----------- Interface functions for higher layer ---------- //
 void mac_bs_set_mcs(MacBS mac, uint userid, uint mcs, uint dl_ul);
 int mac_bs_add_txdata(MacBS mac, uint8_t destUserID, MacDataFrame frame);
 void mac_bs_run_scheduler(MacBS mac);
+void mac_bs_sps_configure(MacBS mac, uint userid, uint dl_ul, uint period, uint num_slots);
+int mac_bs_sched_stats_print(char* buf, int buflen, MacBS mac, uint userid);
+int mac_bs_bcast_stats_print(char* buf, int buflen, MacBS mac);
 
 void* mac_bs_tap_rx_th(void* mac);
 
@@ -29,6 +29,8 @@
 // Define CRC types
 #define CRC8 8
 #define CRC16 16
+// number of bytes the CRC occupies in the channel
+#define CRC16_LEN 2
 
 typedef struct {
 	uint payload_len;
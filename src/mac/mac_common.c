@@ -25,21 +25,304 @@
 #include "../util/ringbuf.h"
 #include "mac_channels.h"
 #include "mac_messages.h"
+#include <errno.h>
+
+struct FramePool_s {
+	MacDataFrame* free_frames;	// stack of unused frames
+	uint num_free;
+	uint num_frames;
+	uint buf_size;				// size of the data buffer of each frame
+	pthread_mutex_t lock;
+	pthread_cond_t frame_returned;
+};
 
 MacDataFrame dataframe_create(uint size)
 {
 	MacDataFrame frame = malloc(sizeof(MacDataFrame_s));
 	frame->data = malloc(size);
 	frame->size = size;
+	frame->pool = NULL;
+	frame->tclass = TCLASS_BEST_EFFORT;
+	frame->thinned = 0;
+	frame->hc = 0;
+	frame->pc = 0;
 	return frame;
 }
 
 void dataframe_destroy(MacDataFrame frame)
 {
+	if (frame->pool != NULL) {
+		// return frame to its pool
+		FramePool pool = frame->pool;
+		pthread_mutex_lock(&pool->lock);
+		pool->free_frames[pool->num_free++] = frame;
+		pthread_cond_signal(&pool->frame_returned);
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
 	free(frame->data);
 	free(frame);
 }
 
+FramePool framepool_create(uint num_frames, uint buf_size)
+{
+	FramePool pool = calloc(sizeof(struct FramePool_s),1);
+	pool->free_frames = malloc(sizeof(MacDataFrame)*num_frames);
+	for (int i=0; i<num_frames; i++) {
+		MacDataFrame frame = dataframe_create(buf_size);
+		frame->pool = pool;
+		pool->free_frames[i] = frame;
+	}
+	pool->num_frames = num_frames;
+	pool->num_free = num_frames;
+	pool->buf_size = buf_size;
+	pthread_mutex_init(&pool->lock,NULL);
+	pthread_cond_init(&pool->frame_returned,NULL);
+	return pool;
+}
+
+// Destroy the pool. All frames have to be returned before
+void framepool_destroy(FramePool pool)
+{
+	if (pool->num_free != pool->num_frames)
+		LOG(WARN,"[MAC] %d frames not returned to pool before destroy!\n",pool->num_frames-pool->num_free);
+	for (int i=0; i<pool->num_free; i++) {
+		pool->free_frames[i]->pool = NULL;
+		dataframe_destroy(pool->free_frames[i]);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->frame_returned);
+	free(pool->free_frames);
+	free(pool);
+}
+
+// Take a frame from the pool. The frame size is set to the buffer size
+// returns NULL if the pool is empty
+MacDataFrame framepool_get(FramePool pool)
+{
+	MacDataFrame frame = NULL;
+	pthread_mutex_lock(&pool->lock);
+	if (pool->num_free>0) {
+		frame = pool->free_frames[--pool->num_free];
+		frame->size = pool->buf_size;
+		frame->tclass = TCLASS_BEST_EFFORT;
+		frame->thinned = 0;
+		frame->hc = 0;
+		frame->pc = 0;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return frame;
+}
+
+// Block until a frame is available in the pool or the timeout expired
+// returns 1 if a frame is available, 0 otherwise
+int framepool_wait(FramePool pool, int timeout_ms)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME,&deadline);
+	deadline.tv_sec += timeout_ms/1000;
+	deadline.tv_nsec += (timeout_ms%1000)*1000000;
+	if (deadline.tv_nsec>=1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec-=1000000000;
+	}
+	pthread_mutex_lock(&pool->lock);
+	int ret = 0;
+	while (pool->num_free==0 && ret!=ETIMEDOUT)
+		ret = pthread_cond_timedwait(&pool->frame_returned,&pool->lock,&deadline);
+	int avail = pool->num_free>0;
+	pthread_mutex_unlock(&pool->lock);
+	return avail;
+}
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_ARP 0x0806
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_IPV6 0x86DD
+#define IPPROTO_ICMP_ 1
+#define IPPROTO_IGMP_ 2
+#define IPPROTO_TCP_ 6
+#define IPPROTO_UDP_ 17
+#define IPPROTO_ICMPV6_ 58
+#define DSCP_CS1 8
+#define DSCP_EF 46
+#define DSCP_CS6 48
+// UDP packets up to this IP length are considered interactive
+#define TCLASS_SMALL_PKT 128
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_RST 0x04
+
+static int port_is_netctrl(uint port)
+{
+	return (port==53 || port==67 || port==68 || port==123 || port==546 || port==547);
+}
+
+// Classify by the transport header. l4 points to the TCP/UDP header,
+// l4_len is the length of the transport header and payload
+static uint8_t classify_l4(uint proto, const uint8_t* l4, int l4_len, uint ip_len)
+{
+	if (proto==IPPROTO_UDP_ && l4_len>=8) {
+		uint sport = (l4[0]<<8) | l4[1];
+		uint dport = (l4[2]<<8) | l4[3];
+		if (port_is_netctrl(sport) || port_is_netctrl(dport))
+			return TCLASS_NETCTRL;
+		if (ip_len <= TCLASS_SMALL_PKT)
+			return TCLASS_INTERACTIVE;
+	} else if (proto==IPPROTO_TCP_ && l4_len>=20) {
+		uint hdr_len = (l4[12]>>4)*4;
+		uint flags = l4[13];
+		// pure ACKs and SYNs without payload. Delaying ACKs throttles the TCP flow in
+		// the opposite direction. Segments with payload, FIN or RST stay in the queue of
+		// their flow, since overtaking queued data causes spurious fast retransmits
+		if (l4_len<=hdr_len && !(flags & (TCP_FLAG_FIN | TCP_FLAG_RST)))
+			return TCLASS_INTERACTIVE;
+	}
+	return TCLASS_BEST_EFFORT;
+}
+
+static uint8_t classify_dscp(uint dscp)
+{
+	if (dscp >= DSCP_CS6)
+		return TCLASS_NETCTRL;
+	if (dscp == DSCP_EF)
+		return TCLASS_INTERACTIVE;
+	if (dscp == DSCP_CS1)
+		return TCLASS_BULK;
+	return TCLASS_BEST_EFFORT;
+}
+
+// Get the ethertype and the start of the L3 header of an Ethernet frame
+// returns the length of the L3 part, -1 if the frame is too short
+static int eth_get_l3(const uint8_t* data, uint len, uint* ethertype, const uint8_t** l3)
+{
+	if (len < 14)
+		return -1;
+	*ethertype = (data[12]<<8) | data[13];
+	*l3 = data+14;
+	int l3_len = len-14;
+	if (*ethertype==ETHERTYPE_VLAN && l3_len>=4) {
+		*ethertype = ((*l3)[2]<<8) | (*l3)[3];
+		*l3 += 4;
+		l3_len -= 4;
+	}
+	return l3_len;
+}
+
+// Lightweight classifier for Ethernet frames. Only looks at the first
+// headers, IPv4 fragments and IPv6 extension headers are not parsed
+uint8_t mac_classify_frame(const uint8_t* data, uint len)
+{
+	uint ethertype;
+	const uint8_t* l3;
+	int l3_len = eth_get_l3(data, len, &ethertype, &l3);
+	if (l3_len < 0)
+		return TCLASS_BEST_EFFORT;
+
+	if (ethertype==ETHERTYPE_ARP) {
+		return TCLASS_NETCTRL;
+	} else if (ethertype==ETHERTYPE_IPV4 && l3_len>=20) {
+		uint ihl = (l3[0]&0x0f)*4;
+		uint ip_len = (l3[2]<<8) | l3[3];
+		uint proto = l3[9];
+		uint8_t tclass = classify_dscp(l3[1]>>2);
+		if (tclass != TCLASS_BEST_EFFORT)
+			return tclass;
+		if (proto==IPPROTO_ICMP_ || proto==IPPROTO_IGMP_)
+			return TCLASS_NETCTRL;
+		uint frag_offset = ((l3[6]&0x1f)<<8) | l3[7];
+		if (frag_offset!=0 || ihl<20 || (int)ihl>l3_len)
+			return TCLASS_BEST_EFFORT;
+		int l4_len = ((int)ip_len<=l3_len ? (int)ip_len : l3_len) - (int)ihl;
+		return classify_l4(proto, l3+ihl, l4_len, ip_len);
+	} else if (ethertype==ETHERTYPE_IPV6 && l3_len>=40) {
+		uint payload_len = (l3[4]<<8) | l3[5];
+		uint proto = l3[6];
+		uint8_t tclass = classify_dscp(((l3[0]&0x0f)<<2) | (l3[1]>>6));
+		if (tclass != TCLASS_BEST_EFFORT)
+			return tclass;
+		if (proto==IPPROTO_ICMPV6_)
+			return TCLASS_NETCTRL;
+		int l4_len = ((int)payload_len<=l3_len-40 ? (int)payload_len : l3_len-40);
+		return classify_l4(proto, l3+40, l4_len, payload_len+40);
+	}
+	return TCLASS_BEST_EFFORT;
+}
+
+// Get the TCP header of an unfragmented IPv4/IPv6 packet and the flow addresses.
+// If the payload is compressed (see mac_hc_compress_payload()), the frame is shorter than
+// the IP length, so only the headers have to fit into the frame
+// returns the length of TCP header and payload, -1 if this is no TCP packet
+static int get_tcp_hdr(const uint8_t* data, uint len, uint pc, const uint8_t** tcp, tcp_ack_s* flow)
+{
+	uint ethertype;
+	const uint8_t* l3;
+	int l3_len = eth_get_l3(data, len, &ethertype, &l3);
+	if (l3_len < 0)
+		return -1;
+	if (ethertype==ETHERTYPE_IPV4 && l3_len>=20) {
+		uint ihl = (l3[0]&0x0f)*4;
+		int ip_len = (l3[2]<<8) | l3[3];
+		uint frag = ((l3[6]&0x3f)<<8) | l3[7];	// MF flag and fragment offset
+		if (l3[9]!=IPPROTO_TCP_ || frag!=0 || ihl<20 || (int)ihl+20>ip_len)
+			return -1;
+		if (ip_len>l3_len && (!pc || (int)ihl+20>l3_len))
+			return -1;
+		memcpy(flow->addr, l3+12, 8);
+		flow->addr_len = 8;
+		*tcp = l3+ihl;
+		return ip_len-ihl;
+	} else if (ethertype==ETHERTYPE_IPV6 && l3_len>=40) {
+		int payload_len = (l3[4]<<8) | l3[5];
+		if (l3[6]!=IPPROTO_TCP_ || payload_len<20)
+			return -1;
+		if (payload_len+40>l3_len && (!pc || 60>l3_len))
+			return -1;
+		memcpy(flow->addr, l3+8, 32);
+		flow->addr_len = 32;
+		*tcp = l3+40;
+		return payload_len;
+	}
+	return -1;
+}
+
+int mac_parse_pure_ack(const uint8_t* data, uint len, tcp_ack_s* ack)
+{
+	const uint8_t* tcp;
+	int tcp_len = get_tcp_hdr(data, len, 0, &tcp, ack);
+	if (tcp_len < 0)
+		return 0;
+	int hdr_len = (tcp[12]>>4)*4;
+	// ACK flag only. PSH/FIN/SYN/RST/URG/ECE/CWR are not replaceable
+	if (tcp[13]!=0x10 || hdr_len<20 || hdr_len!=tcp_len)
+		return 0;
+	// options: only NOP, EOL and timestamp are allowed
+	for (int i=20; i<hdr_len; ) {
+		if (tcp[i]==0) {
+			break;
+		} else if (tcp[i]==1) {
+			i++;
+		} else if (tcp[i]==8 && i+1<hdr_len && tcp[i+1]==10) {
+			i+=10;
+		} else {
+			return 0;
+		}
+	}
+	ack->sport = (tcp[0]<<8) | tcp[1];
+	ack->dport = (tcp[2]<<8) | tcp[3];
+	ack->ack_seq = ((uint32_t)tcp[8]<<24) | (tcp[9]<<16) | (tcp[10]<<8) | tcp[11];
+	return 1;
+}
+
+int mac_frame_in_flow(const uint8_t* data, uint len, uint pc, tcp_ack_s* flow)
+{
+	const uint8_t* tcp;
+	tcp_ack_s f;
+	if (get_tcp_hdr(data, len, pc, &tcp, &f) < 0)
+		return 0;
+	return (f.addr_len==flow->addr_len && memcmp(f.addr,flow->addr,f.addr_len)==0 &&
+			((tcp[0]<<8) | tcp[1])==flow->sport && ((tcp[2]<<8) | tcp[3])==flow->dport);
+}
+
 // Check how many slots are assigned to the given userid
 int num_slot_assigned(uint8_t* assignments, uint num_slots, uint8_t userid)
 {
@@ -21,6 +21,7 @@
 
 #include <stddef.h>
 #include <time.h>
+#include <pthread.h>
 #include "../util/ringbuf.h"
 
 #include "mac_channels.h"
@@ -32,11 +33,28 @@
 	  printf(__VA_ARGS__); }} while(0);
 
 
+struct FramePool_s;
+typedef struct FramePool_s* FramePool;
+
+// Traffic classes of data frames. Lower value means higher priority
+enum mac_tclass {
+	TCLASS_NETCTRL=0,	// ARP, ICMP, ND, DHCP, DNS
+	TCLASS_INTERACTIVE,	// pure TCP ACKs and SYNs, small UDP packets, DSCP EF
+	TCLASS_BEST_EFFORT,	// everything else
+	TCLASS_BULK			// DSCP CS1
+};
+
 // Define generic Dataframe
 // This object is used for interaction with higher layers
 typedef struct {
 	uint size;
 	uint8_t* data;
+	FramePool pool;		// pool the frame belongs to. NULL if created with dataframe_create
+	uint8_t tclass;		// traffic class, enum mac_tclass
+	uint8_t thinned;	// replaced by a newer TCP ACK, drop when dequeued
+	uint8_t hc;			// header is compressed (mac_hc)
+	uint8_t pc;			// payload is compressed (mac_hc)
+	uint64_t enqueue_us;	// time of enqueueing in the fragmenter
 } MacDataFrame_s;
 
 // Store some MAC layer statistics
@@ -54,6 +72,36 @@ typedef MacDataFrame_s* MacDataFrame;
 MacDataFrame dataframe_create(uint size);
 void dataframe_destroy(MacDataFrame frame);
 
+/************ Methods for Dataframe pool ****************/
+// A pool of preallocated frames with a fixed buffer size. Frames taken from
+// the pool are returned by dataframe_destroy. Pool is thread safe.
+FramePool framepool_create(uint num_frames, uint buf_size);
+void framepool_destroy(FramePool pool);
+MacDataFrame framepool_get(FramePool pool);
+int framepool_wait(FramePool pool, int timeout_ms);
+
+/************ Traffic classification ********************/
+// Determine the traffic class of an Ethernet frame from its Ethernet/IP header
+uint8_t mac_classify_frame(const uint8_t* data, uint len);
+
+// TCP flow and ACK number of a pure TCP ACK
+typedef struct {
+	uint8_t addr[32];	// source and destination IP address
+	uint addr_len;
+	uint16_t sport;
+	uint16_t dport;
+	uint32_t ack_seq;
+} tcp_ack_s;
+
+// Check whether an Ethernet frame is a pure TCP ACK that can be replaced
+// by a newer ACK of the same flow: no payload, no flags except ACK and no
+// TCP options except timestamps. In particular ACKs with SACK blocks are excluded
+// returns 1 and fills ack if this is the case
+int mac_parse_pure_ack(const uint8_t* data, uint len, tcp_ack_s* ack);
+
+// Check whether a frame belongs to the given TCP flow. pc is set if the payload is compressed
+int mac_frame_in_flow(const uint8_t* data, uint len, uint pc, tcp_ack_s* flow);
+
 /*************** Various utility methods ****************/
 int num_slot_assigned(uint8_t* assignments, uint num_slots, uint8_t userid);
 void lchan_add_all_msgs(LogicalChannel lchan, ringbuf ctrl_msg_buf);
@@ -21,8 +21,52 @@
 
 // Number of control messages that can be enqueued
 #define MAC_CTRL_MSG_BUF_SIZE 32
-// Number of data frames that can be enqueued
-#define MAC_DATA_BUF_SIZE 32
+// Number of data frames that can be enqueued (per traffic class)
+#define MAC_DATA_BUF_SIZE 64
+// Max number of bytes per traffic class queue if AQM is enabled
+#define MAC_FRAG_BYTE_LIMIT 16000
+
+// CoDel active queue management in the MAC queues. The target is raised
+// to 1.5 times the measured time to send a MTU on slow links
+#define MAC_CODEL_TARGET_US 50000
+#define MAC_CODEL_INTERVAL_US 500000
+// Number of bins of the sojourn time histogram (log2 of ms)
+#define MAC_FRAG_HIST_BINS 14
+
+// Replace queued TCP ACKs by newer cumulative ACKs of the same flow.
+// Default, can be changed with ack_thinning in the mac section of the config file
+#define MAC_ACK_THINNING 1
+
+// Header compression (mac_hc). Default, can be changed with header_compression
+// in the mac section of the config file
+#define MAC_HEADER_COMPRESSION 1
+#define MAC_HC_CONTEXTS 16		// contexts per user and direction. Max 16 (4bit)
+#define MAC_HC_FULL_REPEAT 3	// uncompressed frames sent to establish a context
+#define MAC_HC_REFRESH 64		// send every n-th frame uncompressed to repair lost contexts
+
+// Payload compression with deflate (mac_hc). Default, can be changed with
+// payload_compression in the mac section of the config file
+#define MAC_PAYLOAD_COMPRESSION 0
+#define MAC_PC_LEVEL 1			// zlib compression level
+#define MAC_PC_MIN_SIZE 128		// smaller frames are not compressed
+#define MAC_PC_MIN_GAIN 16		// bytes that have to be saved to send a frame compressed
+#define MAC_PC_FLOWS 16			// flows tracked for skipping incompressible traffic
+#define MAC_PC_MAX_BACKOFF 64	// max frames of a flow sent uncompressed after a failed attempt
+
+// Number of traffic classes, see enum mac_tclass
+#define MAC_NUM_TCLASS 4
+// Traffic class scheduling in the fragmenter. Weight 0 means strict priority,
+// i.e. the class is always served before all weighted classes. Weighted classes
+// share the remaining capacity in proportion to their weight (frames per round).
+// Order: network control, interactive, best effort, bulk
+#define MAC_TCLASS_WEIGHTS {0, 0, 4, 1}
+
+// TAP ingress: maximum number of frames read per wakeup
+#define MAC_TAP_RX_BATCH 16
+// TAP ingress: number of pooled frame buffers. The UE pool matches its queue size,
+// so that an exhausted pool stops reading from TAP until the MAC sent a frame
+#define MAC_TAP_POOL_SIZE_UE (MAC_NUM_TCLASS*MAC_DATA_BUF_SIZE)
+#define MAC_TAP_POOL_SIZE_BS (4*MAC_DATA_BUF_SIZE)
 
 // Maximum allowed response time for control messages sent by BS
 // Unit: number of subframes
@@ -32,6 +76,77 @@
 // Unit: number of subframes
 #define TMR_USER_INACTIVE 200
 
+// Ethernet forwarding table at the BS
+#define MAC_FWD_TABLE_SIZE 256      // number of hash slots. Has to be a power of 2
+#define MAC_FWD_MAX_ENTRIES 128     // max number of learned Ethernet addresses
+// Learned Ethernet addresses are removed if not seen for this time
+// Unit: number of subframes (~17ms each) -> 300s
+#define MAC_FWD_AGING_TIME 17600
+// Interval in which the forwarding table is checked for aged entries
+// Unit: number of subframes
+#define MAC_FWD_AGING_INTERVAL 512
+
+// ARP/ND proxy at the BS. Max number of learned IPv4/IPv6 addresses of the clients.
+// Bindings age out after MAC_FWD_AGING_TIME
+#define MAC_PROXY_MAX_ENTRIES 64
+
+// BS scheduler. Deficit round robin quantum in bytes. Every backlogged user
+// is credited this amount per round. Should be in the order of one TBS
+#define MAC_SCHED_QUANTUM 128
+// max number of rounds credited while searching a user for one slot
+#define MAC_SCHED_MAX_ROUNDS 16
+
+// Broadcast channel. Broadcast data is sent with the lowest DL MCS of all users,
+// lowered by MAC_BCAST_MCS_MARGIN since broadcasts are not acknowledged.
+// Subframes with association responses use MCS 0
+#define MAC_BCAST_MCS_MARGIN 2
+// Max number of DL slots per subframe used for broadcast. Slots are added
+// while the broadcast queue is not empty
+#define MAC_BCAST_MAX_SLOTS 2
+
+// Link adaptation, see mac_la.h. Enabled with link_adaptation in the mac section of the config file
+#define MAC_LINK_ADAPTATION 1
+// SNR [dB] at which each MCS reaches the target slot error rate in an AWGN channel
+#define MAC_LA_SNR_THRESHOLDS {2.5, 4.5, 5.5, 8.5, 10.0, 10.5, 11.5, 14.5, 16.0, 17.5, 19.0, 23.0, 26.0}
+#define MAC_LA_BLER_TARGET 0.1		// target slot error rate of the outer loop
+#define MAC_LA_STEP_DB 0.3			// outer loop offset increase per failed slot
+#define MAC_LA_OFFSET_MIN -1.0		// limits of the outer loop offset [dB]
+#define MAC_LA_OFFSET_MAX 10.0
+#define MAC_LA_HYST_DB 1.0			// additional SNR margin to increase the MCS
+#define MAC_LA_HOLD 64				// min number of subframes between MCS increases
+#define MAC_LA_MIN_GAIN 10			// MCS is skipped if its TBS is not N% larger than of a more robust MCS
+#define MAC_LA_SNR_ALPHA 0.1		// filter weight of a new SNR measurement
+#define MAC_LA_REPORT_INTERVAL 4	// UE sends a channel_quality message every N subframes
+
+// HARQ retransmissions of unicast data slots, see mac_harq.h. Enabled with harq in the mac
+// section of the config file. Process and timing constants are in phy_config.h
+#define MAC_HARQ 1
+
+// Selective repeat ARQ for unicast data fragments. The receiver reports received fragments
+// with arq_status messages, the sender retransmits missing fragments. Enabled with arq in the
+// mac section of the config file. Timers are in subframes
+#define MAC_ARQ 1
+#define MAC_ARQ_SN_MOD 128			// 7bit fragment sequence numbers
+#define MAC_ARQ_WINDOW 64			// max unacknowledged fragments. At most MAC_ARQ_SN_MOD/2
+#define MAC_ARQ_BITMAP_LEN 13		// fragments after the first missing one in a status report
+#define MAC_ARQ_MAX_TX 3			// transmissions of a fragment until it is given up
+#define MAC_ARQ_REORDER_TIMEOUT 14	// wait for HARQ retransmissions (up to 12 subframes) before
+									// a missing fragment is reported or skipped without ARQ
+#define MAC_ARQ_RETX_TIMEOUT 40		// retransmit fragments that are not acknowledged
+#define MAC_ARQ_DISCARD_TIMEOUT (MAC_ARQ_MAX_TX*MAC_ARQ_RETX_TIMEOUT)	// receiver skips a missing fragment
+#define MAC_ARQ_STATUS_INTERVAL 4	// min subframes between two status reports
+
+// Semi-persistent scheduling of periodic flows
+#define MAC_SPS_MAX_FRAME 300		// only flows with frames up to this size [bytes]
+#define MAC_SPS_MIN_PERIOD 2		// range of supported periods [subframes]
+#define MAC_SPS_MAX_PERIOD 63
+#define MAC_SPS_DETECT_CNT 4		// number of matching intervals until a flow is periodic
+#define MAC_SPS_IDLE_RELEASE 8		// release after this number of periods without data
+#define MAC_SPS_MAX_SLOTS 2			// max number of slots per occasion
+
+// Max value of the buffer status in an ul_req message (13bit field)
+#define MAC_UL_REQ_MAX ((1<<13)-1)
+
 // Maximum number of users. Fixed and should not be changed
 #define MAX_USER 16
 
@@ -54,6 +169,12 @@
 #define USER_BROADCAST 1
 // userID that is used to indicate a disabled/unused slot
 #define USER_UNUSED 0
+// marks UL slot UL_RB_SLOT as split into resource blocks in the UL slot assignments
+// of the BS. Not a valid userID, it is signaled as USER_UNUSED
+#define USER_RB 0xff
+// marks a DL or UL data slot as split into mini-slots in the slot assignments of the BS.
+// Not a valid userID, the users of the mini-slots are signaled separately
+#define USER_MINI 0xfe
 
 
 #endif /* MAC_MAC_CONFIG_H_ */
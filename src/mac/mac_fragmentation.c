@@ -19,108 +19,718 @@
 #include "mac_fragmentation.h"
 
 #include <ringbuf.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <libconfig.h>
 #include "mac_config.h"
 
-#define MAX_SEQNR 4 // 2 bits are allocated for seqNr in MacMessage
-#define MAX_FRAGNR 32 // 5 bits are allocated for fragNr in MacMessage
+#define MAX_FRAGNR 32 // max number of fragments of a frame in the reassembler
 
+// sequence number distance from b to a
+#define SN_DIFF(a, b) (((a) + MAC_ARQ_SN_MOD - (b)) % MAC_ARQ_SN_MOD)
+#define SN_ADD(a, n) (((a) + (n)) % MAC_ARQ_SN_MOD)
+
+
+static const uint8_t tclass_weight[MAC_NUM_TCLASS] = MAC_TCLASS_WEIGHTS;
+
+// CoDel state of a queue, see RFC 8289
+typedef struct {
+	uint64_t first_above_time;	// time when the sojourn time stays above target long enough
+	uint64_t drop_next;			// time of the next drop in dropping state
+	uint count;					// drops since entering dropping state
+	uint lastcount;
+	uint dropping;
+} codel_s;
+
+// State of a sent fragment in the ARQ window
+enum {ARQ_OUTSTANDING=0, ARQ_ACKED, ARQ_DROPPED};
+
+typedef struct {
+	MacMessage msg;						// copy of the fragment, NULL once acknowledged
+	uint8_t state;
+	uint8_t num_tx;
+	uint8_t retx;						// scheduled for retransmission
+	long long unsigned int tx_time;		// subframe of the last transmission
+} arq_tx_s;
+
+// Fragment that was received out of order
+typedef struct {
+	uint8_t* data;						// NULL if not received
+	uint len;
+	uint8_t first;
+	uint8_t final;
+	uint8_t hc;
+} arq_rx_s;
 
 struct MacFragmenter_s {
-	uint seqNr;
-	uint fragNr;
+	uint seqNr;								// sequence number of the next new fragment
 	MacDataFrame curr_frame;
-	ringbuf frame_queue;
+	ringbuf frame_queue[MAC_NUM_TCLASS];	// one queue per traffic class
+	uint credit[MAC_NUM_TCLASS];			// remaining frames of weighted classes in this round
+	uint wrr_next;							// weighted class that is currently served
 	uint bytes_sent;
-	uint bytes_buffered;
+	// queued bytes per class are bytes_in-bytes_out. Each counter is
+	// modified by one thread only (producer or consumer)
+	atomic_uint bytes_in[MAC_NUM_TCLASS];
+	atomic_uint bytes_out[MAC_NUM_TCLASS];
+	uint aqm;								// enable byte limit and CoDel
+	codel_s codel[MAC_NUM_TCLASS];
+	uint64_t curr_frame_start;				// time the first fragment of curr_frame was sent
+	uint mtu_time_us;						// estimated time to send a MTU sized frame
+	frag_tclass_stat_s stats[MAC_NUM_TCLASS];
+	uint acks_sent;							// pure TCP ACKs that were sent
+	uint acks_thinned;						// ACKs replaced by a newer ACK
+	uint acks_thinned_frags;				// fragments that were saved by ACK thinning
+	MacHC hc;								// header compressor, NULL if not used
+	uint curr_hc;							// header of curr_frame is compressed
+	// selective repeat ARQ. Status reports arrive in the receive thread,
+	// arq_lock guards the window against the scheduler
+	pthread_mutex_t arq_lock;
+	uint arq;								// keep sent fragments until they are acknowledged
+	uint arq_ack;							// oldest sequence number that is not acknowledged
+	arq_tx_s arq_tx[MAC_ARQ_WINDOW];		// sent fragments, index seqNr%MAC_ARQ_WINDOW
+	long long unsigned int now;				// subframe counter of the last mac_frag_arq_update()
+	frag_arq_stat_s arq_stats;
 } ;
 
 struct MacReassembler_s {
 	uint frame_open;
-	uint seqNr;
 	uint fragNr;
+	uint hc;
 	uint8_t* fragments[MAX_FRAGNR];
 	uint fragments_len[MAX_FRAGNR];
 	uint frame_len;
+	ringbuf frames;						// completed frames
+	// fragments are reassembled in the receive thread, status reports
+	// are created by the scheduler. lock guards the whole reassembler
+	pthread_mutex_t lock;
+	// reordering
+	uint reorder;						// wait for fragments that arrive out of order
+	uint synced;						// a fragment was received since the last reset
+	uint rx_next;						// next sequence number to reassemble
+	uint rx_highest;					// sequence number after the highest received one
+	arq_rx_s rx_buf[MAC_ARQ_WINDOW];	// fragments after a gap, index seqNr%MAC_ARQ_WINDOW
+	long long unsigned int gap_since;	// subframe since which rx_next is missing
+	long long unsigned int now;
+	// status reports
+	uint status_due;					// fragments were received since the last report
+	long long unsigned int last_status;
+	assmbl_stat_s stats;
 } ;
 
 
+static uint64_t frag_time_monotonic(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (uint64_t)now.tv_sec*1000000 + now.tv_nsec/1000;
+}
+
+static uint64_t (*frag_time_us)(void) = frag_time_monotonic;
+static int frag_ack_thinning = MAC_ACK_THINNING;
+static int frag_header_compression = MAC_HEADER_COMPRESSION;
+static int frag_payload_compression = MAC_PAYLOAD_COMPRESSION;
+static int frag_arq = MAC_ARQ;
+
+// Replace the clock used for the queue timestamps. Used by simulations
+void mac_frag_set_clock(uint64_t (*clock)(void))
+{
+	frag_time_us = clock ? clock : frag_time_monotonic;
+}
+
 MacFrag mac_frag_init()
 {
 	MacFrag frag = calloc(1,sizeof(struct MacFragmenter_s));
-	frag->frame_queue = ringbuf_create(MAC_DATA_BUF_SIZE);
+	for (int c=0; c<MAC_NUM_TCLASS; c++) {
+		frag->frame_queue[c] = ringbuf_create(MAC_DATA_BUF_SIZE);
+		frag->credit[c] = tclass_weight[c];
+		atomic_init(&frag->bytes_in[c], 0);
+		atomic_init(&frag->bytes_out[c], 0);
+	}
 	frag->curr_frame = NULL;
+	frag->aqm = 1;
+	pthread_mutex_init(&frag->arq_lock, NULL);
 	return frag;
 }
 
 void mac_frag_destroy(MacFrag frag)
 {
-	while (!ringbuf_isempty(frag->frame_queue)) {
-		MacDataFrame p = ringbuf_get(frag->frame_queue);
-		dataframe_destroy(p);
+	mac_frag_arq_reset(frag);
+	for (int c=0; c<MAC_NUM_TCLASS; c++) {
+		while (!ringbuf_isempty(frag->frame_queue[c])) {
+			MacDataFrame p = ringbuf_get(frag->frame_queue[c]);
+			dataframe_destroy(p);
+		}
+		ringbuf_destroy(frag->frame_queue[c]);
 	}
-	ringbuf_destroy(frag->frame_queue);
-	free(frag->curr_frame);
+	if (frag->curr_frame)
+		dataframe_destroy(frag->curr_frame);
+	pthread_mutex_destroy(&frag->arq_lock);
 	free(frag);
 }
 
+void mac_frag_set_aqm(MacFrag frag, uint enable)
+{
+	frag->aqm = enable;
+}
+
+void mac_frag_set_hc(MacFrag frag, MacHC hc)
+{
+	frag->hc = hc;
+}
+
+void mac_frag_set_ack_thinning(uint enable)
+{
+	frag_ack_thinning = enable;
+}
+
+void mac_frag_set_payload_compression(uint enable)
+{
+	frag_payload_compression = enable;
+}
+
+void mac_frag_set_arq_enabled(uint enable)
+{
+	frag_arq = enable;
+}
+
+uint mac_frag_arq_is_enabled()
+{
+	return frag_arq;
+}
+
+// Read the settings of the "mac" section of the config file
+void mac_frag_config_load(char* config_file)
+{
+	config_t cfg;
+	config_init(&cfg);
+	if (config_file && config_read_file(&cfg, config_file)) {
+		config_setting_t* mac = config_lookup(&cfg, "mac");
+		if (mac) {
+			config_setting_lookup_int(mac, "ack_thinning", &frag_ack_thinning);
+			config_setting_lookup_int(mac, "header_compression", &frag_header_compression);
+			config_setting_lookup_int(mac, "payload_compression", &frag_payload_compression);
+			config_setting_lookup_int(mac, "arq", &frag_arq);
+		}
+	}
+	config_destroy(&cfg);
+	LOG(INFO,"[MAC FRAG] TCP ACK thinning %s\n",frag_ack_thinning ? "enabled" : "disabled");
+	LOG(INFO,"[MAC FRAG] header compression %s\n",frag_header_compression ? "enabled" : "disabled");
+	LOG(INFO,"[MAC FRAG] payload compression %s\n",frag_payload_compression ? "enabled" : "disabled");
+	LOG(INFO,"[MAC FRAG] ARQ %s\n",frag_arq ? "enabled" : "disabled");
+}
+
+//// ARQ sender ////
+
+static int frag_arq_active(MacFrag frag)
+{
+	return frag->arq && frag_arq;
+}
+
+static int arq_window_full(MacFrag frag)
+{
+	return SN_DIFF(frag->seqNr, frag->arq_ack) >= MAC_ARQ_WINDOW;
+}
+
+// Give up the fragment. Its sequence number stays in the window until the
+// receiver skipped it, so both ends keep the same window. The copy is kept
+// to poll for a status report, see mac_frag_arq_update()
+static void arq_drop(MacFrag frag, arq_tx_s* tx)
+{
+	tx->retx = 0;
+	tx->state = ARQ_DROPPED;
+	frag->arq_stats.failed++;
+}
+
+static void arq_ack(arq_tx_s* tx)
+{
+	if (tx->msg)
+		mac_msg_destroy(tx->msg);
+	tx->msg = NULL;
+	tx->retx = 0;
+	tx->state = ARQ_ACKED;
+}
+
+// Schedule a retransmission or give the fragment up
+static void arq_nack(MacFrag frag, arq_tx_s* tx)
+{
+	if (tx->num_tx >= MAC_ARQ_MAX_TX)
+		arq_drop(frag, tx);
+	else
+		tx->retx = 1;
+}
+
+void mac_frag_set_arq(MacFrag frag, uint enable)
+{
+	frag->arq = enable;
+}
+
+void mac_frag_arq_reset(MacFrag frag)
+{
+	pthread_mutex_lock(&frag->arq_lock);
+	for (int i=0; i<MAC_ARQ_WINDOW; i++) {
+		if (frag->arq_tx[i].msg)
+			mac_msg_destroy(frag->arq_tx[i].msg);
+	}
+	memset(frag->arq_tx, 0, sizeof(frag->arq_tx));
+	frag->seqNr = 0;
+	frag->arq_ack = 0;
+	pthread_mutex_unlock(&frag->arq_lock);
+}
+
+// Retransmit fragments that were not acknowledged in time. Covers lost status
+// reports and lost fragments at the end of a burst, which the receiver cannot detect
+void mac_frag_arq_update(MacFrag frag, long long unsigned int now)
+{
+	pthread_mutex_lock(&frag->arq_lock);
+	frag->now = now;
+	if (!frag_arq_active(frag)) {
+		pthread_mutex_unlock(&frag->arq_lock);
+		return;
+	}
+	for (uint sn=frag->arq_ack; sn!=frag->seqNr; sn=SN_ADD(sn,1)) {
+		arq_tx_s* tx = &frag->arq_tx[sn%MAC_ARQ_WINDOW];
+		if (tx->state==ARQ_OUTSTANDING && !tx->retx && now-tx->tx_time >= MAC_ARQ_RETX_TIMEOUT)
+			arq_nack(frag, tx);
+	}
+	// A given up fragment blocks the window until a status report shows that the
+	// receiver skipped it. If that report got lost, nothing else would trigger a new
+	// one. Send the fragment again, the receiver either uses it or reports the duplicate
+	arq_tx_s* head = &frag->arq_tx[frag->arq_ack%MAC_ARQ_WINDOW];
+	if (frag->arq_ack!=frag->seqNr && head->state==ARQ_DROPPED && !head->retx &&
+			now-head->tx_time >= MAC_ARQ_RETX_TIMEOUT)
+		head->retx = 1;
+	pthread_mutex_unlock(&frag->arq_lock);
+}
+
+static void arq_status(MacFrag frag, uint ack_sn, uint bitmap)
+{
+	uint outstanding = SN_DIFF(frag->seqNr, frag->arq_ack);
+	if (SN_DIFF(ack_sn, frag->arq_ack) > outstanding) {
+		LOG(DEBUG,"[MAC FRAG] ARQ status %d outside of window %d-%d\n",ack_sn,frag->arq_ack,frag->seqNr);
+		return;
+	}
+	// all fragments before ack_sn were received or skipped by the receiver
+	while (frag->arq_ack != ack_sn) {
+		arq_ack(&frag->arq_tx[frag->arq_ack%MAC_ARQ_WINDOW]);
+		frag->arq_ack = SN_ADD(frag->arq_ack,1);
+	}
+	outstanding = SN_DIFF(frag->seqNr, frag->arq_ack);
+
+	// fragments up to the last received one are either received or missing.
+	// Missing fragments are retransmitted, if they had time to arrive
+	int last = -1;
+	for (int i=0; i<MAC_ARQ_BITMAP_LEN; i++) {
+		if (bitmap & (1<<i))
+			last = i;
+	}
+	for (int i=-1; i<=last && i+1<outstanding; i++) {
+		arq_tx_s* tx = &frag->arq_tx[SN_ADD(ack_sn,i+1)%MAC_ARQ_WINDOW];
+		if (i>=0 && (bitmap & (1<<i)))
+			arq_ack(tx);
+		else if (tx->state==ARQ_OUTSTANDING && !tx->retx && frag->now-tx->tx_time >= MAC_ARQ_REORDER_TIMEOUT)
+			arq_nack(frag, tx);
+	}
+	// the report does not cover fragments behind the bitmap. The receiver is alive,
+	// so wait with their retransmission until a report covers them
+	for (int i=MAC_ARQ_BITMAP_LEN; i+1<outstanding; i++) {
+		arq_tx_s* tx = &frag->arq_tx[SN_ADD(ack_sn,i+1)%MAC_ARQ_WINDOW];
+		if (tx->state==ARQ_OUTSTANDING && !tx->retx)
+			tx->tx_time = frag->now;
+	}
+	while (frag->arq_ack != frag->seqNr && frag->arq_tx[frag->arq_ack%MAC_ARQ_WINDOW].state == ARQ_ACKED)
+		frag->arq_ack = SN_ADD(frag->arq_ack,1);
+}
+
+void mac_frag_arq_status(MacFrag frag, uint ack_sn, uint bitmap)
+{
+	if (!frag_arq_active(frag))
+		return;
+	pthread_mutex_lock(&frag->arq_lock);
+	arq_status(frag, ack_sn, bitmap);
+	pthread_mutex_unlock(&frag->arq_lock);
+}
+
+// returns the oldest fragment that has to be retransmitted and fits into max_frag_size
+static arq_tx_s* arq_next_retx(MacFrag frag, uint max_frag_size)
+{
+	for (uint sn=frag->arq_ack; sn!=frag->seqNr; sn=SN_ADD(sn,1)) {
+		arq_tx_s* tx = &frag->arq_tx[sn%MAC_ARQ_WINDOW];
+		if (tx->retx && tx->msg->hdr_len + tx->msg->payload_len <= max_frag_size)
+			return tx;
+	}
+	return NULL;
+}
+
+// bytes and number of fragments that wait for retransmission
+static uint arq_retx_pending(MacFrag frag, uint* num_frags)
+{
+	uint bytes = 0, num = 0;
+	if (!frag_arq_active(frag))
+		return 0;
+	for (uint sn=frag->arq_ack; sn!=frag->seqNr; sn=SN_ADD(sn,1)) {
+		arq_tx_s* tx = &frag->arq_tx[sn%MAC_ARQ_WINDOW];
+		if (tx->retx) {
+			bytes += tx->msg->payload_len;
+			num++;
+		}
+	}
+	if (num_frags)
+		*num_frags = num;
+	return bytes;
+}
+
+static uint queued_bytes(MacFrag frag, uint tclass)
+{
+	return atomic_load(&frag->bytes_in[tclass]) - atomic_load(&frag->bytes_out[tclass]);
+}
+
+// Enqueue a frame in the queue of its traffic class.
+// Frames of a class with a full queue are dropped.
+// The payload is compressed here, i.e. in the thread of the caller
 int mac_frag_add_frame(MacFrag frag, MacDataFrame frame)
 {
 	if (frame->size>MAC_MTU) {
 		LOG(WARN,"[MAC FRAG] incoming frame size exceeds MTU! %d bytes\n",frame->size);
 		return 0;
 	}
-	if (ringbuf_isfull(frag->frame_queue)) {
-		LOG(WARN,"[MAC FRAG] cannot enqueue frame. queue full\n");
+	if (frag->hc && frag_payload_compression)
+		mac_hc_compress_payload(frag->hc, frame);
+	uint tclass = frame->tclass<MAC_NUM_TCLASS ? frame->tclass : TCLASS_BEST_EFFORT;
+	if (ringbuf_isfull(frag->frame_queue[tclass]) ||
+		(frag->aqm && queued_bytes(frag,tclass)+frame->size > MAC_FRAG_BYTE_LIMIT)) {
+		LOG(DEBUG,"[MAC FRAG] cannot enqueue frame. queue of class %d full\n",tclass);
+		frag->stats[tclass].drops++;
 		return 0;
 	} else {
-		ringbuf_put(frag->frame_queue,frame);
-		frag->bytes_buffered += frame->size;
+		frame->tclass = tclass;
+		frame->enqueue_us = frag_time_us();
+		atomic_fetch_add(&frag->bytes_in[tclass], frame->size);
+		ringbuf_put(frag->frame_queue[tclass],frame);
 		return 1;
 	}
 }
 
 int mac_frag_has_fragment(MacFrag frag)
 {
-	if (ringbuf_isempty(frag->frame_queue) && (frag->curr_frame==NULL)) {
-		return 0;
-	} else {
+	if (frag_arq_active(frag)) {
+		uint num_retx = 0;
+		pthread_mutex_lock(&frag->arq_lock);
+		arq_retx_pending(frag, &num_retx);
+		int window_full = arq_window_full(frag);
+		pthread_mutex_unlock(&frag->arq_lock);
+		if (num_retx>0)
+			return 1;
+		// no new fragments until the oldest one is acknowledged
+		if (window_full)
+			return 0;
+	}
+	if (frag->curr_frame != NULL)
 		return 1;
+	for (int c=0; c<MAC_NUM_TCLASS; c++) {
+		uint num_frames = ringbuf_len(frag->frame_queue[c]);
+		for (uint i=0; i<num_frames; i++) {
+			MacDataFrame frame = ringbuf_peek(frag->frame_queue[c], i);
+			if (frame && !frame->thinned)
+				return 1;
+		}
 	}
+	return 0;
 }
 
-int mac_frag_queue_full(MacFrag frag)
+int mac_frag_get_buffersize(MacFrag frag)
 {
-	return ringbuf_isfull(frag->frame_queue);
+	pthread_mutex_lock(&frag->arq_lock);
+	uint bytes = arq_retx_pending(frag, NULL);
+	pthread_mutex_unlock(&frag->arq_lock);
+	for (int c=0; c<MAC_NUM_TCLASS; c++)
+		bytes += queued_bytes(frag, c);
+	if (frag->curr_frame)
+		bytes += frag->curr_frame->size - frag->bytes_sent;
+	return bytes;
 }
 
-int mac_frag_get_buffersize(MacFrag frag)
+// number of fragments of max_frag_size that are needed for len bytes.
+// Same split as in mac_frag_get_fragment()
+static uint frag_count(uint len, uint max_frag_size)
 {
-	if (frag->curr_frame) {
-		return (frag->curr_frame->size - frag->bytes_sent) + frag->bytes_buffered;
-	} else {
-		return frag->bytes_buffered;
+	uint data_per_frag = max_frag_size - mac_msg_get_hdrlen(ul_data);
+	return (len + data_per_frag - 1) / data_per_frag;
+}
+
+int mac_frag_get_num_fragments(MacFrag frag, uint max_frag_size)
+{
+	if (max_frag_size <= mac_msg_get_hdrlen(ul_data))
+		return 0;
+	uint num = 0;
+	pthread_mutex_lock(&frag->arq_lock);
+	arq_retx_pending(frag, &num);
+	pthread_mutex_unlock(&frag->arq_lock);
+	if (frag->curr_frame)
+		num += frag_count(frag->curr_frame->size - frag->bytes_sent, max_frag_size);
+	for (int c=0; c<MAC_NUM_TCLASS; c++) {
+		uint num_frames = ringbuf_len(frag->frame_queue[c]);
+		for (uint i=0; i<num_frames; i++) {
+			MacDataFrame frame = ringbuf_peek(frag->frame_queue[c], i);
+			if (frame && !frame->thinned)
+				num += frag_count(frame->size, max_frag_size);
+		}
 	}
+	return num;
 }
 
-MacMessage mac_frag_get_fragment(MacFrag frag, uint max_frag_size, uint is_uplink)
+// Select the class to serve next according to the traffic class priorities.
+// Strict priority classes (weight 0) are served first, the other classes
+// are served weighted round robin with their weight in frames per round.
+// returns -1 if all queues are empty
+static int frag_next_class(MacFrag frag)
+{
+	for (int c=0; c<MAC_NUM_TCLASS; c++) {
+		if (tclass_weight[c]==0 && !ringbuf_isempty(frag->frame_queue[c]))
+			return c;
+	}
+	for (int round=0; round<2; round++) {
+		for (int i=0; i<MAC_NUM_TCLASS; i++) {
+			uint c = frag->wrr_next;
+			if (tclass_weight[c]>0 && frag->credit[c]>0 && !ringbuf_isempty(frag->frame_queue[c])) {
+				frag->credit[c]--;
+				return c;
+			}
+			frag->wrr_next = (c+1) % MAC_NUM_TCLASS;
+		}
+		// no backlogged class has credit left. Start a new round
+		for (int c=0; c<MAC_NUM_TCLASS; c++)
+			frag->credit[c] = tclass_weight[c];
+	}
+	return -1;
+}
+
+// CoDel target and interval. On slow links the target has to be larger than
+// the time needed to send one MTU, otherwise CoDel drops although there is no
+// standing queue. The MTU time is measured, since it depends on MCS and the
+// share of slots the user gets
+static uint codel_target(MacFrag frag)
+{
+	uint target = frag->mtu_time_us*3/2;
+	return target>MAC_CODEL_TARGET_US ? target : MAC_CODEL_TARGET_US;
+}
+
+static uint codel_interval(MacFrag frag)
+{
+	uint interval = 4*codel_target(frag);
+	return interval>MAC_CODEL_INTERVAL_US ? interval : MAC_CODEL_INTERVAL_US;
+}
+
+static uint64_t codel_control_law(MacFrag frag, uint64_t t, uint count)
+{
+	return t + codel_interval(frag)/sqrt(count);
+}
+
+static void frag_record_sojourn(MacFrag frag, MacDataFrame frame, uint sojourn)
+{
+	frag_tclass_stat_s* st = &frag->stats[frame->tclass];
+	st->frames++;
+	st->delay_sum_us += sojourn;
+	if (sojourn > st->delay_max_us)
+		st->delay_max_us = sojourn;
+	uint ms = sojourn/1000;
+	uint bin = 0;
+	while (ms>0 && bin<MAC_FRAG_HIST_BINS-1) {
+		ms >>= 1;
+		bin++;
+	}
+	st->hist[bin]++;
+}
+
+// Take the head frame of a class queue. Sets ok_to_drop if the sojourn
+// time was above target for at least one interval
+static MacDataFrame codel_dodequeue(MacFrag frag, uint c, uint64_t now, int* ok_to_drop)
+{
+	codel_s* cd = &frag->codel[c];
+	*ok_to_drop = 0;
+	MacDataFrame frame = ringbuf_get(frag->frame_queue[c]);
+	// ACKs that were replaced by a newer one
+	while (frame && frame->thinned) {
+		dataframe_destroy(frame);
+		frame = ringbuf_get(frag->frame_queue[c]);
+	}
+	if (frame == NULL) {
+		cd->first_above_time = 0;
+		return NULL;
+	}
+	atomic_fetch_add(&frag->bytes_out[c], frame->size);
+	uint sojourn = now - frame->enqueue_us;
+	frag_record_sojourn(frag, frame, sojourn);
+	if (!frag->aqm)
+		return frame;
+
+	if (sojourn < codel_target(frag) || queued_bytes(frag,c) <= MAC_MTU) {
+		cd->first_above_time = 0;
+	} else if (cd->first_above_time == 0) {
+		cd->first_above_time = now + codel_interval(frag);
+	} else if (now >= cd->first_above_time) {
+		*ok_to_drop = 1;
+	}
+	return frame;
+}
+
+static void codel_drop(MacFrag frag, MacDataFrame frame)
+{
+	frag->stats[frame->tclass].aqm_drops++;
+	dataframe_destroy(frame);
+}
+
+// Dequeue a frame of the given class and apply the CoDel drop decision
+static MacDataFrame codel_dequeue(MacFrag frag, uint c)
+{
+	codel_s* cd = &frag->codel[c];
+	uint64_t now = frag_time_us();
+	int ok_to_drop;
+	MacDataFrame frame = codel_dodequeue(frag, c, now, &ok_to_drop);
+
+	if (cd->dropping) {
+		if (!ok_to_drop) {
+			cd->dropping = 0;
+		}
+		while (frame && cd->dropping && now >= cd->drop_next) {
+			codel_drop(frag, frame);
+			cd->count++;
+			frame = codel_dodequeue(frag, c, now, &ok_to_drop);
+			if (!ok_to_drop)
+				cd->dropping = 0;
+			else
+				cd->drop_next = codel_control_law(frag, cd->drop_next, cd->count);
+		}
+	} else if (frame && ok_to_drop) {
+		codel_drop(frag, frame);
+		frame = codel_dodequeue(frag, c, now, &ok_to_drop);
+		cd->dropping = 1;
+		// start with the drop rate of the last dropping state
+		// if it ended recently. drop_next may be in the future
+		uint delta = cd->count - cd->lastcount;
+		if (delta>1 && now < cd->drop_next + 16*codel_interval(frag))
+			cd->count = delta;
+		else
+			cd->count = 1;
+		cd->drop_next = codel_control_law(frag, now, cd->count);
+		cd->lastcount = cd->count;
+	}
+	return frame;
+}
+
+// Take the next frame. Classes whose frames were all dropped by
+// CoDel are skipped
+static MacDataFrame frag_dequeue(MacFrag frag)
+{
+	MacDataFrame frame = NULL;
+	while (frame == NULL) {
+		int c = frag_next_class(frag);
+		if (c<0)
+			return NULL;
+		frame = codel_dequeue(frag, c);
+	}
+	return frame;
+}
+
+// TCP ACK thinning: if the frame is a pure TCP ACK and newer cumulative ACKs
+// of the same flow are queued, the newest of them is sent instead. The older
+// ACKs are dropped. Duplicate ACKs and ACKs with SACK blocks are kept, since
+// the sender needs them for loss recovery. Frames in the queue are only modified
+// by the consumer, the ACK that is sent instead leaves a thinned placeholder
+static MacDataFrame frag_thin_acks(MacFrag frag, MacDataFrame frame, uint max_frag_size)
+{
+	tcp_ack_s head, ack;
+	if (!frag_ack_thinning || !mac_parse_pure_ack(frame->data, frame->size, &head))
+		return frame;
+
+	ringbuf q = frag->frame_queue[frame->tclass];
+	uint num_frames = ringbuf_len(q);
+	int newest = -1;
+	uint32_t ack_seq = head.ack_seq;
+	for (uint i=0; i<num_frames; i++) {
+		MacDataFrame f = ringbuf_peek(q, i);
+		if (f==NULL || f->thinned || !mac_frame_in_flow(f->data, f->size, f->pc, &head))
+			continue;
+		// stop at anything that is not a strictly newer pure ACK of this flow
+		if (!mac_parse_pure_ack(f->data, f->size, &ack) || (int32_t)(ack.ack_seq-ack_seq) <= 0)
+			break;
+		ack_seq = ack.ack_seq;
+		if (newest >= 0) {
+			// an intermediate ACK is replaced as well
+			MacDataFrame prev = ringbuf_peek(q, newest);
+			prev->thinned = 1;
+			atomic_fetch_add(&frag->bytes_out[prev->tclass], prev->size);
+			frag->acks_thinned++;
+			frag->acks_thinned_frags += frag_count(prev->size, max_frag_size);
+		}
+		newest = i;
+	}
+	frag->acks_sent++;
+	if (newest < 0)
+		return frame;
+
+	// the newest ACK is sent now, the head frame takes its place in the queue
+	MacDataFrame newest_frame = ringbuf_peek(q, newest);
+	atomic_fetch_add(&frag->bytes_out[newest_frame->tclass], newest_frame->size);
+	frame->thinned = 1;
+	ringbuf_set(q, newest, frame);
+	frag->acks_thinned++;
+	frag->acks_thinned_frags += frag_count(frame->size, max_frag_size);
+	return newest_frame;
+}
+
+// Update the estimated time to send one MTU from the time it took
+// to send the fragments of the last frame
+static void frag_update_mtu_time(MacFrag frag, MacDataFrame frame)
+{
+	if (frame->size < MAC_MTU/4)
+		return;
+	uint64_t duration = frag_time_us() - frag->curr_frame_start;
+	uint mtu_time = duration*MAC_MTU/frame->size;
+	if (frag->mtu_time_us == 0)
+		frag->mtu_time_us = mtu_time;
+	else
+		frag->mtu_time_us = (7*(uint64_t)frag->mtu_time_us + mtu_time)/8;
+}
+
+static MacMessage frag_get_fragment(MacFrag frag, uint max_frag_size, uint is_uplink)
 {
-	uint bytes_remain = 0, final_flag,data_len;
+	uint bytes_remain = 0, final_flag, first_flag, data_len;
 	MacMessage fragment = NULL;
 
+	if (frag_arq_active(frag)) {
+		// retransmissions go first
+		arq_tx_s* tx = arq_next_retx(frag, max_frag_size);
+		if (tx) {
+			tx->retx = 0;
+			tx->num_tx++;
+			tx->tx_time = frag->now;
+			frag->arq_stats.retx++;
+			return mac_msg_copy(tx->msg);
+		}
+		if (arq_window_full(frag))
+			return NULL;
+	}
+
 	if (frag->curr_frame) {
 		// there is a open frame that is being fragmented
 		bytes_remain  = frag->curr_frame->size - frag->bytes_sent;
 	} else {
 		// fetch new frame from queue
-		MacDataFrame sdu = ringbuf_get(frag->frame_queue);
+		MacDataFrame sdu = frag_dequeue(frag);
 		if (sdu == NULL) {
 			LOG(ERR,"[MAC FRAG] cannot fetch any SDU from buf\n");
 			return NULL;
 		}
-		frag->bytes_buffered -= sdu->size;
+		sdu = frag_thin_acks(frag, sdu, max_frag_size);
+		frag->curr_hc = 0;
+		if (frag->hc && (frag_header_compression || sdu->pc))
+			frag->curr_hc = mac_hc_compress(frag->hc, sdu, frag_header_compression);
 		frag->curr_frame = sdu;
-		frag->fragNr = 0;
-		frag->seqNr = (frag->seqNr + 1) % MAX_SEQNR;
+		frag->curr_frame_start = frag_time_us();
 		frag->bytes_sent = 0;
 		bytes_remain = sdu->size;
 	}
@@ -135,17 +745,31 @@ MacMessage mac_frag_get_fragment(MacFrag frag, uint max_frag_size, uint is_uplin
 	}
 
 	// create MAC Message
+	first_flag = (frag->bytes_sent == 0);
 	if (is_uplink) {
-		fragment = mac_msg_create_ul_data(data_len,final_flag,frag->seqNr,
-										  frag->fragNr++,frag->curr_frame->data+frag->bytes_sent);
+		fragment = mac_msg_create_ul_data(data_len,final_flag,first_flag,frag->seqNr,
+										  frag->curr_hc,frag->curr_frame->data+frag->bytes_sent);
 	} else {
-		fragment = mac_msg_create_dl_data(data_len,final_flag,frag->seqNr,
-										  frag->fragNr++,frag->curr_frame->data+frag->bytes_sent);
+		fragment = mac_msg_create_dl_data(data_len,final_flag,first_flag,frag->seqNr,
+										  frag->curr_hc,frag->curr_frame->data+frag->bytes_sent);
+	}
+
+	// keep a copy until the receiver acknowledges it
+	if (frag_arq_active(frag)) {
+		arq_tx_s* tx = &frag->arq_tx[frag->seqNr%MAC_ARQ_WINDOW];
+		tx->msg = mac_msg_copy(fragment);
+		tx->state = ARQ_OUTSTANDING;
+		tx->num_tx = 1;
+		tx->retx = 0;
+		tx->tx_time = frag->now;
+		frag->arq_stats.fragments++;
 	}
+	frag->seqNr = SN_ADD(frag->seqNr,1);
 
 	// update fragmenter state
 	frag->bytes_sent += data_len;
 	if (final_flag) {
+		frag_update_mtu_time(frag, frag->curr_frame);
 		dataframe_destroy(frag->curr_frame);
 		frag->curr_frame = NULL;
 	}
@@ -153,73 +777,128 @@ MacMessage mac_frag_get_fragment(MacFrag frag, uint max_frag_size, uint is_uplin
 	return fragment;
 }
 
+MacMessage mac_frag_get_fragment(MacFrag frag, uint max_frag_size, uint is_uplink)
+{
+	pthread_mutex_lock(&frag->arq_lock);
+	MacMessage fragment = frag_get_fragment(frag, max_frag_size, is_uplink);
+	pthread_mutex_unlock(&frag->arq_lock);
+	return fragment;
+}
+
+static const char* tclass_name[MAC_NUM_TCLASS] = {"netctrl", "interactive", "best effort", "bulk"};
+
+const frag_tclass_stat_s* mac_frag_get_stats(MacFrag frag, uint tclass)
+{
+	return tclass<MAC_NUM_TCLASS ? &frag->stats[tclass] : NULL;
+}
+
+// Print the per traffic class queue statistics and sojourn time histograms
+int mac_frag_stats_print(char* buf, int buflen, MacFrag frag)
+{
+	int len = 0;
+	if (buflen>0)
+		buf[0] = '\0';
+	for (int c=0; c<MAC_NUM_TCLASS && len<buflen; c++) {
+		frag_tclass_stat_s* st = &frag->stats[c];
+		if (st->frames==0 && st->drops==0)
+			continue;
+		len += snprintf(buf+len,buflen-len,"%-11s frames: %6d drops full/aqm: %4d/%4d sojourn avg/max: %.1f/%.1fms\n",
+						tclass_name[c], st->frames, st->drops, st->aqm_drops,
+						st->frames ? st->delay_sum_us/1000.0/st->frames : 0, st->delay_max_us/1000.0);
+		// bins: <1ms, <2ms, <4ms, ... >=2^(MAC_FRAG_HIST_BINS-2)ms
+		if (len<buflen)
+			len += snprintf(buf+len,buflen-len,"            sojourn hist (<1,<2,<4..ms):");
+		for (int i=0; i<MAC_FRAG_HIST_BINS && len<buflen; i++)
+			len += snprintf(buf+len,buflen-len," %d",st->hist[i]);
+		if (len<buflen)
+			len += snprintf(buf+len,buflen-len,"\n");
+	}
+	uint acks = frag->acks_sent + frag->acks_thinned;
+	if (acks>0 && len<buflen)
+		len += snprintf(buf+len,buflen-len,"TCP ACK thinning: %d of %d ACKs removed (%.1f%%), %d slots saved\n",
+						frag->acks_thinned, acks, 100.0*frag->acks_thinned/acks, frag->acks_thinned_frags);
+	frag_arq_stat_s* arq = &frag->arq_stats;
+	if (arq->fragments>0 && len<buflen)
+		len += snprintf(buf+len,buflen-len,"ARQ fragments: %d retransmitted: %d (%.1f%%) failed: %d\n",
+						arq->fragments, arq->retx, 100.0*arq->retx/arq->fragments, arq->failed);
+	return len;
+}
+
 MacAssmbl mac_assmbl_init()
 {
 	MacAssmbl assmbl = calloc(sizeof(struct MacReassembler_s),1);
+	// a window of fragments can complete this many frames at once
+	assmbl->frames = ringbuf_create(MAC_ARQ_WINDOW+1);
+	pthread_mutex_init(&assmbl->lock, NULL);
 	return assmbl;
 }
 
-void mac_assmbl_destroy(MacAssmbl assmbl)
+// Drop the frame that is being reassembled
+static void assmbl_discard_frame(MacAssmbl assmbl)
 {
 	for (int i=0; i<assmbl->fragNr; i++)
 		free(assmbl->fragments[i]);
-	free(assmbl);
+	assmbl->fragNr = 0;
+	assmbl->frame_open = 0;
+	assmbl->frame_len = 0;
 }
 
-MacDataFrame mac_assmbl_reassemble(MacAssmbl assmbl, MacMessage fragment)
+void mac_assmbl_reset(MacAssmbl assmbl)
 {
-	MacDLdata* data = &fragment->hdr.DLdata;
-	MacDataFrame frame;
-
-	if (!assmbl->frame_open) {
-		// no frame open yet, store the received sequence number
-		if (data->fragNr == 0) {
-			assmbl->seqNr = data->seqNr;
-			assmbl->fragNr = 0;
-			assmbl->frame_open = 1;
-		} else {
-			LOG(DEBUG,"[MAC ASSMBL] unexpected fragNr for new frame. "
-									"Got %d Expect 0\n",data->fragNr);
-			return NULL;
-		}
+	pthread_mutex_lock(&assmbl->lock);
+	assmbl_discard_frame(assmbl);
+	for (int i=0; i<MAC_ARQ_WINDOW; i++) {
+		free(assmbl->rx_buf[i].data);
+		assmbl->rx_buf[i].data = NULL;
 	}
+	while (!ringbuf_isempty(assmbl->frames))
+		dataframe_destroy(ringbuf_get(assmbl->frames));
+	assmbl->synced = 0;
+	assmbl->rx_next = 0;
+	assmbl->rx_highest = 0;
+	assmbl->status_due = 0;
+	pthread_mutex_unlock(&assmbl->lock);
+}
 
-	// ensure that the sequence number and fragment number matches
-	// TODO implement unordered fragment reception
-	if ((assmbl->seqNr == data->seqNr) && (assmbl->fragNr == data->fragNr)) {
-		assmbl->fragments[assmbl->fragNr] = malloc(fragment->payload_len);
-		memcpy(assmbl->fragments[assmbl->fragNr],fragment->data,fragment->payload_len);
-		assmbl->fragments_len[assmbl->fragNr] = fragment->payload_len;
-		assmbl->frame_len += fragment->payload_len;
-		assmbl->fragNr++;
-	} else {
-		// reset reassembler state
-		LOG(DEBUG,"[MAC ASSMBL] seq/frag Nr does not match: Got seqNr %d fragNr %d, "
-				  "expect %d:%d\n",data->seqNr,data->fragNr,assmbl->seqNr,assmbl->fragNr);
-		for (int i=0; i<assmbl->fragNr; i++) {
-			free(assmbl->fragments[i]);
-		}
-		// if fragnr of the frame is 0, we can use it
-		// as a new start
-		if (data->fragNr==0) {
-			assmbl->fragments[0] = malloc(fragment->payload_len);
-			memcpy(assmbl->fragments[0],fragment->data,fragment->payload_len);
-			assmbl->fragments_len[0] = fragment->payload_len;
-			assmbl->fragNr = 1;
-			assmbl->seqNr = data->seqNr;
-			assmbl->frame_open = 1;
-			assmbl->frame_len=fragment->payload_len;
-		} else {
-			// reset reassembler state
-			assmbl->frame_open = 0;
-			assmbl->frame_len = 0;
-			assmbl->fragNr = 0;
-			return NULL;
+void mac_assmbl_destroy(MacAssmbl assmbl)
+{
+	mac_assmbl_reset(assmbl);
+	ringbuf_destroy(assmbl->frames);
+	pthread_mutex_destroy(&assmbl->lock);
+	free(assmbl);
+}
+
+void mac_assmbl_set_arq(MacAssmbl assmbl, uint enable)
+{
+	assmbl->reorder = enable;
+}
+
+// Add the next fragment in sequence order to the frame. Takes the ownership of data
+static void assmbl_add_fragment(MacAssmbl assmbl, uint8_t* data, uint len, uint first, uint final, uint hc)
+{
+	if (first) {
+		if (assmbl->frame_open) {
+			LOG(DEBUG,"[MAC ASSMBL] frame without final fragment. Dropping\n");
+			assmbl_discard_frame(assmbl);
 		}
+		assmbl->frame_open = 1;
+		assmbl->hc = hc;
 	}
+	if (!assmbl->frame_open || assmbl->fragNr>=MAX_FRAGNR) {
+		// the start of the frame was lost
+		LOG(DEBUG,"[MAC ASSMBL] fragment of an incomplete frame. Dropping\n");
+		assmbl_discard_frame(assmbl);
+		free(data);
+		return;
+	}
+	assmbl->fragments[assmbl->fragNr] = data;
+	assmbl->fragments_len[assmbl->fragNr] = len;
+	assmbl->frame_len += len;
+	assmbl->fragNr++;
 
-	if (data->final_flag) {
-		frame = dataframe_create(assmbl->frame_len);
+	if (final) {
+		MacDataFrame frame = dataframe_create(assmbl->frame_len);
+		frame->hc = assmbl->hc;
 		uint8_t* p = frame->data;
 		for (int i=0; i<assmbl->fragNr; i++) {
 			memcpy(p, assmbl->fragments[i],assmbl->fragments_len[i]);
@@ -229,9 +908,182 @@ MacDataFrame mac_assmbl_reassemble(MacAssmbl assmbl, MacMessage fragment)
 		assmbl->fragNr = 0;
 		assmbl->frame_open = 0;
 		assmbl->frame_len = 0;
-		return frame;
-	} else {
-		// no complete frame received yet
-		return NULL;
+		if (!ringbuf_put(assmbl->frames, frame))
+			dataframe_destroy(frame);
+	}
+}
+
+// Reassemble the buffered fragments that follow rx_next without gap
+static void assmbl_deliver(MacAssmbl assmbl)
+{
+	arq_rx_s* rx = &assmbl->rx_buf[assmbl->rx_next%MAC_ARQ_WINDOW];
+	while (rx->data) {
+		assmbl_add_fragment(assmbl, rx->data, rx->len, rx->first, rx->final, rx->hc);
+		rx->data = NULL;
+		assmbl->rx_next = SN_ADD(assmbl->rx_next,1);
+		rx = &assmbl->rx_buf[assmbl->rx_next%MAC_ARQ_WINDOW];
+	}
+	if (SN_DIFF(assmbl->rx_highest, assmbl->rx_next) >= MAC_ARQ_WINDOW)
+		assmbl->rx_highest = assmbl->rx_next;
+	// the next missing fragment starts to wait
+	assmbl->gap_since = assmbl->now;
+}
+
+// Give up the missing fragments up to the next received one
+static void assmbl_skip(MacAssmbl assmbl)
+{
+	while (assmbl->rx_next != assmbl->rx_highest &&
+			assmbl->rx_buf[assmbl->rx_next%MAC_ARQ_WINDOW].data == NULL) {
+		assmbl->rx_next = SN_ADD(assmbl->rx_next,1);
+		assmbl->stats.skipped++;
+	}
+	assmbl_discard_frame(assmbl);
+	assmbl_deliver(assmbl);
+	// the sender releases the skipped fragments with the next report
+	assmbl->status_due = 1;
+}
+
+static int assmbl_has_gap(MacAssmbl assmbl)
+{
+	return assmbl->rx_next != assmbl->rx_highest;
+}
+
+void mac_assmbl_arq_update(MacAssmbl assmbl, long long unsigned int now)
+{
+	pthread_mutex_lock(&assmbl->lock);
+	assmbl->now = now;
+	// with ARQ the sender retransmits the fragment several times
+	uint timeout = mac_frag_arq_is_enabled() ? MAC_ARQ_DISCARD_TIMEOUT : MAC_ARQ_REORDER_TIMEOUT;
+	if (assmbl->reorder && assmbl_has_gap(assmbl) && now - assmbl->gap_since >= timeout)
+		assmbl_skip(assmbl);
+	pthread_mutex_unlock(&assmbl->lock);
+}
+
+static MacDataFrame assmbl_reassemble(MacAssmbl assmbl, MacMessage fragment)
+{
+	MacDLdata* data = &fragment->hdr.DLdata;
+	uint sn = data->seqNr;
+	uint8_t* payload = malloc(fragment->payload_len);
+	memcpy(payload, fragment->data, fragment->payload_len);
+
+	if (!assmbl->reorder) {
+		// fragments arrive in order, a gap is a lost fragment
+		if (assmbl->synced && sn != assmbl->rx_next) {
+			LOG(DEBUG,"[MAC ASSMBL] seqNr does not match: Got %d expect %d\n",sn,assmbl->rx_next);
+			assmbl->stats.skipped += SN_DIFF(sn, assmbl->rx_next);
+			assmbl_discard_frame(assmbl);
+		}
+		assmbl->synced = 1;
+		assmbl->rx_next = SN_ADD(sn,1);
+		assmbl_add_fragment(assmbl, payload, fragment->payload_len, data->first_flag, data->final_flag, data->hc);
+		return ringbuf_get(assmbl->frames);
+	}
+
+	uint dist = SN_DIFF(sn, assmbl->rx_next);
+	if (dist >= MAC_ARQ_WINDOW) {
+		if (mac_frag_arq_is_enabled()) {
+			// retransmission of a fragment that was received already. The status report got lost
+			assmbl->stats.duplicates++;
+			assmbl->status_due = 1;
+			free(payload);
+			return ringbuf_get(assmbl->frames);
+		}
+		// without ARQ the sender does not wait for us. Move the window
+		while (SN_DIFF(sn, assmbl->rx_next) >= MAC_ARQ_WINDOW) {
+			arq_rx_s* rx = &assmbl->rx_buf[assmbl->rx_next%MAC_ARQ_WINDOW];
+			if (rx->data) {
+				assmbl_add_fragment(assmbl, rx->data, rx->len, rx->first, rx->final, rx->hc);
+				rx->data = NULL;
+			} else {
+				assmbl_discard_frame(assmbl);
+				assmbl->stats.skipped++;
+			}
+			assmbl->rx_next = SN_ADD(assmbl->rx_next,1);
+		}
+		if (SN_DIFF(assmbl->rx_highest, assmbl->rx_next) >= MAC_ARQ_WINDOW)
+			assmbl->rx_highest = assmbl->rx_next;
+		dist = SN_DIFF(sn, assmbl->rx_next);
+	}
+
+	arq_rx_s* rx = &assmbl->rx_buf[sn%MAC_ARQ_WINDOW];
+	assmbl->status_due = 1;
+	if (rx->data) {
+		assmbl->stats.duplicates++;
+		free(payload);
+		return ringbuf_get(assmbl->frames);
+	}
+	rx->data = payload;
+	rx->len = fragment->payload_len;
+	rx->first = data->first_flag;
+	rx->final = data->final_flag;
+	rx->hc = data->hc;
+	if (dist >= SN_DIFF(assmbl->rx_highest, assmbl->rx_next))
+		assmbl->rx_highest = SN_ADD(sn,1);
+
+	if (sn == assmbl->rx_next)
+		assmbl_deliver(assmbl);
+	else
+		assmbl->stats.reordered++;
+	return ringbuf_get(assmbl->frames);
+}
+
+MacDataFrame mac_assmbl_reassemble(MacAssmbl assmbl, MacMessage fragment)
+{
+	pthread_mutex_lock(&assmbl->lock);
+	MacDataFrame frame = assmbl_reassemble(assmbl, fragment);
+	pthread_mutex_unlock(&assmbl->lock);
+	return frame;
+}
+
+MacDataFrame mac_assmbl_get_frame(MacAssmbl assmbl)
+{
+	pthread_mutex_lock(&assmbl->lock);
+	MacDataFrame frame = ringbuf_get(assmbl->frames);
+	pthread_mutex_unlock(&assmbl->lock);
+	return frame;
+}
+
+static int assmbl_status_due(MacAssmbl assmbl)
+{
+	if (!assmbl->reorder || !mac_frag_arq_is_enabled())
+		return 0;
+	if (assmbl->now - assmbl->last_status < MAC_ARQ_STATUS_INTERVAL)
+		return 0;
+	// new fragments, or a missing fragment that should have arrived by now
+	return assmbl->status_due ||
+		   (assmbl_has_gap(assmbl) && assmbl->now - assmbl->gap_since >= MAC_ARQ_REORDER_TIMEOUT);
+}
+
+int mac_assmbl_status_due(MacAssmbl assmbl)
+{
+	pthread_mutex_lock(&assmbl->lock);
+	int due = assmbl_status_due(assmbl);
+	pthread_mutex_unlock(&assmbl->lock);
+	return due;
+}
+
+MacMessage mac_assmbl_get_status(MacAssmbl assmbl, uint is_uplink)
+{
+	uint bitmap = 0;
+	pthread_mutex_lock(&assmbl->lock);
+	for (int i=0; i<MAC_ARQ_BITMAP_LEN; i++) {
+		if (assmbl->rx_buf[SN_ADD(assmbl->rx_next,i+1)%MAC_ARQ_WINDOW].data)
+			bitmap |= 1<<i;
 	}
+	assmbl->status_due = 0;
+	assmbl->last_status = assmbl->now;
+	assmbl->stats.status_sent++;
+	uint ack_sn = assmbl->rx_next;
+	pthread_mutex_unlock(&assmbl->lock);
+	if (is_uplink)
+		return mac_msg_create_ul_arq_status(ack_sn, bitmap);
+	else
+		return mac_msg_create_dl_arq_status(ack_sn, bitmap);
+}
+
+int mac_assmbl_stats_print(char* buf, int buflen, MacAssmbl assmbl)
+{
+	assmbl_stat_s* st = &assmbl->stats;
+	return snprintf(buf, buflen, "reassembly: fragments out of order: %d duplicates: %d skipped: %d status reports: %d\n",
+					st->reordered, st->duplicates, st->skipped, st->status_sent);
 }
@@ -22,6 +22,8 @@
 #include <stddef.h>
 #include "mac_messages.h"
 #include "mac_common.h"
+#include "mac_config.h"
+#include "mac_hc.h"
 
 
 //// Fragmenter / Reassembler struct declarations ////
@@ -31,6 +33,31 @@ struct MacReassembler_s;
 typedef struct MacFragmenter_s* MacFrag;
 typedef struct MacReassembler_s* MacAssmbl;
 
+// Queue statistics of a traffic class
+typedef struct {
+	uint frames;			// frames taken from the queue
+	uint drops;				// frames dropped because the queue was full
+	uint aqm_drops;			// frames dropped by CoDel
+	uint64_t delay_sum_us;	// sojourn time in the queue
+	uint delay_max_us;
+	uint hist[MAC_FRAG_HIST_BINS];	// sojourn time histogram. Bin 0: <1ms, bin i: <2^i ms
+} frag_tclass_stat_s;
+
+// ARQ statistics of a fragmenter
+typedef struct {
+	uint fragments;			// fragments sent for the first time
+	uint retx;				// retransmitted fragments
+	uint failed;			// fragments given up after MAC_ARQ_MAX_TX transmissions
+} frag_arq_stat_s;
+
+// Statistics of a reassembler
+typedef struct {
+	uint reordered;			// fragments received after a gap
+	uint duplicates;		// fragments that were received already
+	uint skipped;			// missing fragments that were given up
+	uint status_sent;		// ARQ status reports
+} assmbl_stat_s;
+
 
 //// MAC Fragmenter methods ////
 
@@ -38,23 +65,75 @@ typedef struct MacReassembler_s* MacAssmbl;
 MacFrag mac_frag_init();
 void mac_frag_destroy(MacFrag frag);
 
-// Add a frame to the MAC queue
+// Add a frame to the MAC queue of its traffic class
 int mac_frag_add_frame(MacFrag frag, MacDataFrame frame);
 
 // Check whether the fragmenter has some data in the queue
 int mac_frag_has_fragment(MacFrag frag);
 
-// Check whether the fragmenter queue is full
-int mac_frag_queue_full(MacFrag frag);
-
 // Get the number of bytes that are currently buffered,
 // i.e. bytes that could be sent
 int mac_frag_get_buffersize(MacFrag frag);
 
+// Get the number of fragments required to send all buffered data
+// if every fragment has the given maximum size
+int mac_frag_get_num_fragments(MacFrag frag, uint max_frag_size);
+
 // Fetch a fragment from the frame queue with a specified maximum
 // fragment size
 MacMessage mac_frag_get_fragment(MacFrag frag, uint max_frag_size, uint is_uplink);
 
+// Enable/disable active queue management (byte limit and CoDel). Enabled by default
+void mac_frag_set_aqm(MacFrag frag, uint enable);
+
+// Compress the frame headers with the given compressor. NULL disables compression
+void mac_frag_set_hc(MacFrag frag, MacHC hc);
+
+// Enable/disable TCP ACK thinning for all fragmenters
+void mac_frag_set_ack_thinning(uint enable);
+
+// Enable/disable payload compression for all fragmenters with a compressor
+void mac_frag_set_payload_compression(uint enable);
+
+// Selective repeat ARQ. Every fragment has a sequence number. With ARQ, unicast fragmenters
+// keep sent fragments until the receiver acknowledges them with a status report and retransmit
+// missing ones. The reassembler of a unicast connection reorders the fragments, which arrive
+// out of order due to HARQ retransmissions. Missing fragments are skipped after
+// MAC_ARQ_REORDER_TIMEOUT subframes without ARQ, after MAC_ARQ_DISCARD_TIMEOUT with ARQ.
+// Timers are driven by the subframe counter of the MAC.
+// Status reports are handled in the receive thread while the scheduler sends fragments, so the
+// ARQ window of a fragmenter and the whole reassembler are guarded by a mutex. Frames of a
+// reassembler are fetched in one thread only, which delivers them to the TAP device
+
+// Enable/disable ARQ for all fragmenters and reassemblers of unicast connections
+void mac_frag_set_arq_enabled(uint enable);
+uint mac_frag_arq_is_enabled();
+
+// Keep sent fragments for retransmissions. Set for unicast fragmenters
+void mac_frag_set_arq(MacFrag frag, uint enable);
+
+// Forget all sent fragments and restart the sequence numbers, e.g. after a new association
+void mac_frag_arq_reset(MacFrag frag);
+
+// Run the retransmission timer. Call once per subframe with the subframe counter
+void mac_frag_arq_update(MacFrag frag, long long unsigned int now);
+
+// Handle an ARQ status report of the receiver
+void mac_frag_arq_status(MacFrag frag, uint ack_sn, uint bitmap);
+
+// Load the fragmenter settings from the "mac" section of the config file
+void mac_frag_config_load(char* config_file);
+
+// Replace the clock [us] used for queue timestamps, e.g. by a simulated clock.
+// NULL restores CLOCK_MONOTONIC. Applies to all fragmenters
+void mac_frag_set_clock(uint64_t (*clock)(void));
+
+// Get the queue statistics of a traffic class
+const frag_tclass_stat_s* mac_frag_get_stats(MacFrag frag, uint tclass);
+
+// Print sojourn time, histogram and drops per traffic class and the ARQ statistics
+int mac_frag_stats_print(char* buf, int buflen, MacFrag frag);
+
 
 //// MAC Reassembler methods ////
 
@@ -62,8 +141,31 @@ MacMessage mac_frag_get_fragment(MacFrag frag, uint max_frag_size, uint is_uplin
 MacAssmbl mac_assmbl_init();
 void mac_assmbl_destroy(MacAssmbl assmbl);
 
+// Reorder the fragments and send status reports. Set for unicast reassemblers.
+// Otherwise fragments are expected in order and missing ones are skipped at once
+void mac_assmbl_set_arq(MacAssmbl assmbl, uint enable);
+
+// Drop all fragments and restart the sequence numbers, e.g. after a new association
+void mac_assmbl_reset(MacAssmbl assmbl);
+
+// Run the reordering timer. Call once per subframe with the subframe counter.
+// Frames completed by skipping missing fragments are fetched with mac_assmbl_get_frame()
+void mac_assmbl_arq_update(MacAssmbl assmbl, long long unsigned int now);
+
 // add a new fragment to the reassembler buffer
-// returns a MAC frame if reception of a open frame was completed
+// returns a MAC frame if reception of a open frame was completed. A fragment that
+// closes a gap can complete more frames, fetch them with mac_assmbl_get_frame()
 MacDataFrame mac_assmbl_reassemble(MacAssmbl assmbl, MacMessage fragment);
 
+// returns the next completed frame or NULL
+MacDataFrame mac_assmbl_get_frame(MacAssmbl assmbl);
+
+// returns 1 if a status report should be sent
+int mac_assmbl_status_due(MacAssmbl assmbl);
+
+// Create the status report with the received fragments. is_uplink selects the message type
+MacMessage mac_assmbl_get_status(MacAssmbl assmbl, uint is_uplink);
+
+int mac_assmbl_stats_print(char* buf, int buflen, MacAssmbl assmbl);
+
 #endif /* MAC_MAC_FRAGMENTATION_H_ */
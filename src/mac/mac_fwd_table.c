@@ -0,0 +1,289 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#include "mac_fwd_table.h"
+#include "mac_config.h"
+#include "../util/log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define FWD_SLOT_EMPTY 0xFFFF
+#define FWD_ENTRY_NONE 0xFFFF
+
+// One learned address. Entries live in a pool and are referenced by index
+// from the hash slots and from the per-user lists, so that moving a hash slot
+// does not invalidate the user list.
+struct fwd_entry {
+    uint64_t key;                   // 48bit Ethernet address
+    uint8_t userid;
+    uint16_t next;                  // next entry of the same user, or next free entry
+    unsigned long long last_seen;   // subframe in which the address was seen the last time
+};
+
+struct MacFwdTable_s {
+    // open addressing hash table with linear probing. Stores pool indices
+    uint16_t slots[MAC_FWD_TABLE_SIZE];
+    struct fwd_entry pool[MAC_FWD_MAX_ENTRIES];
+    uint16_t user_head[MAX_USER];   // first entry of each user
+    uint16_t free_head;             // first unused entry in pool
+    uint num_entries;
+
+    atomic_uint seq;                // sequence counter. Odd while the table is modified
+    pthread_mutex_t write_lock;     // serializes writers
+};
+
+static uint64_t fwd_key(const uint8_t* addr)
+{
+    return ((uint64_t)addr[0]<<40) | ((uint64_t)addr[1]<<32) | ((uint64_t)addr[2]<<24) |
+           ((uint64_t)addr[3]<<16) | ((uint64_t)addr[4]<<8) | (uint64_t)addr[5];
+}
+
+static uint fwd_hash(uint64_t key)
+{
+    // 64bit multiplicative hash, take the upper bits
+    return (uint)((key * 0x9E3779B97F4A7C15ull) >> 40) & (MAC_FWD_TABLE_SIZE-1);
+}
+
+// Mark the start/end of a modification that is visible to readers.
+// Caller has to hold the write lock
+static void fwd_seq_begin(MacFwdTbl tbl)
+{
+    atomic_fetch_add_explicit(&tbl->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void fwd_seq_end(MacFwdTbl tbl)
+{
+    atomic_fetch_add_explicit(&tbl->seq, 1, memory_order_release);
+}
+
+MacFwdTbl mac_fwd_init()
+{
+    MacFwdTbl tbl = calloc(sizeof(struct MacFwdTable_s),1);
+    for (int i=0; i<MAC_FWD_TABLE_SIZE; i++)
+        tbl->slots[i] = FWD_SLOT_EMPTY;
+    for (int i=0; i<MAX_USER; i++)
+        tbl->user_head[i] = FWD_ENTRY_NONE;
+    for (int i=0; i<MAC_FWD_MAX_ENTRIES; i++)
+        tbl->pool[i].next = (i+1<MAC_FWD_MAX_ENTRIES) ? i+1 : FWD_ENTRY_NONE;
+    tbl->free_head = 0;
+    atomic_init(&tbl->seq, 0);
+    pthread_mutex_init(&tbl->write_lock, NULL);
+    return tbl;
+}
+
+void mac_fwd_destroy(MacFwdTbl tbl)
+{
+    pthread_mutex_destroy(&tbl->write_lock);
+    free(tbl);
+}
+
+// find the hash slot of key. Returns -1 if not found
+// Caller has to hold the write lock
+static int fwd_find_slot(MacFwdTbl tbl, uint64_t key)
+{
+    uint pos = fwd_hash(key);
+    for (int i=0; i<MAC_FWD_TABLE_SIZE; i++) {
+        uint16_t idx = tbl->slots[pos];
+        if (idx == FWD_SLOT_EMPTY)
+            return -1;
+        if (tbl->pool[idx].key == key)
+            return pos;
+        pos = (pos+1) & (MAC_FWD_TABLE_SIZE-1);
+    }
+    return -1;
+}
+
+int mac_fwd_lookup(MacFwdTbl tbl, const uint8_t* etheraddr)
+{
+    uint64_t key = fwd_key(etheraddr);
+    uint seq;
+    int userid;
+    do {
+        seq = atomic_load_explicit(&tbl->seq, memory_order_acquire);
+        userid = -1;
+        if (seq & 1)
+            continue;   // writer active, retry
+        // probe table. Values read here may be inconsistent, thus only use
+        // range checked indices. The result is validated by the seqlock below
+        uint pos = fwd_hash(key);
+        for (int i=0; i<MAC_FWD_TABLE_SIZE; i++) {
+            uint16_t idx = tbl->slots[pos];
+            if (idx >= MAC_FWD_MAX_ENTRIES)
+                break;
+            if (tbl->pool[idx].key == key) {
+                userid = tbl->pool[idx].userid;
+                break;
+            }
+            pos = (pos+1) & (MAC_FWD_TABLE_SIZE-1);
+        }
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&tbl->seq, memory_order_relaxed));
+    return userid;
+}
+
+// remove entry from the list of its user. Caller holds the write lock
+static void fwd_unlink_user(MacFwdTbl tbl, uint16_t idx)
+{
+    uint16_t* p = &tbl->user_head[tbl->pool[idx].userid];
+    while (*p != FWD_ENTRY_NONE) {
+        if (*p == idx) {
+            *p = tbl->pool[idx].next;
+            return;
+        }
+        p = &tbl->pool[*p].next;
+    }
+}
+
+// remove the entry stored in hash slot pos and return it to the pool.
+// The entry has to be unlinked from its user list already.
+// Uses backward shift deletion, so that no tombstones are required.
+// Caller holds the write lock and is inside fwd_seq_begin/end
+static void fwd_delete_slot(MacFwdTbl tbl, uint pos)
+{
+    uint16_t idx = tbl->slots[pos];
+    tbl->pool[idx].next = tbl->free_head;
+    tbl->free_head = idx;
+    tbl->num_entries--;
+
+    uint hole = pos;
+    uint next = (pos+1) & (MAC_FWD_TABLE_SIZE-1);
+    while (tbl->slots[next] != FWD_SLOT_EMPTY) {
+        uint home = fwd_hash(tbl->pool[tbl->slots[next]].key);
+        // move entry into the hole if its home position is not within (hole, next]
+        if (((next - home) & (MAC_FWD_TABLE_SIZE-1)) >= ((next - hole) & (MAC_FWD_TABLE_SIZE-1))) {
+            tbl->slots[hole] = tbl->slots[next];
+            hole = next;
+        }
+        next = (next+1) & (MAC_FWD_TABLE_SIZE-1);
+    }
+    tbl->slots[hole] = FWD_SLOT_EMPTY;
+}
+
+void mac_fwd_learn(MacFwdTbl tbl, const uint8_t* etheraddr, uint userid, unsigned long long now)
+{
+    uint64_t key = fwd_key(etheraddr);
+    if (userid >= MAX_USER || (etheraddr[0] & 0x01))
+        return;     // do not learn group addresses
+
+    pthread_mutex_lock(&tbl->write_lock);
+    int pos = fwd_find_slot(tbl, key);
+    if (pos >= 0) {
+        // known address. Refresh and check if it moved to another user
+        uint16_t idx = tbl->slots[pos];
+        tbl->pool[idx].last_seen = now;
+        if (tbl->pool[idx].userid != userid) {
+            fwd_seq_begin(tbl);
+            fwd_unlink_user(tbl, idx);
+            tbl->pool[idx].userid = userid;
+            tbl->pool[idx].next = tbl->user_head[userid];
+            tbl->user_head[userid] = idx;
+            fwd_seq_end(tbl);
+            LOG(INFO, "[MAC BS] EtherAddr %012llx moved to userid %d\n", (unsigned long long)key, userid);
+        }
+        pthread_mutex_unlock(&tbl->write_lock);
+        return;
+    }
+    if (tbl->free_head == FWD_ENTRY_NONE) {
+        pthread_mutex_unlock(&tbl->write_lock);
+        LOG(WARN, "[MAC BS] forwarding table full. Cannot add EtherAddr %012llx\n", (unsigned long long)key);
+        return;
+    }
+
+    fwd_seq_begin(tbl);
+    uint16_t idx = tbl->free_head;
+    tbl->free_head = tbl->pool[idx].next;
+    tbl->pool[idx].key = key;
+    tbl->pool[idx].userid = userid;
+    tbl->pool[idx].last_seen = now;
+    tbl->pool[idx].next = tbl->user_head[userid];
+    tbl->user_head[userid] = idx;
+    pos = fwd_hash(key);
+    while (tbl->slots[pos] != FWD_SLOT_EMPTY)
+        pos = (pos+1) & (MAC_FWD_TABLE_SIZE-1);
+    tbl->slots[pos] = idx;
+    tbl->num_entries++;
+    fwd_seq_end(tbl);
+    pthread_mutex_unlock(&tbl->write_lock);
+
+    LOG(INFO, "[MAC BS] Add EtherAddr: %02x:%02x:%02x:%02x:%02x:%02x -> userid %d\n",
+        etheraddr[0],etheraddr[1],etheraddr[2],etheraddr[3],etheraddr[4],etheraddr[5], userid);
+}
+
+// Walks only the entries of the user, not the whole table
+void mac_fwd_remove_user(MacFwdTbl tbl, uint userid)
+{
+    if (userid >= MAX_USER)
+        return;
+    pthread_mutex_lock(&tbl->write_lock);
+    fwd_seq_begin(tbl);
+    uint16_t idx = tbl->user_head[userid];
+    tbl->user_head[userid] = FWD_ENTRY_NONE;
+    while (idx != FWD_ENTRY_NONE) {
+        uint16_t next = tbl->pool[idx].next;
+        int pos = fwd_find_slot(tbl, tbl->pool[idx].key);
+        if (pos >= 0)
+            fwd_delete_slot(tbl, pos);
+        idx = next;
+    }
+    fwd_seq_end(tbl);
+    pthread_mutex_unlock(&tbl->write_lock);
+}
+
+// Scans without the seqlock, since only writers modify the entries. Lookups are only
+// blocked if entries expired, and the removals are logged after the table is released
+void mac_fwd_age(MacFwdTbl tbl, unsigned long long now, unsigned long long max_age)
+{
+    uint16_t expired[MAC_FWD_MAX_ENTRIES];
+    uint64_t keys[MAC_FWD_MAX_ENTRIES];
+    uint8_t userids[MAC_FWD_MAX_ENTRIES];
+    uint num_expired = 0;
+
+    pthread_mutex_lock(&tbl->write_lock);
+    for (int userid=0; userid<MAX_USER; userid++) {
+        for (uint16_t idx = tbl->user_head[userid]; idx != FWD_ENTRY_NONE; idx = tbl->pool[idx].next) {
+            if (now - tbl->pool[idx].last_seen > max_age) {
+                keys[num_expired] = tbl->pool[idx].key;
+                userids[num_expired] = userid;
+                expired[num_expired++] = idx;
+            }
+        }
+    }
+    if (num_expired > 0) {
+        fwd_seq_begin(tbl);
+        for (uint i=0; i<num_expired; i++) {
+            fwd_unlink_user(tbl, expired[i]);
+            int pos = fwd_find_slot(tbl, keys[i]);
+            if (pos >= 0)
+                fwd_delete_slot(tbl, pos);
+        }
+        fwd_seq_end(tbl);
+    }
+    pthread_mutex_unlock(&tbl->write_lock);
+
+    for (uint i=0; i<num_expired; i++)
+        LOG(INFO, "[MAC BS] EtherAddr %012llx of userid %d aged out\n",
+            (unsigned long long)keys[i], userids[i]);
+}
+
+uint mac_fwd_num_entries(MacFwdTbl tbl)
+{
+    return tbl->num_entries;
+}
@@ -0,0 +1,51 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#ifndef MAC_MAC_FWD_TABLE_H_
+#define MAC_MAC_FWD_TABLE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Forwarding table that maps Ethernet addresses to MAC userids.
+// Lookups are lock-free (seqlock) and can be done concurrently to
+// learning/removal, which are serialized by a mutex.
+struct MacFwdTable_s;
+typedef struct MacFwdTable_s* MacFwdTbl;
+
+MacFwdTbl mac_fwd_init();
+void mac_fwd_destroy(MacFwdTbl tbl);
+
+// Find the userid the Ethernet address etheraddr belongs to.
+// returns the userid or -1 if the address is unknown
+int mac_fwd_lookup(MacFwdTbl tbl, const uint8_t* etheraddr);
+
+// Learn that etheraddr is reachable via userid. now is the current
+// subframe counter and is used for aging
+void mac_fwd_learn(MacFwdTbl tbl, const uint8_t* etheraddr, uint userid, unsigned long long now);
+
+// Remove all entries that belong to userid
+void mac_fwd_remove_user(MacFwdTbl tbl, uint userid);
+
+// Remove all entries that have not been seen for max_age subframes
+void mac_fwd_age(MacFwdTbl tbl, unsigned long long now, unsigned long long max_age);
+
+// Number of entries currently stored
+uint mac_fwd_num_entries(MacFwdTbl tbl);
+
+#endif /* MAC_MAC_FWD_TABLE_H_ */
@@ -0,0 +1,150 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#include "mac_harq.h"
+#include "mac_config.h"
+#include "../util/log.h"
+
+#include <stdio.h>
+#include <libconfig.h>
+
+static int harq_enabled = MAC_HARQ;
+
+void mac_harq_tx_reset(harq_tx_s* h)
+{
+	for (int i=0; i<HARQ_PROCESSES; i++) {
+		if (h->proc[i].chan)
+			lchan_destroy(h->proc[i].chan);
+	}
+	memset(h, 0, sizeof(harq_tx_s));
+}
+
+void mac_harq_tx_new(harq_tx_s* h, harq_stats_s* st, uint sfn, uint slot, LogicalChannel chan,
+					 uint mcs, long long unsigned int now)
+{
+	harq_tx_proc_s* p = &h->proc[HARQ_PROC(sfn, slot)];
+	if (p->chan)
+		mac_harq_tx_drop(p, st);
+	p->chan = chan;
+	p->mcs = mcs;
+	p->num_tx = 1;
+	p->sfn = sfn;
+	p->nack = 0;
+	p->tx_time = now;
+	if (st)
+		st->blocks++;
+}
+
+void mac_harq_tx_feedback(harq_tx_s* h, harq_stats_s* st, uint sfn, uint ack, uint nack)
+{
+	for (int slot=0; slot<NUM_SLOT; slot++) {
+		harq_tx_proc_s* p = &h->proc[HARQ_PROC(sfn, slot)];
+		// the process might carry a newer block already
+		if (p->chan==NULL || p->sfn!=sfn || p->nack)
+			continue;
+		if (ack & (1<<slot)) {
+			st->ok[p->num_tx-1]++;
+			lchan_destroy(p->chan);
+			p->chan = NULL;
+		} else if (nack & (1<<slot)) {
+			p->nack = 1;
+			if (p->num_tx >= HARQ_MAX_TX)
+				mac_harq_tx_drop(p, st);
+		}
+	}
+}
+
+harq_tx_proc_s* mac_harq_tx_due(harq_tx_s* h, harq_stats_s* st, uint sfn, uint slot,
+								long long unsigned int now)
+{
+	harq_tx_proc_s* p = &h->proc[HARQ_PROC(sfn, slot)];
+	if (p->chan==NULL || p->tx_time+HARQ_RTT > now)
+		return NULL;
+	if (p->nack && p->tx_time+HARQ_RTT == now)
+		return p;
+	// no NACK in time or the scheduler skipped the slot
+	mac_harq_tx_drop(p, st);
+	return NULL;
+}
+
+void mac_harq_tx_retransmit(harq_tx_proc_s* p, harq_stats_s* st, uint sfn, long long unsigned int now)
+{
+	p->num_tx++;
+	p->sfn = sfn;
+	p->nack = 0;
+	p->tx_time = now;
+	if (st)
+		st->retx++;
+}
+
+void mac_harq_tx_drop(harq_tx_proc_s* p, harq_stats_s* st)
+{
+	if (st) {
+		if (p->nack)
+			st->failed++;
+		else
+			st->no_feedback++;
+	}
+	lchan_destroy(p->chan);
+	p->chan = NULL;
+	p->nack = 0;
+}
+
+int mac_harq_tx_waiting(harq_tx_s* h, uint sfn)
+{
+	for (int slot=0; slot<NUM_SLOT; slot++) {
+		harq_tx_proc_s* p = &h->proc[HARQ_PROC(sfn, slot)];
+		if (p->chan && p->sfn==sfn && !p->nack)
+			return 1;
+	}
+	return 0;
+}
+
+int mac_harq_stats_print(char* buf, int buflen, harq_stats_s* st)
+{
+	int len = snprintf(buf, buflen, "HARQ blocks: %d retx: %d ok after 1..%d tx:", st->blocks, st->retx, HARQ_MAX_TX);
+	for (int i=0; i<HARQ_MAX_TX && len<buflen; i++)
+		len += snprintf(buf+len, buflen-len, " %d", st->ok[i]);
+	if (len<buflen)
+		len += snprintf(buf+len, buflen-len, " failed: %d no feedback: %d residual BLER: %.2f%%\n",
+						st->failed, st->no_feedback, st->blocks ? 100.0*st->failed/st->blocks : 0);
+	return len;
+}
+
+void mac_harq_set_enabled(uint enable)
+{
+	harq_enabled = enable;
+}
+
+uint mac_harq_is_enabled()
+{
+	return harq_enabled;
+}
+
+void mac_harq_config_load(char* config_file)
+{
+	config_t cfg;
+	config_init(&cfg);
+	if (config_file && config_read_file(&cfg, config_file)) {
+		config_setting_t* mac = config_lookup(&cfg, "mac");
+		if (mac)
+			config_setting_lookup_int(mac, "harq", &harq_enabled);
+	}
+	config_destroy(&cfg);
+	LOG(INFO,"[MAC HARQ] retransmissions %s\n",harq_enabled ? "enabled" : "disabled");
+}
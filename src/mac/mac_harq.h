@@ -0,0 +1,102 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#ifndef MAC_MAC_HARQ_H_
+#define MAC_MAC_HARQ_H_
+
+#include "mac_channels.h"
+#include "../phy/phy_config.h"
+
+// Hybrid ARQ (HARQ) for unicast data slots.
+// A block with CRC error is retransmitted unchanged and the receiver combines the soft bits of
+// all receptions before decoding (Chase combining, see phy_harq_decode()). HARQ is synchronous:
+// a retransmission is sent in the same slot HARQ_RTT subframes after the previous transmission.
+// The process of a slot follows from its position, so no process number is signaled.
+// Retransmissions are scheduled before SPS and the dynamic scheduler. If the slot cannot be
+// assigned to the user, e.g. due to half-duplex constraints, the block is given up.
+// DL: the UE reports the CRC results of its DL slots with the harq_ack message. The BS
+// retransmits a block if a NACK arrives before the retransmission is scheduled. Users without
+// UL slot to send the feedback in time get one, if a slot is free.
+// UL: the BS keeps failed UL slots and assigns the same slot again with the retransmission flag
+// in the DL ctrl slot. The UE keeps its last block per process and resends it.
+
+// Transmitter state of a HARQ process
+typedef struct {
+	LogicalChannel chan;	// the block, NULL if the process is idle
+	uint8_t mcs;
+	uint8_t num_tx;			// transmissions of the block so far
+	uint8_t sfn;			// subframe number of the last transmission
+	uint8_t nack;			// receiver reported a CRC error
+	long long unsigned int tx_time;	// subframe counter of the last transmission
+} harq_tx_proc_s;
+
+typedef struct {
+	harq_tx_proc_s proc[HARQ_PROCESSES];
+} harq_tx_s;
+
+// HARQ statistics of one link direction
+typedef struct {
+	uint blocks;			// blocks sent for the first time
+	uint retx;				// retransmissions
+	uint ok[HARQ_MAX_TX];	// blocks received after n+1 transmissions
+	uint failed;			// blocks given up after a CRC error
+	uint no_feedback;		// DL blocks given up without ACK/NACK
+} harq_stats_s;
+
+// CRC results of the unicast DL slots of one subframe at the UE. Bit i is slot i
+typedef struct {
+	uint8_t ack;
+	uint8_t nack;
+	uint8_t reported;		// results that were sent to the BS
+	long long unsigned int time;	// subframe counter when the slots were assigned
+} harq_feedback_s;
+
+// Release all stored blocks
+void mac_harq_tx_reset(harq_tx_s* h);
+
+// Store a block that was sent for the first time in a slot of subframe sfn. Takes the
+// ownership of chan. A block that is still stored in the process is given up. st may be NULL
+void mac_harq_tx_new(harq_tx_s* h, harq_stats_s* st, uint sfn, uint slot, LogicalChannel chan,
+					 uint mcs, long long unsigned int now);
+
+// Handle the feedback for the blocks sent in subframe sfn. ack and nack are slot bitmasks
+void mac_harq_tx_feedback(harq_tx_s* h, harq_stats_s* st, uint sfn, uint ack, uint nack);
+
+// Get the block to retransmit in a slot of subframe sfn, which is scheduled at subframe counter now.
+// The block has to be retransmitted with mac_harq_tx_retransmit() or given up with mac_harq_tx_drop().
+// Blocks without NACK are given up when their slot recurs
+// returns NULL if no retransmission is due
+harq_tx_proc_s* mac_harq_tx_due(harq_tx_s* h, harq_stats_s* st, uint sfn, uint slot,
+								long long unsigned int now);
+
+void mac_harq_tx_retransmit(harq_tx_proc_s* p, harq_stats_s* st, uint sfn, long long unsigned int now);
+void mac_harq_tx_drop(harq_tx_proc_s* p, harq_stats_s* st);
+
+// returns 1 if a block sent in subframe sfn waits for feedback
+int mac_harq_tx_waiting(harq_tx_s* h, uint sfn);
+
+int mac_harq_stats_print(char* buf, int buflen, harq_stats_s* st);
+
+// Enable or disable retransmissions at the BS globally
+void mac_harq_set_enabled(uint enable);
+uint mac_harq_is_enabled();
+
+// Read the harq setting of the "mac" section of the config file
+void mac_harq_config_load(char* config_file);
+
+#endif /* MAC_MAC_HARQ_H_ */
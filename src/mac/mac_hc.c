@@ -0,0 +1,527 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#include "mac_hc.h"
+#include "mac_config.h"
+#include "../util/log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <zlib.h>
+
+#define ETH_HDR_LEN 14
+#define IPV4_HDR_LEN 20
+#define UDP_HDR_LEN 8
+#define IPPROTO_TCP_ 6
+#define IPPROTO_UDP_ 17
+#define IPV6_HDR_LEN 40
+
+// static header fields: MAC dst/src, TOS, TTL, proto, IP src/dst, ports
+#define HC_STATIC_LEN 27
+
+// first byte of a compressed header
+#define HC_FLAG_TCP 0x08
+#define HC_FLAG_DF 0x04
+#define HC_FLAG_PC 0x02		// payload is deflated
+#define HC_FLAG_RAW 0x01	// no compressed header, the full frame follows
+
+// deflate window. Frames are compressed independently, so a small window is sufficient
+#define PC_WINDOW_BITS 11
+#define PC_MEM_LEVEL 4
+
+typedef struct {
+	uint valid;
+	uint8_t fields[HC_STATIC_LEN];
+	uint full_sent;			// compressor: uncompressed frames sent for this context
+	uint since_refresh;		// compressor: compressed frames since the last uncompressed one
+} hc_context_s;
+
+typedef struct {
+	uint backoff;			// frames to skip after the next failed attempt
+	uint skip;				// remaining frames sent uncompressed
+} pc_flow_s;
+
+struct MacHC_s {
+	hc_context_s comp[MAC_HC_CONTEXTS];		// used by the sending side
+	hc_context_s decomp[MAC_HC_CONTEXTS];	// used by the receiving side
+	hc_stats_s stats;
+
+	// payload compression. Deflate runs in the thread that enqueues frames,
+	// inflate in the receiving thread
+	z_stream deflate;
+	z_stream inflate;
+	pc_flow_s pc_flows[MAC_PC_FLOWS];
+	uint8_t deflate_buf[MAC_MTU];
+	uint8_t inflate_buf[MAC_MTU];
+};
+
+MacHC mac_hc_init()
+{
+	MacHC hc = calloc(1,sizeof(struct MacHC_s));
+	if (deflateInit2(&hc->deflate, MAC_PC_LEVEL, Z_DEFLATED, -PC_WINDOW_BITS, PC_MEM_LEVEL,
+					 Z_DEFAULT_STRATEGY) != Z_OK ||
+		inflateInit2(&hc->inflate, -PC_WINDOW_BITS) != Z_OK) {
+		LOG(ERR,"[MAC HC] cannot init zlib\n");
+	}
+	return hc;
+}
+
+void mac_hc_destroy(MacHC hc)
+{
+	deflateEnd(&hc->deflate);
+	inflateEnd(&hc->inflate);
+	free(hc);
+}
+
+void mac_hc_reset(MacHC hc)
+{
+	memset(hc->comp, 0, sizeof(hc->comp));
+	memset(hc->decomp, 0, sizeof(hc->decomp));
+}
+
+static uint64_t hc_time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// CRC-8 (polynomial 0x07) over the static fields of a context
+static uint8_t hc_crc8(const uint8_t* data, uint len)
+{
+	uint8_t crc = 0;
+	for (int i=0; i<len; i++) {
+		crc ^= data[i];
+		for (int b=0; b<8; b++)
+			crc = (crc & 0x80) ? (crc<<1) ^ 0x07 : (crc<<1);
+	}
+	return crc;
+}
+
+// context index: FNV-1a hash of the static fields
+static uint hc_context_idx(const uint8_t* fields)
+{
+	uint32_t h = 2166136261u;
+	for (int i=0; i<HC_STATIC_LEN; i++) {
+		h ^= fields[i];
+		h *= 16777619u;
+	}
+	return (h ^ (h>>16)) % MAC_HC_CONTEXTS;
+}
+
+// Check whether the frame can be compressed and extract the static fields.
+// The length fields are not checked for frames with compressed payload
+// returns the length of Ethernet, IP and UDP/TCP header, 0 if not compressible
+static uint hc_parse(const uint8_t* data, uint len, uint pc, uint8_t* fields)
+{
+	if (len < ETH_HDR_LEN+IPV4_HDR_LEN+UDP_HDR_LEN)
+		return 0;
+	const uint8_t* ip = data+ETH_HDR_LEN;
+	uint ip_len = (ip[2]<<8) | ip[3];
+	// plain IPv4 header without options, not fragmented, no Ethernet padding
+	if (data[12]!=0x08 || data[13]!=0x00 || ip[0]!=0x45 || (!pc && ip_len!=len-ETH_HDR_LEN) ||
+		(ip[6] & 0xbf)!=0 || ip[7]!=0)
+		return 0;
+
+	uint hdr_len = ETH_HDR_LEN+IPV4_HDR_LEN;
+	const uint8_t* l4 = ip+IPV4_HDR_LEN;
+	if (ip[9]==IPPROTO_UDP_) {
+		uint udp_len = (l4[4]<<8) | l4[5];
+		if (udp_len != ip_len-IPV4_HDR_LEN || hdr_len+UDP_HDR_LEN>len)
+			return 0;
+		hdr_len += UDP_HDR_LEN;
+	} else if (ip[9]==IPPROTO_TCP_) {
+		uint tcp_hdr_len = (l4[12]>>4)*4;
+		if (tcp_hdr_len<20 || hdr_len+tcp_hdr_len>len)
+			return 0;
+		hdr_len += tcp_hdr_len;
+	} else {
+		return 0;
+	}
+
+	memcpy(fields, data, 12);		// MAC addresses
+	fields[12] = ip[1];				// TOS
+	fields[13] = ip[8];				// TTL
+	fields[14] = ip[9];				// protocol
+	memcpy(fields+15, ip+12, 8);	// IP addresses
+	memcpy(fields+23, l4, 4);		// ports
+	return hdr_len;
+}
+
+// Offset of the payload behind the Ethernet, IP and UDP/TCP headers. Only
+// header bytes are evaluated, so both ends get the same offset for a frame
+// with compressed payload
+static uint pc_payload_offset(const uint8_t* data, uint len)
+{
+	uint off = ETH_HDR_LEN;
+	if (len < off)
+		return len;
+	const uint8_t* ip = data+ETH_HDR_LEN;
+	uint proto;
+	if (data[12]==0x08 && data[13]==0x00 && len>=off+IPV4_HDR_LEN) {
+		off += (ip[0] & 0x0f)*4;
+		proto = ip[9];
+	} else if (data[12]==0x86 && data[13]==0xdd && len>=off+IPV6_HDR_LEN) {
+		off += IPV6_HDR_LEN;
+		proto = ip[6];
+	} else {
+		return off;
+	}
+	if (proto==IPPROTO_TCP_ && len>=off+20)
+		off += (data[off+12]>>4)*4;
+	else if (proto==IPPROTO_UDP_)
+		off += UDP_HDR_LEN;
+	return off<len ? off : len;
+}
+
+// Flow of a frame for the payload compression backoff: MAC addresses,
+// ethertype and for IP frames protocol, addresses and ports
+static uint pc_flow_idx(const uint8_t* data, uint off)
+{
+	uint32_t h = 2166136261u;
+	uint8_t key[14+1+32+4];
+	uint key_len = 14;
+	memcpy(key, data, 14);
+	const uint8_t* ip = data+ETH_HDR_LEN;
+	if (data[12]==0x08 && data[13]==0x00 && off>=ETH_HDR_LEN+IPV4_HDR_LEN) {
+		key[key_len++] = ip[9];
+		memcpy(key+key_len, ip+12, 8);
+		key_len += 8;
+		if (off>=ETH_HDR_LEN+(ip[0] & 0x0f)*4+4) {
+			memcpy(key+key_len, ip+(ip[0] & 0x0f)*4, 4);
+			key_len += 4;
+		}
+	} else if (data[12]==0x86 && data[13]==0xdd && off>=ETH_HDR_LEN+IPV6_HDR_LEN) {
+		key[key_len++] = ip[6];
+		memcpy(key+key_len, ip+8, 32);
+		key_len += 32;
+		if (off>=ETH_HDR_LEN+IPV6_HDR_LEN+4) {
+			memcpy(key+key_len, ip+IPV6_HDR_LEN, 4);
+			key_len += 4;
+		}
+	}
+	for (int i=0; i<key_len; i++) {
+		h ^= key[i];
+		h *= 16777619u;
+	}
+	return (h ^ (h>>16)) % MAC_PC_FLOWS;
+}
+
+int mac_hc_compress_payload(MacHC hc, MacDataFrame frame)
+{
+	if (frame->size < MAC_PC_MIN_SIZE)
+		return 0;
+	uint off = pc_payload_offset(frame->data, frame->size);
+	uint payload_len = frame->size - off;
+	if (payload_len <= MAC_PC_MIN_GAIN)
+		return 0;
+	hc->stats.pc_frames++;
+	pc_flow_s* flow = &hc->pc_flows[pc_flow_idx(frame->data, off)];
+	if (flow->skip > 0) {
+		// flow sent incompressible data recently
+		flow->skip--;
+		hc->stats.pc_skipped++;
+		return 0;
+	}
+
+	// the output buffer only has room for a result that saves enough bytes
+	uint64_t start = hc_time_ns();
+	uint out_max = payload_len - MAC_PC_MIN_GAIN;
+	deflateReset(&hc->deflate);
+	hc->deflate.next_in = frame->data+off;
+	hc->deflate.avail_in = payload_len;
+	hc->deflate.next_out = hc->deflate_buf;
+	hc->deflate.avail_out = out_max;
+	int ret = deflate(&hc->deflate, Z_FINISH);
+	uint out_len = out_max - hc->deflate.avail_out;
+	hc->stats.pc_bytes_in += payload_len;
+	hc->stats.pc_time_ns += hc_time_ns() - start;
+
+	if (ret != Z_STREAM_END) {
+		// incompressible: send the next frames of this flow without trying
+		flow->backoff = flow->backoff ? flow->backoff*2 : 1;
+		if (flow->backoff > MAC_PC_MAX_BACKOFF)
+			flow->backoff = MAC_PC_MAX_BACKOFF;
+		flow->skip = flow->backoff;
+		return 0;
+	}
+	flow->backoff = 0;
+	memcpy(frame->data+off, hc->deflate_buf, out_len);
+	frame->size = off + out_len;
+	frame->pc = 1;
+	hc->stats.pc_compressed++;
+	hc->stats.pc_bytes_saved += payload_len - out_len;
+	return 1;
+}
+
+// Inflate a compressed payload into the inflate buffer
+// returns the payload length or -1 on error
+static int pc_inflate(MacHC hc, const uint8_t* in, uint in_len, uint out_max)
+{
+	uint64_t start = hc_time_ns();
+	inflateReset(&hc->inflate);
+	hc->inflate.next_in = (uint8_t*)in;
+	hc->inflate.avail_in = in_len;
+	hc->inflate.next_out = hc->inflate_buf;
+	hc->inflate.avail_out = out_max;
+	int ret = inflate(&hc->inflate, Z_FINISH);
+	hc->stats.rx_pc_time_ns += hc_time_ns() - start;
+	if (ret != Z_STREAM_END) {
+		LOG(DEBUG,"[MAC HC] cannot inflate payload: %d\n",ret);
+		return -1;
+	}
+	uint len = out_max - hc->inflate.avail_out;
+	hc->stats.rx_pc_frames++;
+	hc->stats.rx_pc_bytes += len;
+	return len;
+}
+
+// Frames without compressed header but with compressed payload are prefixed
+// with a single byte. The frame buffer has room for it since compression
+// saved at least MAC_PC_MIN_GAIN bytes
+static int hc_send_uncompressed(MacHC hc, MacDataFrame frame)
+{
+	if (frame->pc) {
+		memmove(frame->data+1, frame->data, frame->size);
+		frame->data[0] = HC_FLAG_RAW | HC_FLAG_PC;
+		frame->size++;
+	}
+	hc->stats.tx_bytes_out += frame->size;
+	return frame->pc;
+}
+
+// Compressed header:
+// byte 0: context idx (4bit), TCP flag, DF flag, payload compression flag, 0
+// byte 1: CRC-8 of the context
+// byte 2-3: IP identification
+// UDP: UDP checksum (2 bytes)
+// TCP: TCP header without the ports
+int mac_hc_compress(MacHC hc, MacDataFrame frame, uint compress_headers)
+{
+	uint8_t fields[HC_STATIC_LEN];
+	uint8_t chdr[64];
+	hc->stats.tx_frames++;
+	hc->stats.tx_bytes_in += frame->size;
+
+	uint hdr_len = compress_headers ? hc_parse(frame->data, frame->size, frame->pc, fields) : 0;
+	if (hdr_len == 0)
+		return hc_send_uncompressed(hc, frame);
+
+	uint idx = hc_context_idx(fields);
+	hc_context_s* ctx = &hc->comp[idx];
+	if (!ctx->valid || memcmp(ctx->fields, fields, HC_STATIC_LEN)!=0) {
+		// new flow or hash collision: (re-)establish the context
+		memcpy(ctx->fields, fields, HC_STATIC_LEN);
+		ctx->valid = 1;
+		ctx->full_sent = 0;
+	}
+	if (ctx->full_sent < MAC_HC_FULL_REPEAT || ctx->since_refresh >= MAC_HC_REFRESH) {
+		// the decompressor learns the context from uncompressed frames
+		ctx->full_sent++;
+		ctx->since_refresh = 0;
+		return hc_send_uncompressed(hc, frame);
+	}
+	ctx->since_refresh++;
+
+	const uint8_t* ip = frame->data+ETH_HDR_LEN;
+	const uint8_t* l4 = ip+IPV4_HDR_LEN;
+	uint clen = 0;
+	chdr[clen++] = (idx<<4) | (ip[9]==IPPROTO_TCP_ ? HC_FLAG_TCP : 0) | ((ip[6] & 0x40) ? HC_FLAG_DF : 0) |
+				   (frame->pc ? HC_FLAG_PC : 0);
+	chdr[clen++] = hc_crc8(fields, HC_STATIC_LEN);
+	chdr[clen++] = ip[4];
+	chdr[clen++] = ip[5];
+	if (ip[9]==IPPROTO_UDP_) {
+		chdr[clen++] = l4[6];
+		chdr[clen++] = l4[7];
+	} else {
+		uint tcp_hdr_len = (l4[12]>>4)*4;
+		memcpy(chdr+clen, l4+4, tcp_hdr_len-4);
+		clen += tcp_hdr_len-4;
+	}
+
+	uint payload_len = frame->size - hdr_len;
+	memmove(frame->data+clen, frame->data+hdr_len, payload_len);
+	memcpy(frame->data, chdr, clen);
+	frame->size = clen + payload_len;
+	hc->stats.tx_compressed++;
+	hc->stats.tx_bytes_out += frame->size;
+	return 1;
+}
+
+static uint16_t ipv4_checksum(const uint8_t* hdr)
+{
+	uint32_t sum = 0;
+	for (int i=0; i<IPV4_HDR_LEN; i+=2)
+		sum += (hdr[i]<<8) | hdr[i+1];
+	while (sum>>16)
+		sum = (sum & 0xffff) + (sum>>16);
+	return ~sum & 0xffff;
+}
+
+static void hc_learn_context(MacHC hc, MacDataFrame frame)
+{
+	uint8_t fields[HC_STATIC_LEN];
+	if (hc_parse(frame->data, frame->size, 0, fields) > 0) {
+		hc_context_s* ctx = &hc->decomp[hc_context_idx(fields)];
+		memcpy(ctx->fields, fields, HC_STATIC_LEN);
+		ctx->valid = 1;
+	}
+}
+
+// Restore a frame with full headers and compressed payload
+static MacDataFrame hc_decompress_raw(MacHC hc, MacDataFrame frame)
+{
+	const uint8_t* d = frame->data+1;
+	uint len = frame->size-1;
+	uint off = pc_payload_offset(d, len);
+	int payload_len = -1;
+	if ((frame->data[0] & HC_FLAG_PC) && off<len)
+		payload_len = pc_inflate(hc, d+off, len-off, MAC_MTU-off);
+	if (payload_len < 0) {
+		hc->stats.rx_failed++;
+		dataframe_destroy(frame);
+		return NULL;
+	}
+	MacDataFrame out = dataframe_create(off+payload_len);
+	memcpy(out->data, d, off);
+	memcpy(out->data+off, hc->inflate_buf, payload_len);
+	dataframe_destroy(frame);
+	hc_learn_context(hc, out);
+	return out;
+}
+
+MacDataFrame mac_hc_decompress(MacHC hc, MacDataFrame frame)
+{
+	if (!frame->hc) {
+		// learn the context from uncompressed frames
+		hc_learn_context(hc, frame);
+		return frame;
+	}
+	if (frame->size == 0) {
+		hc->stats.rx_failed++;
+		dataframe_destroy(frame);
+		return NULL;
+	}
+	if (frame->data[0] & HC_FLAG_RAW)
+		return hc_decompress_raw(hc, frame);
+
+	hc->stats.rx_compressed++;
+	const uint8_t* c = frame->data;
+	uint is_tcp = c[0] & HC_FLAG_TCP;
+	hc_context_s* ctx = &hc->decomp[c[0]>>4];
+	uint clen = is_tcp ? 4+16 : 4+2;
+	if (frame->size < clen || !ctx->valid || hc_crc8(ctx->fields, HC_STATIC_LEN)!=c[1] ||
+		(ctx->fields[14]==IPPROTO_TCP_) != (is_tcp!=0)) {
+		LOG(DEBUG,"[MAC HC] no matching context %d for compressed frame\n",c[0]>>4);
+		hc->stats.rx_failed++;
+		dataframe_destroy(frame);
+		return NULL;
+	}
+	uint l4_hdr_len = UDP_HDR_LEN;
+	if (is_tcp) {
+		// data offset is the 9th byte of the TCP header without ports
+		l4_hdr_len = (c[4+8]>>4)*4;
+		clen = 4 + l4_hdr_len-4;
+		if (l4_hdr_len<20 || frame->size<clen) {
+			hc->stats.rx_failed++;
+			dataframe_destroy(frame);
+			return NULL;
+		}
+	}
+	const uint8_t* payload = c+clen;
+	int payload_len = frame->size - clen;
+	if (c[0] & HC_FLAG_PC) {
+		payload_len = pc_inflate(hc, c+clen, payload_len, MAC_MTU-(ETH_HDR_LEN+IPV4_HDR_LEN+l4_hdr_len));
+		payload = hc->inflate_buf;
+		if (payload_len < 0) {
+			hc->stats.rx_failed++;
+			dataframe_destroy(frame);
+			return NULL;
+		}
+	}
+	uint l4_len = l4_hdr_len + payload_len;
+	MacDataFrame out = dataframe_create(ETH_HDR_LEN + IPV4_HDR_LEN + l4_len);
+	uint8_t* d = out->data;
+
+	// Ethernet header
+	memcpy(d, ctx->fields, 12);
+	d[12] = 0x08;
+	d[13] = 0x00;
+	// IPv4 header
+	uint8_t* ip = d+ETH_HDR_LEN;
+	uint ip_len = IPV4_HDR_LEN + l4_len;
+	ip[0] = 0x45;
+	ip[1] = ctx->fields[12];
+	ip[2] = ip_len>>8;
+	ip[3] = ip_len & 0xff;
+	ip[4] = c[2];
+	ip[5] = c[3];
+	ip[6] = (c[0] & HC_FLAG_DF) ? 0x40 : 0;
+	ip[7] = 0;
+	ip[8] = ctx->fields[13];
+	ip[9] = ctx->fields[14];
+	ip[10] = 0;
+	ip[11] = 0;
+	memcpy(ip+12, ctx->fields+15, 8);
+	uint16_t csum = ipv4_checksum(ip);
+	ip[10] = csum>>8;
+	ip[11] = csum & 0xff;
+	// UDP/TCP header
+	uint8_t* l4 = ip+IPV4_HDR_LEN;
+	memcpy(l4, ctx->fields+23, 4);
+	if (is_tcp) {
+		memcpy(l4+4, c+4, l4_hdr_len-4);
+	} else {
+		l4[4] = l4_len>>8;
+		l4[5] = l4_len & 0xff;
+		l4[6] = c[4];
+		l4[7] = c[5];
+	}
+	memcpy(l4+l4_hdr_len, payload, payload_len);
+
+	dataframe_destroy(frame);
+	return out;
+}
+
+const hc_stats_s* mac_hc_get_stats(MacHC hc)
+{
+	return &hc->stats;
+}
+
+int mac_hc_stats_print(char* buf, int buflen, MacHC hc)
+{
+	hc_stats_s* st = &hc->stats;
+	int len = snprintf(buf,buflen,"Header compression: TX %d/%d frames compressed, %.1f%% bytes saved. "
+						   "RX %d compressed, %d dropped\n",
+						   st->tx_compressed, st->tx_frames,
+						   st->tx_bytes_in ? 100.0*(st->tx_bytes_in-st->tx_bytes_out)/st->tx_bytes_in : 0,
+						   st->rx_compressed, st->rx_failed);
+	if ((st->pc_frames || st->rx_pc_frames) && len<buflen) {
+		len += snprintf(buf+len,buflen-len,"Payload compression: TX %d/%d frames compressed (%d skipped), "
+						"%llu bytes saved (%.1f%%), %.1f ns/byte. RX %d inflated, %.1f ns/byte\n",
+						st->pc_compressed, st->pc_frames, st->pc_skipped,
+						(unsigned long long)st->pc_bytes_saved,
+						st->pc_bytes_in ? 100.0*st->pc_bytes_saved/st->pc_bytes_in : 0,
+						st->pc_bytes_in ? (double)st->pc_time_ns/st->pc_bytes_in : 0,
+						st->rx_pc_frames, st->rx_pc_bytes ? (double)st->rx_pc_time_ns/st->rx_pc_bytes : 0);
+	}
+	return len;
+}
@@ -0,0 +1,86 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#ifndef MAC_MAC_HC_H_
+#define MAC_MAC_HC_H_
+
+#include "mac_common.h"
+
+// Context based header compression for Ethernet/IPv4/UDP and Ethernet/IPv4/TCP frames.
+// Static header fields (MAC and IP addresses, ports, TOS, TTL) are stored in a context
+// at both ends. Contexts are indexed by a hash of the static fields and are learned by the
+// decompressor from uncompressed frames. Dynamic fields are sent unchanged, lengths and the
+// IP checksum are reconstructed. Since no field is delta coded, a lost frame never
+// desynchronizes the context. Compressed frames carry a CRC over the context, frames with
+// a mismatching context are dropped. The compressor sends the first frames of a new context
+// and regularly one frame uncompressed to (re-)establish the context.
+//
+// Optionally the payload behind the UDP/TCP header (or behind the Ethernet header for other
+// protocols) is compressed with raw deflate when the frame is enqueued. Each frame is
+// compressed on its own, so losses do not affect other frames. The headers stay intact for
+// classification, ACK thinning and header compression. Flows that send incompressible data
+// are skipped for an exponentially growing number of frames.
+
+struct MacHC_s;
+typedef struct MacHC_s* MacHC;
+
+// Statistics of compressor and decompressor
+typedef struct {
+	uint tx_frames;			// frames given to the compressor
+	uint tx_compressed;		// frames sent with compressed header
+	uint64_t tx_bytes_in;	// frame bytes before and after compression
+	uint64_t tx_bytes_out;
+	uint rx_compressed;		// received frames with compressed header
+	uint rx_failed;			// compressed frames dropped due to unknown context or inflate error
+	uint pc_frames;			// frames considered for payload compression
+	uint pc_compressed;		// frames sent with compressed payload
+	uint pc_skipped;		// frames not tried due to the flow backoff
+	uint64_t pc_bytes_in;	// payload bytes given to deflate
+	uint64_t pc_bytes_saved;
+	uint64_t pc_time_ns;	// CPU time spent in deflate
+	uint rx_pc_frames;		// received frames with inflated payload
+	uint64_t rx_pc_bytes;	// inflated payload bytes
+	uint64_t rx_pc_time_ns;	// CPU time spent in inflate
+} hc_stats_s;
+
+MacHC mac_hc_init();
+void mac_hc_destroy(MacHC hc);
+
+// Forget all contexts, e.g. after a new association
+void mac_hc_reset(MacHC hc);
+
+// Compress the payload of the frame in place and set frame->pc. Frames that
+// are too small or do not get smaller by MAC_PC_MIN_GAIN bytes are unchanged
+// returns 1 if the payload was compressed
+int mac_hc_compress_payload(MacHC hc, MacDataFrame frame);
+
+// Compress the headers of the frame in place, if compress_headers is set.
+// Frames with compressed payload always get a compression header. Updates the frame size
+// returns 1 if the frame has to be sent with hc flag, 0 if it is sent unchanged
+int mac_hc_compress(MacHC hc, MacDataFrame frame, uint compress_headers);
+
+// Restore the headers and payload of a received frame. Frames without compressed
+// header are used to learn contexts and returned unchanged.
+// returns the decompressed frame or NULL if the context is unknown or the payload is corrupt.
+// The given frame is destroyed in this case
+MacDataFrame mac_hc_decompress(MacHC hc, MacDataFrame frame);
+
+const hc_stats_s* mac_hc_get_stats(MacHC hc);
+int mac_hc_stats_print(char* buf, int buflen, MacHC hc);
+
+#endif /* MAC_MAC_HC_H_ */
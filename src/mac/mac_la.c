@@ -0,0 +1,140 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#include "mac_la.h"
+#include "mac_config.h"
+#include "../phy/phy_common.h"
+#include "../util/log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <libconfig.h>
+
+static const float la_snr_threshold[NUM_MCS_SCHEMES] = MAC_LA_SNR_THRESHOLDS;
+
+// Transport block size per MCS, 0 if unknown
+static uint la_tbs[NUM_MCS_SCHEMES];
+
+static int la_enabled = MAC_LINK_ADAPTATION;
+
+void mac_la_init(link_adapt_s* la, float alpha)
+{
+	memset(la, 0, sizeof(link_adapt_s));
+	la->alpha = alpha;
+}
+
+void mac_la_add_snr(link_adapt_s* la, float snr)
+{
+	if (!la->has_snr) {
+		la->snr = snr;
+		la->has_snr = 1;
+	} else {
+		la->snr += la->alpha*(snr - la->snr);
+	}
+}
+
+void mac_la_add_crc(link_adapt_s* la, uint num_ok, uint num_fail)
+{
+	// in steady state, fail*STEP = ok*STEP*T/(1-T), i.e. the error rate is T
+	la->offset += num_fail*MAC_LA_STEP_DB;
+	la->offset -= num_ok*MAC_LA_STEP_DB*MAC_LA_BLER_TARGET/(1-MAC_LA_BLER_TARGET);
+	if (la->offset > MAC_LA_OFFSET_MAX)
+		la->offset = MAC_LA_OFFSET_MAX;
+	if (la->offset < MAC_LA_OFFSET_MIN)
+		la->offset = MAC_LA_OFFSET_MIN;
+	la->crc_ok += num_ok;
+	la->crc_fail += num_fail;
+}
+
+// An MCS is only used if it carries clearly more data than all more robust MCS
+static int la_mcs_usable(uint mcs)
+{
+	for (int i=0; i<mcs; i++) {
+		if (la_tbs[mcs]>0 && la_tbs[i]*(100+MAC_LA_MIN_GAIN)>=la_tbs[mcs]*100)
+			return 0;
+	}
+	return 1;
+}
+
+// Highest usable MCS whose threshold plus margin is below the given SNR
+static uint la_max_mcs(float snr, float margin)
+{
+	uint mcs = 0;
+	for (int i=1; i<NUM_MCS_SCHEMES; i++) {
+		if (snr >= la_snr_threshold[i]+margin && la_mcs_usable(i))
+			mcs = i;
+	}
+	return mcs;
+}
+
+uint mac_la_select(link_adapt_s* la, uint cur_mcs, long long unsigned int now)
+{
+	if (!la->has_snr || cur_mcs>=NUM_MCS_SCHEMES)
+		return cur_mcs;
+
+	float snr = la->snr - la->offset;
+	uint mcs = la_max_mcs(snr, 0);
+	if (mcs < cur_mcs) {
+		// lower immediately
+		la->mcs_down++;
+	} else {
+		mcs = la_max_mcs(snr, MAC_LA_HYST_DB);
+		if (mcs <= cur_mcs || now < la->hold_until)
+			return cur_mcs;
+		la->mcs_up++;
+	}
+	la->hold_until = now + MAC_LA_HOLD;
+	return mcs;
+}
+
+void mac_la_set_tbs(uint mcs, uint tbs)
+{
+	if (mcs<NUM_MCS_SCHEMES)
+		la_tbs[mcs] = tbs;
+}
+
+int mac_la_stats_print(char* buf, int buflen, link_adapt_s* la)
+{
+	uint slots = la->crc_ok + la->crc_fail;
+	return snprintf(buf, buflen, "SNR: %5.1fdB offset: %4.1fdB slot errors: %d/%d (%.1f%%) MCS up/down: %d/%d%s\n",
+					la->snr, la->offset, la->crc_fail, slots, slots ? 100.0*la->crc_fail/slots : 0,
+					la->mcs_up, la->mcs_down, la->fixed ? " (fixed)" : "");
+}
+
+void mac_la_set_enabled(uint enable)
+{
+	la_enabled = enable;
+}
+
+uint mac_la_is_enabled()
+{
+	return la_enabled;
+}
+
+void mac_la_config_load(char* config_file)
+{
+	config_t cfg;
+	config_init(&cfg);
+	if (config_file && config_read_file(&cfg, config_file)) {
+		config_setting_t* mac = config_lookup(&cfg, "mac");
+		if (mac)
+			config_setting_lookup_int(mac, "link_adaptation", &la_enabled);
+	}
+	config_destroy(&cfg);
+	LOG(INFO,"[MAC LA] link adaptation %s\n",la_enabled ? "enabled" : "disabled");
+}
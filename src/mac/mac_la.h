@@ -0,0 +1,78 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#ifndef MAC_MAC_LA_H_
+#define MAC_MAC_LA_H_
+
+#include <sys/types.h>
+
+// Link adaptation (LA)
+// Selects the MCS of a link direction from the measured SNR. The SNR is estimated from the
+// error vector magnitude of the demodulated symbols and filtered per link. An outer loop
+// corrects the SNR thresholds of the MCS table with the CRC results of the data slots,
+// so that the slot error rate converges to MAC_LA_BLER_TARGET: every failed slot raises the
+// offset by MAC_LA_STEP_DB, every successful slot lowers it by a fraction of that step.
+// The MCS is lowered as soon as the corrected SNR drops below the threshold of the current
+// MCS. It is raised only if the SNR exceeds the threshold of the new MCS by MAC_LA_HYST_DB
+// and no change happened within the last MAC_LA_HOLD subframes.
+// The BS runs the adaptation for DL and UL of every user. The UE measures the DL and reports
+// the SNR and its DL CRC results with the channel_quality message.
+
+// Adaptation state of one link direction
+typedef struct {
+	float snr;				// filtered SNR estimate [dB]
+	float alpha;			// filter weight of a new measurement
+	uint has_snr;			// set after the first measurement
+	float offset;			// outer loop correction of the SNR thresholds [dB]
+	uint fixed;				// MCS was set manually. No adaptation
+	long long unsigned int hold_until;	// no MCS increase before this subframe
+	// statistics
+	uint crc_ok;
+	uint crc_fail;
+	uint mcs_up;
+	uint mcs_down;
+} link_adapt_s;
+
+// Reset the link state. alpha is the weight of a new SNR measurement,
+// use 1 if the measurements are already filtered
+void mac_la_init(link_adapt_s* la, float alpha);
+
+// Add an SNR measurement in dB
+void mac_la_add_snr(link_adapt_s* la, float snr);
+
+// Add the CRC results of data slots sent with the current MCS
+void mac_la_add_crc(link_adapt_s* la, uint num_ok, uint num_fail);
+
+// Select the MCS for the link based on the current MCS.
+// returns the new MCS or cur_mcs if no change is needed
+uint mac_la_select(link_adapt_s* la, uint cur_mcs, long long unsigned int now);
+
+// Set the transport block size of an MCS. MCS which do not carry MAC_LA_MIN_GAIN percent
+// more data than a more robust MCS are skipped. Without sizes, a higher MCS index is assumed to carry more data
+void mac_la_set_tbs(uint mcs, uint tbs);
+
+int mac_la_stats_print(char* buf, int buflen, link_adapt_s* la);
+
+// Enable or disable the adaptation at the BS globally
+void mac_la_set_enabled(uint enable);
+uint mac_la_is_enabled();
+
+// Read the link_adaptation setting of the "mac" section of the config file
+void mac_la_config_load(char* config_file);
+
+#endif /* MAC_MAC_LA_H_ */
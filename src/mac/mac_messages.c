@@ -19,6 +19,7 @@
 #include "mac_messages.h"
 
 #include "../util/log.h"
+#include <math.h>
 
 /* Local Helper functions */
 
@@ -37,18 +38,24 @@ int mac_msg_get_hdrlen(CtrlID_e type)
 		return 2;
 	case session_end:
 		return 1;
+	case dl_arq_status:
+		return 3;
 	case dl_data:
 		return 3;
 	case ul_req:
 		return 2;
 	case channel_quality:
-		return 1;
-	case keepalive:
-		return 1;
+		return 2;
+	case harq_ack:
+		return 2;
+	case ul_arq_status:
+		return 3;
 	case control_ack:
 		return 1;
     case mcs_chance_req:
         return 1;
+	case sps_req:
+		return 2;
 	case ul_data:
 		return 3;
 	default:
@@ -85,7 +92,8 @@ MacMessage mac_msg_create_associate_response(uint userID, uint rachUserID,
 	genericmsg->hdr_bin[0] |= (userID & 0b1111) << 1;
 	genericmsg->hdr_bin[0] |= (rachUserID & 0b1000) >> 3;
 	genericmsg->hdr_bin[1] = (rachUserID & 0b111) << 5;
-	genericmsg->hdr_bin[1] |= (response & 0b111) << 2;
+	genericmsg->hdr_bin[1] |= (PROTO_VERSION & 0b1100) << 1;
+	genericmsg->hdr_bin[1] |= (response & 0b1) << 2;
 	genericmsg->hdr_bin[1] |= (PROTO_VERSION & 0b11);
     genericmsg->hdr_bin[2] = timing_advance & 0xff;
 
@@ -147,25 +155,53 @@ MacMessage mac_msg_create_session_end()
 	return genericmsg;
 }
 
-MacMessage mac_msg_create_dl_data(uint data_length, uint8_t final,
-							uint8_t seqNr, uint8_t fragNr, uint8_t* data)
+static MacMessage mac_msg_create_arq_status(CtrlID_e type, uint arq, uint ack_sn, uint bitmap)
+{
+	MacMessage genericmsg = mac_msg_create_generic(type);
+	MacARQStatus* msg = &genericmsg->hdr.ARQStatus;
+
+	// the UL status report uses the ID of harq_ack
+	uint ctrl_id = (type == ul_arq_status) ? harq_ack : type;
+	genericmsg->hdr_bin[0] = (ctrl_id & 0b111) << 5;
+	genericmsg->hdr_bin[0] |= (arq & 0b1) << 4;
+	genericmsg->hdr_bin[0] |= (ack_sn & 0b1111000) >> 3;
+	genericmsg->hdr_bin[1] = (ack_sn & 0b111) << 5;
+	genericmsg->hdr_bin[1] |= (bitmap >> 8) & 0b11111;
+	genericmsg->hdr_bin[2] = bitmap & 0xff;
+
+	msg->ctrl_id = ctrl_id & 0b111;
+	msg->arq = arq;
+	msg->ack_sn = ack_sn;
+	msg->bitmap = bitmap;
+	return genericmsg;
+}
+
+MacMessage mac_msg_create_dl_arq_status(uint ack_sn, uint bitmap)
+{
+	return mac_msg_create_arq_status(dl_arq_status, 0, ack_sn, bitmap);
+}
+
+MacMessage mac_msg_create_dl_data(uint data_length, uint8_t final, uint8_t first,
+							uint8_t seqNr, uint8_t hc, uint8_t* data)
 {
 	MacMessage genericmsg = mac_msg_create_generic(dl_data);
 	MacDLdata* msg = &genericmsg->hdr.DLdata;
 	genericmsg->payload_len = data_length;
 
 	genericmsg->hdr_bin[0] = (dl_data &0b111) << 5;
-	genericmsg->hdr_bin[0] |= (data_length >> 7) & 0b11111;
-	genericmsg->hdr_bin[1] = (data_length & 0b01111111) <<1;
-	genericmsg->hdr_bin[1] |= final & 0b1;
-	genericmsg->hdr_bin[2] = (seqNr & 0b111) << 5;
-	genericmsg->hdr_bin[2] |= fragNr & 0b11111;
+	genericmsg->hdr_bin[0] |= (data_length >> 6) & 0b11111;
+	genericmsg->hdr_bin[1] = (data_length & 0b111111) << 2;
+	genericmsg->hdr_bin[1] |= (final & 0b1) << 1;
+	genericmsg->hdr_bin[1] |= first & 0b1;
+	genericmsg->hdr_bin[2] = (hc & 0b1) << 7;
+	genericmsg->hdr_bin[2] |= seqNr & 0b1111111;
 
 	msg->ctrl_id = dl_data & 0b111;
 	msg->data_length = data_length;
-	msg->fragNr = fragNr;
 	msg->seqNr = seqNr;
+	msg->hc = hc;
 	msg->final_flag = final;
+	msg->first_flag = first;
 	genericmsg->data = malloc(data_length);
 	memcpy(genericmsg->data,data,data_length);
 
@@ -186,30 +222,54 @@ MacMessage mac_msg_create_ul_req(uint PacketQueueSize)
 	return genericmsg;
 }
 
-MacMessage mac_msg_create_channel_quality(uint quality_idx)
+MacMessage mac_msg_create_channel_quality(float snr, uint crc_ok, uint crc_fail)
 {
 	MacMessage genericmsg = mac_msg_create_generic(channel_quality);
 	MacChannelQuality* msg = &genericmsg->hdr.ChannelQuality;
 
-	genericmsg->hdr_bin[0] = (channel_quality & 0b111) >> 5;
+	// saturate the values to the field sizes
+	int snr_q = lroundf(snr) + CHANNEL_QUALITY_SNR_OFFSET;
+	snr_q = snr_q < 0 ? 0 : (snr_q > 0b111111 ? 0b111111 : snr_q);
+	crc_ok = crc_ok > 0b1111 ? 0b1111 : crc_ok;
+	crc_fail = crc_fail > 0b111 ? 0b111 : crc_fail;
+
+	genericmsg->hdr_bin[0] = (channel_quality & 0b111) << 5;
+	genericmsg->hdr_bin[0] |= (snr_q >> 1) & 0b11111;
+	genericmsg->hdr_bin[1] = (snr_q & 0b1) << 7;
+	genericmsg->hdr_bin[1] |= (crc_ok & 0b1111) << 3;
+	genericmsg->hdr_bin[1] |= crc_fail & 0b111;
 
 	msg->ctrl_id = channel_quality  & 0b111;
-	msg->channel_quality = quality_idx;
+	msg->snr = snr_q;
+	msg->crc_ok = crc_ok;
+	msg->crc_fail = crc_fail;
 	return genericmsg;
 }
 
-MacMessage mac_msg_create_keepalive()
+MacMessage mac_msg_create_harq_ack(uint sfn, uint ack, uint nack)
 {
-	MacMessage genericmsg = mac_msg_create_generic(keepalive);
-	MacKeepalive* msg = &genericmsg->hdr.Keepalive;
-
-	genericmsg->hdr_bin[0] = (keepalive & 0b111) << 5;
-
-	msg->ctrl_id = keepalive  & 0b111;
-	msg->reserved = 0;
+	MacMessage genericmsg = mac_msg_create_generic(harq_ack);
+	MacHARQAck* msg = &genericmsg->hdr.HARQAck;
+
+	// bit 4 of the first byte is the arq flag of ul_arq_status, 0 for harq_ack
+	genericmsg->hdr_bin[0] = (harq_ack & 0b111) << 5;
+	genericmsg->hdr_bin[0] |= (sfn & 0b111) << 1;
+	genericmsg->hdr_bin[0] |= (ack & 0b1000) >> 3;
+	genericmsg->hdr_bin[1] = (ack & 0b111) << 5;
+	genericmsg->hdr_bin[1] |= (nack & 0b1111) << 1;
+
+	msg->ctrl_id = harq_ack  & 0b111;
+	msg->sfn = sfn;
+	msg->ack = ack;
+	msg->nack = nack;
 	return genericmsg;
 }
 
+MacMessage mac_msg_create_ul_arq_status(uint ack_sn, uint bitmap)
+{
+	return mac_msg_create_arq_status(ul_arq_status, 1, ack_sn, bitmap);
+}
+
 MacMessage mac_msg_create_control_ack(uint acked_ctrl_id)
 {
 	MacMessage genericmsg = mac_msg_create_generic(control_ack);
@@ -238,31 +298,63 @@ MacMessage mac_msg_create_mcs_change_req(uint is_ul, uint mcs)
     return genericmsg;
 }
 
-MacMessage mac_msg_create_ul_data(uint data_length, uint8_t final,
-							uint8_t seqNr, uint8_t fragNr, uint8_t* data)
+MacMessage mac_msg_create_sps_req(uint period, uint num_slots, int shift)
+{
+	MacMessage genericmsg = mac_msg_create_generic(sps_req);
+	MacSPSReq* msg = &genericmsg->hdr.SPSReq;
+
+	genericmsg->hdr_bin[0] = (sps_req & 0b111) << 5;
+	genericmsg->hdr_bin[0] |= (period >> 3) & 0b11111;
+	genericmsg->hdr_bin[1] = (period & 0b111) << 5;
+	genericmsg->hdr_bin[1] |= (num_slots & 0b11) << 3;
+	genericmsg->hdr_bin[1] |= shift & 0b111;
+
+	msg->ctrl_id = sps_req & 0b111;
+	msg->period = period;
+	msg->num_slots = num_slots;
+	msg->shift = shift;
+	return genericmsg;
+}
+
+MacMessage mac_msg_create_ul_data(uint data_length, uint8_t final, uint8_t first,
+							uint8_t seqNr, uint8_t hc, uint8_t* data)
 {
 	MacMessage genericmsg = mac_msg_create_generic(ul_data);
 	MacULdata* msg = &genericmsg->hdr.ULdata;
 	genericmsg->payload_len = data_length;
 
 	genericmsg->hdr_bin[0] = (ul_data &0b111) << 5;
-	genericmsg->hdr_bin[0] |= (data_length >> 7) & 0b11111;
-	genericmsg->hdr_bin[1] = (data_length & 0b01111111) <<1;
-	genericmsg->hdr_bin[1] |= final & 0b1;
-	genericmsg->hdr_bin[2] = (seqNr & 0b111) << 5;
-	genericmsg->hdr_bin[2] |= fragNr & 0b11111;
+	genericmsg->hdr_bin[0] |= (data_length >> 6) & 0b11111;
+	genericmsg->hdr_bin[1] = (data_length & 0b111111) << 2;
+	genericmsg->hdr_bin[1] |= (final & 0b1) << 1;
+	genericmsg->hdr_bin[1] |= first & 0b1;
+	genericmsg->hdr_bin[2] = (hc & 0b1) << 7;
+	genericmsg->hdr_bin[2] |= seqNr & 0b1111111;
 
 	msg->ctrl_id = ul_data & 0b111;
 	msg->data_length = data_length;
-	msg->fragNr = fragNr;
 	msg->seqNr = seqNr;
+	msg->hc = hc;
 	msg->final_flag = final;
+	msg->first_flag = first;
 	genericmsg->data = malloc(data_length);
 	memcpy(genericmsg->data,data,data_length);
 
 	return genericmsg;
 }
 
+// Duplicate a message including its payload
+MacMessage mac_msg_copy(MacMessage genericmsg)
+{
+	MacMessage copy = malloc(sizeof(MacMessage_s));
+	memcpy(copy, genericmsg, sizeof(MacMessage_s));
+	if (genericmsg->data) {
+		copy->data = malloc(genericmsg->payload_len);
+		memcpy(copy->data, genericmsg->data, genericmsg->payload_len);
+	}
+	return copy;
+}
+
 // Free all memory allocated for the message
 void mac_msg_destroy(MacMessage genericmsg)
 {
@@ -295,8 +387,9 @@ void mac_msg_parse_associate_response(MacMessage msg)
 	msg->hdr.AssociateResponse.userid = (msg->hdr_bin[0] & 0b00011110) >>1;
 	msg->hdr.AssociateResponse.rachuserid = ((msg->hdr_bin[0] & 0b1) << 3)
 											| (msg->hdr_bin[1] & 0b11100000) >> 5;
-	msg->hdr.AssociateResponse.response = (msg->hdr_bin[1] & 0b11100) >>2;
-	msg->hdr.AssociateResponse.protoVersion = msg->hdr_bin[1] & 0b11;
+	msg->hdr.AssociateResponse.response = (msg->hdr_bin[1] & 0b100) >>2;
+	msg->hdr.AssociateResponse.protoVersion = ((msg->hdr_bin[1] & 0b11000) >> 1)
+											  | (msg->hdr_bin[1] & 0b11);
     msg->hdr.AssociateResponse.timing_advance = msg->hdr_bin[2];
 }
 
@@ -322,11 +415,12 @@ void mac_msg_parse_timing_advance(MacMessage msg)
 void mac_msg_parse_dl_data(MacMessage msg)
 {
 	msg->hdr.DLdata.ctrl_id = msg->type & 0b111;
-	msg->hdr.DLdata.data_length = ((msg->hdr_bin[0] & 0b11111) << 7)
-									| (msg->hdr_bin[1] >> 1);
-	msg->hdr.DLdata.final_flag = msg->hdr_bin[1] & 0b1;
-	msg->hdr.DLdata.seqNr = msg->hdr_bin[2] >> 5;
-	msg->hdr.DLdata.fragNr = msg->hdr_bin[2] & 0b11111;
+	msg->hdr.DLdata.data_length = ((msg->hdr_bin[0] & 0b11111) << 6)
+									| (msg->hdr_bin[1] >> 2);
+	msg->hdr.DLdata.final_flag = (msg->hdr_bin[1] >> 1) & 0b1;
+	msg->hdr.DLdata.first_flag = msg->hdr_bin[1] & 0b1;
+	msg->hdr.DLdata.hc = msg->hdr_bin[2] >> 7;
+	msg->hdr.DLdata.seqNr = msg->hdr_bin[2] & 0b1111111;
 }
 
 void mac_msg_parse_ul_req(MacMessage msg)
@@ -338,12 +432,27 @@ void mac_msg_parse_ul_req(MacMessage msg)
 
 void mac_msg_parse_channel_quality(MacMessage msg)
 {
-	//TBD!
+	msg->hdr.ChannelQuality.ctrl_id = msg->type & 0b111;
+	msg->hdr.ChannelQuality.snr = ((msg->hdr_bin[0] & 0b11111) << 1) | (msg->hdr_bin[1] >> 7);
+	msg->hdr.ChannelQuality.crc_ok = (msg->hdr_bin[1] >> 3) & 0b1111;
+	msg->hdr.ChannelQuality.crc_fail = msg->hdr_bin[1] & 0b111;
 }
 
-void mac_msg_parse_keepalive(MacMessage msg)
+void mac_msg_parse_harq_ack(MacMessage msg)
 {
-	msg->hdr.Keepalive.ctrl_id = msg->type & 0b111;
+	msg->hdr.HARQAck.ctrl_id = msg->type & 0b111;
+	msg->hdr.HARQAck.sfn = (msg->hdr_bin[0] >> 1) & 0b111;
+	msg->hdr.HARQAck.ack = ((msg->hdr_bin[0] & 0b1) << 3) | (msg->hdr_bin[1] >> 5);
+	msg->hdr.HARQAck.nack = (msg->hdr_bin[1] >> 1) & 0b1111;
+}
+
+// DL and UL status reports have the same layout
+void mac_msg_parse_arq_status(MacMessage msg)
+{
+	msg->hdr.ARQStatus.ctrl_id = msg->hdr_bin[0] >> 5;
+	msg->hdr.ARQStatus.arq = (msg->hdr_bin[0] >> 4) & 0b1;
+	msg->hdr.ARQStatus.ack_sn = ((msg->hdr_bin[0] & 0b1111) << 3) | (msg->hdr_bin[1] >> 5);
+	msg->hdr.ARQStatus.bitmap = ((msg->hdr_bin[1] & 0b11111) << 8) | msg->hdr_bin[2];
 }
 
 void mac_msg_parse_control_ack(MacMessage msg)
@@ -359,14 +468,25 @@ void mac_msg_parse_mcs_change_req(MacMessage msg)
     msg->hdr.MCSChangeReq.mcs = (msg->hdr_bin[0] & 0b1111);
 }
 
+void mac_msg_parse_sps_req(MacMessage msg)
+{
+	msg->hdr.SPSReq.ctrl_id = msg->type & 0b111;
+	msg->hdr.SPSReq.period = ((msg->hdr_bin[0] & 0b11111) << 3) | (msg->hdr_bin[1] >> 5);
+	msg->hdr.SPSReq.num_slots = (msg->hdr_bin[1] >> 3) & 0b11;
+	// sign extend 3bit shift
+	int shift = msg->hdr_bin[1] & 0b111;
+	msg->hdr.SPSReq.shift = (shift & 0b100) ? shift-8 : shift;
+}
+
 void mac_msg_parse_ul_data(MacMessage msg)
 {
 	msg->hdr.ULdata.ctrl_id = msg->type & 0b111;
-	msg->hdr.ULdata.data_length = ((msg->hdr_bin[0] & 0b11111) << 7)
-									| (msg->hdr_bin[1] >> 1);
-	msg->hdr.ULdata.final_flag = msg->hdr_bin[1] & 0b1;
-	msg->hdr.ULdata.seqNr = msg->hdr_bin[2] >> 5;
-	msg->hdr.ULdata.fragNr = msg->hdr_bin[2] & 0b11111;
+	msg->hdr.ULdata.data_length = ((msg->hdr_bin[0] & 0b11111) << 6)
+									| (msg->hdr_bin[1] >> 2);
+	msg->hdr.ULdata.final_flag = (msg->hdr_bin[1] >> 1) & 0b1;
+	msg->hdr.ULdata.first_flag = msg->hdr_bin[1] & 0b1;
+	msg->hdr.ULdata.hc = msg->hdr_bin[2] >> 7;
+	msg->hdr.ULdata.seqNr = msg->hdr_bin[2] & 0b1111111;
 }
 
 // read from a binary buffer and try to parse a Mac message
@@ -385,6 +505,9 @@ MacMessage mac_msg_parse(uint8_t* buf, uint buflen, uint8_t ul_flag)
 	// UL control messages start at 8 in the enum -> add 0x8
 	if (ul_flag) {
 		type += 0b1000;
+		// harq_ack and ul_arq_status share the ID
+		if (type == harq_ack && (buf[0] & 0b10000))
+			type = ul_arq_status;
 	}
 
 	MacMessage genericmsg = mac_msg_create_generic(type);
@@ -426,8 +549,12 @@ MacMessage mac_msg_parse(uint8_t* buf, uint buflen, uint8_t ul_flag)
 	case channel_quality:
 		mac_msg_parse_channel_quality(genericmsg);
 		break;
-	case keepalive:
-		mac_msg_parse_keepalive(genericmsg);
+	case harq_ack:
+		mac_msg_parse_harq_ack(genericmsg);
+		break;
+	case dl_arq_status:
+	case ul_arq_status:
+		mac_msg_parse_arq_status(genericmsg);
 		break;
 	case control_ack:
 		mac_msg_parse_control_ack(genericmsg);
@@ -435,6 +562,9 @@ MacMessage mac_msg_parse(uint8_t* buf, uint buflen, uint8_t ul_flag)
     case mcs_chance_req:
         mac_msg_parse_mcs_change_req(genericmsg);
         break;
+	case sps_req:
+		mac_msg_parse_sps_req(genericmsg);
+		break;
 	case ul_data:
 		mac_msg_parse_ul_data(genericmsg);
 		break;
@@ -25,8 +25,10 @@
 #include <stdlib.h>
 
 
-// MAC Protocol version
-#define PROTO_VERSION 0
+// MAC Protocol version. The associate response carries it in 4 bits: the 2 bits of the
+// original version field and 2 bits taken from the response field. Peers that use the
+// 2 bit version field read a version >= 4 as a failed association
+#define PROTO_VERSION 9
 
 // lowest 3 bits of this number are equal to the control ID
 // that is written to the message itself
@@ -39,13 +41,16 @@ typedef enum {
 	ul_mcs_info,
 	timing_advance,
 	session_end,
+	dl_arq_status,
 	dl_data = 7,
 	ul_req = 9,
 	channel_quality,
-	keepalive,
+	harq_ack,
 	control_ack,
     mcs_chance_req,
-	ul_data = 15
+	sps_req,
+	ul_data = 15,
+	ul_arq_status = 16	// shares the ID of harq_ack, see MacARQStatus
 } CtrlID_e;
 
 // Association response types
@@ -58,8 +63,8 @@ typedef struct {
 	uint32_t ctrl_id :3;
 	uint32_t userid :4;
 	uint32_t rachuserid :4;
-	uint32_t response :3;
-	uint32_t protoVersion : 2;
+	uint32_t response :1;
+	uint32_t protoVersion : 4;
     uint32_t timing_advance : 8;
 } MacAssociateResponse;
 
@@ -80,10 +85,11 @@ typedef struct {
 
 typedef struct {
 	uint32_t ctrl_id :3;
-	uint32_t data_length : 12;
-	uint32_t final_flag :1;
-	uint32_t seqNr : 3;
-	uint32_t fragNr : 5;
+	uint32_t data_length : 11;
+	uint32_t final_flag :1;		// last fragment of a frame
+	uint32_t first_flag :1;		// first fragment of a frame
+	uint32_t hc :1;				// frame header is compressed (mac_hc)
+	uint32_t seqNr : 7;			// fragment sequence number, see MAC_ARQ_SN_MOD
 } MacDLdata;
 
 typedef struct {
@@ -91,15 +97,33 @@ typedef struct {
 	uint32_t packetqueuesize :13;
 } MacULreq;
 
+// SNR in channel_quality messages is sent in dB with this offset
+#define CHANNEL_QUALITY_SNR_OFFSET 10
+
 typedef struct {
 	uint32_t ctrl_id :3;
-	uint32_t channel_quality :5; // TODO to be defined
+	uint32_t snr :6;			// DL SNR in dB + CHANNEL_QUALITY_SNR_OFFSET
+	uint32_t crc_ok :4;			// unicast DL slots received since the last report
+	uint32_t crc_fail :3;		// unicast DL slots with CRC error since the last report
 } MacChannelQuality;
 
+// HARQ feedback for the unicast DL slots of one subframe. Bit i is slot i
+typedef struct {
+	uint32_t ctrl_id :3;
+	uint32_t sfn :3;			// DL subframe number
+	uint32_t ack :4;			// slots received correctly
+	uint32_t nack :4;			// slots with CRC error
+} MacHARQAck;
+
+// ARQ status report of the receiver of data fragments. All fragments before ack_sn were
+// received, bit i of the bitmap is set if fragment ack_sn+1+i was received.
+// The UL message shares the ID of harq_ack and is marked with the arq flag
 typedef struct {
 	uint32_t ctrl_id :3;
-	uint32_t reserved : 5;
-} MacKeepalive;
+	uint32_t arq :1;
+	uint32_t ack_sn :7;
+	uint32_t bitmap :13;
+} MacARQStatus;
 
 typedef struct {
     uint32_t ctrl_id :3;
@@ -112,12 +136,21 @@ typedef struct {
     uint32_t mcs :4;
 } MacMCSChangeReq;
 
+// Request semi-persistent UL slots. num_slots=0 releases them
+typedef struct {
+	uint32_t ctrl_id :3;
+	uint32_t period :8;			// in 1/4 subframes
+	uint32_t num_slots :2;
+	int32_t shift :3;			// move the occasions earlier by this number of subframes
+} MacSPSReq;
+
 typedef struct {
 	uint32_t ctrl_id :3;
-	uint32_t data_length : 12;
-	uint32_t final_flag :1;
-	uint32_t seqNr : 3;
-	uint32_t fragNr : 5;
+	uint32_t data_length : 11;
+	uint32_t final_flag :1;		// last fragment of a frame
+	uint32_t first_flag :1;		// first fragment of a frame
+	uint32_t hc :1;				// frame header is compressed (mac_hc)
+	uint32_t seqNr : 7;			// fragment sequence number, see MAC_ARQ_SN_MOD
 } MacULdata;
 
 // Generic struct for Mac Message exchange between Modules
@@ -132,9 +165,11 @@ typedef struct {
 		MacDLdata DLdata;
 		MacULreq ULreq;
 		MacChannelQuality ChannelQuality;
-		MacKeepalive Keepalive;
+		MacHARQAck HARQAck;
+		MacARQStatus ARQStatus;
 		MacControlAck ControlAck;
         MacMCSChangeReq MCSChangeReq;
+		MacSPSReq SPSReq;
 		MacULdata ULdata;
 	} hdr;
 	CtrlID_e type;
@@ -157,17 +192,21 @@ MacMessage mac_msg_create_dl_mcs_info(uint mcs);
 MacMessage mac_msg_create_ul_mcs_info(uint mcs);
 MacMessage mac_msg_create_timing_advance(uint timingAdvance);
 MacMessage mac_msg_create_session_end();
-MacMessage mac_msg_create_dl_data(uint data_length, uint8_t fragment,
-								  uint8_t seqNr, uint8_t fragNr, uint8_t* data );
+MacMessage mac_msg_create_dl_arq_status(uint ack_sn, uint bitmap);
+MacMessage mac_msg_create_dl_data(uint data_length, uint8_t final, uint8_t first,
+								  uint8_t seqNr, uint8_t hc, uint8_t* data );
 // Uplink
 MacMessage mac_msg_create_ul_req(uint PacketQueueSize);
-MacMessage mac_msg_create_channel_quality(uint quality_idx);
-MacMessage mac_msg_create_keepalive();
+MacMessage mac_msg_create_channel_quality(float snr, uint crc_ok, uint crc_fail);
+MacMessage mac_msg_create_harq_ack(uint sfn, uint ack, uint nack);
+MacMessage mac_msg_create_ul_arq_status(uint ack_sn, uint bitmap);
 MacMessage mac_msg_create_control_ack(uint acked_ctrl_id);
 MacMessage mac_msg_create_mcs_change_req(uint is_ul, uint mcs);
-MacMessage mac_msg_create_ul_data(uint data_length, uint8_t final,
-								  uint8_t seqNr, uint8_t fragNr, uint8_t* data);
+MacMessage mac_msg_create_sps_req(uint period, uint num_slots, int shift);
+MacMessage mac_msg_create_ul_data(uint data_length, uint8_t final, uint8_t first,
+								  uint8_t seqNr, uint8_t hc, uint8_t* data);
 
+MacMessage mac_msg_copy(MacMessage genericmsg);
 void mac_msg_destroy(MacMessage genericmsg);
 
 //// Functions to write/parse messages to/from buffers ////
@@ -0,0 +1,348 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#include "mac_proxy.h"
+#include "mac_config.h"
+#include "../util/log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define ETH_HDR_LEN 14
+#define ARP_LEN 28
+#define IPV6_HDR_LEN 40
+#define ICMPV6_NS 135
+#define ICMPV6_NA 136
+#define ND_OPT_SRC_LLADDR 1
+#define ND_OPT_TGT_LLADDR 2
+#define NA_FLAG_ROUTER 0x80
+#define NA_FLAG_SOLICITED 0x40
+#define NA_FLAG_OVERRIDE 0x20
+
+typedef struct {
+	uint valid;
+	uint ipv6;
+	uint8_t ip[16];
+	uint8_t mac[6];
+	uint8_t userid;
+	uint8_t router;					// IPv6: client announced itself as router
+	unsigned long long last_seen;	// subframe in which the binding was seen the last time
+} proxy_entry_s;
+
+struct MacProxy_s {
+	proxy_entry_s entries[MAC_PROXY_MAX_ENTRIES];
+	pthread_mutex_t lock;
+	proxy_stats_s stats;
+};
+
+MacProxy mac_proxy_init()
+{
+	MacProxy proxy = calloc(1,sizeof(struct MacProxy_s));
+	pthread_mutex_init(&proxy->lock, NULL);
+	return proxy;
+}
+
+void mac_proxy_destroy(MacProxy proxy)
+{
+	pthread_mutex_destroy(&proxy->lock);
+	free(proxy);
+}
+
+static uint is_ethertype(const uint8_t* data, uint16_t type)
+{
+	return data[12]==(type>>8) && data[13]==(type & 0xff);
+}
+
+// Caller has to hold the lock
+static proxy_entry_s* proxy_find(MacProxy proxy, uint ipv6, const uint8_t* ip)
+{
+	for (int i=0; i<MAC_PROXY_MAX_ENTRIES; i++) {
+		proxy_entry_s* e = &proxy->entries[i];
+		if (e->valid && e->ipv6==ipv6 && memcmp(e->ip, ip, ipv6 ? 16 : 4)==0)
+			return e;
+	}
+	return NULL;
+}
+
+static void proxy_update(MacProxy proxy, uint ipv6, const uint8_t* ip, const uint8_t* mac,
+						 uint userid, uint router, unsigned long long now)
+{
+	pthread_mutex_lock(&proxy->lock);
+	proxy_entry_s* e = proxy_find(proxy, ipv6, ip);
+	if (e == NULL) {
+		// take a free entry or replace the oldest one
+		e = &proxy->entries[0];
+		for (int i=0; i<MAC_PROXY_MAX_ENTRIES && e->valid; i++) {
+			proxy_entry_s* c = &proxy->entries[i];
+			if (!c->valid || c->last_seen < e->last_seen)
+				e = c;
+		}
+		if (!e->valid)
+			proxy->stats.num_entries++;
+		memset(e, 0, sizeof(proxy_entry_s));
+		e->valid = 1;
+		e->ipv6 = ipv6;
+		memcpy(e->ip, ip, ipv6 ? 16 : 4);
+		LOG(DEBUG,"[MAC PROXY] learned %s address of user %d\n",ipv6 ? "IPv6" : "IPv4",userid);
+	}
+	memcpy(e->mac, mac, 6);
+	e->userid = userid;
+	e->router = router;
+	e->last_seen = now;
+	pthread_mutex_unlock(&proxy->lock);
+}
+
+// Refresh an existing binding by the source of a regular IP frame
+static void proxy_refresh(MacProxy proxy, uint ipv6, const uint8_t* ip, const uint8_t* mac,
+						  uint userid, unsigned long long now)
+{
+	pthread_mutex_lock(&proxy->lock);
+	proxy_entry_s* e = proxy_find(proxy, ipv6, ip);
+	if (e && e->userid==userid && memcmp(e->mac, mac, 6)==0)
+		e->last_seen = now;
+	pthread_mutex_unlock(&proxy->lock);
+}
+
+// Find a link layer address option of a neighbor discovery message
+static const uint8_t* nd_find_lladdr(const uint8_t* opt, int opt_len, uint type)
+{
+	while (opt_len >= 8) {
+		uint len = opt[1]*8;
+		if (len == 0 || len > opt_len)
+			return NULL;
+		if (opt[0]==type && len>=8)
+			return opt+2;
+		opt += len;
+		opt_len -= len;
+	}
+	return NULL;
+}
+
+void mac_proxy_learn(MacProxy proxy, const uint8_t* data, uint len, uint userid, unsigned long long now)
+{
+	if (len < ETH_HDR_LEN)
+		return;
+	const uint8_t* l3 = data+ETH_HDR_LEN;
+	uint l3_len = len-ETH_HDR_LEN;
+	if (is_ethertype(data, 0x0806)) {
+		// ARP request or reply of the client: sender addresses are the client's
+		if (l3_len<ARP_LEN || l3[0]!=0 || l3[1]!=1 || l3[2]!=0x08 || l3[3]!=0x00 || l3[4]!=6 || l3[5]!=4)
+			return;
+		const uint8_t zero[4] = {0};
+		if (memcmp(l3+14, zero, 4)==0 || memcmp(l3+8, data+6, 6)!=0)
+			return;
+		proxy_update(proxy, 0, l3+14, l3+8, userid, 0, now);
+	} else if (is_ethertype(data, 0x0800)) {
+		if (l3_len >= 20)
+			proxy_refresh(proxy, 0, l3+12, data+6, userid, now);
+	} else if (is_ethertype(data, 0x86dd)) {
+		if (l3_len < IPV6_HDR_LEN)
+			return;
+		const uint8_t* icmp = l3+IPV6_HDR_LEN;
+		int icmp_len = l3_len-IPV6_HDR_LEN;
+		if (l3[6]==58 && l3[7]==255 && icmp_len>=24 && icmp[0]==ICMPV6_NA && icmp[1]==0) {
+			// neighbor advertisement: target address with target link layer address
+			const uint8_t* lladdr = nd_find_lladdr(icmp+24, icmp_len-24, ND_OPT_TGT_LLADDR);
+			if (lladdr == NULL)
+				lladdr = data+6;
+			if (memcmp(lladdr, data+6, 6)==0)
+				proxy_update(proxy, 1, icmp+8, lladdr, userid, (icmp[4] & NA_FLAG_ROUTER)!=0, now);
+		} else {
+			proxy_refresh(proxy, 1, l3+8, data+6, userid, now);
+		}
+	}
+}
+
+static MacDataFrame proxy_arp_reply(MacProxy proxy, const uint8_t* data, const uint8_t* arp)
+{
+	// only requests for another address. Gratuitous ARP is forwarded
+	if (arp[0]!=0 || arp[1]!=1 || arp[2]!=0x08 || arp[3]!=0x00 || arp[4]!=6 || arp[5]!=4 ||
+		arp[6]!=0 || arp[7]!=1 || memcmp(arp+14, arp+24, 4)==0)
+		return NULL;
+
+	uint8_t mac[6];
+	pthread_mutex_lock(&proxy->lock);
+	proxy_entry_s* e = proxy_find(proxy, 0, arp+24);
+	if (e)
+		memcpy(mac, e->mac, 6);
+	pthread_mutex_unlock(&proxy->lock);
+	if (e == NULL || memcmp(mac, arp+8, 6)==0)
+		return NULL;
+
+	MacDataFrame reply = dataframe_create(ETH_HDR_LEN+ARP_LEN);
+	uint8_t* d = reply->data;
+	memcpy(d, arp+8, 6);
+	memcpy(d+6, mac, 6);
+	d[12] = 0x08;
+	d[13] = 0x06;
+	uint8_t* r = d+ETH_HDR_LEN;
+	memcpy(r, arp, 6);
+	r[6] = 0;
+	r[7] = 2;					// reply
+	memcpy(r+8, mac, 6);		// sender: the client
+	memcpy(r+14, arp+24, 4);
+	memcpy(r+18, arp+8, 10);	// target: the requester
+	proxy->stats.arp_replies++;
+	return reply;
+}
+
+static uint16_t icmpv6_checksum(const uint8_t* ip6, const uint8_t* icmp, uint len)
+{
+	uint32_t sum = 0;
+	for (int i=8; i<40; i+=2)		// source and destination address
+		sum += (ip6[i]<<8) | ip6[i+1];
+	sum += len;
+	sum += 58;
+	for (int i=0; i+1<len; i+=2)
+		sum += (icmp[i]<<8) | icmp[i+1];
+	if (len & 1)
+		sum += icmp[len-1]<<8;
+	while (sum>>16)
+		sum = (sum & 0xffff) + (sum>>16);
+	return ~sum & 0xffff;
+}
+
+static MacDataFrame proxy_na_reply(MacProxy proxy, const uint8_t* data, const uint8_t* ip6, uint l3_len)
+{
+	const uint8_t* icmp = ip6+IPV6_HDR_LEN;
+	int icmp_len = l3_len-IPV6_HDR_LEN;
+	if (ip6[6]!=58 || ip6[7]!=255 || icmp_len<24 || icmp[0]!=ICMPV6_NS || icmp[1]!=0)
+		return NULL;
+	// duplicate address detection (unspecified source) is forwarded
+	const uint8_t zero[16] = {0};
+	if (memcmp(ip6+8, zero, 16)==0)
+		return NULL;
+
+	uint8_t mac[6];
+	uint router = 0;
+	pthread_mutex_lock(&proxy->lock);
+	proxy_entry_s* e = proxy_find(proxy, 1, icmp+8);
+	if (e) {
+		memcpy(mac, e->mac, 6);
+		router = e->router;
+	}
+	pthread_mutex_unlock(&proxy->lock);
+	if (e == NULL || memcmp(mac, data+6, 6)==0)
+		return NULL;
+
+	// NA with target link layer address option to the soliciting node
+	const uint na_len = 24+8;
+	MacDataFrame reply = dataframe_create(ETH_HDR_LEN+IPV6_HDR_LEN+na_len);
+	uint8_t* d = reply->data;
+	memset(d, 0, reply->size);
+	memcpy(d, data+6, 6);
+	memcpy(d+6, mac, 6);
+	d[12] = 0x86;
+	d[13] = 0xdd;
+	uint8_t* r = d+ETH_HDR_LEN;
+	r[0] = 0x60;
+	r[4] = 0;
+	r[5] = na_len;
+	r[6] = 58;
+	r[7] = 255;
+	memcpy(r+8, icmp+8, 16);	// source: the target address
+	memcpy(r+24, ip6+8, 16);	// destination: the soliciting node
+	uint8_t* na = r+IPV6_HDR_LEN;
+	na[0] = ICMPV6_NA;
+	na[4] = NA_FLAG_SOLICITED | NA_FLAG_OVERRIDE | (router ? NA_FLAG_ROUTER : 0);
+	memcpy(na+8, icmp+8, 16);
+	na[24] = ND_OPT_TGT_LLADDR;
+	na[25] = 1;
+	memcpy(na+26, mac, 6);
+	uint16_t csum = icmpv6_checksum(r, na, na_len);
+	na[2] = csum>>8;
+	na[3] = csum & 0xff;
+	proxy->stats.na_replies++;
+	return reply;
+}
+
+MacDataFrame mac_proxy_reply(MacProxy proxy, const uint8_t* data, uint len)
+{
+	if (len < ETH_HDR_LEN)
+		return NULL;
+	if (is_ethertype(data, 0x0806) && len >= ETH_HDR_LEN+ARP_LEN)
+		return proxy_arp_reply(proxy, data, data+ETH_HDR_LEN);
+	if (is_ethertype(data, 0x86dd) && len >= ETH_HDR_LEN+IPV6_HDR_LEN)
+		return proxy_na_reply(proxy, data, data+ETH_HDR_LEN, len-ETH_HDR_LEN);
+	return NULL;
+}
+
+int mac_proxy_lookup(MacProxy proxy, const uint8_t* data, uint len)
+{
+	// multicast and broadcast frames go to all users
+	if (len < ETH_HDR_LEN || (data[0] & 0x01))
+		return -1;
+	int userid = -1;
+	pthread_mutex_lock(&proxy->lock);
+	// destination Ethernet address of a learned binding
+	for (int i=0; i<MAC_PROXY_MAX_ENTRIES && userid<0; i++) {
+		proxy_entry_s* e = &proxy->entries[i];
+		if (e->valid && memcmp(e->mac, data, 6)==0)
+			userid = e->userid;
+	}
+	// otherwise the destination IP address
+	if (userid < 0) {
+		proxy_entry_s* e = NULL;
+		if (is_ethertype(data, 0x0800) && len >= ETH_HDR_LEN+20)
+			e = proxy_find(proxy, 0, data+ETH_HDR_LEN+16);
+		else if (is_ethertype(data, 0x86dd) && len >= ETH_HDR_LEN+IPV6_HDR_LEN)
+			e = proxy_find(proxy, 1, data+ETH_HDR_LEN+24);
+		if (e)
+			userid = e->userid;
+	}
+	pthread_mutex_unlock(&proxy->lock);
+	if (userid >= 0)
+		proxy->stats.unicast_redirected++;
+	return userid;
+}
+
+void mac_proxy_remove_user(MacProxy proxy, uint userid)
+{
+	pthread_mutex_lock(&proxy->lock);
+	for (int i=0; i<MAC_PROXY_MAX_ENTRIES; i++) {
+		proxy_entry_s* e = &proxy->entries[i];
+		if (e->valid && e->userid==userid) {
+			e->valid = 0;
+			proxy->stats.num_entries--;
+		}
+	}
+	pthread_mutex_unlock(&proxy->lock);
+}
+
+void mac_proxy_age(MacProxy proxy, unsigned long long now, unsigned long long max_age)
+{
+	pthread_mutex_lock(&proxy->lock);
+	for (int i=0; i<MAC_PROXY_MAX_ENTRIES; i++) {
+		proxy_entry_s* e = &proxy->entries[i];
+		if (e->valid && now-e->last_seen > max_age) {
+			e->valid = 0;
+			proxy->stats.num_entries--;
+		}
+	}
+	pthread_mutex_unlock(&proxy->lock);
+}
+
+int mac_proxy_stats_print(char* buf, int buflen, MacProxy proxy)
+{
+	proxy_stats_s* st = &proxy->stats;
+	return snprintf(buf,buflen,"ARP/ND proxy: %d bindings, %d ARP and %d NS answered, "
+						   "%d unknown unicast frames sent to a learned user\n",
+						   st->num_entries, st->arp_replies, st->na_replies, st->unicast_redirected);
+}
@@ -0,0 +1,64 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#ifndef MAC_MAC_PROXY_H_
+#define MAC_MAC_PROXY_H_
+
+#include "mac_common.h"
+
+// ARP/ND proxy at the BS. Learns the IPv4 and IPv6 addresses of the clients
+// from ARP packets and neighbor advertisements they send in UL. ARP requests and
+// neighbor solicitations for these addresses that arrive from TAP are answered
+// locally and do not use the broadcast channel. Unicast frames to an unknown
+// Ethernet address are sent to the user the destination was learned from.
+// Learning and removal are serialized with lookups by a mutex. Lookups are only
+// done for frames that are not in the forwarding table.
+struct MacProxy_s;
+typedef struct MacProxy_s* MacProxy;
+
+typedef struct {
+	uint arp_replies;		// ARP requests answered
+	uint na_replies;		// neighbor solicitations answered
+	uint unicast_redirected;	// unknown unicast frames sent to a learned user
+	uint num_entries;
+} proxy_stats_s;
+
+MacProxy mac_proxy_init();
+void mac_proxy_destroy(MacProxy proxy);
+
+// Learn address bindings from a frame that was received from userid.
+// now is the current subframe counter and is used for aging
+void mac_proxy_learn(MacProxy proxy, const uint8_t* data, uint len, uint userid, unsigned long long now);
+
+// Create the answer to an ARP request or neighbor solicitation for a learned address.
+// returns the reply frame or NULL if the frame is no such request
+MacDataFrame mac_proxy_reply(MacProxy proxy, const uint8_t* data, uint len);
+
+// Find the user a unicast frame to an unknown Ethernet address belongs to
+// returns the userid or -1 if the destination is unknown
+int mac_proxy_lookup(MacProxy proxy, const uint8_t* data, uint len);
+
+// Remove all bindings of userid
+void mac_proxy_remove_user(MacProxy proxy, uint userid);
+
+// Remove all bindings that have not been seen for max_age subframes
+void mac_proxy_age(MacProxy proxy, unsigned long long now, unsigned long long max_age);
+
+int mac_proxy_stats_print(char* buf, int buflen, MacProxy proxy);
+
+#endif /* MAC_MAC_PROXY_H_ */
@@ -0,0 +1,110 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#include "mac_sps.h"
+#include "mac_config.h"
+
+#include <stdlib.h>
+
+int sps_detect_arrival(sps_detector_s* det, long long unsigned int now, uint size)
+{
+	uint interval = (now - det->last_arrival)*SPS_Q;
+	det->last_arrival = now;
+
+	if (size > MAC_SPS_MAX_FRAME || interval < MAC_SPS_MIN_PERIOD*SPS_Q ||
+			interval > MAC_SPS_MAX_PERIOD*SPS_Q) {
+		// no candidate for SPS
+		det->hits = 0;
+		det->max_size = 0;
+		det->active = 0;
+		return 0;
+	}
+
+	if (det->hits > 0 && abs((int)interval - (int)det->period) <= SPS_Q) {
+		// interval matches. Average the period, arrivals are quantized to subframes
+		det->period += ((int)interval - (int)det->period)/4;
+		det->hits++;
+	} else {
+		det->period = interval;
+		det->hits = 1;
+		det->max_size = 0;
+		det->active = 0;
+	}
+	if (size > det->max_size)
+		det->max_size = size;
+
+	if (!det->active && det->hits >= MAC_SPS_DETECT_CNT) {
+		det->active = 1;
+		return 1;
+	}
+	return 0;
+}
+
+int sps_detect_idle(sps_detector_s* det, long long unsigned int now)
+{
+	if (det->active && (now - det->last_arrival)*SPS_Q > MAC_SPS_IDLE_RELEASE*det->period) {
+		det->active = 0;
+		det->hits = 0;
+		return 1;
+	}
+	return 0;
+}
+
+void sps_detect_record(sps_detector_s* det, long long unsigned int now, uint size)
+{
+	uint head = atomic_load_explicit(&det->arr_head, memory_order_relaxed);
+	uint tail = atomic_load_explicit(&det->arr_tail, memory_order_acquire);
+	if (head - tail >= SPS_ARRIVAL_QUEUE_LEN) {
+		// more arrivals than a periodic flow has per subframe
+		atomic_store(&det->arr_overflow, 1);
+		return;
+	}
+	sps_arrival_s* arr = &det->arrivals[head & (SPS_ARRIVAL_QUEUE_LEN-1)];
+	arr->subframe = now;
+	arr->size = size;
+	atomic_store_explicit(&det->arr_head, head+1, memory_order_release);
+}
+
+int sps_detect_update(sps_detector_s* det, long long unsigned int now)
+{
+	uint tail = atomic_load_explicit(&det->arr_tail, memory_order_relaxed);
+	uint head = atomic_load_explicit(&det->arr_head, memory_order_acquire);
+	while (tail != head) {
+		sps_arrival_s* arr = &det->arrivals[tail & (SPS_ARRIVAL_QUEUE_LEN-1)];
+		sps_detect_arrival(det, arr->subframe, arr->size);
+		tail++;
+		atomic_store_explicit(&det->arr_tail, tail, memory_order_release);
+	}
+	if (atomic_exchange(&det->arr_overflow, 0)) {
+		// bursty flow. Restart the detection
+		det->hits = 0;
+		det->max_size = 0;
+		det->active = 0;
+	}
+	return sps_detect_idle(det, now);
+}
+
+uint sps_num_slots(uint size, uint frag_payload)
+{
+	if (frag_payload == 0)
+		return MAC_SPS_MAX_SLOTS;
+	uint slots = (size + frag_payload - 1) / frag_payload;
+	if (slots > MAC_SPS_MAX_SLOTS)
+		slots = MAC_SPS_MAX_SLOTS;
+	return slots;
+}
@@ -0,0 +1,89 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#ifndef MAC_MAC_SPS_H_
+#define MAC_MAC_SPS_H_
+
+#include <sys/types.h>
+#include <stdatomic.h>
+
+// Semi-persistent scheduling (SPS)
+// Periodic flows with small frames (e.g. voice, telemetry) get recurring slots
+// without waiting for a buffer status report and a dynamic grant.
+// Periods are stored as fixed point numbers with SPS_Q steps per subframe,
+// since the packetization interval is usually not a multiple of a subframe
+#define SPS_Q 4
+
+// Number of frame arrivals that can be recorded between two detector updates. Power of 2
+#define SPS_ARRIVAL_QUEUE_LEN 16
+
+typedef struct {
+	long long unsigned int subframe;
+	uint size;
+} sps_arrival_s;
+
+// Detects whether the frames of a link direction arrive periodically.
+// Arrivals are recorded by the ingress thread in a lock-free single producer queue.
+// All other fields are only used by the MAC thread, which processes the arrivals
+typedef struct {
+	long long unsigned int last_arrival;	// subframe of the last arrival
+	uint period;		// estimated interval between arrivals [1/SPS_Q subframes]
+	uint hits;			// number of consecutive intervals that matched the period
+	uint max_size;		// largest frame since the detection started
+	uint active;		// set while the flow is considered periodic
+
+	sps_arrival_s arrivals[SPS_ARRIVAL_QUEUE_LEN];
+	atomic_uint arr_head;		// modified by the ingress thread only
+	atomic_uint arr_tail;		// modified by the MAC thread only
+	atomic_uint arr_overflow;	// set if arrivals were lost
+} sps_detector_s;
+
+// Recurring slot assignment of a user for one link direction at the BS
+typedef struct {
+	uint active;
+	uint configured;					// set via mac_bs_sps_configure(). Not released on inactivity
+	uint period;						// [1/SPS_Q subframes]
+	long long unsigned int next;		// subframe of the next occasion [1/SPS_Q subframes]
+	uint slots;							// number of slots per occasion
+	uint idle;							// consecutive occasions without data
+	uint rx_cnt;						// UL: number of received data slots at the last occasion
+	uint occasions;						// statistics: number of occasions and occasions with data
+	uint used;
+} sps_grant_s;
+
+// Record a new frame arrival. Called by the ingress thread, does not block
+void sps_detect_record(sps_detector_s* det, long long unsigned int now, uint size);
+
+// Process the recorded arrivals and check whether a periodic flow stopped.
+// Called by the MAC thread before the detector state is used
+// returns 1 if the flow was periodic and no frame arrived for MAC_SPS_IDLE_RELEASE periods
+int sps_detect_update(sps_detector_s* det, long long unsigned int now);
+
+// Update the detector with a new frame arrival
+// returns 1 if the flow became periodic with this arrival, otherwise 0
+int sps_detect_arrival(sps_detector_s* det, long long unsigned int now, uint size);
+
+// Check whether a periodic flow stopped
+// returns 1 if the flow was periodic and no frame arrived for MAC_SPS_IDLE_RELEASE periods
+int sps_detect_idle(sps_detector_s* det, long long unsigned int now);
+
+// Number of slots needed per occasion for frames of the given size
+// if each slot carries one fragment with frag_payload bytes of data
+uint sps_num_slots(uint size, uint frag_payload);
+
+#endif /* MAC_MAC_SPS_H_ */
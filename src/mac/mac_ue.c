@@ -32,8 +32,14 @@ MacUE mac_ue_init()
 	mac->fragmenter = mac_frag_init();
 	mac->reassembler = mac_assmbl_init();
     mac->reassembler_brcst = mac_assmbl_init();
+	mac->hc = mac_hc_init();
+	mac_frag_set_hc(mac->fragmenter, mac->hc);
+	mac_frag_set_arq(mac->fragmenter, 1);
+	mac_assmbl_set_arq(mac->reassembler, 1);
+	mac_la_init(&mac->la_dl, MAC_LA_SNR_ALPHA);
+	pthread_mutex_init(&mac->harq_fb_lock, NULL);
 #ifdef MAC_ENABLE_TAP_DEV
-	mac->tapdevice = tap_init("tap0");
+	mac->tap_pool = framepool_create(MAC_TAP_POOL_SIZE_UE, MAC_MTU);
 #endif
 	return mac;
 }
@@ -42,11 +48,16 @@ void mac_ue_destroy(MacUE mac)
 {
 	mac_frag_destroy(mac->fragmenter);
 	mac_assmbl_destroy(mac->reassembler);
+	mac_hc_destroy(mac->hc);
+	mac_harq_tx_reset(&mac->harq_ul);
 	while (!ringbuf_isempty(mac->msg_control_queue)) {
 		MacMessage p = ringbuf_get(mac->msg_control_queue);
 		mac_msg_destroy(p);
 	}
 	ringbuf_destroy(mac->msg_control_queue);
+	if (mac->tap_pool)
+		framepool_destroy(mac->tap_pool);
+	pthread_mutex_destroy(&mac->harq_fb_lock);
 	free(mac);
 }
 
@@ -57,6 +68,32 @@ void mac_ue_set_phy_interface(MacUE mac, struct PhyUE_s* phy)
 	mac->phy = phy;
 }
 
+// Deliver a reassembled DL frame. Unicast frames may have compressed headers
+static void mac_ue_rx_frame(MacUE mac, MacDataFrame frame, uint is_broadcast)
+{
+	if (!is_broadcast)
+		frame = mac_hc_decompress(mac->hc, frame);
+	if (frame == NULL)
+		return;
+	mac->stats.bytes_rx += frame->size;
+	LOG(INFO,"[MAC UE] received dataframe of %d bytes. brdcst: %d\n",frame->size, is_broadcast);
+	//PRINT_BIN(INFO,frame->data,frame->size); LOG(INFO,"\n");
+
+#ifdef MAC_TEST_DELAY
+	static uint sfn=0;
+	memcpy(&sfn,frame->data,sizeof(uint));
+	if (sfn<num_simulated_subframes)
+		mac_dl_timestamps[sfn] += global_sfn*SUBFRAME_LEN+global_symbol;
+#endif
+
+#ifdef MAC_ENABLE_TAP_DEV
+	// egress thread writes the frame to TAP and destroys it
+	tap_send_frame(mac->tapdevice,frame);
+#else
+	dataframe_destroy(frame);
+#endif
+}
+
 // Generic handler for received messages
 int mac_ue_handle_message(MacUE mac, MacMessage msg, uint is_broadcast)
 {
@@ -82,6 +119,17 @@ int mac_ue_handle_message(MacUE mac, MacMessage msg, uint is_broadcast)
 			mac->userid = msg->hdr.AssociateResponse.userid;
 			mac->dl_mcs = 0;
 			mac->ul_mcs = 0;
+			mac->sps_slots = 0;		// BS has no semi-persistent assignment for us yet
+			mac_hc_reset(mac->hc);	// BS starts without header compression contexts
+			mac->la_crc_ok = 0;
+			mac->la_crc_fail = 0;
+			mac->la_report_due = 0;
+			mac_harq_tx_reset(&mac->harq_ul);
+			pthread_mutex_lock(&mac->harq_fb_lock);
+			memset(mac->harq_fb, 0, sizeof(mac->harq_fb));
+			pthread_mutex_unlock(&mac->harq_fb_lock);
+			mac_frag_arq_reset(mac->fragmenter);	// sequence numbers start at 0 again
+			mac_assmbl_reset(mac->reassembler);
             mac->timing_advance = msg->hdr.AssociateResponse.timing_advance;
 			phy_ue_set_mcs_dl(mac->phy,0);
 			// init mac statistics
@@ -135,28 +183,23 @@ int mac_ue_handle_message(MacUE mac, MacMessage msg, uint is_broadcast)
 		mac->userid = 0;
 		break;
 	case dl_data:
-        if (is_broadcast)
-            frame = mac_assmbl_reassemble(mac->reassembler_brcst, msg);
-        else
-            frame = mac_assmbl_reassemble(mac->reassembler, msg);
-		if (frame != NULL) {
-			mac->stats.bytes_rx += frame->size;
-            LOG(INFO,"[MAC UE] received dataframe of %d bytes. brdcst: %d\n",frame->size, is_broadcast);
-			//PRINT_BIN(INFO,frame->data,frame->size); LOG(INFO,"\n");
-
-#ifdef MAC_ENABLE_TAP_DEV
-			tap_send(mac->tapdevice,frame->data,frame->size);
-#endif
-
-#ifdef MAC_TEST_DELAY
-			static uint sfn=0;
-			memcpy(&sfn,frame->data,sizeof(uint));
-			if (sfn<num_simulated_subframes)
-				mac_dl_timestamps[sfn] += global_sfn*SUBFRAME_LEN+global_symbol;
-#endif
-			dataframe_destroy(frame);
+		if (is_broadcast) {
+			frame = mac_assmbl_reassemble(mac->reassembler_brcst, msg);
+			if (frame != NULL)
+				mac_ue_rx_frame(mac, frame, 1);
+		} else {
+			frame = mac_assmbl_reassemble(mac->reassembler, msg);
+			while (frame != NULL) {
+				mac_ue_rx_frame(mac, frame, 0);
+				frame = mac_assmbl_get_frame(mac->reassembler);
+			}
 		}
 		break;
+	case dl_arq_status:
+		LOG_SFN_MAC(DEBUG,"[MAC UE] ARQ status: ack %d bitmap %x\n",
+					msg->hdr.ARQStatus.ack_sn, msg->hdr.ARQStatus.bitmap);
+		mac_frag_arq_status(mac->fragmenter, msg->hdr.ARQStatus.ack_sn, msg->hdr.ARQStatus.bitmap);
+		break;
 	default:
 		LOG(WARN,"[MAC UE] unexpected MacMsg ID: %d\n",msg->type);
 		mac_msg_destroy(msg);
@@ -166,12 +209,191 @@ int mac_ue_handle_message(MacUE mac, MacMessage msg, uint is_broadcast)
 	return 1;
 }
 
-// Set the channel assignments which were decoded in the DLCTRL slot
-void mac_ue_set_assignments(MacUE mac, uint8_t* dlslot, uint8_t* ulslot, uint8_t* ulctrl)
+// Set the channel assignments which were decoded in the DLCTRL slot of subframe sfn.
+// ulrb are the resource blocks of the split UL slot, ulmini the mini-slots of UL slots split in time.
+// ul_retx marks the assigned UL slots in which a HARQ retransmission is expected
+void mac_ue_set_assignments(MacUE mac, uint sfn, uint8_t* dlslot, uint8_t* ulslot, uint8_t* ulctrl,
+							uint8_t* ulrb, uint8_t* ulmini, uint8_t ul_retx)
 {
 	memcpy(mac->dl_data_assignments, dlslot, MAC_DLDATA_SLOTS);
 	memcpy(mac->ul_data_assignments, ulslot, MAC_ULDATA_SLOTS);
 	memcpy(mac->ul_ctrl_assignments, ulctrl, MAC_ULCTRL_SLOTS);
+	memcpy(mac->ul_rb_assignments, ulrb, NUM_UL_RB);
+	memcpy(mac->ul_mini_assignments, ulmini, MAC_ULDATA_SLOTS*NUM_MINI_SLOT);
+	mac->ul_retx = ul_retx;
+
+	harq_feedback_s* fb = &mac->harq_fb[sfn%FRAME_LEN];
+	pthread_mutex_lock(&mac->harq_fb_lock);
+	memset(fb, 0, sizeof(harq_feedback_s));
+	fb->time = mac->subframe_cnt;
+	pthread_mutex_unlock(&mac->harq_fb_lock);
+}
+
+// Called by PHY with the CRC result of a unicast DL slot after num_rx receptions of the block
+void mac_ue_harq_result(MacUE mac, uint sfn, uint slot, int crc_ok, uint num_rx)
+{
+	harq_feedback_s* fb = &mac->harq_fb[sfn%FRAME_LEN];
+	pthread_mutex_lock(&mac->harq_fb_lock);
+	if (crc_ok)
+		fb->ack |= 1<<slot;
+	else
+		fb->nack |= 1<<slot;
+	pthread_mutex_unlock(&mac->harq_fb_lock);
+
+	// only first transmissions tell whether the MCS fits
+	if (num_rx==1) {
+		if (crc_ok)
+			mac->la_crc_ok++;
+		else
+			mac->la_crc_fail++;
+	}
+}
+
+// Get the buffer status that is reported to the BS. It is the UL slot
+// payload (TBS without CRC) required to send all buffered data with the current
+// MCS, i.e. includes fragment and ul_req headers and the padding of the
+// last fragment of each frame. Thus the BS can grant the exact number of slots
+uint mac_ue_get_ul_req_size(MacUE mac)
+{
+	uint slot_payload = get_tbs_size(mac->phy->common,mac->ul_mcs)/8 - CRC16_LEN;
+	uint num_frags = mac_frag_get_num_fragments(mac->fragmenter,
+												slot_payload-mac_msg_get_hdrlen(ul_req));
+	uint size = num_frags*slot_payload;
+	// the ARQ status report needs an UL data slot
+	if (size==0 && mac_assmbl_status_due(mac->reassembler))
+		size = slot_payload;
+	return size > MAC_UL_REQ_MAX ? MAC_UL_REQ_MAX : size;
+}
+
+// Request, adapt or release semi-persistent UL slots for periodic flows.
+// The BS places the first occasion arbitrarily. Whenever the UE is assigned
+// while the periodic frame waits for more than one subframe, or shortly before
+// it arrives, it requests to shift the occasions
+void mac_ue_sps_update(MacUE mac, int num_assigned, uint queuesize)
+{
+	sps_detector_s* det = &mac->sps_det;
+	uint slots = 0;
+	int shift = 0;
+
+	sps_detect_update(det, mac->subframe_cnt);
+	if (det->active) {
+		uint frag_payload = get_tbs_size(mac->phy->common,mac->ul_mcs)/8 - CRC16_LEN
+							- mac_msg_get_hdrlen(ul_req) - mac_msg_get_hdrlen(ul_data);
+		slots = sps_num_slots(det->max_size, frag_payload);
+	}
+
+	if (mac->sps_slots>0 && slots>0 && num_assigned>0 && mac->subframe_cnt >= mac->sps_next_adjust) {
+		uint wait = mac->subframe_cnt - det->last_arrival;
+		long long int next_arrival = det->last_arrival*SPS_Q + det->period;
+		if (queuesize>0 && wait>=2 && wait*SPS_Q < det->period) {
+			// frame waited for the occasion. Move occasions earlier
+			shift = (wait-1 > 3) ? 3 : wait-1;
+		} else if (queuesize==0 && next_arrival - (long long int)mac->subframe_cnt*SPS_Q <= SPS_Q) {
+			// occasion just before the frame arrives. Move it later
+			shift = -1;
+		}
+	}
+
+	if (slots != mac->sps_slots || shift != 0 ||
+			(slots>0 && abs((int)det->period - (int)mac->sps_period) > SPS_Q/2)) {
+		MacMessage msg = mac_msg_create_sps_req(slots ? det->period : 0, slots, shift);
+		if (!ringbuf_put(mac->msg_control_queue, msg)) {
+			mac_msg_destroy(msg);
+			return;
+		}
+		LOG_SFN_MAC(INFO,"[MAC UE] sps_req period %.2f slots %d shift %d\n",
+					(float)det->period/SPS_Q, slots, shift);
+		mac->sps_slots = slots;
+		mac->sps_period = det->period;
+		// let the BS apply the change before adapting again
+		mac->sps_next_adjust = mac->subframe_cnt + 2*det->period/SPS_Q;
+	}
+}
+
+// Add the channel_quality message to the logical channel if a report is due and fits
+static void mac_ue_add_quality_report(MacUE mac, LogicalChannel chan)
+{
+	if (!mac->la_report_due || lchan_unused_bytes(chan) < mac_msg_get_hdrlen(channel_quality))
+		return;
+	MacMessage msg = mac_msg_create_channel_quality(mac->la_dl.snr, mac->la_crc_ok, mac->la_crc_fail);
+	lchan_add_message(chan, msg);
+	mac_msg_destroy(msg);
+	mac->la_crc_ok = 0;
+	mac->la_crc_fail = 0;
+	mac->la_report_due = 0;
+}
+
+// Add harq_ack messages with the CRC results of the DL subframes that were not reported yet.
+// Results that arrive after the BS scheduled the retransmission are not sent
+static void mac_ue_add_harq_feedback(MacUE mac, LogicalChannel chan)
+{
+	pthread_mutex_lock(&mac->harq_fb_lock);
+	for (int sfn=0; sfn<FRAME_LEN; sfn++) {
+		harq_feedback_s* fb = &mac->harq_fb[sfn];
+		uint results = fb->ack | fb->nack;
+		if ((results & ~fb->reported)==0 || mac->subframe_cnt - fb->time > HARQ_RTT-2)
+			continue;
+		if (lchan_unused_bytes(chan) < mac_msg_get_hdrlen(harq_ack))
+			break;
+		MacMessage msg = mac_msg_create_harq_ack(sfn, fb->ack, fb->nack);
+		lchan_add_message(chan, msg);
+		mac_msg_destroy(msg);
+		fb->reported = results;
+	}
+	pthread_mutex_unlock(&mac->harq_fb_lock);
+}
+
+// Add the ARQ status report of the DL fragments if it is due and fits
+static void mac_ue_add_arq_status(MacUE mac, LogicalChannel chan)
+{
+	if (!mac_assmbl_status_due(mac->reassembler) ||
+			lchan_unused_bytes(chan) < mac_msg_get_hdrlen(ul_arq_status))
+		return;
+	MacMessage msg = mac_assmbl_get_status(mac->reassembler, 1);
+	lchan_add_message(chan, msg);
+	mac_msg_destroy(msg);
+}
+
+// Run the DL reordering timer. Frames that were waiting for a missing fragment are
+// delivered when the fragment is given up. Called by the PHY once per subframe in the
+// thread that decodes the DL data slots, which is the only one that delivers frames to TAP
+void mac_ue_rx_arq_update(MacUE mac)
+{
+	MacDataFrame frame;
+	mac_assmbl_arq_update(mac->reassembler, mac->subframe_cnt);
+	while ((frame = mac_assmbl_get_frame(mac->reassembler)) != NULL)
+		mac_ue_rx_frame(mac, frame, 0);
+}
+
+// Create the logical channel of an UL data slot or resource block: control messages,
+// HARQ feedback, ARQ status, quality report, a data fragment and the buffer status
+static LogicalChannel mac_ue_create_ul_chan(MacUE mac, uint size, uint queuesize)
+{
+	LogicalChannel chan = lchan_create(size, CRC16);
+	lchan_add_all_msgs(chan, mac->msg_control_queue);
+	mac_ue_add_harq_feedback(mac, chan);
+	mac_ue_add_arq_status(mac, chan);
+	mac_ue_add_quality_report(mac, chan);
+	// leave space for the buffer status report
+	int frag_size = lchan_unused_bytes(chan)-mac_msg_get_hdrlen(ul_req);
+	if (queuesize>0 && frag_size > mac_msg_get_hdrlen(ul_data)) {
+		// client is assigned to slot and has data
+		MacMessage msg = mac_frag_get_fragment(mac->fragmenter, frag_size, 1);
+		if (msg) {
+			lchan_add_message(chan, msg);
+			mac->stats.bytes_tx+=msg->payload_len;
+			mac_msg_destroy(msg);
+		}
+	}
+	// piggyback the buffer status in every UL slot. If the client
+	// has no data, it serves as keepalive
+	if (lchan_unused_bytes(chan) >= mac_msg_get_hdrlen(ul_req)) {
+		MacMessage msg = mac_msg_create_ul_req(mac_ue_get_ul_req_size(mac));
+		lchan_add_message(chan, msg);
+		mac_msg_destroy(msg);
+	}
+	lchan_calc_crc(chan);
+	return chan;
 }
 
 // UE scheduler. Is called once per subframe
@@ -180,10 +402,11 @@ void mac_ue_set_assignments(MacUE mac, uint8_t* dlslot, uint8_t* ulslot, uint8_t
 // the slot assignment variables are up to date
 void mac_ue_run_scheduler(MacUE mac)
 {
+	mac_frag_arq_update(mac->fragmenter, mac->subframe_cnt);
 	uint queuesize = mac_frag_get_buffersize(mac->fragmenter);
 	uint slotsize = get_tbs_size(mac->phy->common,mac->ul_mcs)/8;
 	int num_assigned = num_slot_assigned(mac->ul_data_assignments,MAC_ULDATA_SLOTS,UE_ASSIGNED);
-	uint next_sfn = (mac->phy->common->tx_subframe+1) % 2; // subframe for which the scheduler is run
+	uint next_sfn = (mac->phy->common->tx_subframe+1) % FRAME_LEN; // subframe for which the scheduler is run
 	// Log schedule
 	LOG(TRACE,"[MAC UE] Scheduler user assignments:\n");
 	LOG(TRACE,"         DL data slots: %4d %4d %4d %4d\n", mac->dl_data_assignments[0],
@@ -208,68 +431,86 @@ void mac_ue_run_scheduler(MacUE mac)
 	// reset symbol allocation. Will be set during phy modulation
 	phy_ue_reset_symbol_allocation(mac->phy, next_sfn%2);
 
+	// request recurring UL slots for periodic flows
+	mac_ue_sps_update(mac, num_assigned, queuesize);
+
+	// report the DL quality in the next UL data or ctrl slot
+	if (mac->la_dl.has_snr && mac->subframe_cnt % MAC_LA_REPORT_INTERVAL == 0)
+		mac->la_report_due = 1;
+
     // iterate over slots and check if the client is assigned to it
 	if (num_assigned>0) {
 		mac->last_assignment = mac->subframe_cnt;
 		for (int i=0; i<MAC_ULDATA_SLOTS; i++) {
 			if (mac->ul_data_assignments[i] == 1) {
-				num_assigned--;
-				LogicalChannel chan = lchan_create(slotsize, CRC16);
-				lchan_add_all_msgs(chan, mac->msg_control_queue);
-				if (queuesize>0) {
-					// client is assigned to slot and has data
-                    if (num_assigned==0 && queuesize>lchan_unused_bytes(chan)) {
-						// this is the last assigned slot within subframe
-						// if we still have remaining data, add a ul_req to this slot
-                        uint remaining_bytes = queuesize-lchan_unused_bytes(chan)+mac_msg_get_hdrlen(ul_req);
-                        MacMessage msg = mac_msg_create_ul_req(remaining_bytes);
-						lchan_add_message(chan, msg);
-						mac_msg_destroy(msg);
-					}
-					MacMessage msg = mac_frag_get_fragment(mac->fragmenter,
-													lchan_unused_bytes(chan),1);
-					lchan_add_message(chan, msg);
-					mac->stats.bytes_tx+=msg->payload_len;
-					mac_msg_destroy(msg);
-				} else {
-					// client is assigned to slot but has no data
-					// send keepalive instead.
-					MacMessage msg = mac_msg_create_keepalive();
-					lchan_add_message(chan, msg);
-					mac_msg_destroy(msg);
+				// resend the block of this HARQ process if the BS asks for it. If the block
+				// is gone, new data is sent and the BS decodes it on its own
+				harq_tx_proc_s* p = &mac->harq_ul.proc[HARQ_PROC(next_sfn, i)];
+				if ((mac->ul_retx & (1<<i)) && p->chan && p->tx_time+HARQ_RTT == mac->subframe_cnt &&
+						p->num_tx < HARQ_MAX_TX) {
+					phy_map_ulslot(mac->phy, p->chan, next_sfn%2, i, p->mcs);
+					mac_harq_tx_retransmit(p, NULL, next_sfn, mac->subframe_cnt);
+					continue;
 				}
-				lchan_calc_crc(chan);
-				phy_map_ulslot(mac->phy,chan,next_sfn, i, mac->ul_mcs);
-				lchan_destroy(chan);
+				LogicalChannel chan = mac_ue_create_ul_chan(mac, slotsize, queuesize);
+				phy_map_ulslot(mac->phy,chan,next_sfn%2, i, mac->ul_mcs);
+				mac_harq_tx_new(&mac->harq_ul, NULL, next_sfn, i, chan, mac->ul_mcs, mac->subframe_cnt);
 				queuesize = mac_frag_get_buffersize(mac->fragmenter);
 			}
 		}
 	}
 
+	// resource blocks of the split UL slot. They are not retransmitted by HARQ, lost
+	// fragments are recovered by ARQ
+	for (int rb=0; rb<NUM_UL_RB; rb++) {
+		if (mac->ul_rb_assignments[rb] != UE_ASSIGNED)
+			continue;
+		mac->last_assignment = mac->subframe_cnt;
+		uint rbsize = get_rb_tbs_size(mac->phy->common,mac->ul_mcs)/8;
+		LogicalChannel chan = mac_ue_create_ul_chan(mac, rbsize, queuesize);
+		phy_map_ulrb(mac->phy, chan, next_sfn%2, rb, mac->ul_mcs);
+		lchan_destroy(chan);
+		queuesize = mac_frag_get_buffersize(mac->fragmenter);
+	}
+
+	// mini-slots of UL slots split in time. Like resource blocks, they are not retransmitted by HARQ
+	for (int i=0; i<MAC_ULDATA_SLOTS*NUM_MINI_SLOT; i++) {
+		if (mac->ul_mini_assignments[i] != UE_ASSIGNED)
+			continue;
+		mac->last_assignment = mac->subframe_cnt;
+		uint minisize = get_mini_tbs_size(mac->phy->common,mac->ul_mcs)/8;
+		LogicalChannel chan = mac_ue_create_ul_chan(mac, minisize, queuesize);
+		phy_map_ulmini(mac->phy, chan, next_sfn%2, i/NUM_MINI_SLOT, i%NUM_MINI_SLOT, mac->ul_mcs);
+		lchan_destroy(chan);
+		queuesize = mac_frag_get_buffersize(mac->fragmenter);
+	}
+
 	// check for ULctrl slots
 	if (num_slot_assigned(mac->ul_ctrl_assignments, MAC_ULCTRL_SLOTS, 1)>0) {
 		mac->last_assignment = mac->subframe_cnt;
 
 		// check if we have to create ul_req
-		if (queuesize>0) {
-			MacMessage msg = mac_msg_create_ul_req(queuesize);
-			ringbuf_put(mac->msg_control_queue, msg);
-		}
-
-		// if there are no ctrl messages to be sent we have to create keepalive
-		if (ringbuf_isempty(mac->msg_control_queue)) {
-			MacMessage msg = mac_msg_create_keepalive();
+		if (queuesize>0 || mac_assmbl_status_due(mac->reassembler)) {
+			MacMessage msg = mac_msg_create_ul_req(mac_ue_get_ul_req_size(mac));
 			ringbuf_put(mac->msg_control_queue, msg);
 		}
 
 		// create logical channel with control messages
 		LogicalChannel chan = lchan_create(get_ulctrl_slot_size(mac->phy->common)/8,CRC8);
 		lchan_add_all_msgs(chan, mac->msg_control_queue);
+		mac_ue_add_harq_feedback(mac, chan);
+		mac_ue_add_quality_report(mac, chan);
+		// if there is nothing else to send, an empty buffer status serves as keepalive
+		if (chan->writepos == 0) {
+			MacMessage msg = mac_msg_create_ul_req(mac_ue_get_ul_req_size(mac));
+			lchan_add_message(chan, msg);
+			mac_msg_destroy(msg);
+		}
 		lchan_calc_crc(chan);
 		// find the ulctrl slot in which we can transmit
 		for (int i=0; i<MAC_ULCTRL_SLOTS; i++) {
 			if (mac->ul_ctrl_assignments[i] == UE_ASSIGNED) {
-				phy_map_ulctrl(mac->phy,chan,next_sfn,i);
+				phy_map_ulctrl(mac->phy,chan,next_sfn%2,i);
 				LOG_SFN_MAC(DEBUG,"[MAC UE] map ulctrl %d %d\n",mac->phy->common->tx_subframe,mac->phy->common->tx_symbol);
 			}
 		}
@@ -311,7 +552,11 @@ void mac_ue_rx_channel(MacUE mac, LogicalChannel chan, uint is_broadcast)
 // Add a higher layer packet to the tx queue
 int mac_ue_add_txdata(MacUE mac, MacDataFrame frame)
 {
-	return mac_frag_add_frame(mac->fragmenter, frame);
+	uint size = frame->size;
+	if (!mac_frag_add_frame(mac->fragmenter, frame))
+		return 0;
+	sps_detect_record(&mac->sps_det, mac->subframe_cnt, size);
+	return 1;
 }
 
 int mac_ue_is_associated(MacUE mac)
@@ -329,6 +574,12 @@ void mac_ue_req_mcs_change(MacUE mac, uint mcs, uint is_ul)
     }
 }
 
+// Called by PHY with the SNR measured in the DL ctrl slot
+void mac_ue_dl_quality(MacUE mac, float snr)
+{
+	mac_la_add_snr(&mac->la_dl, snr);
+}
+
 int mac_ue_get_timing_advance(MacUE mac)
 {
     return mac->timing_advance;
@@ -344,21 +595,30 @@ void* mac_ue_tap_rx_th(void* arg)
 	}
 	LOG(INFO,"[MAC/TAP] start TAP thread\n");
 	while (1) {
-		// ensure that we we have space to add a packet to the mac queue
-		while (mac_frag_queue_full(mac->fragmenter)) {
-			usleep(10000);
-		}
+		// Backpressure: stop reading from TAP if all frame buffers are in use.
+		// Frames of a traffic class with a full queue are dropped, so that
+		// bulk traffic cannot block the higher priority classes
+		if (!framepool_wait(mac->tap_pool, 1000))
+			continue;
 
-		// wait for packet from TAP
-		tap_receive(mac->tapdevice);
+		// wait for packets from TAP
+		if (!tap_wait(mac->tapdevice, 1000))
+			continue;
 
-		// forward to MAC
-		if (mac->tapdevice->bytes_rec>0) {
-			MacDataFrame frame = dataframe_create(mac->tapdevice->bytes_rec);
-			memcpy(frame->data,mac->tapdevice->buffer,frame->size);
+		// drain pending frames directly into pooled buffers
+		for (int i=0; i<MAC_TAP_RX_BATCH; i++) {
+			MacDataFrame frame = framepool_get(mac->tap_pool);
+			if (frame == NULL)
+				break;
+			frame->size = tap_receive(mac->tapdevice, frame->data, frame->size);
+			if (frame->size == 0) {
+				dataframe_destroy(frame);
+				break;
+			}
+			frame->tclass = mac_classify_frame(frame->data, frame->size);
 			if (!mac_ue_add_txdata(mac, frame)) {
 				dataframe_destroy(frame);
-				LOG(WARN,"[MAC UE] could not forward TAP data to MAC. queue full\n");
+				LOG(DEBUG,"[MAC UE] could not forward TAP data to MAC. queue full\n");
 			}
 		}
 	}
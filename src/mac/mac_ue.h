@@ -23,7 +23,11 @@
 #include "mac_common.h"
 #include "mac_config.h"
 #include "mac_fragmentation.h"
+#include "mac_sps.h"
+#include "mac_la.h"
+#include "mac_harq.h"
 #include "tap_dev.h"
+#include <pthread.h>
 
 struct PhyUE_s;
 typedef struct PhyUE_s* PhyUE;
@@ -38,12 +42,16 @@ struct MacUE_s {
 	ringbuf msg_control_queue;
 	MacFrag fragmenter;
     MacAssmbl reassembler;              // reassembles unicast frames
+    MacHC hc;                           // header compression contexts
     MacAssmbl reassembler_brcst;        // reassemble broadcast frames
 	tap_dev tapdevice;
+	FramePool tap_pool;					// frame buffers for TAP ingress
 
 	uint8_t ul_ctrl_assignments[MAC_ULCTRL_SLOTS]; //TODO the assignments are already defined in PHY instance
 	uint8_t ul_data_assignments[MAC_ULDATA_SLOTS];
 	uint8_t dl_data_assignments[MAC_DLDATA_SLOTS];
+	uint8_t ul_rb_assignments[NUM_UL_RB];	// resource blocks of the split UL slot
+	uint8_t ul_mini_assignments[MAC_ULDATA_SLOTS*NUM_MINI_SLOT];	// mini-slots of UL slots split in time
 
 	uint8_t is_associated;
 
@@ -53,6 +61,24 @@ struct MacUE_s {
 
 	struct PhyUE_s* phy;
 
+	// semi-persistent UL scheduling
+	sps_detector_s sps_det;				// detects periodic UL frames
+	uint sps_slots;						// requested slots per occasion. 0 if not requested
+	uint sps_period;					// requested period [1/SPS_Q subframes]
+	long unsigned int sps_next_adjust;	// earliest subframe for the next phase adjustment
+
+	// DL channel quality reports for the link adaptation at the BS
+	link_adapt_s la_dl;					// filtered DL SNR
+	uint la_crc_ok;						// unicast DL slots received since the last report
+	uint la_crc_fail;
+	uint la_report_due;					// a report is sent in the next UL slot
+
+	// HARQ
+	harq_tx_s harq_ul;					// UL blocks kept for retransmission
+	uint8_t ul_retx;					// UL slots in which the BS expects a retransmission
+	harq_feedback_s harq_fb[FRAME_LEN];	// CRC results of the DL slots per subframe
+	pthread_mutex_t harq_fb_lock;		// results arrive in the receive threads, the scheduler reports them
+
 	MACstat_s stats;
 };
 
@@ -64,11 +90,16 @@ void  mac_ue_destroy(MacUE mac);
 void  mac_ue_set_phy_interface(MacUE mac, PhyUE phy);
 
 /************** MAC INTERFACE FUNCTIONS *************************/
-void mac_ue_set_assignments(MacUE mac, uint8_t* dlslot, uint8_t* ulslot, uint8_t* ulctrl);
+void mac_ue_set_assignments(MacUE mac, uint sfn, uint8_t* dlslot, uint8_t* ulslot, uint8_t* ulctrl,
+							uint8_t* ulrb, uint8_t* ulmini, uint8_t ul_retx);
+void mac_ue_harq_result(MacUE mac, uint sfn, uint slot, int crc_ok, uint num_rx);
+void mac_ue_rx_arq_update(MacUE mac);
 void mac_ue_run_scheduler(MacUE mac);
+uint mac_ue_get_ul_req_size(MacUE mac);
 void mac_ue_rx_channel(MacUE mac, LogicalChannel chan, uint is_broadcast);
 int  mac_ue_add_txdata(MacUE mac, MacDataFrame frame);
 void mac_ue_req_mcs_change(MacUE mac, uint mcs, uint is_ul);
+void mac_ue_dl_quality(MacUE mac, float snr);
 
 /*** Getter functions ***/
 int mac_ue_is_associated(MacUE mac);
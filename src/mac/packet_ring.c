@@ -0,0 +1,268 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#include "packet_ring.h"
+
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "../util/log.h"
+
+// available since Linux 4.20. Do not loop back our own TX frames
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif
+
+// Ring geometry
+#define PKT_RING_BLOCK_SIZE (1<<16)		// 64kB per block
+#define PKT_RING_FRAME_SIZE (1<<11)		// 2kB per frame, fits one Ethernet frame
+#define PKT_RING_RX_BLOCKS 8
+#define PKT_RING_TX_BLOCKS 2
+#define PKT_RING_RX_BLOCK_TIMEOUT 1		// retire partially filled RX blocks after 1ms
+
+struct packet_ring_s {
+	int fd;
+	uint8_t* map;			// mmap of RX ring followed by TX ring
+	size_t map_len;
+
+	// RX ring state
+	uint8_t* rx_ring;
+	uint rx_block;						// block that is currently processed
+	struct tpacket3_hdr* rx_pkt;		// next packet within the current block
+	uint rx_remaining;					// number of unread packets within the current block
+	uint rx_oversized;					// frames dropped because they exceed the receive buffer
+
+	// TX ring state
+	uint8_t* tx_ring;
+	uint tx_frame_nr;
+	uint tx_frame;						// next frame to be used
+	uint tx_pending;					// frames placed in the ring but not flushed yet
+};
+
+static struct tpacket_block_desc* rx_block_desc(packet_ring ring, uint block)
+{
+	return (struct tpacket_block_desc*)(ring->rx_ring + block*PKT_RING_BLOCK_SIZE);
+}
+
+static struct tpacket3_hdr* tx_frame_hdr(packet_ring ring, uint frame)
+{
+	return (struct tpacket3_hdr*)(ring->tx_ring + frame*PKT_RING_FRAME_SIZE);
+}
+
+packet_ring packet_ring_init(char* ifname)
+{
+	packet_ring ring = calloc(sizeof(struct packet_ring_s),1);
+
+	ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (ring->fd < 0) {
+		LOG(ERR,"[PACKET RING] cannot open AF_PACKET socket: %s\n",strerror(errno));
+		free(ring);
+		return NULL;
+	}
+
+	int version = TPACKET_V3;
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		LOG(ERR,"[PACKET RING] TPACKET_V3 not supported: %s\n",strerror(errno));
+		goto fail;
+	}
+
+	struct tpacket_req3 rx_req = {0};
+	rx_req.tp_block_size = PKT_RING_BLOCK_SIZE;
+	rx_req.tp_block_nr = PKT_RING_RX_BLOCKS;
+	rx_req.tp_frame_size = PKT_RING_FRAME_SIZE;
+	rx_req.tp_frame_nr = PKT_RING_BLOCK_SIZE/PKT_RING_FRAME_SIZE*PKT_RING_RX_BLOCKS;
+	rx_req.tp_retire_blk_tov = PKT_RING_RX_BLOCK_TIMEOUT;
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &rx_req, sizeof(rx_req)) < 0) {
+		LOG(ERR,"[PACKET RING] cannot create RX ring: %s\n",strerror(errno));
+		goto fail;
+	}
+
+	struct tpacket_req3 tx_req = {0};
+	tx_req.tp_block_size = PKT_RING_BLOCK_SIZE;
+	tx_req.tp_block_nr = PKT_RING_TX_BLOCKS;
+	tx_req.tp_frame_size = PKT_RING_FRAME_SIZE;
+	tx_req.tp_frame_nr = PKT_RING_BLOCK_SIZE/PKT_RING_FRAME_SIZE*PKT_RING_TX_BLOCKS;
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_TX_RING, &tx_req, sizeof(tx_req)) < 0) {
+		LOG(ERR,"[PACKET RING] cannot create TX ring: %s\n",strerror(errno));
+		goto fail;
+	}
+	ring->tx_frame_nr = tx_req.tp_frame_nr;
+
+	// RX and TX ring are mapped with a single mmap call. RX ring comes first
+	ring->map_len = (size_t)PKT_RING_BLOCK_SIZE*(PKT_RING_RX_BLOCKS+PKT_RING_TX_BLOCKS);
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (ring->map == MAP_FAILED) {
+		LOG(ERR,"[PACKET RING] cannot mmap rings: %s\n",strerror(errno));
+		goto fail;
+	}
+	ring->rx_ring = ring->map;
+	ring->tx_ring = ring->map + PKT_RING_BLOCK_SIZE*PKT_RING_RX_BLOCKS;
+
+	int ignore_outgoing = 1;
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore_outgoing, sizeof(ignore_outgoing)) < 0)
+		LOG(INFO,"[PACKET RING] PACKET_IGNORE_OUTGOING not supported. Filter in userspace\n");
+
+	// bind to interface
+	struct sockaddr_ll addr = {0};
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_ALL);
+	addr.sll_ifindex = if_nametoindex(ifname);
+	if (addr.sll_ifindex == 0 || bind(ring->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		LOG(ERR,"[PACKET RING] cannot bind to interface %s: %s\n",ifname,strerror(errno));
+		goto fail;
+	}
+
+	// we bridge the interface, thus we need to receive all frames
+	struct packet_mreq mreq = {0};
+	mreq.mr_ifindex = addr.sll_ifindex;
+	mreq.mr_type = PACKET_MR_PROMISC;
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+		LOG(WARN,"[PACKET RING] cannot set %s to promiscuous mode: %s\n",ifname,strerror(errno));
+
+	LOG(INFO,"[PACKET RING] attached to interface %s\n",ifname);
+	return ring;
+
+fail:
+	if (ring->map && ring->map != MAP_FAILED)
+		munmap(ring->map, ring->map_len);
+	close(ring->fd);
+	free(ring);
+	return NULL;
+}
+
+void packet_ring_destroy(packet_ring ring)
+{
+	packet_ring_flush(ring);
+	munmap(ring->map, ring->map_len);
+	close(ring->fd);
+	free(ring);
+}
+
+int packet_ring_fd(packet_ring ring)
+{
+	return ring->fd;
+}
+
+// give the current RX block back to the kernel and advance to the next one
+static void rx_release_block(packet_ring ring)
+{
+	struct tpacket_block_desc* bd = rx_block_desc(ring, ring->rx_block);
+	__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+	ring->rx_block = (ring->rx_block+1) % PKT_RING_RX_BLOCKS;
+	ring->rx_pkt = NULL;
+	ring->rx_remaining = 0;
+}
+
+int packet_ring_rx_pending(packet_ring ring)
+{
+	if (ring->rx_pkt != NULL)
+		return 1;
+	struct tpacket_block_desc* bd = rx_block_desc(ring, ring->rx_block);
+	return (__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) != 0;
+}
+
+int packet_ring_receive(packet_ring ring, uint8_t* buf, unsigned int buflen)
+{
+	while (packet_ring_rx_pending(ring)) {
+		if (ring->rx_pkt == NULL) {
+			// start processing of a new block
+			struct tpacket_block_desc* bd = rx_block_desc(ring, ring->rx_block);
+			ring->rx_remaining = bd->hdr.bh1.num_pkts;
+			if (ring->rx_remaining == 0) {
+				rx_release_block(ring);
+				continue;
+			}
+			ring->rx_pkt = (struct tpacket3_hdr*)((uint8_t*)bd + bd->hdr.bh1.offset_to_first_pkt);
+		}
+
+		struct tpacket3_hdr* hdr = ring->rx_pkt;
+		struct sockaddr_ll* sll = (struct sockaddr_ll*)((uint8_t*)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+		uint len = hdr->tp_snaplen;
+		int skip = (sll->sll_pkttype == PACKET_OUTGOING);
+		if (!skip && (hdr->tp_len > buflen || len < hdr->tp_len)) {
+			// i.e. GRO aggregates. A truncated frame must not be forwarded
+			LOG(WARN,"[PACKET RING] frame with %d bytes exceeds buffer. Drop it\n",hdr->tp_len);
+			ring->rx_oversized++;
+			skip = 1;
+		}
+		if (!skip)
+			memcpy(buf, (uint8_t*)hdr + hdr->tp_mac, len);
+
+		// advance to next packet
+		ring->rx_remaining--;
+		if (ring->rx_remaining == 0)
+			rx_release_block(ring);
+		else
+			ring->rx_pkt = (struct tpacket3_hdr*)((uint8_t*)hdr + hdr->tp_next_offset);
+
+		if (!skip)
+			return len;
+	}
+	return 0;
+}
+
+unsigned int packet_ring_rx_oversized(packet_ring ring)
+{
+	return ring->rx_oversized;
+}
+
+int packet_ring_send(packet_ring ring, uint8_t* buf, unsigned int buflen)
+{
+	struct tpacket3_hdr* hdr = tx_frame_hdr(ring, ring->tx_frame);
+	uint status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+	if (status == TP_STATUS_WRONG_FORMAT) {
+		LOG(WARN,"[PACKET RING] kernel rejected TX frame\n");
+	} else if (status != TP_STATUS_AVAILABLE) {
+		// ring full. Let the kernel send the pending frames
+		packet_ring_flush(ring);
+		return 0;
+	}
+	uint max_len = PKT_RING_FRAME_SIZE - (TPACKET3_HDRLEN - sizeof(struct sockaddr_ll));
+	if (buflen > max_len) {
+		LOG(WARN,"[PACKET RING] frame with %d bytes exceeds TX frame size\n",buflen);
+		return 0;
+	}
+
+	uint8_t* data = (uint8_t*)hdr + TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+	memcpy(data, buf, buflen);
+	hdr->tp_len = buflen;
+	hdr->tp_snaplen = buflen;
+	hdr->tp_next_offset = 0;
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+	ring->tx_frame = (ring->tx_frame+1) % ring->tx_frame_nr;
+	ring->tx_pending++;
+	return 1;
+}
+
+void packet_ring_flush(packet_ring ring)
+{
+	if (ring->tx_pending == 0)
+		return;
+	if (sendto(ring->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 && errno != EAGAIN)
+		LOG(WARN,"[PACKET RING] TX ring flush failed: %s\n",strerror(errno));
+	ring->tx_pending = 0;
+}
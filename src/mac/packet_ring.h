@@ -0,0 +1,49 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#ifndef MAC_PACKET_RING_H_
+#define MAC_PACKET_RING_H_
+
+#include <stdint.h>
+
+// Raw AF_PACKET socket with TPACKET_V3 RX/TX mmap rings, bound to an
+// existing network interface. Alternative to the TAP device if the MAC
+// is attached directly to a physical Ethernet port.
+// RX frames are taken from the ring without a syscall as long as ring blocks
+// are ready, TX frames are placed in the ring and sent with one syscall per batch
+struct packet_ring_s;
+typedef struct packet_ring_s* packet_ring;
+
+packet_ring packet_ring_init(char* ifname);
+void packet_ring_destroy(packet_ring ring);
+int packet_ring_fd(packet_ring ring);
+
+// check whether the ring holds received frames that were not read yet
+int packet_ring_rx_pending(packet_ring ring);
+// copy the next received frame to buf. returns the frame length or 0 if none is pending.
+// Frames longer than buflen are dropped
+int packet_ring_receive(packet_ring ring, uint8_t* buf, unsigned int buflen);
+// number of received frames dropped because they exceeded the buffer
+unsigned int packet_ring_rx_oversized(packet_ring ring);
+
+// place a frame in the TX ring. returns 1 on success, 0 if the ring is full
+int packet_ring_send(packet_ring ring, uint8_t* buf, unsigned int buflen);
+// hand all frames placed in the TX ring to the kernel
+void packet_ring_flush(packet_ring ring);
+
+#endif /* MAC_PACKET_RING_H_ */
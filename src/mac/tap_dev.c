@@ -27,6 +27,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <libconfig.h>
 
 #include "../util/log.h"
 
@@ -87,28 +90,240 @@ tap_dev tap_init(char* tap_name)
 		exit(EXIT_FAILURE);
 		return NULL;
 	}
+	// reads are done in batches after poll() signals new data
+	int flags = fcntl(dev->tapfd, F_GETFL, 0);
+	fcntl(dev->tapfd, F_SETFL, flags | O_NONBLOCK);
+	dev->backend = TAP_BACKEND_TAP;
 
-	dev->buffer = malloc(MTU_SIZE);
+	for (int q=0; q<TAP_NUM_TXQ; q++) {
+		atomic_init(&dev->txq[q].head, 0);
+		atomic_init(&dev->txq[q].tail, 0);
+	}
+	atomic_init(&dev->tx_waiting, 0);
+	pthread_mutex_init(&dev->tx_lock, NULL);
+	pthread_cond_init(&dev->tx_cond, NULL);
+	return dev;
+}
+
+// initialize the device structure with an AF_PACKET ring attached to an
+// existing interface. Frames are exchanged with that interface directly,
+// no TAP device and no bridge are required
+tap_dev tap_init_packet(char* ifname)
+{
+	tap_dev dev = calloc(sizeof(struct tap_dev_s),1);
+	strncpy(dev->tap_name,ifname,IFNAMSIZ-1);
+	dev->ring = packet_ring_init(dev->tap_name);
+	if (dev->ring==NULL) {
+		LOG(ERR,"Could not attach to interface %s!\n",dev->tap_name);
+		free(dev);
+		exit(EXIT_FAILURE);
+		return NULL;
+	}
+	dev->tapfd = packet_ring_fd(dev->ring);
+	dev->backend = TAP_BACKEND_PACKET;
+
+	for (int q=0; q<TAP_NUM_TXQ; q++) {
+		atomic_init(&dev->txq[q].head, 0);
+		atomic_init(&dev->txq[q].tail, 0);
+	}
+	atomic_init(&dev->tx_waiting, 0);
+	pthread_mutex_init(&dev->tx_lock, NULL);
+	pthread_cond_init(&dev->tx_cond, NULL);
+	return dev;
+}
+
+// initialize the device as configured in the "net" section of the config file.
+// Creates TAP device tap0 if the section does not exist
+tap_dev tap_init_config(char* config_file)
+{
+	const char* backend = "tap";
+	const char* ifname = "tap0";
+	config_t cfg;
+	config_init(&cfg);
+	if (config_file && config_read_file(&cfg, config_file)) {
+		config_setting_t* net = config_lookup(&cfg, "net");
+		if (net) {
+			config_setting_lookup_string(net, "backend", &backend);
+			config_setting_lookup_string(net, "interface", &ifname);
+		}
+	}
+
+	tap_dev dev;
+	if (strcmp(backend, "packet") == 0) {
+		LOG(INFO,"[TAP DEV] use AF_PACKET ring on interface %s\n",ifname);
+		dev = tap_init_packet((char*)ifname);
+	} else {
+		if (strcmp(backend, "tap") != 0)
+			LOG(WARN,"[TAP DEV] unknown net backend %s. Use TAP device\n",backend);
+		char name[IFNAMSIZ] = {0};
+		strncpy(name, ifname, IFNAMSIZ-1);
+		dev = tap_init(name);
+	}
+	config_destroy(&cfg);
 	return dev;
 }
 
-// try to receive from the tap device
-void tap_receive(tap_dev dev)
+// Wait until the tap device has data to read
+// returns 1 if data is available, 0 on timeout or error
+int tap_wait(tap_dev dev, int timeout_ms)
 {
-	int nread = read(dev->tapfd, dev->buffer, MTU_SIZE);
+	// frames left in the RX ring do not trigger poll()
+	if (dev->backend == TAP_BACKEND_PACKET && packet_ring_rx_pending(dev->ring))
+		return 1;
+	struct pollfd pfd = {.fd = dev->tapfd, .events = POLLIN};
+	int ret = poll(&pfd, 1, timeout_ms);
+	if (ret < 0 && errno != EINTR)
+		LOG(ERR,"[TAP DEV] poll failed: %d\n",errno);
+	return ret > 0 && (pfd.revents & POLLIN);
+}
+
+// Read one frame from the tap device to the given buffer. Does not block
+// returns the number of bytes read, 0 if no frame is pending
+int tap_receive(tap_dev dev, uint8_t* buffer, unsigned int buflen)
+{
+	if (dev->backend == TAP_BACKEND_PACKET)
+		return packet_ring_receive(dev->ring, buffer, buflen);
+
+	int nread = read(dev->tapfd, buffer, buflen);
 	if (nread < 0) {
-		LOG(ERR,"[TAP DEV] could not read TAP device!\n");
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			LOG(ERR,"[TAP DEV] could not read TAP device!\n");
 		nread = 0;
 	}
-	dev->bytes_rec = nread;
+	return nread;
 }
 
-// push a buffer to the tap device
+// push a buffer to the tap device.
+// With the AF_PACKET backend the frame is only placed in the TX ring, see tap_flush()
 void tap_send(tap_dev dev, uint8_t* buffer, uint buflen)
 {
+	if (dev->backend == TAP_BACKEND_PACKET) {
+		// ring full: packet_ring_send() kicked the kernel, retry once
+		if (!packet_ring_send(dev->ring, buffer, buflen) &&
+			!packet_ring_send(dev->ring, buffer, buflen)) {
+			dev->tx_errors++;
+			LOG(ERR, "[TAP DEV] TX ring of %s full!\n",dev->tap_name);
+		}
+		return;
+	}
 	int nwrite  = write(dev->tapfd, buffer, buflen);
 	if (nwrite != buflen) {
+		dev->tx_errors++;
 		LOG(ERR, "[TAP DEV] could not write to TAP device!\n");
 	}
 }
 
+// send all frames buffered by tap_send(). No-op for TAP devices
+void tap_flush(tap_dev dev)
+{
+	if (dev->backend == TAP_BACKEND_PACKET)
+		packet_ring_flush(dev->ring);
+}
+
+// Enqueue a frame that will be written to TAP by the egress thread.
+// Does not block. Must only be called from a single thread per queue, since the
+// queue and its statistics are updated without locks. The frame is destroyed after it was written or if the queue is full
+// returns 1 on success, 0 if the frame was dropped
+static int tap_txq_put(tap_dev dev, tap_txq_s* q, MacDataFrame frame)
+{
+	uint head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	uint tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+	uint depth = head - tail;
+	if (depth >= TAP_TX_QUEUE_LEN) {
+		q->drops++;
+		dataframe_destroy(frame);
+		LOG(WARN, "[TAP DEV] egress queue full. Drop frame\n");
+		return 0;
+	}
+	q->frames[head & (TAP_TX_QUEUE_LEN-1)] = frame;
+	atomic_store_explicit(&q->head, head+1, memory_order_release);
+	if (depth+1 > q->max_depth)
+		q->max_depth = depth+1;
+
+	// wake up egress thread if it sleeps
+	if (atomic_load(&dev->tx_waiting)) {
+		pthread_mutex_lock(&dev->tx_lock);
+		pthread_cond_signal(&dev->tx_cond);
+		pthread_mutex_unlock(&dev->tx_lock);
+	}
+	return 1;
+}
+
+// Frames received by the MAC. Called from the MAC RX thread
+int tap_send_frame(tap_dev dev, MacDataFrame frame)
+{
+	return tap_txq_put(dev, &dev->txq[TAP_TXQ_MAC], frame);
+}
+
+// Frames generated by the TAP ingress thread
+int tap_send_local_frame(tap_dev dev, MacDataFrame frame)
+{
+	return tap_txq_put(dev, &dev->txq[TAP_TXQ_LOCAL], frame);
+}
+
+static int tap_txq_empty(tap_dev dev)
+{
+	for (int q=0; q<TAP_NUM_TXQ; q++) {
+		if (atomic_load(&dev->txq[q].head) != atomic_load(&dev->txq[q].tail))
+			return 0;
+	}
+	return 1;
+}
+
+// Egress thread. Drains all queued frames per wakeup and writes them to TAP.
+// Runs without RT priority, so that a slow TAP does not stall the PHY/MAC threads
+void* tap_tx_th(void* arg)
+{
+	tap_dev dev = (tap_dev)arg;
+	LOG(INFO,"[TAP DEV] start TAP egress thread\n");
+	while (1) {
+		for (int i=0; i<TAP_NUM_TXQ; i++) {
+			tap_txq_s* q = &dev->txq[i];
+			uint tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+			uint head = atomic_load_explicit(&q->head, memory_order_acquire);
+			while (tail != head) {
+				MacDataFrame frame = q->frames[tail & (TAP_TX_QUEUE_LEN-1)];
+				tap_send(dev, frame->data, frame->size);
+				dataframe_destroy(frame);
+				dev->tx_frames++;
+				tail++;
+				atomic_store_explicit(&q->tail, tail, memory_order_release);
+				if (tail == head)
+					head = atomic_load_explicit(&q->head, memory_order_acquire);
+			}
+		}
+		// one syscall for the whole batch with the AF_PACKET backend
+		tap_flush(dev);
+
+		// queues empty. Sleep until a producer signals new frames
+		pthread_mutex_lock(&dev->tx_lock);
+		atomic_store(&dev->tx_waiting, 1);
+		while (tap_txq_empty(dev))
+			pthread_cond_wait(&dev->tx_cond, &dev->tx_lock);
+		atomic_store(&dev->tx_waiting, 0);
+		pthread_mutex_unlock(&dev->tx_lock);
+	}
+	return NULL;
+}
+
+// Print TAP egress statistics to the given buffer
+int tap_stats_print(char* buf, int buflen, tap_dev dev)
+{
+	// drops and depth are summed over the queues, the max depth is the one of the fullest queue
+	uint depth = 0, drops = 0, max_depth = 0;
+	for (int q=0; q<TAP_NUM_TXQ; q++) {
+		depth += atomic_load(&dev->txq[q].head) - atomic_load(&dev->txq[q].tail);
+		drops += dev->txq[q].drops;
+		if (dev->txq[q].max_depth > max_depth)
+			max_depth = dev->txq[q].max_depth;
+	}
+	int len = snprintf(buf,buflen,"TAP egress frames: %6d drops: %d errors: %d\n"\
+								  "TAP egress queue depth: %d max: %d/%d\n",
+								  dev->tx_frames, drops, dev->tx_errors,
+								  depth, max_depth, TAP_TX_QUEUE_LEN);
+	if (dev->backend == TAP_BACKEND_PACKET && len < buflen)
+		len += snprintf(buf+len,buflen-len,"TAP ingress oversized drops: %d\n",
+						packet_ring_rx_oversized(dev->ring));
+	return len;
+}
+
@@ -24,25 +24,70 @@
 #include <linux/if_tun.h>
 
 #include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "mac_common.h"
+#include "packet_ring.h"
 
 // We want to be able to capture whole ethernet frames
 // MTU at least = 1500(ether mtu) + 14(ether header)
 // MTU_SIZE defines the size of the buffer TAP can write to
 #define MTU_SIZE (1500+14)
 
+// Number of frames that can be queued for the TAP egress thread. Power of 2
+#define TAP_TX_QUEUE_LEN 64
+
+// Backend used to exchange Ethernet frames with the host
+enum tap_backend {TAP_BACKEND_TAP=0, TAP_BACKEND_PACKET};
+
+// Egress queues. Each queue has a single producer
+enum tap_txq {
+	TAP_TXQ_MAC=0,		// frames received by the MAC
+	TAP_TXQ_LOCAL,		// frames generated by the ingress thread, e.g. ARP proxy replies
+	TAP_NUM_TXQ
+};
+
+// Lock-free single producer / single consumer (egress thread) queue
+typedef struct {
+	MacDataFrame frames[TAP_TX_QUEUE_LEN];
+	atomic_uint head;		// next position to write. Modified by producer only
+	atomic_uint tail;		// next position to read. Modified by consumer only
+	uint drops;				// frames dropped because the queue was full. Modified by producer only
+	uint max_depth;			// max queue depth. Modified by producer only
+} tap_txq_s;
+
 struct tap_dev_s {
 	char tap_name[IFNAMSIZ];
-	int tapfd;
+	int tapfd;			// non-blocking file descriptor of the tap device
+	enum tap_backend backend;
+	packet_ring ring;	// AF_PACKET ring of an existing interface if backend==TAP_BACKEND_PACKET
+
+	tap_txq_s txq[TAP_NUM_TXQ];
+	atomic_int tx_waiting;		// set while the egress thread sleeps
+	pthread_mutex_t tx_lock;
+	pthread_cond_t tx_cond;
 
-	uint8_t* buffer;
-	unsigned int bytes_rec;
+	// egress statistics
+	uint tx_frames;
+	uint tx_errors;
 };
 
 typedef struct tap_dev_s* tap_dev;
 
 tap_dev tap_init(char* tap_name);
-void tap_receive(tap_dev dev);
+tap_dev tap_init_packet(char* ifname);
+tap_dev tap_init_config(char* config_file);
+int tap_wait(tap_dev dev, int timeout_ms);
+int tap_receive(tap_dev dev, uint8_t* buffer, unsigned int buflen);
 void tap_send(tap_dev dev, uint8_t* buffer, uint buflen);
+void tap_flush(tap_dev dev);
+
+// enqueue a frame for the egress thread. Takes ownership of the frame
+int tap_send_frame(tap_dev dev, MacDataFrame frame);
+// same for frames generated by the ingress thread
+int tap_send_local_frame(tap_dev dev, MacDataFrame frame);
+void* tap_tx_th(void* dev);
+int tap_stats_print(char* buf, int buflen, tap_dev dev);
 
 
 #endif /* MAC_TAP_DEV_H_ */
@@ -22,6 +22,9 @@
 #include "../runtime/test.h"
 #endif
 
+// start of the FFT window of split slots within the CP
+#define RB_FFT_BACKOFF (cp_len/2)
+
 // Forward declarations of local helper functions
 int phy_bs_proc_rach(PhyBS phy, int timing_diff);
 int _bs_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd);
@@ -43,16 +46,13 @@ PhyBS phy_bs_init()
 	PhyBS phy = calloc(sizeof(struct PhyBS_s),1);
 
 	phy->common = phy_common_init();
-#if USE_ROBUST_PILOT
-	gen_pilot_symbols_robust(phy->common, 1);
-#else
 	gen_pilot_symbols(phy->common, 1);
-#endif
 	// Create OFDM frame generator: nFFt, CPlen, taperlen, subcarrier alloc
 	phy->fg = ofdmframegen_create(nfft, cp_len, 0, phy->common->pilot_sc);
 
 	// Create OFDM receiver
 	phy->fs_rach = NULL;
+	phy->sync_rach = phy_sync_init(phy->common->pilot_sc);
 
     // alloc buffer for dl control slot
     phy->dlctrl_buf = calloc((num_data_sc+num_pilot_sc)*DLCTRL_LEN/8, 1);
@@ -60,10 +60,14 @@ PhyBS phy_bs_init()
 	// Alloc memory for slot assignments
 	phy->ulslot_assignments = malloc(2*sizeof(uint8_t*));
 	phy->ulctrl_assignments = malloc(2*sizeof(uint8_t*));
+	phy->ulrb_assignments = malloc(2*sizeof(uint8_t*));
+	phy->ulmini_assignments = malloc(2*sizeof(uint8_t*));
 
 	for (int i=0; i<2; i++) {
 		phy->ulslot_assignments[i] = calloc(sizeof(uint8_t),NUM_SLOT);
 		phy->ulctrl_assignments[i] = calloc(sizeof(uint8_t),NUM_ULCTRL_SLOT);
+		phy->ulrb_assignments[i] = calloc(sizeof(uint8_t),NUM_UL_RB);
+		phy->ulmini_assignments[i] = calloc(sizeof(uint8_t),NUM_SLOT*NUM_MINI_SLOT);
 	}
 
     // buffer for ofdm symbol allocation
@@ -74,6 +78,15 @@ PhyBS phy_bs_init()
     // allocate memory for rach_buffer
     phy->rach_buffer = calloc(sizeof(float complex)*nfft,1);
 
+    // FFT of split slots. The window starts RB_FFT_BACKOFF samples early, so users which
+    // are received slightly late or early do not leak into the next symbol
+    phy->rb_fft_in = calloc(sizeof(float complex),nfft);
+    phy->rb_fft_out = calloc(sizeof(float complex),nfft);
+    phy->rb_fft_ramp = calloc(sizeof(float complex),nfft);
+    phy->rb_fft = fft_create_plan(nfft, phy->rb_fft_in, phy->rb_fft_out, LIQUID_FFT_FORWARD, 0);
+    for (int k=0; k<nfft; k++)
+        phy->rb_fft_ramp[k] = cexpf(_Complex_I*2*M_PI*k*RB_FFT_BACKOFF/nfft);
+
     // Set RX position
     phy->common->rx_symbol = SUBFRAME_LEN - DL_UL_SHIFT - DL_UL_SHIFT_COMP_BS;
     phy->common->rx_subframe = FRAME_LEN -1;
@@ -92,15 +105,25 @@ void phy_bs_destroy(PhyBS phy)
 	ofdmframegen_destroy(phy->fg);
 	if (phy->fs_rach!=NULL)
 		ofdmframesync_destroy(phy->fs_rach);
+	phy_sync_destroy(phy->sync_rach);
 
 	free(phy->dlctrl_buf);
 
 	for (int i=0; i<2; i++) {
 		free(phy->ulslot_assignments[i]);
 		free(phy->ulctrl_assignments[i]);
+		free(phy->ulrb_assignments[i]);
+		free(phy->ulmini_assignments[i]);
 	}
 	free(phy->ulslot_assignments);
 	free(phy->ulctrl_assignments);
+	free(phy->ulrb_assignments);
+	free(phy->ulmini_assignments);
+
+	fft_destroy_plan(phy->rb_fft);
+	free(phy->rb_fft_in);
+	free(phy->rb_fft_out);
+	free(phy->rb_fft_ramp);
 
 	free(phy->ul_symbol_alloc[0]);
 	free(phy->ul_symbol_alloc[1]);
@@ -209,10 +232,11 @@ int phy_map_dlslot(PhyBS phy, LogicalChannel chan, uint subframe, uint8_t slot_n
 	liquid_repack_bytes(interleaved_b,8,enc_len,repacked_b,modem_get_bps(common->mcs_modem[mcs]),num_repacked,&bytes_written);
 
 	uint total_samps = 0;
-	uint first_symb = DLCTRL_LEN+2+(SLOT_LEN+1)*slot_nr;
-	uint last_symb = DLCTRL_LEN+2+(SLOT_LEN+1)*(slot_nr+1)-2;
+	uint first_symb = DL_SLOT_START+(SLOT_LEN+1)*slot_nr;
+	uint last_symb = DL_SLOT_START+(SLOT_LEN+1)*(slot_nr+1)-2;
 
 	// modulate signal
+	phy_set_slot_pilots(common, common->pilot_symbols_tx[subframe], first_symb, mcs);
 	phy_mod(phy->common,subframe,0,nfft-1,first_symb,last_symb, mcs, repacked_b, num_repacked, &total_samps);
     TIMECHECK_STOP(check_mod);
     TIMECHECK_STOP(timecheck_tx);
@@ -227,6 +251,49 @@ int phy_map_dlslot(PhyBS phy, LogicalChannel chan, uint subframe, uint8_t slot_n
 	return 0;
 }
 
+// create mini-slot mini of the split DL data slot slot_nr in frequency domain.
+// The other half of the slot is mapped for another user. Mini-slots are sent without HARQ
+int phy_map_dlmini(PhyBS phy, LogicalChannel chan, uint subframe, uint8_t slot_nr, uint mini, uint mcs)
+{
+	PhyCommon common = phy->common;
+
+	uint8_t* repacked_b;
+	uint bytes_written=0;
+	uint32_t blocksize = get_mini_tbs_size(common, mcs);
+
+	if (blocksize/8 != chan->payload_len) {
+		printf("Error: Wrong TBS\n");
+		return -1;
+	}
+
+	// encode channel
+	uint enc_len = fec_get_enc_msg_length(common->mcs_fec_scheme[mcs],chan->payload_len);
+	uint8_t* enc_b = malloc(enc_len);
+	fec_encode(common->mcs_fec[mcs], blocksize/8, chan->data, enc_b);
+
+	//interleaving
+	uint8_t* interleaved_b = malloc(enc_len);
+	interleaver_encode(common->mini_interlvr[mcs],enc_b,interleaved_b);
+
+	// repack bytes so that each array entry can be mapped to one symbol
+	int num_repacked = ceil(enc_len*8.0/modem_get_bps(common->mcs_modem[mcs]));
+	repacked_b = malloc(num_repacked);
+	liquid_repack_bytes(interleaved_b,8,enc_len,repacked_b,modem_get_bps(common->mcs_modem[mcs]),num_repacked,&bytes_written);
+
+	uint total_samps = 0;
+	uint slot_start = DL_SLOT_START+(SLOT_LEN+1)*slot_nr;
+	uint first_symb = slot_start+mini*MINI_SLOT_LEN;
+	uint last_symb = first_symb+MINI_SLOT_SYMBOLS(mini)-1;
+
+	// modulate signal
+	phy_set_mini_pilots(common, common->pilot_symbols_tx[subframe], slot_start, mini);
+	phy_mod(common,subframe,0,nfft-1,first_symb,last_symb, mcs, repacked_b, num_repacked, &total_samps);
+	free(interleaved_b);
+	free(enc_b);
+	free(repacked_b);
+	return 0;
+}
+
 void phy_map_dlctrl(PhyBS phy, uint subframe)
 {
 	PhyCommon common = phy->common;
@@ -234,7 +301,7 @@ void phy_map_dlctrl(PhyBS phy, uint subframe)
 	// use MCS0 for modulation
 	uint mcs = 0;
 
-	uint buf_size = (2*NUM_SLOT+NUM_ULCTRL_SLOT)/2;
+	uint buf_size = DLCTRL_SIZE;
 
 	// add CRC
 	phy->dlctrl_buf[buf_size].byte = crc_generate_key(LIQUID_CRC_8, (uint8_t*)phy->dlctrl_buf,buf_size);
@@ -263,20 +330,69 @@ void phy_map_dlctrl(PhyBS phy, uint subframe)
 //Set the assignments of Downlink data slots
 void phy_assign_dlctrl_dd(PhyBS phy, uint8_t* slot_assignment)
 {
+	// a slot split into mini-slots is signaled by phy_assign_dlctrl_dl_mini()
 	for (int i=0; i<NUM_SLOT; i+=2) {
-	    phy->dlctrl_buf[i/2].h4 = slot_assignment[i];
-	    phy->dlctrl_buf[i/2].l4 = slot_assignment[i+1];
+	    phy->dlctrl_buf[i/2].h4 = slot_assignment[i]==USER_MINI ? USER_UNUSED : slot_assignment[i];
+	    phy->dlctrl_buf[i/2].l4 = slot_assignment[i+1]==USER_MINI ? USER_UNUSED : slot_assignment[i+1];
 	}
 }
 
+// Signal the data slot of one link direction that is split into mini-slots. idx is the first
+// byte of the slot nibbles. Only one slot per direction can be split
+static void phy_bs_assign_dlctrl_mini(PhyBS phy, uint idx, uint mini_idx, uint8_t* slot_assignment,
+									  uint8_t* mini_assignment)
+{
+	phy->dlctrl_buf[mini_idx].byte = 0;
+	for (int i=0; i<NUM_SLOT; i++) {
+		if (slot_assignment[i]!=USER_MINI)
+			continue;
+		if (i%2)
+			phy->dlctrl_buf[idx+i/2].l4 = mini_assignment[i*NUM_MINI_SLOT];
+		else
+			phy->dlctrl_buf[idx+i/2].h4 = mini_assignment[i*NUM_MINI_SLOT];
+		phy->dlctrl_buf[mini_idx].h4 = i+1;
+		phy->dlctrl_buf[mini_idx].l4 = mini_assignment[i*NUM_MINI_SLOT+1];
+		return;
+	}
+}
+
+// Set the assignments of the mini-slots of the Downlink slot marked with USER_MINI.
+// Has to be called after phy_assign_dlctrl_dd()
+void phy_assign_dlctrl_dl_mini(PhyBS phy, uint8_t* slot_assignment, uint8_t* mini_assignment)
+{
+	phy_bs_assign_dlctrl_mini(phy, 0, DLCTRL_MINI_IDX, slot_assignment, mini_assignment);
+}
+
+// Set the MCS used for all broadcast slots of the subframe
+void phy_assign_dlctrl_bcast_mcs(PhyBS phy, uint mcs)
+{
+	phy->dlctrl_buf[DLCTRL_BCAST_MCS_IDX].h4 = mcs;
+}
+
+// Set the HARQ retransmission flags of the Uplink data slots. Bit i is slot i
+void phy_assign_dlctrl_ul_retx(PhyBS phy, uint subframe, uint8_t retx)
+{
+	phy->ulslot_retx[subframe] = retx;
+	phy->dlctrl_buf[DLCTRL_BCAST_MCS_IDX].l4 = retx;
+}
+
+// returns the first symbol of an UL data slot within the subframe
+static uint phy_bs_ul_slot_start(uint slotnr)
+{
+	// slot 3 and 4 are shifted back since the ULCTRL lies between slot 2 and 3
+	return (SLOT_LEN+1)*slotnr + (slotnr>=2 ? 4 : 0);
+}
+
 // Set the assignments of Uplink data slots
 void phy_assign_dlctrl_ud(PhyBS phy, uint subframe, uint8_t* slot_assignment)
 {
 	memcpy(phy->ulslot_assignments[subframe], slot_assignment, NUM_SLOT);
 
+	// a split slot (USER_RB or USER_MINI) is signaled as unused, followed by the resource
+	// block assignments. Mini-slots are signaled by phy_assign_dlctrl_ul_mini()
 	for (int i=0; i<NUM_SLOT; i+=2) {
-	    phy->dlctrl_buf[NUM_SLOT/2+i/2].h4 = slot_assignment[i];
-	    phy->dlctrl_buf[NUM_SLOT/2+i/2].l4 = slot_assignment[i+1];
+	    phy->dlctrl_buf[NUM_SLOT/2+i/2].h4 = slot_assignment[i]>=USER_MINI ? USER_UNUSED : slot_assignment[i];
+	    phy->dlctrl_buf[NUM_SLOT/2+i/2].l4 = slot_assignment[i+1]>=USER_MINI ? USER_UNUSED : slot_assignment[i+1];
 	}
 
 	// TODO generalize this
@@ -287,6 +403,41 @@ void phy_assign_dlctrl_ud(PhyBS phy, uint subframe, uint8_t* slot_assignment)
 	memset(&phy->ul_symbol_alloc[subframe][3*(SLOT_LEN+1)+4], slot_assignment[3], SLOT_LEN);
 }
 
+// Set the assignments of the resource blocks of the split Uplink slot UL_RB_SLOT
+// Only used if the slot is assigned to USER_RB
+void phy_assign_dlctrl_ul_rb(PhyBS phy, uint subframe, uint8_t* rb_assignment)
+{
+	memcpy(phy->ulrb_assignments[subframe], rb_assignment, NUM_UL_RB);
+
+	for (int i=0; i<NUM_UL_RB; i+=2) {
+	    phy->dlctrl_buf[DLCTRL_RB_IDX+i/2].h4 = rb_assignment[i];
+	    phy->dlctrl_buf[DLCTRL_RB_IDX+i/2].l4 = rb_assignment[i+1];
+	}
+}
+
+// Set the assignments of the mini-slots of the Uplink slot marked with USER_MINI.
+// Has to be called after phy_assign_dlctrl_ud()
+void phy_assign_dlctrl_ul_mini(PhyBS phy, uint subframe, uint8_t* mini_assignment)
+{
+	memcpy(phy->ulmini_assignments[subframe], mini_assignment, NUM_SLOT*NUM_MINI_SLOT);
+	phy_bs_assign_dlctrl_mini(phy, NUM_SLOT/2, DLCTRL_MINI_IDX+1, phy->ulslot_assignments[subframe], mini_assignment);
+
+	// each half of a split slot is received by the receiver of its user. Nothing is received
+	// in the guard symbol between the halves
+	for (int i=0; i<NUM_SLOT; i++) {
+		if (phy->ulslot_assignments[subframe][i]!=USER_MINI)
+			continue;
+		uint slot_start = phy_bs_ul_slot_start(i);
+		for (int mini=0; mini<NUM_MINI_SLOT; mini++) {
+			uint first_symb = slot_start+mini*MINI_SLOT_LEN;
+			memset(&phy->ul_symbol_alloc[subframe][first_symb],
+				   mini_assignment[i*NUM_MINI_SLOT+mini], MINI_SLOT_SYMBOLS(mini));
+			memset(&phy->ul_symbol_alloc[subframe][first_symb+MINI_SLOT_SYMBOLS(mini)],
+				   USER_UNUSED, MINI_SLOT_LEN-MINI_SLOT_SYMBOLS(mini));
+		}
+	}
+}
+
 // Set the assignments of Uplink control slots
 void phy_assign_dlctrl_uc(PhyBS phy, uint subframe, uint8_t* slot_assignment)
 {
@@ -303,6 +454,128 @@ void phy_assign_dlctrl_uc(PhyBS phy, uint subframe, uint8_t* slot_assignment)
 
 }
 
+// returns the MCS of an UL data slot of the user in the current rx subframe.
+// Retransmissions are sent with the MCS of the first transmission
+static uint phy_bs_ul_slot_mcs(PhyBS phy, user_s* ue, uint slotnr)
+{
+	PhyCommon common = phy->common;
+	uint retx = (phy->ulslot_retx[common->rx_subframe%2] >> slotnr) & 1;
+	if (mac_harq_is_enabled() && retx) {
+		harq_rx_proc_s* harq = &ue->harq_ul[HARQ_PROC(common->rx_subframe, slotnr)];
+		if (harq->num_rx>0)
+			return harq->mcs;
+	}
+	return ue->ul_mcs;
+}
+
+// Fold the residual phase drift of the last decoded UL slot of the user into its CFO.
+// After a failed slot, the CFO of the last good slot is kept, since the sync
+// object updated it with wrong pilots
+static void phy_bs_update_ul_cfo(user_s* ue)
+{
+	if (ue->ul_slot_done && ue->ul_slot_ok)
+		ue->ul_cfo = ofdmframesync_get_cfo(ue->fs) + ue->ul_phase_drift/(nfft+cp_len);
+	ue->ul_slot_done = 0;
+}
+
+// Decode the resource blocks of a split UL slot. The symbols of all users were transformed
+// with one FFT. Each block is corrected with the CFO of its user and equalized with its own
+// pilots, which also removes the timing offset of the user. Blocks are decoded without HARQ
+static void phy_bs_proc_rb_slot(PhyBS phy, uint slotnr)
+{
+	PhyCommon common = phy->common;
+	uint sfn = common->rx_subframe %2;
+	uint first_symb = phy_bs_ul_slot_start(slotnr);
+	uint last_symb = first_symb+SLOT_LEN-1;
+
+	for (uint rb=0; rb<NUM_UL_RB; rb++) {
+		uint userid = phy->ulrb_assignments[sfn][rb];
+		if (userid==USER_UNUSED)
+			continue;
+		user_s* ue = phy->mac->UE[userid];
+		if (ue==NULL) {
+			LOG(ERR,"[PHY BS] cannot decode resource block of user %d. User does not exist!\n",userid);
+			continue;
+		}
+		uint mcs = ue->ul_mcs;
+		uint first_sc = common->rb_first_sc[rb];
+		uint last_sc = common->rb_last_sc[rb];
+
+		// remove the phase rotation between the symbols caused by the CFO of the user.
+		// The interference between the subcarriers caused by the CFO is not removed
+		float cfo = ofdmframesync_get_cfo(ue->fs);
+		if (chan_est) {
+			phy_bs_update_ul_cfo(ue);
+			cfo = ue->ul_cfo;
+		}
+		for (uint sym=first_symb; sym<=last_symb; sym++) {
+			float complex rot = cexpf(-_Complex_I*cfo*(nfft+cp_len)*(sym-first_symb));
+			for (uint k=first_sc; k<=last_sc; k++)
+				common->rxdata_f[sym][k] *= rot;
+		}
+		chan_est_s est = {0};
+		phy_chan_est_sc(common, first_sc, last_sc, first_symb, last_symb, &est);
+
+		// demodulate and decode
+		uint buf_len = common->rb_llr_len[mcs];
+		uint8_t* demod_buf = malloc(buf_len);
+		uint written_samps = 0;
+		float snr = phy_demod_soft_snr(common, first_sc, last_sc, first_symb, last_symb, mcs,
+									   demod_buf, buf_len, &written_samps);
+		LogicalChannel chan = lchan_create(get_rb_tbs_size(common, mcs)/8,CRC16);
+		phy_decode_rb(common, mcs, demod_buf, chan);
+		free(demod_buf);
+
+		// pass to upper layer. The residual phase drift of a decoded block corrects the CFO
+		int crc_ok = mac_bs_rx_channel(phy->mac,chan, userid);
+		if (chan_est && crc_ok && est.num_pilot_symbols>1)
+			ue->ul_cfo = cfo + est.phase_drift/(nfft+cp_len);
+		mac_bs_ul_quality(phy->mac, userid, snr, crc_ok);
+	}
+}
+
+// Decode the mini-slots of an UL slot that is split in time. Each half was received by the
+// receiver of its user and is equalized with its own pilots. Mini-slots are decoded without HARQ
+static void phy_bs_proc_mini_slot(PhyBS phy, uint slotnr)
+{
+	PhyCommon common = phy->common;
+	uint sfn = common->rx_subframe %2;
+
+	for (uint mini=0; mini<NUM_MINI_SLOT; mini++) {
+		uint userid = phy->ulmini_assignments[sfn][slotnr*NUM_MINI_SLOT+mini];
+		if (userid==USER_UNUSED)
+			continue;
+		user_s* ue = phy->mac->UE[userid];
+		if (ue==NULL) {
+			LOG(ERR,"[PHY BS] cannot decode mini-slot of user %d. User does not exist!\n",userid);
+			continue;
+		}
+		uint mcs = ue->ul_mcs;
+		uint first_symb = phy_bs_ul_slot_start(slotnr)+mini*MINI_SLOT_LEN;
+		uint last_symb = first_symb+MINI_SLOT_SYMBOLS(mini)-1;
+
+		// demodulate and decode
+		chan_est_s est = {0};
+		if (chan_est)
+			phy_chan_est_slot(common, first_symb, last_symb, &est);
+		uint buf_len = common->mini_llr_len[mcs];
+		uint8_t* demod_buf = malloc(buf_len);
+		uint written_samps = 0;
+		float snr = phy_demod_soft_snr(common, 0, nfft-1, first_symb, last_symb, mcs,
+									   demod_buf, buf_len, &written_samps);
+		LogicalChannel chan = lchan_create(get_mini_tbs_size(common, mcs)/8,CRC16);
+		phy_decode_mini(common, mcs, demod_buf, chan);
+		free(demod_buf);
+
+		// pass to upper layer. The residual phase drift corrects the CFO like for a full slot
+		int crc_ok = mac_bs_rx_channel(phy->mac,chan, userid);
+		ue->ul_phase_drift = est.phase_drift;
+		ue->ul_slot_ok = crc_ok && est.num_pilot_symbols>1;
+		ue->ul_slot_done = 1;
+		mac_bs_ul_quality(phy->mac, userid, snr, crc_ok);
+	}
+}
+
 // Decode a PHY ul slot and call the MAC callback function
 void phy_bs_proc_slot(PhyBS phy, uint slotnr)
 {
@@ -311,40 +584,56 @@ void phy_bs_proc_slot(PhyBS phy, uint slotnr)
 	//get user that was supposed to send in this slot
 	uint userid =  phy->ulslot_assignments[sfn][slotnr];
 
+	// once per subframe, in the thread that passes the UL data to the MAC
+	if (slotnr==0)
+		mac_bs_rx_arq_update(phy->mac);
 	if (userid==0) {
 		return; // Slot was not assigned. Nothing to decode
 	}
+	if (userid==USER_RB) {
+		phy_bs_proc_rb_slot(phy, slotnr);
+		return;
+	}
+	if (userid==USER_MINI) {
+		phy_bs_proc_mini_slot(phy, slotnr);
+		return;
+	}
 	if (phy->mac->UE[userid]==NULL) {
 		// User was assigned but does not exist in config. Should not happen
 		LOG(ERR,"[PHY BS] cannot decode data for user %d. User does not exist!\n",userid);
 		return;
 	}
 
-	uint mcs = phy->mac->UE[userid]->ul_mcs; // TODO create method to fetch this?
+	// retransmissions are sent with the MCS of the first transmission. If retransmissions
+	// are disabled, slots are decoded without HARQ
+	user_s* ue = phy->mac->UE[userid];
+	uint retx = (phy->ulslot_retx[sfn] >> slotnr) & 1;
+	harq_rx_proc_s* harq = NULL;
+	if (mac_harq_is_enabled()) {
+		harq = &ue->harq_ul[HARQ_PROC(common->rx_subframe, slotnr)];
+		if (!retx)
+			phy_harq_reset(harq);
+	}
+	uint mcs = phy_bs_ul_slot_mcs(phy, ue, slotnr);
 	uint32_t blocksize = get_tbs_size(common, mcs);
 
-	uint buf_len = 8*fec_get_enc_msg_length(common->mcs_fec_scheme[mcs],blocksize/8);
+	uint buf_len = common->mcs_llr_len[mcs];
 	uint8_t* demod_buf = malloc(buf_len);
 
 	// demodulate signal
 	uint written_samps = 0;
-	uint first_symb = (SLOT_LEN+1)*slotnr;
-	uint last_symb = (SLOT_LEN+1)*(slotnr+1)-2; //TODO use more constants and explain how to calc this
-	// slot 3 and 4 are shifted back since the ULCTRL lies between slot 2 and 3
-	if(slotnr>=2) {
-		first_symb += 4;
-		last_symb +=4;
-	}
-	phy_demod_soft(common, 0, nfft-1, first_symb, last_symb, mcs,
-				   demod_buf, buf_len, &written_samps);
-
-	//deinterleaving
-	uint8_t* deinterleaved_b = malloc(buf_len);
-	interleaver_decode_soft(common->mcs_interlvr[mcs],demod_buf,deinterleaved_b);
-
-	// decoding
+	uint first_symb = phy_bs_ul_slot_start(slotnr);
+	uint last_symb = first_symb+SLOT_LEN-1;
+	chan_est_s est = {0};
+	if (chan_est)
+		phy_chan_est_slot(common, first_symb, last_symb, &est);
+	float snr = phy_demod_soft_snr(common, 0, nfft-1, first_symb, last_symb, mcs,
+								   demod_buf, buf_len, &written_samps);
+
+	// decoding, combined with previous receptions of the block
 	LogicalChannel chan = lchan_create(blocksize/8,CRC16);
-	fec_decode_soft(common->mcs_fec[mcs], blocksize/8, deinterleaved_b, chan->data);
+	uint num_rx;
+	phy_harq_decode(common, harq, mcs, demod_buf, phy->mac->subframe_cnt, chan, &num_rx);
 
 #ifdef PHY_TEST_BER
 	uint32_t num_biterr = 0;
@@ -355,13 +644,22 @@ void phy_bs_proc_slot(PhyBS phy, uint slotnr)
 #endif
 
 	// pass to upper layer
-	if(!mac_bs_rx_channel(phy->mac,chan, userid)) {
+	int crc_ok = mac_bs_rx_channel(phy->mac,chan, userid);
+	if(!crc_ok) {
 		// log when crc check failed
 		ofdmframesync fs = mac_bs_get_receiver(phy->mac,userid);
 		if (fs!=NULL)
 			LOG_SFN_PHY(TRACE,"cfo was: %.3fHz\n",ofdmframesync_get_cfo(fs)*samplerate/6.28);
 	}
-	free(deinterleaved_b);
+	ue->ul_phase_drift = est.phase_drift;
+	ue->ul_slot_ok = crc_ok && est.num_pilot_symbols>1;
+	ue->ul_slot_done = 1;
+	mac_bs_ul_harq_result(phy->mac, userid, common->rx_subframe, slotnr, crc_ok, num_rx);
+	// only first transmissions tell whether the MCS fits
+	if (num_rx==1)
+		mac_bs_ul_quality(phy->mac, userid, snr, crc_ok);
+	else if (crc_ok)
+		mac_bs_ul_quality(phy->mac, userid, snr, -1);
 	free(demod_buf);
 }
 
@@ -384,15 +682,16 @@ void phy_bs_proc_ulctrl(PhyBS phy, uint slotnr)
 	uint first_symb = (SLOT_LEN+1)*2 + 2*slotnr;
 	uint last_symb  = (SLOT_LEN+1)*2 + 2*slotnr; //TODO use more constants and explain how to calc this
 
-	phy_demod_soft(common, 0, nfft-1, first_symb, last_symb, mcs,
-				   demod_buf, buf_len, &written_samps);
+	float snr = phy_demod_soft_snr(common, 0, nfft-1, first_symb, last_symb, mcs,
+								   demod_buf, buf_len, &written_samps);
 
 	// decoding
 	LogicalChannel chan = lchan_create(blocksize/8,CRC8);
 	fec_decode_soft(common->fec_ctrl, blocksize/8, demod_buf, chan->data);
 
-	// pass to upper layer
-	mac_bs_rx_channel(phy->mac,chan, userid);
+	// pass to upper layer. Ctrl slots always use MCS 0, only the SNR is used for the UL MCS
+	if (mac_bs_rx_channel(phy->mac,chan, userid))
+		mac_bs_ul_quality(phy->mac, userid, snr, -1);
 	free(demod_buf);
 }
 
@@ -446,15 +745,11 @@ int phy_bs_proc_rach(PhyBS phy, int timing_diff)
 	return 1;
 }
 
-// callback for OFDM receiver
-// is called for every symbol that is received
-int _bs_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd)
+// Start the processing of slots whose last symbol was received to rxdata_f
+static void phy_bs_symbol_done(PhyBS phy)
 {
-	PhyBS phy = (PhyBS)userd;
 	PhyCommon common = phy->common;
 
-	memcpy(common->rxdata_f[common->rx_symbol],X,sizeof(float complex)*nfft);
-
 	switch (common->rx_symbol) {
 	case (SLOT_LEN-1):
 		// finished receiving one of the UL slots
@@ -507,6 +802,17 @@ int _bs_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd)
 	default:
 		break;
 	}
+}
+
+// callback for OFDM receiver
+// is called for every symbol that is received
+int _bs_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd)
+{
+	PhyBS phy = (PhyBS)userd;
+	PhyCommon common = phy->common;
+
+	memcpy(common->rxdata_f[common->rx_symbol],X,sizeof(float complex)*nfft);
+	phy_bs_symbol_done(phy);
 
 	// Debug log
 	/*char name[30];
@@ -518,6 +824,25 @@ int _bs_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd)
 	return 0;
 }
 
+// Receive a symbol of a split UL slot. It carries the resource blocks of several
+// users, so it is transformed with one FFT instead of the receivers of the users
+static void phy_bs_rx_rb_symbol(PhyBS phy, float complex* rxbuf_time)
+{
+	PhyCommon common = phy->common;
+	uint sfn = common->rx_subframe %2;
+
+	// the pilot pattern of split slots does not depend on the MCS of the users
+	uint prev_rx_symb = (common->rx_symbol-1) % SUBFRAME_LEN;
+	if (common->rx_symbol == 0 || phy->ul_symbol_alloc[sfn][prev_rx_symb]!=USER_RB)
+		memcpy(&common->pilot_symbols_rx[common->rx_symbol], common->slot_pilots[UL_RB_PILOTS], SLOT_LEN);
+
+	memcpy(phy->rb_fft_in, rxbuf_time+cp_len-RB_FFT_BACKOFF, sizeof(float complex)*nfft);
+	fft_execute(phy->rb_fft);
+	for (int k=0; k<nfft; k++)
+		common->rxdata_f[common->rx_symbol][k] = phy->rb_fft_out[k]*phy->rb_fft_ramp[k];
+	phy_bs_symbol_done(phy);
+}
+
 // Create one OFDM symbol in time domain
 // Subcarriers in frequency have to be set beforehand!
 void phy_bs_write_symbol(PhyBS phy, float complex* txbuf_time)
@@ -536,7 +861,9 @@ void phy_bs_write_symbol(PhyBS phy, float complex* txbuf_time)
         ofdmframegen_write_S1(phy->fg, txbuf_time);
     } else if (common->tx_subframe == 0 && tx_symb == SUBFRAME_LEN-1-SYNC_SYMBOLS+3) {
         phy_bs_write_sync_info(phy, txbuf_time);
-	} else if (common->pilot_symbols_tx[tx_symb] == PILOT) {
+	} else if (common->pilot_symbols_tx[sfn][tx_symb] == PILOT) {
+		// all pilot symbols carry the same pilots, see phy_chan_est_slot()
+		ofdmframegen_reset(phy->fg);
 		ofdmframegen_writesymbol(phy->fg, common->txdata_f[sfn][tx_symb],txbuf_time);
 	} else {
 		ofdmframegen_writesymbol_nopilot(phy->fg, common->txdata_f[sfn][tx_symb],txbuf_time);
@@ -554,6 +881,43 @@ void phy_bs_write_symbol(PhyBS phy, float complex* txbuf_time)
 	}
 }
 
+// Set the CFO of the user before the first symbol of an UL slot. The residual phase
+// drift of the last decoded slot corrects the CFO, see phy_bs_update_ul_cfo()
+static void phy_bs_track_cfo(PhyBS phy, uint userid, ofdmframesync fs)
+{
+	user_s* ue = phy->mac->UE[userid];
+	if (!chan_est || ue==NULL)
+		return;
+	phy_bs_update_ul_cfo(ue);
+	ofdmframesync_set_cfo(fs, ue->ul_cfo);
+}
+
+// Set the pilot pattern of an UL data slot or mini-slot before it is received, since the
+// receiver has to know which symbols carry pilots
+static void phy_bs_set_ul_pilots(PhyBS phy, uint userid)
+{
+	PhyCommon common = phy->common;
+	user_s* ue = phy->mac->UE[userid];
+	if (ue==NULL)
+		return;
+	for (uint slotnr=0; slotnr<NUM_SLOT; slotnr++) {
+		uint first_symb = phy_bs_ul_slot_start(slotnr);
+		if (phy->ulslot_assignments[common->rx_subframe%2][slotnr] == USER_MINI) {
+			for (uint mini=0; mini<NUM_MINI_SLOT; mini++) {
+				if (common->rx_symbol == first_symb+mini*MINI_SLOT_LEN) {
+					phy_set_mini_pilots(common, common->pilot_symbols_rx, first_symb, mini);
+					return;
+				}
+			}
+			continue;
+		}
+		if (common->rx_symbol == first_symb) {
+			phy_set_slot_pilots(common, common->pilot_symbols_rx, first_symb, phy_bs_ul_slot_mcs(phy, ue, slotnr));
+			return;
+		}
+	}
+}
+
 // Main PHY receive function
 //receive one ofdm symbol amount of samples and process them
 // NOTE: in constrast to the phyUE receive function, the amount of processed
@@ -571,12 +935,13 @@ void phy_bs_rx_symbol(PhyBS phy, float complex* rxbuf_time)
 		} else {
 			phy->fs_rach = ofdmframesync_create(nfft,cp_len,0,phy->common->pilot_sc,_ofdm_rx_rach_cb, phy);
 		}
+		phy_sync_reset(phy->sync_rach);
 	}
 
 	if (sfn == 0 && common->rx_symbol>=SUBFRAME_LEN-SLOT_LEN-2) {
 		// RA slot. Try to find sync sequence
 		if (phy->fs_rach && !ofdmframesync_is_synced(phy->fs_rach)) {
-			int offset = ofdmframesync_find_data_start(phy->fs_rach, rxbuf_time, rx_sym);
+			int offset = phy_sync_find_data_start(phy->sync_rach, phy->fs_rach, rxbuf_time, rx_sym);
 			if (offset !=-1) {
 				phy->rach_timing = offset+(nfft+cp_len)*(common->rx_symbol-(SUBFRAME_LEN-SLOT_LEN+SYNC_SYMBOLS-1));
 				LOG(INFO,"[PHY BS] detected preamble of association request in (%d %d)! offset %d. cfo %.3f Hz\n",
@@ -591,23 +956,27 @@ void phy_bs_rx_symbol(PhyBS phy, float complex* rxbuf_time)
             else
 				ofdmframesync_execute(phy->fs_rach, rxbuf_time, phy->rach_timing % rx_sym);
 		}
+	} else if (phy->ul_symbol_alloc[sfn%2][common->rx_symbol]==USER_RB) {
+		// split slot, shared by several users
+		phy_bs_rx_rb_symbol(phy, rxbuf_time);
 	} else {
 		// not in RA slot. Do normal receive
 		uint userid = phy->ul_symbol_alloc[sfn%2][common->rx_symbol];
 		ofdmframesync fs = mac_bs_get_receiver(phy->mac,userid);
 		if (fs!=NULL) {
-			// if this is the first symbol of a slot, soft reset the
+			// if this is the first symbol of a slot or mini-slot, soft reset the
 			// sync object
 			uint prev_rx_symb = (common->rx_symbol-1) % SUBFRAME_LEN;
-			if (common->rx_symbol == 0 || phy->ul_symbol_alloc[sfn%2][prev_rx_symb]==0) {
+			if (common->rx_symbol == 0 || phy->ul_symbol_alloc[sfn%2][prev_rx_symb]!=userid) {
 				ofdmframesync_reset_soft(fs);
+				phy_bs_track_cfo(phy, userid, fs);
+				phy_bs_set_ul_pilots(phy, userid);
 			}
 
 			if (common->pilot_symbols_rx[common->rx_symbol] == PILOT) {
 				ofdmframesync_reset_msequence(fs);
 				ofdmframesync_execute(fs,rxbuf_time,rx_sym);
 				LOG_SFN_PHY(TRACE,"[PHY BS] cfo was: %.3fHz\n",ofdmframesync_get_cfo(fs)*samplerate/6.28);
-				//ofdmframesync_set_cfo(fs,0); // TODO cfo estimation. Currently not working since we often receive if no data is sent. -> wrong pilot -> wrong cfo
 			} else {
 				ofdmframesync_execute_nopilot(fs,rxbuf_time,rx_sym);
 			}
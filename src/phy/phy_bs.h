@@ -20,6 +20,7 @@
 #define PHY_BS_H_
 
 #include "phy_common.h"
+#include "phy_sync.h"
 #include "../mac/mac_bs.h"
 #include "../platform/platform.h"
 #include <pthread.h>
@@ -31,19 +32,31 @@ struct PhyBS_s {
 	PhyCommon common;			// pointer to common phy objects
 	ofdmframegen fg;			// OFDM frame generator object
 	ofdmframesync fs_rach; 		// OFDM receiver for rach slot
+	PhySync sync_rach;			// coarse detector of the association request preamble
 
 	// Variables to store the slot assignments
 	// 1. array index: 0 for even subframes, 1 for uneven subframe
 	// 2. array index: slot index
 	uint8_t** ulslot_assignments;
 	uint8_t** ulctrl_assignments;
+	uint8_t** ulrb_assignments;		// resource blocks of the split UL slot UL_RB_SLOT
+	uint8_t** ulmini_assignments;	// mini-slots of the UL slots split in time. Index: slot*NUM_MINI_SLOT+mini
+	// HARQ retransmission flags of the UL data slots. Index: even/uneven subframe
+	uint8_t ulslot_retx[2];
 
 	// store uplink resource allocation on OFDM symbol basis
-	// BS has to pick the correct ofdmframesync object depending on the user
+	// BS has to pick the correct ofdmframesync object depending on the user.
+	// Symbols of a split slot are marked with USER_RB, mini-slots with the user of the mini-slot
 	// 1. Index: subframe index: 0 -> even, 1->odd
 	// 2. Index ofdm symbol idx
 	uint8_t** ul_symbol_alloc;
 
+	// FFT of the symbols of a split UL slot, which carry the resource blocks of several users
+	fftplan rb_fft;
+	float complex* rb_fft_in;
+	float complex* rb_fft_out;
+	float complex* rb_fft_ramp;		// corrects the phase of the FFT window that starts within the CP
+
 	dlctrl_alloc_t* dlctrl_buf;	// holds DL ctrl slot data
 
 	// buffer stores data which is sent by users during RACH procedure
@@ -76,10 +89,16 @@ void phy_bs_set_rx_slot_th_signal(PhyBS phy, pthread_cond_t* cond);
 
 /************* TX mapper functions *************************/
 int phy_map_dlslot(PhyBS phy, LogicalChannel chan, uint subframe, uint8_t slot_nr, uint userid, uint mcs);
+int phy_map_dlmini(PhyBS phy, LogicalChannel chan, uint subframe, uint8_t slot_nr, uint mini, uint mcs);
 void phy_map_dlctrl(PhyBS phy, uint subframe);
 void phy_assign_dlctrl_dd(PhyBS phy, uint8_t* slot_assignment);
+void phy_assign_dlctrl_bcast_mcs(PhyBS phy, uint mcs);
+void phy_assign_dlctrl_ul_retx(PhyBS phy, uint subframe, uint8_t retx);
 void phy_assign_dlctrl_ud(PhyBS phy, uint subframe, uint8_t* slot_assignment);
 void phy_assign_dlctrl_uc(PhyBS phy, uint subframe, uint8_t* slot_assignment);
+void phy_assign_dlctrl_ul_rb(PhyBS phy, uint subframe, uint8_t* rb_assignment);
+void phy_assign_dlctrl_dl_mini(PhyBS phy, uint8_t* slot_assignment, uint8_t* mini_assignment);
+void phy_assign_dlctrl_ul_mini(PhyBS phy, uint subframe, uint8_t* mini_assignment);
 
 /************** Main RX/TX functions ***********************/
 void phy_bs_rx_symbol(PhyBS phy, float complex* rxbuf_time);
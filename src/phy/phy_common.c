@@ -19,6 +19,34 @@
 #include "phy_common.h"
 #include "phy_config.h"
 
+const mcs_def_s mcs_table[NUM_MCS_SCHEMES] = {
+    {LIQUID_MODEM_QPSK,   LIQUID_FEC_CONV_V27},      // 0: 1.00 bit/symbol
+    {LIQUID_MODEM_QPSK,   LIQUID_FEC_CONV_V27P23},   // 1: 1.33
+    {LIQUID_MODEM_QPSK,   LIQUID_FEC_CONV_V27P34},   // 2: 1.50
+    {LIQUID_MODEM_QAM16,  LIQUID_FEC_CONV_V27},      // 3: 2.00
+    {LIQUID_MODEM_PSK8,   LIQUID_FEC_CONV_V27P34},   // 4: 2.25
+    {LIQUID_MODEM_QAM16,  LIQUID_FEC_CONV_V27P23},   // 5: 2.67
+    {LIQUID_MODEM_QAM16,  LIQUID_FEC_CONV_V27P34},   // 6: 3.00
+    {LIQUID_MODEM_QAM32,  LIQUID_FEC_CONV_V27P34},   // 7: 3.75
+    {LIQUID_MODEM_QAM64,  LIQUID_FEC_CONV_V27P23},   // 8: 4.00
+    {LIQUID_MODEM_QAM64,  LIQUID_FEC_CONV_V27P34},   // 9: 4.50
+    {LIQUID_MODEM_QAM64,  LIQUID_FEC_CONV_V27P56},   // 10: 5.00
+    {LIQUID_MODEM_QAM256, LIQUID_FEC_CONV_V27P34},   // 11: 6.00
+    {LIQUID_MODEM_QAM256, LIQUID_FEC_CONV_V27P78},   // 12: 7.00
+};
+
+
+// Size of the largest block with the given mcs whose encoded bits fit into symbols
+// resource elements. The soft bits are rounded up to full symbols
+static void calc_block_size(PhyCommon phy, uint mcs, uint symbols, uint* tbs, uint* enc_len, uint* llr_len)
+{
+    uint bps = modem_get_bps(phy->mcs_modem[mcs]);
+    *tbs = symbols*bps/8;
+    while (*tbs>0 && (fec_get_enc_msg_length(phy->mcs_fec_scheme[mcs],*tbs)*8+bps-1)/bps > symbols)
+        (*tbs)--;
+    *enc_len = fec_get_enc_msg_length(phy->mcs_fec_scheme[mcs],*tbs);
+    *llr_len = (*enc_len*8+bps-1)/bps*bps;
+}
 
 // Init the PHY instance
 PhyCommon phy_common_init()
@@ -40,36 +68,26 @@ PhyCommon phy_common_init()
 
     // alloc buffer for subcarrier definitions
     phy->pilot_sc = calloc(nfft,1);
+    phy->pilot_ref = calloc(nfft,sizeof(float));
     phy->pilot_symbols_rx = calloc(SUBFRAME_LEN,1);
-    phy->pilot_symbols_tx = calloc(SUBFRAME_LEN,1);
-
-    // init modulator objects
-    phy->mcs_modem[0] = modem_create(LIQUID_MODEM_QPSK);
-    phy->mcs_modem[1] = modem_create(LIQUID_MODEM_QPSK);
-    phy->mcs_modem[2] = modem_create(LIQUID_MODEM_QAM16);
-    phy->mcs_modem[3] = modem_create(LIQUID_MODEM_QAM16);
-    phy->mcs_modem[4] = modem_create(LIQUID_MODEM_QAM64);
-    phy->mcs_modem[5] = modem_create(LIQUID_MODEM_QAM64);
-    phy->mcs_modem[6] = modem_create(LIQUID_MODEM_QAM256);
-
-    // init FEC modules
-    phy->fec_ctrl = fec_create(LIQUID_FEC_CONV_V27, NULL);
-    phy->mcs_fec[0] = fec_create(LIQUID_FEC_CONV_V27, NULL);
-    phy->mcs_fec[1] = fec_create(LIQUID_FEC_CONV_V27P34, NULL);
-    phy->mcs_fec[2] = fec_create(LIQUID_FEC_CONV_V27, NULL);
-    phy->mcs_fec[3] = fec_create(LIQUID_FEC_CONV_V27P34, NULL);
-    phy->mcs_fec[4] = fec_create(LIQUID_FEC_CONV_V27, NULL);
-    phy->mcs_fec[5] = fec_create(LIQUID_FEC_CONV_V27P34, NULL);
-    phy->mcs_fec[6] = fec_create(LIQUID_FEC_CONV_V27, NULL);
-
-    phy->mcs_fec_scheme[0] = LIQUID_FEC_CONV_V27;
-    phy->mcs_fec_scheme[1] = LIQUID_FEC_CONV_V27P34;
-    phy->mcs_fec_scheme[2] = LIQUID_FEC_CONV_V27;
-    phy->mcs_fec_scheme[3] = LIQUID_FEC_CONV_V27P34;
-    phy->mcs_fec_scheme[4] = LIQUID_FEC_CONV_V27;
-    phy->mcs_fec_scheme[5] = LIQUID_FEC_CONV_V27P34;
-    phy->mcs_fec_scheme[6] = LIQUID_FEC_CONV_V27;
+    phy->pilot_symbols_tx = malloc(sizeof(uint8_t*)*2);
+    phy->pilot_symbols_tx[0] = calloc(SUBFRAME_LEN,1);
+    phy->pilot_symbols_tx[1] = calloc(SUBFRAME_LEN,1);
+
+    // pilot patterns of the data slots
+    for (int i=0; i<SLOT_LEN; i++) {
+        phy->slot_pilots[PILOTS_DEFAULT][i] = (pilot_symbols[i] == DATA) ? PILOT : NO_PILOT;
+        phy->slot_pilots[PILOTS_SPARSE][i] = (i==0 || i==SLOT_LEN/2 || i==SLOT_LEN-1) ? PILOT : NO_PILOT;
+        phy->slot_pilots[PILOTS_DENSE][i] = PILOT;
+    }
 
+    // init modulator and FEC objects
+    phy->fec_ctrl = fec_create(mcs_table[0].fec, NULL);
+    for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++) {
+        phy->mcs_modem[mcs] = modem_create(mcs_table[mcs].modulation);
+        phy->mcs_fec[mcs] = fec_create(mcs_table[mcs].fec, NULL);
+        phy->mcs_fec_scheme[mcs] = mcs_table[mcs].fec;
+    }
 
     // init subframe number and rx symbol nr
     phy->rx_subframe = 0;
@@ -77,11 +95,58 @@ PhyCommon phy_common_init()
     phy->tx_subframe = 0;
     phy->tx_symbol = 0;
 
-    // init the interleaver
+    // calc the slot sizes and init the interleaver. Pilot subcarriers carry data in symbols without pilots
+    for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++) {
+        uint symbols = 0;
+        for (int i=0; i<SLOT_LEN; i++)
+            symbols += num_data_sc + (phy->slot_pilots[mcs_pilots[mcs]][i] == NO_PILOT ? num_pilot_sc : 0);
+        calc_block_size(phy, mcs, symbols, &phy->mcs_tbs[mcs], &phy->mcs_enc_len[mcs], &phy->mcs_llr_len[mcs]);
+        phy->mcs_interlvr[mcs] = interleaver_create(phy->mcs_enc_len[mcs]);
+    }
+
+    // resource blocks of a split UL slot: groups of adjacent used subcarriers
+    uint rb_sc = (num_data_sc+num_pilot_sc)/NUM_UL_RB;
+    uint used = 0;
+    for (int k=0; k<nfft; k++) {
+        if (subcarrier_alloc[k] == OFDMFRAME_SCTYPE_NULL)
+            continue;
+        uint rb = used/rb_sc;
+        if (rb >= NUM_UL_RB)
+            break;
+        if (used%rb_sc == 0)
+            phy->rb_first_sc[rb] = k;
+        phy->rb_last_sc[rb] = k;
+        used++;
+    }
+    uint rb_symbols = 0;
+    for (int rb=0; rb<NUM_UL_RB; rb++) {
+        uint data_sc = 0, pilot_sc = 0, symbols = 0;
+        for (int k=phy->rb_first_sc[rb]; k<=phy->rb_last_sc[rb]; k++) {
+            data_sc += subcarrier_alloc[k] == OFDMFRAME_SCTYPE_DATA;
+            pilot_sc += subcarrier_alloc[k] == OFDMFRAME_SCTYPE_PILOT;
+        }
+        for (int i=0; i<SLOT_LEN; i++)
+            symbols += data_sc + (phy->slot_pilots[UL_RB_PILOTS][i] == NO_PILOT ? pilot_sc : 0);
+        if (rb==0 || symbols < rb_symbols)
+            rb_symbols = symbols;
+    }
+    for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++) {
+        calc_block_size(phy, mcs, rb_symbols, &phy->rb_tbs[mcs], &phy->rb_enc_len[mcs], &phy->rb_llr_len[mcs]);
+        phy->rb_interlvr[mcs] = interleaver_create(phy->rb_enc_len[mcs]);
+    }
+
+    // mini-slots of a split data slot: the halves differ in their number of pilot and guard symbols
+    uint mini_symbols = 0;
+    for (int mini=0; mini<NUM_MINI_SLOT; mini++) {
+        uint symbols = 0;
+        for (int i=mini*MINI_SLOT_LEN; i<mini*MINI_SLOT_LEN+MINI_SLOT_SYMBOLS(mini); i++)
+            symbols += num_data_sc + (phy->slot_pilots[MINI_SLOT_PILOTS][i] == NO_PILOT ? num_pilot_sc : 0);
+        if (mini==0 || symbols < mini_symbols)
+            mini_symbols = symbols;
+    }
     for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++) {
-    	uint payload_size = get_tbs_size(phy,mcs)/8;
-    	uint enc_size = fec_get_enc_msg_length(phy->mcs_fec_scheme[mcs],payload_size);
-        phy->mcs_interlvr[mcs] = interleaver_create(enc_size);
+        calc_block_size(phy, mcs, mini_symbols, &phy->mini_tbs[mcs], &phy->mini_enc_len[mcs], &phy->mini_llr_len[mcs]);
+        phy->mini_interlvr[mcs] = interleaver_create(phy->mini_enc_len[mcs]);
     }
 
     return phy;
@@ -103,14 +168,20 @@ void phy_common_destroy(PhyCommon phy)
 
     // free buffer for subcarrier definitions
     free(phy->pilot_sc);
+    free(phy->pilot_ref);
     free(phy->pilot_symbols_rx);
+    free(phy->pilot_symbols_tx[0]);
+    free(phy->pilot_symbols_tx[1]);
     free(phy->pilot_symbols_tx);
 
     // delete modulator, fec and interleaver objects
+    fec_destroy(phy->fec_ctrl);
     for (int i=0; i<NUM_MCS_SCHEMES; i++) {
         modem_destroy(phy->mcs_modem[i]);
         fec_destroy(phy->mcs_fec[i]);
         interleaver_destroy(phy->mcs_interlvr[i]);
+        interleaver_destroy(phy->rb_interlvr[i]);
+        interleaver_destroy(phy->mini_interlvr[i]);
     }
     free(phy);
 }
@@ -119,9 +190,19 @@ void phy_common_destroy(PhyCommon phy)
 // returns the Transport Block size of a UL/DL data slot in bits
 int get_tbs_size(PhyCommon phy, uint mcs)
 {
-    uint symbols = (SLOT_LEN-pilot_symbols_per_slot)*(num_data_sc+num_pilot_sc)+pilot_symbols_per_slot*num_data_sc;
-    uint enc_bits = symbols*modem_get_bps(phy->mcs_modem[mcs]); //number of encoded bits
-    return (enc_bits-16)*fec_get_rate(phy->mcs_fec_scheme[mcs]); // real tbs size. Subtract 16bit for conv encoding
+    return 8*phy->mcs_tbs[mcs];
+}
+
+// returns the Transport Block size of a resource block in bits
+int get_rb_tbs_size(PhyCommon phy, uint mcs)
+{
+    return 8*phy->rb_tbs[mcs];
+}
+
+// returns the Transport Block size of a mini-slot in bits
+int get_mini_tbs_size(PhyCommon phy, uint mcs)
+{
+    return 8*phy->mini_tbs[mcs];
 }
 
 // returns the size of the ULCTRL slots in bits
@@ -154,7 +235,7 @@ void phy_mod(PhyCommon common, uint subframe, uint first_sc, uint last_sc, uint
 	*written_samps = 0;
 	for (int sym_idx=first_symb; sym_idx<=last_symb; sym_idx++) {
 		for (int i=first_sc; i<=last_sc; i++) {
-			if ((common->pilot_symbols_tx[sym_idx] == NO_PILOT && !(common->pilot_sc[i] == OFDMFRAME_SCTYPE_NULL)) ||
+			if ((common->pilot_symbols_tx[subframe][sym_idx] == NO_PILOT && !(common->pilot_sc[i] == OFDMFRAME_SCTYPE_NULL)) ||
 			    (common->pilot_sc[i] == OFDMFRAME_SCTYPE_DATA)) {
 				modem_modulate(common->mcs_modem[mcs],(uint)data[(*written_samps)++], &common->txdata_f[subframe][sym_idx][i]);
 				if (*written_samps >= buf_len) {
@@ -165,10 +246,10 @@ void phy_mod(PhyCommon common, uint subframe, uint first_sc, uint last_sc, uint
 	}
 }
 
-// Symbol demapper with soft decision
-// returns an array with n llr values for each demapped symbol and the number of demapped bits
-void phy_demod_soft(PhyCommon common, uint first_sc, uint last_sc, uint first_symb, uint last_symb,
-					uint mcs, uint8_t* llr, uint num_llr, uint* written_samps)
+// Symbol demapper with soft decision. If evm_sum is given, the squared error vector magnitudes
+// of the demodulated symbols are added to it and the number of symbols to num_symbols
+static void demod_soft(PhyCommon common, uint first_sc, uint last_sc, uint first_symb, uint last_symb,
+					   uint mcs, uint8_t* llr, uint num_llr, uint* written_samps, float* evm_sum, uint* num_symbols)
 {
 	*written_samps = 0;
 	uint bps = modem_get_bps(common->mcs_modem[mcs]);
@@ -180,8 +261,13 @@ void phy_demod_soft(PhyCommon common, uint first_sc, uint last_sc, uint first_sy
 			if ((common->pilot_symbols_rx[sym_idx] == NO_PILOT && !(common->pilot_sc[i] == OFDMFRAME_SCTYPE_NULL)) ||
 			    (common->pilot_sc[i] == OFDMFRAME_SCTYPE_DATA)) {
 				modem_demodulate_soft(common->mcs_modem[mcs], common->rxdata_f[sym_idx][i], &symbol, &llr[*written_samps]);
+				if (evm_sum) {
+					float evm = modem_get_demodulator_evm(common->mcs_modem[mcs]);
+					*evm_sum += evm*evm;
+					(*num_symbols)++;
+				}
 				*written_samps+=bps;
-				if (*written_samps+bps >= num_llr) {
+				if (*written_samps+bps > num_llr) {
 					return;
 				}
 			}
@@ -189,45 +275,317 @@ void phy_demod_soft(PhyCommon common, uint first_sc, uint last_sc, uint first_sy
 	}
 }
 
+// Symbol demapper with soft decision
+// returns an array with n llr values for each demapped symbol and the number of demapped bits
+void phy_demod_soft(PhyCommon common, uint first_sc, uint last_sc, uint first_symb, uint last_symb,
+					uint mcs, uint8_t* llr, uint num_llr, uint* written_samps)
+{
+	demod_soft(common, first_sc, last_sc, first_symb, last_symb, mcs, llr, num_llr, written_samps, NULL, NULL);
+}
+
+// Symbol demapper with soft decision which also estimates the SNR in dB
+float phy_demod_soft_snr(PhyCommon common, uint first_sc, uint last_sc, uint first_symb, uint last_symb,
+						 uint mcs, uint8_t* llr, uint num_llr, uint* written_samps)
+{
+	float evm_sum = 0;
+	uint num_symbols = 0;
+	demod_soft(common, first_sc, last_sc, first_symb, last_symb, mcs, llr, num_llr, written_samps,
+			   &evm_sum, &num_symbols);
+	if (num_symbols==0)
+		return 0;
+	// constellations are normalized to unit energy
+	float evm = evm_sum/num_symbols;
+	return (evm > PHY_SNR_MAX_LIN) ? -10*log10f(evm) : PHY_SNR_MAX;
+}
+
+
+void phy_chan_est_slot(PhyCommon common, uint first_symb, uint last_symb, chan_est_s* est)
+{
+	phy_chan_est_sc(common, 0, nfft-1, first_symb, last_symb, est);
+}
+
+// signed subcarrier frequency of index k
+static int sc_freq(uint k)
+{
+	return (k < nfft/2) ? (int)k : (int)k-nfft;
+}
+
+void phy_chan_est_sc(PhyCommon common, uint first_sc, uint last_sc, uint first_symb, uint last_symb,
+					 chan_est_s* est)
+{
+	est->phase_drift = 0;
+	est->num_pilot_symbols = 0;
+
+	// pilot symbols of the slot and pilot subcarriers ordered by frequency
+	uint num_ps = 0, num_p = 0;
+	uint* ps = malloc(sizeof(uint)*(last_symb-first_symb+1));
+	uint* p_sc = malloc(sizeof(uint)*nfft);
+	for (uint s=first_symb; s<=last_symb; s++) {
+		if (common->pilot_symbols_rx[s] == PILOT)
+			ps[num_ps++] = s;
+	}
+	for (int f=-nfft/2; f<nfft/2; f++) {
+		uint k = (f+nfft) % nfft;
+		if (k>=first_sc && k<=last_sc && common->pilot_sc[k] == OFDMFRAME_SCTYPE_PILOT)
+			p_sc[num_p++] = k;
+	}
+	if (num_ps==0 || num_p<2) {
+		free(ps);
+		free(p_sc);
+		return;
+	}
+
+	// LS estimate on the pilots. Index: pilot symbol * num_p + pilot
+	float complex* hp = malloc(sizeof(float complex)*num_ps*num_p);
+	for (int i=0; i<num_ps; i++) {
+		for (int j=0; j<num_p; j++)
+			hp[i*num_p+j] = common->rxdata_f[ps[i]][p_sc[j]] * common->pilot_ref[p_sc[j]];
+	}
+
+	// residual CFO: phase rotation between consecutive pilot symbols
+	float drift = 0;
+	if (num_ps>1) {
+		float complex corr = 0;
+		for (int i=1; i<num_ps; i++) {
+			for (int j=0; j<num_p; j++)
+				corr += hp[i*num_p+j] * conjf(hp[(i-1)*num_p+j]);
+		}
+		float spacing = (float)(ps[num_ps-1]-ps[0]) / (num_ps-1);
+		drift = cargf(corr) / spacing;
+	}
+
+	// timing offset: phase slope between neighboring pilots in frequency
+	float complex corr_f = 0;
+	for (int i=0; i<num_ps; i++) {
+		for (int j=1; j<num_p; j++)
+			corr_f += hp[i*num_p+j] * conjf(hp[i*num_p+j-1]);
+	}
+	float slope = cargf(corr_f) * (num_p-1) / (sc_freq(p_sc[num_p-1])-sc_freq(p_sc[0]));
+
+	// remove the rotation and slope and fit h(t) = c0 + c1*(t-t_mean) for every pilot
+	float t_mean = 0, t_var = 0;
+	for (int i=0; i<num_ps; i++)
+		t_mean += ps[i];
+	t_mean /= num_ps;
+	for (int i=0; i<num_ps; i++)
+		t_var += (ps[i]-t_mean)*(ps[i]-t_mean);
+	float complex* c0 = calloc(num_p, sizeof(float complex));
+	float complex* c1 = calloc(num_p, sizeof(float complex));
+	for (int i=0; i<num_ps; i++) {
+		float complex rot = cexpf(-_Complex_I*drift*(ps[i]-t_mean));
+		for (int j=0; j<num_p; j++) {
+			float complex h = hp[i*num_p+j]*rot*cexpf(-_Complex_I*slope*sc_freq(p_sc[j]));
+			c0[j] += h/num_ps;
+			if (t_var>0)
+				c1[j] += h*(ps[i]-t_mean)/t_var;
+		}
+	}
+
+	// interpolate in frequency and equalize every symbol of the slot. Subcarriers
+	// outside the outer pilots are extrapolated from the two nearest pilots
+	for (int k=first_sc; k<=last_sc; k++) {
+		if (common->pilot_sc[k] == OFDMFRAME_SCTYPE_NULL)
+			continue;
+		int f = sc_freq(k);
+		int j = 0;
+		while (j < num_p-2) {
+			if (f < sc_freq(p_sc[j+1]))
+				break;
+			j++;
+		}
+		int f0 = sc_freq(p_sc[j]);
+		int f1 = sc_freq(p_sc[j+1]);
+		float w = (float)(f-f0)/(f1-f0);
+		float complex a0 = ((1-w)*c0[j] + w*c0[j+1]) * cexpf(_Complex_I*slope*f);
+		float complex a1 = ((1-w)*c1[j] + w*c1[j+1]) * cexpf(_Complex_I*slope*f);
+		for (uint s=first_symb; s<=last_symb; s++) {
+			float complex h = (a0 + a1*(s-t_mean)) * cexpf(_Complex_I*drift*(s-t_mean));
+			if (crealf(h*conjf(h)) > 1e-6f)
+				common->rxdata_f[s][k] /= h;
+		}
+	}
+	est->phase_drift = drift;
+	est->num_pilot_symbols = num_ps;
+
+	free(ps);
+	free(p_sc);
+	free(hp);
+	free(c0);
+	free(c1);
+}
+
+void phy_decode_slot(PhyCommon common, uint mcs, uint8_t* llr, LogicalChannel chan)
+{
+	uint8_t* deinterleaved_b = malloc(common->mcs_llr_len[mcs]);
+	interleaver_decode_soft(common->mcs_interlvr[mcs], llr, deinterleaved_b);
+	fec_decode_soft(common->mcs_fec[mcs], chan->payload_len, deinterleaved_b, chan->data);
+	free(deinterleaved_b);
+}
+
+void phy_decode_rb(PhyCommon common, uint mcs, uint8_t* llr, LogicalChannel chan)
+{
+	uint8_t* deinterleaved_b = malloc(common->rb_llr_len[mcs]);
+	interleaver_decode_soft(common->rb_interlvr[mcs], llr, deinterleaved_b);
+	fec_decode_soft(common->mcs_fec[mcs], chan->payload_len, deinterleaved_b, chan->data);
+	free(deinterleaved_b);
+}
+
+void phy_decode_mini(PhyCommon common, uint mcs, uint8_t* llr, LogicalChannel chan)
+{
+	uint8_t* deinterleaved_b = malloc(common->mini_llr_len[mcs]);
+	interleaver_decode_soft(common->mini_interlvr[mcs], llr, deinterleaved_b);
+	fec_decode_soft(common->mcs_fec[mcs], chan->payload_len, deinterleaved_b, chan->data);
+	free(deinterleaved_b);
+}
+
+// Soft bits are proportional to the distance to the decision threshold. Since the
+// receptions have a similar SNR, the average is used instead of the sum, so the combined
+// soft bits keep the range of one reception and do not saturate
+void phy_harq_combine(uint8_t* acc, uint8_t* llr, uint len, uint num_rx)
+{
+	for (uint i=0; i<len; i++)
+		acc[i] = ((num_rx-1)*acc[i] + llr[i] + num_rx/2) / num_rx;
+}
+
+int phy_harq_decode(PhyCommon common, harq_rx_proc_s* proc, uint mcs, uint8_t* llr,
+					long long unsigned int now, LogicalChannel chan, uint* num_rx)
+{
+	uint len = common->mcs_llr_len[mcs];
+	*num_rx = 1;
+	if (proc==NULL) {
+		phy_decode_slot(common, mcs, llr, chan);
+		return lchan_verify_crc(chan);
+	}
+
+	long long int age = now - proc->rx_time;
+	if (proc->num_rx>0 && proc->mcs==mcs && age>=HARQ_RTT-1 && age<=HARQ_RTT+1) {
+		// probably a retransmission of the stored block
+		phy_harq_combine(proc->llr, llr, len, proc->num_rx+1);
+		phy_decode_slot(common, mcs, proc->llr, chan);
+		if (lchan_verify_crc(chan)) {
+			*num_rx = proc->num_rx+1;
+			proc->num_rx = 0;
+			return 1;
+		}
+		phy_decode_slot(common, mcs, llr, chan);
+		if (lchan_verify_crc(chan)) {
+			proc->num_rx = 0;
+			return 1;
+		}
+		// keep the combined soft bits
+		proc->num_rx++;
+		proc->rx_time = now;
+		*num_rx = proc->num_rx;
+		if (proc->num_rx >= HARQ_MAX_TX)
+			proc->num_rx = 0;
+		return 0;
+	}
+
+	phy_decode_slot(common, mcs, llr, chan);
+	if (lchan_verify_crc(chan)) {
+		proc->num_rx = 0;
+		return 1;
+	}
+	// store the soft bits for the retransmission
+	if (proc->size < len) {
+		free(proc->llr);
+		proc->llr = malloc(len);
+		proc->size = len;
+	}
+	memcpy(proc->llr, llr, len);
+	proc->mcs = mcs;
+	proc->num_rx = 1;
+	proc->rx_time = now;
+	return 0;
+}
+
+void phy_harq_reset(harq_rx_proc_s* proc)
+{
+	proc->num_rx = 0;
+}
+
+void phy_harq_free(harq_rx_proc_s* procs, uint num)
+{
+	for (uint i=0; i<num; i++) {
+		free(procs[i].llr);
+		procs[i].llr = NULL;
+		procs[i].size = 0;
+		procs[i].num_rx = 0;
+	}
+}
+
+// Pilot values written by ofdmframegen after a reset of its pilot sequence. The pilot
+// sequence is reset before every pilot symbol, so the channel estimator knows the pilots
+static void gen_pilot_ref(PhyCommon phy)
+{
+    msequence ms = msequence_create_default(8);
+    for (int i=0; i<nfft; i++) {
+        // ofdmframegen starts at the lowest frequency
+        int k = (i + nfft/2) % nfft;
+        phy->pilot_ref[k] = 0;
+        if (phy->pilot_sc[k] == OFDMFRAME_SCTYPE_PILOT)
+            phy->pilot_ref[k] = msequence_advance(ms) ? 1.0f : -1.0f;
+    }
+    msequence_destroy(ms);
+}
 
 void gen_pilot_symbols(PhyCommon phy, uint is_bs)
 {
     // load subcarrier allocation from phy config
     memcpy(phy->pilot_sc,subcarrier_alloc,nfft);
+    gen_pilot_ref(phy);
 
     // create time domain distribution of ofdm pilots within subcarrier
 	// UE transmits in UL and RXs in DL, BS the other way around
 	// define pilots accordingly
-	uint8_t* pilot_ul,*pilot_dl;
-	if (is_bs) {
-		pilot_dl = phy->pilot_symbols_tx;
-		pilot_ul = phy->pilot_symbols_rx;
-	} else {
-		pilot_dl = phy->pilot_symbols_rx;
-		pilot_ul = phy->pilot_symbols_tx;
-	}
-
-    // Reset pilot allocation
-    memset(pilot_dl,NO_PILOT,SUBFRAME_LEN);
-    memset(pilot_ul,NO_PILOT,SUBFRAME_LEN);
-
-    // DL: dlctrl slot uses pilots
-    memset(&pilot_dl[0],PILOT,DLCTRL_LEN);
-
-    // replicate slot allocation for one slot over the subframe
-    for (int slot_nr=0; slot_nr<NUM_SLOT; slot_nr++) {
-        int slot_start = DLCTRL_LEN+SLOT_GUARD_INTERVAL + slot_nr*(SLOT_LEN+SLOT_GUARD_INTERVAL);
-        memcpy(&pilot_dl[slot_start], pilot_symbols, SLOT_LEN);
-    }
+	// The pilots of data slots are set to the pattern of the slot's MCS when the slot is
+	// mapped or before it is received, see phy_set_slot_pilots(). Start with the default pattern
+	for (int i=0; i<2; i++) {
+		uint8_t* pilot_ul,*pilot_dl;
+		if (is_bs) {
+			pilot_dl = phy->pilot_symbols_tx[i];
+			pilot_ul = phy->pilot_symbols_rx;
+		} else {
+			pilot_dl = phy->pilot_symbols_rx;
+			pilot_ul = phy->pilot_symbols_tx[i];
+		}
 
-    // Pilot symbols within subframe in UL
-    //uldata slots
-    memcpy(&pilot_ul[0], pilot_symbols, SLOT_LEN);
-    memcpy(&pilot_ul[SLOT_LEN+SLOT_GUARD_INTERVAL], pilot_symbols, SLOT_LEN);
-    memcpy(&pilot_ul[2*(SLOT_LEN+SLOT_GUARD_INTERVAL)+NUM_ULCTRL_SLOT*2], pilot_symbols, SLOT_LEN);
-    memcpy(&pilot_ul[3*(SLOT_LEN+SLOT_GUARD_INTERVAL)+NUM_ULCTRL_SLOT*2], pilot_symbols, SLOT_LEN);
+		// Reset pilot allocation
+		memset(pilot_dl,NO_PILOT,SUBFRAME_LEN);
+		memset(pilot_ul,NO_PILOT,SUBFRAME_LEN);
 
-    //ulctrl slots
-    pilot_ul[2*(SLOT_LEN+SLOT_GUARD_INTERVAL)] = PILOT;
-    pilot_ul[2*(SLOT_LEN+SLOT_GUARD_INTERVAL)+2] = PILOT;
+		// DL: dlctrl slot uses pilots
+		memset(&pilot_dl[0],PILOT,DLCTRL_LEN);
+
+		// replicate slot allocation for one slot over the subframe
+		for (int slot_nr=0; slot_nr<NUM_SLOT; slot_nr++) {
+			int slot_start = DL_SLOT_START + slot_nr*(SLOT_LEN+SLOT_GUARD_INTERVAL);
+			memcpy(&pilot_dl[slot_start], phy->slot_pilots[PILOTS_DEFAULT], SLOT_LEN);
+		}
+
+		// Pilot symbols within subframe in UL
+		//uldata slots
+		memcpy(&pilot_ul[0], phy->slot_pilots[PILOTS_DEFAULT], SLOT_LEN);
+		memcpy(&pilot_ul[SLOT_LEN+SLOT_GUARD_INTERVAL], phy->slot_pilots[PILOTS_DEFAULT], SLOT_LEN);
+		memcpy(&pilot_ul[2*(SLOT_LEN+SLOT_GUARD_INTERVAL)+NUM_ULCTRL_SLOT*2], phy->slot_pilots[PILOTS_DEFAULT], SLOT_LEN);
+		memcpy(&pilot_ul[3*(SLOT_LEN+SLOT_GUARD_INTERVAL)+NUM_ULCTRL_SLOT*2], phy->slot_pilots[PILOTS_DEFAULT], SLOT_LEN);
+
+		//ulctrl slots
+		pilot_ul[2*(SLOT_LEN+SLOT_GUARD_INTERVAL)] = PILOT;
+		pilot_ul[2*(SLOT_LEN+SLOT_GUARD_INTERVAL)+2] = PILOT;
+	}
+}
+
+void phy_set_slot_pilots(PhyCommon common, uint8_t* pilot_symbols, uint first_symb, uint mcs)
+{
+	memcpy(&pilot_symbols[first_symb], common->slot_pilots[mcs_pilots[mcs]], SLOT_LEN);
+}
+
+void phy_set_mini_pilots(PhyCommon common, uint8_t* pilot_symbols, uint slot_start, uint mini)
+{
+	uint first_symb = slot_start+mini*MINI_SLOT_LEN;
+	memcpy(&pilot_symbols[first_symb], &common->slot_pilots[MINI_SLOT_PILOTS][mini*MINI_SLOT_LEN],
+		   MINI_SLOT_SYMBOLS(mini));
+	// the guard symbol after the mini-slot carries no signal
+	memset(&pilot_symbols[first_symb+MINI_SLOT_SYMBOLS(mini)], NO_PILOT, MINI_SLOT_LEN-MINI_SLOT_SYMBOLS(mini));
 }
\ No newline at end of file
@@ -28,9 +28,13 @@
 #include <string.h>
 #include <math.h>
 
-// number of defined MCS schemes
-// has to match the number of define schemes in phy_common_init()
-#define NUM_MCS_SCHEMES 7
+// number of defined MCS schemes, see mcs_table in phy_common.c
+// max 16, the MCS is signaled in 4bit fields
+#define NUM_MCS_SCHEMES 13
+
+// upper limit of SNR estimates [dB]
+#define PHY_SNR_MAX 50.0
+#define PHY_SNR_MAX_LIN 1e-5
 
 // log makro to log with subframe number
 #define LOG_SFN_PHY(level, ...) do { if (level>=global_log_level) \
@@ -49,6 +53,15 @@ typedef union {
 
 enum {NO_PILOT, PILOT};		// definition for pilot_symbols variable
 
+// Definition of an MCS scheme
+typedef struct {
+	modulation_scheme modulation;
+	fec_scheme fec;
+} mcs_def_s;
+
+// MCS schemes ordered by spectral efficiency. MCS 0 is used for all control slots
+extern const mcs_def_s mcs_table[NUM_MCS_SCHEMES];
+
 
 // Struct contains PHY variables common to UE and BS Phy layer
 typedef struct {
@@ -59,8 +72,10 @@ typedef struct {
 	uint tx_active;	// for UEs, TX is only activated after sync is established
 
 	uint8_t* pilot_sc;	// defines which subcarriers are used for pilots
+	float* pilot_ref;	// value of each pilot subcarrier. All pilot symbols carry the same pilots
 	uint8_t* pilot_symbols_rx; // stores which OFDM symbols in a subframe contain pilots.
-	uint8_t* pilot_symbols_tx;
+	uint8_t** pilot_symbols_tx; // 1. Index: even/uneven subframe, like txdata_f. 2. Index: ofdm symbol idx
+	uint8_t slot_pilots[NUM_PILOT_PATTERNS][SLOT_LEN]; // ofdm symbols with pilots within a slot per pattern
 
 	// hold TX data in frequency domain
 	// 1. Index: subframe index: 0 for even subframes, 1 for uneven
@@ -72,18 +87,55 @@ typedef struct {
 	// 2. Index subcarrier idx
 	float complex** rxdata_f;
 
-	modem mcs_modem[8];	// array of modems for different mcs
+	modem mcs_modem[NUM_MCS_SCHEMES];	// array of modems for different mcs
 	fec fec_ctrl;       // ctrl slots are encoded with MCS 0. we add a separate coder, because data and control slots
 	                    // might be decoded in parallel (multithreading) and cannot use the same coder
-	fec mcs_fec[8];		// array of encoders/decoders for different mcs
-	fec_scheme mcs_fec_scheme[8];
-
-	interleaver mcs_interlvr[8]; // array of interleavers for different mcs
+	fec mcs_fec[NUM_MCS_SCHEMES];		// array of encoders/decoders for different mcs
+	fec_scheme mcs_fec_scheme[NUM_MCS_SCHEMES];
+
+	interleaver mcs_interlvr[NUM_MCS_SCHEMES]; // array of interleavers for different mcs
+
+	// sizes of a data slot per mcs, derived from mcs_table and the pilot pattern of the mcs
+	uint mcs_tbs[NUM_MCS_SCHEMES];		// transport block size [bytes]
+	uint mcs_enc_len[NUM_MCS_SCHEMES];	// encoded transport block [bytes]
+	uint mcs_llr_len[NUM_MCS_SCHEMES];	// soft bits of the encoded block, rounded up to full symbols
+
+	// resource blocks of a split UL slot: subcarrier range of each block and sizes per mcs.
+	// All blocks have the size of the smallest block
+	uint rb_first_sc[NUM_UL_RB];
+	uint rb_last_sc[NUM_UL_RB];
+	uint rb_tbs[NUM_MCS_SCHEMES];
+	uint rb_enc_len[NUM_MCS_SCHEMES];
+	uint rb_llr_len[NUM_MCS_SCHEMES];
+	interleaver rb_interlvr[NUM_MCS_SCHEMES];
+
+	// sizes of a mini-slot per mcs. Both halves of a split slot have the size of the smaller one,
+	// i.e. of the first half, which ends with the guard symbol
+	uint mini_tbs[NUM_MCS_SCHEMES];
+	uint mini_enc_len[NUM_MCS_SCHEMES];
+	uint mini_llr_len[NUM_MCS_SCHEMES];
+	interleaver mini_interlvr[NUM_MCS_SCHEMES];
 
 } PhyCommon_s;
 
 typedef PhyCommon_s* PhyCommon;
 
+// HARQ receive process. Holds the soft bits of a block with CRC error, which are
+// combined with the retransmission of the block (Chase combining)
+typedef struct {
+	uint8_t* llr;			// soft bits of all receptions, averaged
+	uint size;				// allocated size of llr
+	uint8_t mcs;
+	uint8_t num_rx;			// receptions stored in llr, 0 if the process is idle
+	long long unsigned int rx_time;	// subframe counter of the last reception
+} harq_rx_proc_s;
+
+// Result of the channel estimation of a slot
+typedef struct {
+	float phase_drift;			// residual phase rotation per OFDM symbol [rad], caused by a residual CFO
+	uint num_pilot_symbols;		// pilot symbols of the slot, 0 if the slot was not equalized
+} chan_est_s;
+
 // Create the common phy struct
 PhyCommon phy_common_init();
 
@@ -92,6 +144,12 @@ void phy_common_destroy(PhyCommon phy);
 // returns the Transport Block size of a UL/DL data slot in bits
 int get_tbs_size(PhyCommon phy, uint mcs);
 
+// returns the Transport Block size of a resource block of a split UL slot in bits
+int get_rb_tbs_size(PhyCommon phy, uint mcs);
+
+// returns the Transport Block size of a mini-slot (half of a split data slot) in bits
+int get_mini_tbs_size(PhyCommon phy, uint mcs);
+
 // returns the size of an UL control slot in bits
 int get_ulctrl_slot_size(PhyCommon phy);
 
@@ -105,9 +163,65 @@ void phy_mod(PhyCommon common, uint subframe, uint first_sc, uint last_sc, uint
 void phy_demod_soft(PhyCommon common, uint first_sc, uint last_sc, uint first_symb, uint last_symb,
 					uint mcs, uint8_t* llr, uint num_llr, uint* written_samps);
 
+// Symbol demapper like phy_demod_soft(). Additionally estimates the SNR from the error vector
+// magnitude of the symbols w.r.t. the nearest constellation point. The estimate is too high if
+// many symbols are demodulated wrongly, i.e. below the SNR range of the modulation, since a
+// wrong decision is closer to the received symbol than the transmitted point
+// returns the SNR in dB, limited to PHY_SNR_MAX
+float phy_demod_soft_snr(PhyCommon common, uint first_sc, uint last_sc, uint first_symb, uint last_symb,
+						 uint mcs, uint8_t* llr, uint num_llr, uint* written_samps);
+
+// Deinterleave and decode the soft bits of a data slot into the logical channel
+void phy_decode_slot(PhyCommon common, uint mcs, uint8_t* llr, LogicalChannel chan);
+
+// Deinterleave and decode the soft bits of a resource block into the logical channel
+void phy_decode_rb(PhyCommon common, uint mcs, uint8_t* llr, LogicalChannel chan);
+
+// Deinterleave and decode the soft bits of a mini-slot into the logical channel
+void phy_decode_mini(PhyCommon common, uint mcs, uint8_t* llr, LogicalChannel chan);
+
+// Add the soft bits of a new reception to the average of num_rx-1 previous receptions
+void phy_harq_combine(uint8_t* acc, uint8_t* llr, uint len, uint num_rx);
+
+// Decode a unicast data slot with HARQ. If the process holds a block with the same MCS that
+// failed HARQ_RTT subframes ago (+-1 due to processing jitter), the slot is combined with it first.
+// If this fails, the slot is decoded on its own, since the transmitter might have given up the
+// block. Failed receptions are stored for the retransmission, up to HARQ_MAX_TX receptions.
+// now is a subframe counter. proc may be NULL to decode without HARQ.
+// returns 1 if the CRC is valid. num_rx is set to the number of receptions of the block
+int phy_harq_decode(PhyCommon common, harq_rx_proc_s* proc, uint mcs, uint8_t* llr,
+					long long unsigned int now, LogicalChannel chan, uint* num_rx);
+
+// Forget the stored block of a process
+void phy_harq_reset(harq_rx_proc_s* proc);
+
+// Free the soft bit buffers of num processes
+void phy_harq_free(harq_rx_proc_s* procs, uint num);
+
+// Pilot based channel estimation and equalization of the symbols first_symb..last_symb in
+// rxdata_f. ofdmframesync equalizes with the gain estimated from the last sync sequence and
+// corrects the phase of pilot symbols. The remaining channel is estimated on the pilots of all
+// pilot symbols of the slot. The phase rotation between pilot symbols gives the residual CFO,
+// which is removed before a line is fitted in time through the estimates of each pilot.
+// The fit averages the noise over the slot and follows a channel that changes within the slot.
+// The phase slope between neighboring pilots, caused by a timing offset, is removed before the
+// estimate is interpolated linearly between the pilots in frequency
+void phy_chan_est_slot(PhyCommon common, uint first_symb, uint last_symb, chan_est_s* est);
+
+// Channel estimation like phy_chan_est_slot(), restricted to the pilots and subcarriers
+// first_sc..last_sc, e.g. a resource block. Needs at least two pilot subcarriers
+void phy_chan_est_sc(PhyCommon common, uint first_sc, uint last_sc, uint first_symb, uint last_symb,
+					 chan_est_s* est);
+
 // Define which OFDM symbols whithin a subframe contain pilots
 void gen_pilot_symbols(PhyCommon phy, uint is_bs);
-void gen_pilot_symbols_robust(PhyCommon phy, uint is_bs);
-void gen_pilot_symbols_robust2(PhyCommon phy, uint is_bs);
+
+// Set the pilot symbols of a data slot that starts at first_symb to the pilot pattern of the mcs.
+// pilot_symbols is pilot_symbols_rx or one of the pilot_symbols_tx arrays
+void phy_set_slot_pilots(PhyCommon common, uint8_t* pilot_symbols, uint first_symb, uint mcs);
+
+// Set the pilot pattern of mini-slot mini of the split data slot starting at slot_start.
+// The halves of a split slot use the halves of the MINI_SLOT_PILOTS pattern
+void phy_set_mini_pilots(PhyCommon common, uint8_t* pilot_symbols, uint slot_start, uint mini);
 
 #endif /* PHY_COMMON_H_ */
@@ -20,11 +20,12 @@
 #include "../util/log.h"
 #include <libconfig.h>
 #include <liquid/liquid.h>
+#include <string.h>
 
 void phy_config_load_file(char* config_file)
 {
     config_t cfg;
-    config_setting_t* phy_settings=NULL, *subcarrier_settings=NULL, *symbol_settings=NULL;
+    config_setting_t* phy_settings=NULL, *subcarrier_settings=NULL, *symbol_settings=NULL, *mcs_settings=NULL;
     config_init(&cfg);
 
     /* Read the file. If there is an error, report it and exit. */
@@ -46,6 +47,14 @@ void phy_config_load_file(char* config_file)
         config_setting_lookup_float(phy_settings,"agc_rssi_filt_param",&agc_rssi_filt_param);
         config_setting_lookup_int(phy_settings,"agc_change_threshold",&agc_change_threshold);
         config_setting_lookup_int(phy_settings,"agc_desired_rssi",&agc_desired_rssi);
+        config_setting_lookup_int(phy_settings,"chan_est",&chan_est);
+        config_setting_lookup_int(phy_settings,"rx_gating",&rx_gating);
+        config_setting_lookup_int(phy_settings,"coarse_sync",&coarse_sync);
+        config_setting_lookup_int(phy_settings,"coarse_sync_decim",&coarse_sync_decim);
+        config_setting_lookup_int(phy_settings,"coarse_sync_max_cfo",&coarse_sync_max_cfo);
+        config_setting_lookup_float(phy_settings,"coarse_sync_threshold",&coarse_sync_threshold);
+        config_setting_lookup_int(phy_settings,"ul_rb",&ul_rb);
+        config_setting_lookup_int(phy_settings,"mini_slots",&mini_slots);
 
         subcarrier_settings = config_setting_get_member(phy_settings, "subcarrier_alloc");
         if (subcarrier_settings!=NULL && config_setting_length(subcarrier_settings)>0) {
@@ -87,6 +96,17 @@ void phy_config_load_file(char* config_file)
                 }
             }
         }
+        mcs_settings = config_setting_get_member(phy_settings, "mcs_pilots");
+        if (mcs_settings!=NULL) {
+            for (int i=0; i<config_setting_length(mcs_settings) && i<16; i++) {
+                mcs_pilots[i] = config_setting_get_int_elem(mcs_settings,i);
+                if (mcs_pilots[i]<0 || mcs_pilots[i]>=NUM_PILOT_PATTERNS) {
+                    LOG(ERR, "[PHY CONFIG] error when parsing mcs_pilots. %d is an unknown pilot pattern\n",
+                        mcs_pilots[i]);
+                    mcs_pilots[i] = PILOTS_DEFAULT;
+                }
+            }
+        }
     }
 }
 
@@ -125,11 +145,22 @@ void phy_config_default_64()
     pilot_symbols = calloc(SLOT_LEN,1);
     for (int i=0; i<SLOT_LEN; i+=2)
         pilot_symbols[i]=DATA;
+    int mcs_pilots_default[] = DEFAULT_MCS_PILOTS;
+    memset(mcs_pilots, 0, sizeof(mcs_pilots));
+    memcpy(mcs_pilots, mcs_pilots_default, sizeof(mcs_pilots_default));
 
     coarse_cfo_filt_param = DEFAULT_COARSE_CFO_FILT_PARAM;
     agc_rssi_filt_param = DEFAULT_AGC_RSSI_FILT_PARAM;
     agc_change_threshold = DEFAULT_AGC_CHANGE_THRESHOLD;
     agc_desired_rssi = DEFAULT_AGC_DESIRED_RSSI;
+    chan_est = DEFAULT_CHAN_EST;
+    rx_gating = DEFAULT_RX_GATING;
+    coarse_sync = DEFAULT_COARSE_SYNC;
+    coarse_sync_decim = DEFAULT_COARSE_SYNC_DECIM;
+    coarse_sync_max_cfo = DEFAULT_COARSE_SYNC_MAX_CFO;
+    coarse_sync_threshold = DEFAULT_COARSE_SYNC_THRESHOLD;
+    ul_rb = DEFAULT_UL_RB;
+    mini_slots = DEFAULT_MINI_SLOTS;
 }
 
 void phy_config_print()
@@ -154,6 +185,16 @@ void phy_config_print()
         printf("%d ", pilot_symbols[x]);
     }
     printf("\n");
+    printf("pilots per MCS: ");
+    for (int x = 0; x < 16; x++)
+        printf("%d ", mcs_pilots[x]);
+    printf("\n");
 
     printf("coarse cfo filter param: %.3f\n",coarse_cfo_filt_param);
+    printf("channel estimation: %s\n", chan_est ? "pilot based" : "sync sequence only");
+    printf("UE rx gating: %d\n", rx_gating);
+    printf("coarse sync: %d, decimation %d, max cfo %d Hz, threshold %.2f\n",
+           coarse_sync, coarse_sync_decim, coarse_sync_max_cfo, coarse_sync_threshold);
+    printf("UL resource blocks: %d\n", ul_rb);
+    printf("mini-slots: %d\n", mini_slots);
 }
@@ -43,14 +43,62 @@
 #define SLOT_GUARD_INTERVAL 1 // number of ofdm symbols between two slots
 #define NUM_ULCTRL_SLOT 2	// number of UL control slots
 #define SUBFRAME_LEN 64		// number of OFDM symbols per subframe
-#define DLCTRL_LEN 2		// number of OFDM symbols for DL control info
+#define DLCTRL_LEN 3		// number of OFDM symbols for DL control info
+#define DL_SLOT_START 4		// first OFDM symbol of DL data slot 0
+// UL data slot UL_RB_SLOT can be split into NUM_UL_RB resource blocks of adjacent subcarriers,
+// which are assigned to different users. Slot 2 is used since it is available in every subframe
+#define NUM_UL_RB 4
+#define UL_RB_SLOT 2
+#define UL_RB_PILOTS PILOTS_DEFAULT	// pilot pattern of a split slot, independent of the MCS
+// A DL or UL data slot can be split in time into NUM_MINI_SLOT mini-slots of MINI_SLOT_LEN symbols,
+// which are assigned to different users. Mini-slot m of a subframe is half m%NUM_MINI_SLOT of slot
+// m/NUM_MINI_SLOT. The last MINI_SLOT_GUARD symbols of each half except the last one stay unused,
+// since the PTT edges of the UEs of adjacent UL halves fall into them, like the guard between slots.
+// Mini-slot m starts at symbol m*MINI_SLOT_LEN of the slot and has MINI_SLOT_SYMBOLS(m) symbols
+#define NUM_MINI_SLOT 2
+#define MINI_SLOT_LEN (SLOT_LEN/NUM_MINI_SLOT)
+#define MINI_SLOT_GUARD 1
+#define MINI_SLOT_SYMBOLS(m) (MINI_SLOT_LEN - ((m)<NUM_MINI_SLOT-1 ? MINI_SLOT_GUARD : 0))
+#define MINI_SLOT_PILOTS PILOTS_DEFAULT	// pilot pattern of a split slot, independent of the MCS
+// DL control info: one nibble per DL/UL data slot and UL ctrl slot with the
+// assigned userid, followed by one byte with the MCS of the broadcast slots (upper nibble)
+// and the HARQ retransmission flags of the UL data slots (lower nibble, bit i is slot i),
+// followed by one nibble per resource block of slot UL_RB_SLOT with the assigned userid.
+// Resource blocks are only used if the slot itself is not assigned.
+// The last byte per link direction (DL, UL) signals a slot split into mini-slots: the upper nibble
+// is the slot number+1 (0: no split slot), the lower nibble the user of the second mini-slot.
+// The nibble of the split slot holds the user of the first mini-slot.
+// The DL ctrl slot is sent with MCS 0 and holds up to 11 bytes including the CRC
+#define DLCTRL_BCAST_MCS_IDX ((2*NUM_SLOT+NUM_ULCTRL_SLOT)/2)
+#define DLCTRL_RB_IDX (DLCTRL_BCAST_MCS_IDX+1)
+#define DLCTRL_MINI_IDX (DLCTRL_RB_IDX+NUM_UL_RB/2)
+#define DLCTRL_SIZE (DLCTRL_MINI_IDX+2)
 #define SYNC_SYMBOLS 4		// number of OFDM symbols for synch signaling
 #define FRAME_LEN 8			// number of subframes per frame
 #define DL_UL_SHIFT 34		// number of ofdm symbols the UL is shifted behind
 #define MAX_USER 16
 
+// HARQ: a block with CRC error is retransmitted in the same slot HARQ_RTT subframes later
+#define HARQ_RTT 4			// number of subframes after which a HARQ process recurs
+#define HARQ_PROCESSES (HARQ_RTT*NUM_SLOT)	// HARQ processes per user and link direction
+#define HARQ_MAX_TX 4		// max number of transmissions of a block
+// HARQ process of a data slot
+#define HARQ_PROC(subframe, slot) (((subframe)%HARQ_RTT)*NUM_SLOT + (slot))
+
 
 #define DEFAULT_COARSE_CFO_FILT_PARAM 0.8f
+#define DEFAULT_CHAN_EST 1
+#define DEFAULT_RX_GATING 1
+#define DEFAULT_COARSE_SYNC 1
+#define DEFAULT_COARSE_SYNC_DECIM 1
+#define DEFAULT_COARSE_SYNC_MAX_CFO 4000
+#define DEFAULT_COARSE_SYNC_THRESHOLD 0.3f
+#define DEFAULT_UL_RB 1
+#define DEFAULT_MINI_SLOTS 1
+// pilot pattern of each MCS: sparse pilots for 64QAM 3/4 and above
+#define DEFAULT_MCS_PILOTS {PILOTS_DEFAULT, PILOTS_DEFAULT, PILOTS_DEFAULT, PILOTS_DEFAULT, PILOTS_DEFAULT, \
+							PILOTS_DEFAULT, PILOTS_DEFAULT, PILOTS_DEFAULT, PILOTS_DEFAULT, PILOTS_SPARSE, \
+							PILOTS_SPARSE, PILOTS_SPARSE, PILOTS_SPARSE}
 
 // AGC default configuration
 #define DEFAULT_AGC_RSSI_FILT_PARAM 0.25f
@@ -71,7 +119,14 @@
 #endif
 
 
-enum {NOT_USED, DATA, PTT_UP, PTT_DOWN}; // definition for tx_symbol allocation variable
+// definition for tx_symbol allocation variable
+// DATA_RB: data symbol of a split UL slot. The UE writes its pilots itself and leaves the
+// subcarriers of the other resource blocks empty
+enum {NOT_USED, DATA, PTT_UP, PTT_DOWN, DATA_RB};
+
+// Pilot patterns of data slots in time domain
+// default: pilot_symbols, sparse: first, middle and last symbol, dense: every symbol
+enum {PILOTS_DEFAULT, PILOTS_SPARSE, PILOTS_DENSE, NUM_PILOT_PATTERNS};
 
 // ---------------------------- global PHY layer configurtion  --------------------------------- //
 
@@ -86,6 +141,9 @@ int num_data_sc;            // total number of data subcarriers
 int num_pilot_sc;           // total number of pilot subcarriers
 int pilot_symbols_per_slot; // number of symbols including pilots per slot
 char* pilot_symbols;        // ofdm symbol types within a data-slot
+// Pilot pattern of the data slots of each MCS. Both ends derive the pattern from the MCS of
+// a slot, so it changes with the MCS of a user. Only the first NUM_MCS_SCHEMES entries are used
+int mcs_pilots[16];
 
 // UE regularly re-syncs to the sync sequence to estimate timing offset
 // during this also the carrier frequency offset is estimated.
@@ -106,6 +164,30 @@ int agc_change_threshold;
 // Theoretical limits for RSSI are [-66 0]. For OFDM-QAM waveform this should be set to ~ -15
 int agc_desired_rssi;
 
+// Equalize the data slots with the pilot based channel estimator, see phy_chan_est_slot().
+// Otherwise only the gain estimated by ofdmframesync from the sync sequence is used
+int chan_est;
+
+// UE only passes symbols to the OFDM receiver that belong to the DL ctrl slot, to DL slots
+// assigned to it or broadcast, or to the sync sequence. Other symbols are skipped without FFT
+int rx_gating;
+
+// UE initial sync and BS random access search the sync sequence with an FFT based
+// correlator first, see phy_sync.h. 0: sample by sample search of ofdmframesync only
+int coarse_sync;
+int coarse_sync_decim;			// decimation of the samples before the correlation: 1 or 2
+int coarse_sync_max_cfo;		// CFO [Hz] before sync that is covered by the correlator
+double coarse_sync_threshold;	// detection threshold of the normalized correlation [0 1]
+
+// BS splits UL slot UL_RB_SLOT into resource blocks for users with few bytes to send. The
+// subcarriers of all users are taken from one FFT per symbol and equalized per resource block.
+// UEs always follow the assignments signaled in the DL ctrl slot
+int ul_rb;
+
+// BS splits one DL and one UL data slot per subframe into mini-slots for users with few bytes
+// to send. UEs always follow the assignments signaled in the DL ctrl slot
+int mini_slots;
+
 int log_coarse_cfo_flag;    // set this flag to enable logging the coarse cfo estimate to a file
 char coarse_cfo_logfile[80];// name of the coarse cfo logfile
 
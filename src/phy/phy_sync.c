@@ -0,0 +1,342 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#include "phy_sync.h"
+#include "phy_config.h"
+#include "../util/log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define SYNC_SEQ_SYMBOLS 3		// S0a, S0b and S1
+// ofdmframesync gets the sync sequence and one symbol in front of it
+#define SYNC_WINDOW_SYMBOLS (SYNC_SEQ_SYMBOLS+1)
+// number of new symbols ofdmframesync may search after a coarse detection
+#define SYNC_FINE_SYMBOLS 2
+
+struct PhySync_s {
+	uint decim;				// decimation factor
+	uint M;					// length of the decimated S1 reference
+	uint N;					// FFT size
+	int num_shifts;			// number of frequency shifts of the spectrum on each side
+
+	float complex* H;		// spectrum of the matched filter, normalized by the reference energy
+	float complex* x;		// M-1 old and up to M+1 new decimated samples
+	float complex* X;		// spectrum of x
+	float complex* Y;		// shifted spectrum of x times H
+	float complex* y;		// correlation
+	float* energy;			// cumulative energy of x
+	fftplan fft;
+	fftplan ifft;
+	uint x_len;				// number of samples in x
+	uint x_eval;			// correlation is evaluated up to this index of x
+	uint64_t x_start;		// full rate sample index of x[0]
+	float complex acc;		// decimator
+	uint acc_len;
+
+	float complex* hist;	// ring buffer of the last full rate samples
+	float complex* window;	// linear copy of the history for ofdmframesync
+	uint hist_len;
+	uint64_t num_samples;	// number of samples since the last reset
+
+	int detected;			// ofdmframesync searches after a coarse detection
+	uint64_t trigger;		// sample index behind the detected S1 symbol
+	uint fine_remaining;	// samples ofdmframesync may still search
+
+	sync_stats_s stats;
+};
+
+static uint64_t phy_sync_time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+PhySync phy_sync_init(unsigned char* subcarrier_alloc)
+{
+	PhySync sync = calloc(sizeof(struct PhySync_s),1);
+	uint sym_len = nfft+cp_len;
+
+	sync->decim = coarse_sync_decim;
+	// with a decimation by 4 the correlation over 16 samples is too noisy
+	if (sync->decim<1 || sync->decim>2 || nfft % sync->decim) {
+		LOG(WARN,"[PHY] coarse sync decimation %d not supported. Using 1\n", coarse_sync_decim);
+		sync->decim = 1;
+	}
+	sync->M = nfft/sync->decim;
+	sync->N = 2*sync->M;
+	// the bins of the N point FFT are samplerate/(2*nfft) apart, independent of the decimation
+	sync->num_shifts = roundf((float)coarse_sync_max_cfo*2*nfft/samplerate);
+	if (sync->num_shifts > sync->N/4)
+		sync->num_shifts = sync->N/4;
+
+	sync->H = malloc(sync->N*sizeof(float complex));
+	sync->x = calloc(sync->N,sizeof(float complex));
+	sync->X = malloc(sync->N*sizeof(float complex));
+	sync->Y = malloc(sync->N*sizeof(float complex));
+	sync->y = malloc(sync->N*sizeof(float complex));
+	sync->energy = malloc((sync->N+1)*sizeof(float));
+	sync->fft = fft_create_plan(sync->N, sync->x, sync->X, LIQUID_FFT_FORWARD, 0);
+	sync->ifft = fft_create_plan(sync->N, sync->Y, sync->y, LIQUID_FFT_BACKWARD, 0);
+
+	// reference: the decimated S1 symbol without cyclic prefix. The periodic S0 symbols
+	// would correlate at several lags
+	float complex* seq = malloc(SYNC_SEQ_SYMBOLS*sym_len*sizeof(float complex));
+	ofdmframegen fg = ofdmframegen_create(nfft, cp_len, 0, subcarrier_alloc);
+	ofdmframegen_write_S0a(fg, seq);
+	ofdmframegen_write_S0b(fg, seq+sym_len);
+	ofdmframegen_write_S1(fg, seq+2*sym_len);
+	ofdmframegen_destroy(fg);
+	float complex* s1 = seq+(SYNC_SEQ_SYMBOLS-1)*sym_len+cp_len;
+
+	// matched filter h[n] = conj(r[M-1-n]), zero padded to N
+	float complex* h = calloc(sync->N,sizeof(float complex));
+	float ref_energy = 0;
+	for (int m=0; m<sync->M; m++) {
+		float complex r = 0;
+		for (int d=0; d<sync->decim; d++)
+			r += s1[m*sync->decim+d];
+		h[sync->M-1-m] = conjf(r);
+		ref_energy += crealf(r*conjf(r));
+	}
+	fftplan p = fft_create_plan(sync->N, h, sync->H, LIQUID_FFT_FORWARD, 0);
+	fft_execute(p);
+	fft_destroy_plan(p);
+	// the inverse FFT is not normalized
+	for (int i=0; i<sync->N; i++)
+		sync->H[i] /= sync->N*sqrtf(ref_energy);
+	free(h);
+	free(seq);
+
+	// the window for ofdmframesync ends up to one block behind the detected S1
+	sync->hist_len = (SYNC_WINDOW_SYMBOLS+2)*sym_len;
+	sync->hist = malloc(sync->hist_len*sizeof(float complex));
+	sync->window = malloc(sync->hist_len*sizeof(float complex));
+
+	phy_sync_reset(sync);
+	return sync;
+}
+
+void phy_sync_destroy(PhySync sync)
+{
+	fft_destroy_plan(sync->fft);
+	fft_destroy_plan(sync->ifft);
+	free(sync->H);
+	free(sync->x);
+	free(sync->X);
+	free(sync->Y);
+	free(sync->y);
+	free(sync->energy);
+	free(sync->hist);
+	free(sync->window);
+	free(sync);
+}
+
+// restart the correlation after samples were only passed to ofdmframesync. The last samples
+// of the history fill the correlator, so the next sample can be evaluated
+static void phy_sync_restart(PhySync sync)
+{
+	uint len = (sync->M-1)*sync->decim;
+	if (len > sync->num_samples)
+		len = sync->num_samples - sync->num_samples % sync->decim;
+	sync->x_start = sync->num_samples-len;
+	sync->x_len = 0;
+	for (int i=0; i<len; i+=sync->decim) {
+		float complex acc = 0;
+		for (int d=0; d<sync->decim; d++)
+			acc += sync->hist[(sync->x_start+i+d) % sync->hist_len];
+		sync->x[sync->x_len++] = acc;
+	}
+	sync->x_eval = sync->x_len;
+	sync->acc = 0;
+	sync->acc_len = 0;
+	sync->detected = 0;
+	sync->fine_remaining = 0;
+}
+
+// clear the sample history and the detector state
+static void phy_sync_clear(PhySync sync)
+{
+	sync->num_samples = 0;
+	phy_sync_restart(sync);
+}
+
+void phy_sync_reset(PhySync sync)
+{
+	phy_sync_clear(sync);
+	memset(&sync->stats, 0, sizeof(sync_stats_s));
+}
+
+const sync_stats_s* phy_sync_get_stats(PhySync sync)
+{
+	return &sync->stats;
+}
+
+static void phy_sync_push_history(PhySync sync, float complex* samples, uint num_samples)
+{
+	for (int i=0; i<num_samples; i++) {
+		sync->hist[sync->num_samples % sync->hist_len] = samples[i];
+		sync->num_samples++;
+	}
+}
+
+// Evaluate the correlation for the samples in x that were not evaluated yet.
+// Samples behind x_len are set to zero, their correlation is evaluated later
+// sets detected and trigger if the normalized correlation exceeds the threshold
+static void phy_sync_correlate(PhySync sync)
+{
+	uint M = sync->M;
+	uint N = sync->N;
+	uint first = sync->x_eval > M-1 ? sync->x_eval : M-1;
+	if (sync->x_len <= first)
+		return;
+
+	memset(sync->x+sync->x_len, 0, (N-sync->x_len)*sizeof(float complex));
+	fft_execute(sync->fft);
+	sync->energy[0] = 0;
+	for (int i=0; i<sync->x_len; i++)
+		sync->energy[i+1] = sync->energy[i] + crealf(sync->x[i]*conjf(sync->x[i]));
+
+	float max = 0;
+	int max_idx = 0;
+	for (int k=-sync->num_shifts; k<=sync->num_shifts; k++) {
+		// shifting the spectrum by k bins removes a CFO of k*samplerate/(2*nfft)
+		for (int i=0; i<N; i++)
+			sync->Y[i] = sync->X[(i+k+N) % N] * sync->H[i];
+		fft_execute(sync->ifft);
+		// y[j] is the correlation of the M samples ending with x[j]
+		for (int j=first; j<sync->x_len; j++) {
+			float e = sync->energy[j+1] - sync->energy[j+1-M];
+			float c = crealf(sync->y[j]*conjf(sync->y[j]));
+			if (e > 0 && c > max*e) {
+				max = c/e;
+				max_idx = j;
+			}
+		}
+	}
+	sync->x_eval = sync->x_len;
+
+	if (max > coarse_sync_threshold) {
+		sync->detected = 1;
+		sync->trigger = sync->x_start + (uint64_t)(max_idx+1)*sync->decim;
+	}
+}
+
+// Pass samples through the coarse detector until the sync sequence is detected
+// returns the number of processed samples
+static uint phy_sync_detect(PhySync sync, float complex* rxbuf_time, uint num_samples)
+{
+	for (int i=0; i<num_samples; i++) {
+		phy_sync_push_history(sync, &rxbuf_time[i], 1);
+		sync->acc += rxbuf_time[i];
+		if (++sync->acc_len < sync->decim)
+			continue;
+		sync->x[sync->x_len++] = sync->acc;
+		sync->acc = 0;
+		sync->acc_len = 0;
+		if (sync->x_len == sync->N) {
+			phy_sync_correlate(sync);
+			// keep the last M-1 samples for the next block
+			uint shift = sync->N-(sync->M-1);
+			memmove(sync->x, sync->x+shift, (sync->M-1)*sizeof(float complex));
+			sync->x_start += (uint64_t)shift*sync->decim;
+			sync->x_len = sync->M-1;
+			sync->x_eval = sync->M-1;
+			if (sync->detected)
+				return i+1;
+		}
+	}
+	// evaluate the incomplete block, so the detection does not lag behind the buffer
+	phy_sync_correlate(sync);
+	return num_samples;
+}
+
+// Hand the samples of the detected sync sequence to ofdmframesync
+// returns the sample index of the ofdm symbol after the sync sequence relative to
+// the current buffer, or -1
+static int phy_sync_fine(PhySync sync, ofdmframesync fs, uint64_t buf_start)
+{
+	uint sym_len = nfft+cp_len;
+	uint64_t hist_first = sync->num_samples > sync->hist_len ? sync->num_samples-sync->hist_len : 0;
+	uint64_t start = sync->trigger > SYNC_WINDOW_SYMBOLS*sym_len ? sync->trigger-SYNC_WINDOW_SYMBOLS*sym_len : 0;
+	if (start < hist_first)
+		start = hist_first;
+	uint len = sync->num_samples-start;
+	for (int i=0; i<len; i++)
+		sync->window[i] = sync->hist[(start+i) % sync->hist_len];
+
+	sync->stats.detections++;
+	sync->fine_remaining = SYNC_FINE_SYMBOLS*sym_len;
+	ofdmframesync_reset(fs);
+	int offset = ofdmframesync_find_data_start(fs, sync->window, len);
+	if (offset == -1)
+		return -1;
+	if (start+offset < buf_start) {
+		// the data symbols started in a previous buffer
+		sync->stats.misses++;
+		phy_sync_restart(sync);
+		ofdmframesync_reset(fs);
+		return -1;
+	}
+	return start+offset-buf_start;
+}
+
+int phy_sync_find_data_start(PhySync sync, ofdmframesync fs, float complex* rxbuf_time, uint num_samples)
+{
+	uint64_t t_start = phy_sync_time_ns();
+	int offset = -1;
+
+	if (!coarse_sync) {
+		offset = ofdmframesync_find_data_start(fs, rxbuf_time, num_samples);
+	} else {
+		uint64_t buf_start = sync->num_samples;
+		uint pos = 0;
+		while (pos < num_samples && offset == -1) {
+			if (!sync->detected) {
+				pos += phy_sync_detect(sync, rxbuf_time+pos, num_samples-pos);
+				if (sync->detected)
+					offset = phy_sync_fine(sync, fs, buf_start);
+			} else {
+				// ofdmframesync did not find the sequence in the window. Let it search the next samples
+				uint len = fmin(num_samples-pos, sync->fine_remaining);
+				int off = ofdmframesync_find_data_start(fs, rxbuf_time+pos, len);
+				if (off != -1) {
+					offset = pos+off;
+					len = off;
+				}
+				phy_sync_push_history(sync, rxbuf_time+pos, len);
+				pos += len;
+				sync->fine_remaining -= len;
+				if (offset == -1 && sync->fine_remaining == 0) {
+					sync->stats.misses++;
+					phy_sync_restart(sync);
+					ofdmframesync_reset(fs);
+				}
+			}
+		}
+		if (offset != -1)
+			phy_sync_clear(sync);
+	}
+
+	sync->stats.samples += offset==-1 ? num_samples : offset;
+	sync->stats.cpu_ns += phy_sync_time_ns()-t_start;
+	return offset;
+}
@@ -0,0 +1,60 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+#ifndef PHY_SYNC_H_
+#define PHY_SYNC_H_
+
+#include <liquid/liquid.h>
+#include <stdint.h>
+
+// Coarse detection of the sync sequence (S0a, S0b, S1) in front of ofdmframesync.
+// The received samples are optionally decimated and cross correlated with the S1 symbol
+// in blocks with FFTs (overlap-save). A bank of frequency shifts of the input spectrum makes
+// the correlation robust against the CFO before sync. The correlation is normalized by the
+// energy of the samples, so the threshold does not depend on the gain.
+// When it exceeds coarse_sync_threshold, the samples of the sync sequence are taken from a
+// history buffer and given to ofdmframesync_find_data_start() for fine timing and CFO.
+// Thus the sample by sample search of ofdmframesync only runs around a detected sequence.
+
+struct PhySync_s;
+typedef struct PhySync_s* PhySync;
+
+// Statistics of the last acquisition, i.e. since the last reset
+typedef struct {
+	uint64_t samples;		// samples searched until sync was found
+	uint64_t cpu_ns;		// CPU time spent in the search
+	uint detections;		// coarse detections given to ofdmframesync
+	uint misses;			// detections where ofdmframesync did not find the sync sequence
+} sync_stats_s;
+
+// Create a detector for the sync sequence of the given subcarrier allocation
+PhySync phy_sync_init(unsigned char* subcarrier_alloc);
+void phy_sync_destroy(PhySync sync);
+
+// Forget the sample history, e.g. after ofdmframesync was reset or
+// samples were not passed to the detector
+void phy_sync_reset(PhySync sync);
+
+// Search the sync sequence in a block of samples. fs is reset on a coarse detection.
+// Falls back to ofdmframesync_find_data_start() if coarse_sync is disabled
+// returns -1 if no sync found, else the sample index of the ofdm symbol after the sync sequence
+int phy_sync_find_data_start(PhySync sync, ofdmframesync fs, float complex* rxbuf_time, uint num_samples);
+
+const sync_stats_s* phy_sync_get_stats(PhySync sync);
+
+#endif /* PHY_SYNC_H_ */
@@ -32,6 +32,7 @@ extern struct phy_config_s PHY_CONFIG;
 
 // Declarations of local functions
 int _ue_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd);
+static void phy_ue_alloc_ul_slot(PhyUE phy, uint sfn, uint first_symb, uint last_symb, uint type);
 
 // Init the PhyUE struct
 PhyUE phy_ue_init()
@@ -39,27 +40,30 @@ PhyUE phy_ue_init()
 	PhyUE phy = calloc(sizeof(struct PhyUE_s),1);
 
 	phy->common = phy_common_init();
-#if USE_ROBUST_PILOT
-	gen_pilot_symbols_robust(phy->common, 0);
-#else
 	gen_pilot_symbols(phy->common, 0);
-#endif
 
 	// Create OFDM frame generator: nFFt, CPlen, taperlen, subcarrier alloc
 	phy->fg = ofdmframegen_create(nfft, cp_len, 0, phy->common->pilot_sc);
 
 	// Create OFDM receiver
 	phy->fs = ofdmframesync_create(nfft, cp_len, 0, phy->common->pilot_sc, _ue_rx_symbol_cb, phy);
+	phy->sync = phy_sync_init(phy->common->pilot_sc);
 
 	// Alloc memory for slot assignments
 	phy->dlslot_assignments = malloc(2*sizeof(assignment_t*));
 	phy->ulslot_assignments = malloc(2*sizeof(assignment_t*));
 	phy->ulctrl_assignments = malloc(2*sizeof(assignment_t*));
+	phy->ulrb_assignments = malloc(2*sizeof(assignment_t*));
+	phy->dlmini_assignments = malloc(2*sizeof(assignment_t*));
+	phy->ulmini_assignments = malloc(2*sizeof(assignment_t*));
 
 	for (int i=0; i<2; i++) {
 		phy->dlslot_assignments[i] = calloc(sizeof(assignment_t),NUM_SLOT);
 		phy->ulslot_assignments[i] = calloc(sizeof(assignment_t),NUM_SLOT);
 		phy->ulctrl_assignments[i] = calloc(sizeof(assignment_t),NUM_ULCTRL_SLOT);
+		phy->ulrb_assignments[i] = calloc(sizeof(assignment_t),NUM_UL_RB);
+		phy->dlmini_assignments[i] = calloc(sizeof(assignment_t),NUM_SLOT*NUM_MINI_SLOT);
+		phy->ulmini_assignments[i] = calloc(sizeof(assignment_t),NUM_SLOT*NUM_MINI_SLOT);
 	}
 
     // buffer for ofdm symbol allocation
@@ -88,6 +92,11 @@ PhyUE phy_ue_init()
 	phy->bs_txgain = -128;
 	phy->bs_rxgain = -128;
 	phy->rssi = agc_desired_rssi;
+
+	phy->rx_symbol_pos = 0;
+	phy->rx_skip = 0;
+	phy->rx_rot = 1;
+	phy->rx_rot_buf = malloc(sizeof(float complex)*(nfft+cp_len));
     return phy;
 }
 
@@ -96,17 +105,26 @@ void phy_ue_destroy(PhyUE phy)
 	phy_common_destroy(phy->common);
 	ofdmframegen_destroy(phy->fg);
 	ofdmframesync_destroy(phy->fs);
+	phy_sync_destroy(phy->sync);
+	free(phy->rx_rot_buf);
 
 	for (int i=0; i<2; i++) {
 		free(phy->dlslot_assignments[i]);
 		free(phy->ulslot_assignments[i]);
 		free(phy->ulctrl_assignments[i]);
+		free(phy->ulrb_assignments[i]);
+		free(phy->dlmini_assignments[i]);
+		free(phy->ulmini_assignments[i]);
 		free(phy->ul_symbol_alloc[i]);
 	}
 	free(phy->dlslot_assignments);
 	free(phy->ulslot_assignments);
 	free(phy->ulctrl_assignments);
+	free(phy->ulrb_assignments);
+	free(phy->dlmini_assignments);
+	free(phy->ulmini_assignments);
 	free(phy->ul_symbol_alloc);
+	phy_harq_free(phy->harq_dl, HARQ_PROCESSES);
 
 	free(phy);
 }
@@ -148,10 +166,13 @@ int phy_ue_initial_sync(PhyUE phy, float complex* rxbuf_time, uint num_samples)
 {
 	PhyCommon common = phy->common;
 
-	int offset = ofdmframesync_find_data_start(phy->fs,rxbuf_time,num_samples);
+	int offset = phy_sync_find_data_start(phy->sync,phy->fs,rxbuf_time,num_samples);
 	if (offset!=-1) {
+		const sync_stats_s* stats = phy_sync_get_stats(phy->sync);
 		common->rx_symbol = SUBFRAME_LEN - 1 - 1; //there is the sync info symbol and one guard symbol remaining in the subframe
 		common->rx_subframe = 0;
+		phy->rx_symbol_pos = 0;
+		phy->rx_rot = 1;
 
 		//apply filtering of coarse CFO estimation if we have old estimates
 		if (phy->has_synced_once == 0) {
@@ -163,6 +184,8 @@ int phy_ue_initial_sync(PhyUE phy, float complex* rxbuf_time, uint num_samples)
 			phy->has_synced_once = 1;
 			phy->prev_cfo = ofdmframesync_get_cfo(phy->fs);
 			LOG(INFO,"[PHY UE] Got sync! cfo: %.3fHz offset: %d samps\n",phy->prev_cfo*samplerate/6.28,offset);
+			LOG(INFO,"[PHY UE] acquisition: %.1fms of samples, %.2fms CPU, %d detections, %d missed\n",
+					stats->samples*1000.0/samplerate, stats->cpu_ns/1e6, stats->detections, stats->misses);
 			SYSLOG(LOG_INFO,"[PHY UE] Got sync! cfo: %.3fHz offset: %d samps\n",phy->prev_cfo*samplerate/6.28,offset);
 		} else {
 			float new_cfo = ofdmframesync_get_cfo(phy->fs);
@@ -171,7 +194,8 @@ int phy_ue_initial_sync(PhyUE phy, float complex* rxbuf_time, uint num_samples)
 
 			float cfo_filt = (1-coarse_cfo_filt_param)*phy->prev_cfo + coarse_cfo_filt_param*new_cfo;
 			ofdmframesync_set_cfo(phy->fs,cfo_filt);
-			LOG_SFN_PHY(DEBUG,"[PHY UE] sync seq. cfo: %.3fHz offset: %d samps\n",new_cfo*samplerate/6.28,offset);
+			LOG_SFN_PHY(DEBUG,"[PHY UE] sync seq. cfo: %.3fHz offset: %d samps, search %.1fms CPU %.3fms\n",
+						new_cfo*samplerate/6.28,offset,stats->samples*1000.0/samplerate,stats->cpu_ns/1e6);
 
 		}
 	}
@@ -184,14 +208,15 @@ int phy_ue_initial_sync(PhyUE phy, float complex* rxbuf_time, uint num_samples)
 int phy_ue_proc_dlctrl(PhyUE phy)
 {
     PhyCommon common = phy->common;
-	uint dlctrl_size = (NUM_SLOT*2 + NUM_ULCTRL_SLOT)/2;
+	uint dlctrl_size = DLCTRL_SIZE;
 	uint sfn = common->rx_subframe % 2; // even or uneven subframe?
 
 	// demodulate signal.
 	uint llr_len = 2*DLCTRL_LEN*(num_data_sc+num_pilot_sc);
 	uint8_t* llr_buf = malloc(llr_len);
 	uint total_samps = 0;
-	phy_demod_soft(common, 0, nfft-1, 0, DLCTRL_LEN-1, 0, llr_buf, llr_len, &total_samps);
+	// the DL ctrl slot is sent every subframe with MCS 0. Use it to measure the DL SNR
+	float snr = phy_demod_soft_snr(common, 0, nfft-1, 0, DLCTRL_LEN-1, 0, llr_buf, llr_len, &total_samps);
 
 	// soft decoding
 	dlctrl_alloc_t* dlctrl_buf = malloc(dlctrl_size+1);
@@ -207,6 +232,8 @@ int phy_ue_proc_dlctrl(PhyUE phy)
 		LOG(WARN,"\n");
 		// set dlctrl buf to 0 so that mac will think no slots allocated
 		memset(dlctrl_buf,0,dlctrl_size);
+	} else {
+		mac_ue_dl_quality(phy->mac, snr);
 	}
 
 	// Set the decoded user assignments in the phy struct
@@ -227,63 +254,150 @@ int phy_ue_proc_dlctrl(PhyUE phy)
 		idx++;
 	}
 	for (int i=0; i<NUM_ULCTRL_SLOT/2; i++) {
-		LOG(DEBUG,"%02x\n",dlctrl_buf[idx].byte);
+		LOG(DEBUG,"%02x",dlctrl_buf[idx].byte);
 		phy->ulctrl_assignments[sfn][2*i  ] = (dlctrl_buf[idx].h4 == phy->userid) ? UE_ASSIGNED : NOT_ASSIGNED;
 		phy->ulctrl_assignments[sfn][2*i+1] = (dlctrl_buf[idx].l4 == phy->userid) ? UE_ASSIGNED : NOT_ASSIGNED;
 		idx++;
 	}
+	// resource blocks are only valid if the split slot is not assigned as a whole
+	dlctrl_alloc_t rb_slot = dlctrl_buf[NUM_SLOT/2+UL_RB_SLOT/2];
+	uint rb_valid = (UL_RB_SLOT%2 ? rb_slot.l4 : rb_slot.h4) == USER_UNUSED;
+	for (int i=0; i<NUM_UL_RB/2; i++) {
+		idx = DLCTRL_RB_IDX+i;
+		LOG(DEBUG,"%02x",dlctrl_buf[idx].byte);
+		phy->ulrb_assignments[sfn][2*i  ] = (rb_valid && dlctrl_buf[idx].h4 == phy->userid) ? UE_ASSIGNED : NOT_ASSIGNED;
+		phy->ulrb_assignments[sfn][2*i+1] = (rb_valid && dlctrl_buf[idx].l4 == phy->userid) ? UE_ASSIGNED : NOT_ASSIGNED;
+	}
+	// a slot split into mini-slots carries the user of the first mini-slot in its nibble
+	for (int dir=0; dir<2; dir++) {
+		uint8_t* slots = dir==0 ? phy->dlslot_assignments[sfn] : phy->ulslot_assignments[sfn];
+		uint8_t* minis = dir==0 ? phy->dlmini_assignments[sfn] : phy->ulmini_assignments[sfn];
+		dlctrl_alloc_t mini_byte = dlctrl_buf[DLCTRL_MINI_IDX+dir];
+		LOG(DEBUG,"%02x",mini_byte.byte);
+		memset(minis, NOT_ASSIGNED, NUM_SLOT*NUM_MINI_SLOT);
+		if (mini_byte.h4 == 0 || mini_byte.h4 > NUM_SLOT)
+			continue;
+		uint slot = mini_byte.h4-1;
+		dlctrl_alloc_t slot_byte = dlctrl_buf[dir*NUM_SLOT/2+slot/2];
+		slots[slot] = NOT_ASSIGNED;
+		minis[slot*NUM_MINI_SLOT  ] = (slot%2 ? slot_byte.l4 : slot_byte.h4) == phy->userid ? UE_ASSIGNED : NOT_ASSIGNED;
+		minis[slot*NUM_MINI_SLOT+1] = mini_byte.l4 == phy->userid ? UE_ASSIGNED : NOT_ASSIGNED;
+	}
+	LOG(DEBUG,"\n");
+	phy->mcs_bcast[sfn] = dlctrl_buf[DLCTRL_BCAST_MCS_IDX].h4 < NUM_MCS_SCHEMES ?
+						  dlctrl_buf[DLCTRL_BCAST_MCS_IDX].h4 : 0;
+
+	// The pilot pattern of the DL slots follows from their MCS. Slots of other users are
+	// received without pilots, since their MCS is unknown. Mini-slots use a fixed pattern
+	for (int i=0; i<NUM_SLOT; i++) {
+		uint first_symb = DL_SLOT_START+(SLOT_LEN+1)*i;
+		uint8_t* minis = &phy->dlmini_assignments[sfn][i*NUM_MINI_SLOT];
+		if (minis[0] == UE_ASSIGNED || minis[1] == UE_ASSIGNED) {
+			memset(&common->pilot_symbols_rx[first_symb], NO_PILOT, SLOT_LEN);
+			for (int mini=0; mini<NUM_MINI_SLOT; mini++) {
+				if (minis[mini] == UE_ASSIGNED)
+					phy_set_mini_pilots(common, common->pilot_symbols_rx, first_symb, mini);
+			}
+		} else if (phy->dlslot_assignments[sfn][i] == UE_ASSIGNED)
+			phy_set_slot_pilots(common, common->pilot_symbols_rx, first_symb, phy->mcs_dl);
+		else if (phy->dlslot_assignments[sfn][i] == BRCST_ASSIGNED)
+			phy_set_slot_pilots(common, common->pilot_symbols_rx, first_symb, phy->mcs_bcast[sfn]);
+		else
+			memset(&common->pilot_symbols_rx[first_symb], NO_PILOT, SLOT_LEN);
+	}
 
-	// Pass slot assignment to MAC
-	mac_ue_set_assignments(phy->mac,phy->dlslot_assignments[sfn],
+	// Pass slot assignment to MAC. The lower nibble of the broadcast MCS byte flags UL retransmissions
+	mac_ue_set_assignments(phy->mac,common->rx_subframe,
+									phy->dlslot_assignments[sfn],
 									phy->ulslot_assignments[sfn],
-									phy->ulctrl_assignments[sfn]);
+									phy->ulctrl_assignments[sfn],
+									phy->ulrb_assignments[sfn],
+									phy->ulmini_assignments[sfn],
+									dlctrl_buf[DLCTRL_BCAST_MCS_IDX].l4);
 
 	free(llr_buf);
 	free(dlctrl_buf);
 	return 1;
 }
 
+// Decode the mini-slots of the user in a DL slot that is split in time.
+// Mini-slots are decoded without HARQ
+static void phy_ue_proc_mini_slot(PhyUE phy, uint slotnr)
+{
+	PhyCommon common = phy->common;
+	uint rx_sfn = common->rx_subframe;
+	uint mcs = phy->mcs_dl;
+
+	for (uint mini=0; mini<NUM_MINI_SLOT; mini++) {
+		if (phy->dlmini_assignments[rx_sfn%2][slotnr*NUM_MINI_SLOT+mini] != UE_ASSIGNED)
+			continue;
+		uint buf_len = common->mini_llr_len[mcs];
+		uint8_t* demod_buf = malloc(buf_len);
+
+		// demodulate signal
+		uint written_samps = 0;
+		uint first_symb = DL_SLOT_START+(SLOT_LEN+1)*slotnr+mini*MINI_SLOT_LEN;
+		uint last_symb = first_symb+MINI_SLOT_SYMBOLS(mini)-1;
+		if (chan_est) {
+			chan_est_s est;
+			phy_chan_est_slot(common, first_symb, last_symb, &est);
+		}
+		phy_demod_soft(common, 0, nfft-1, first_symb, last_symb, mcs,
+					   demod_buf, buf_len, &written_samps);
+
+		// deinterleaving and decoding
+		LogicalChannel chan = lchan_create(get_mini_tbs_size(common, mcs)/8,CRC16);
+		phy_decode_mini(common, mcs, demod_buf, chan);
+		phy->mac_rx_cb(phy->mac, chan, 0);
+		free(demod_buf);
+	}
+}
+
 TIMECHECK_CREATE(timecheck_ue_rx);
 TIMECHECK_CREATE(check_demod);
 TIMECHECK_CREATE(check_fec);
-TIMECHECK_CREATE(check_interl);
 // Decode a PHY dl slot and call the MAC callback function
 void phy_ue_proc_slot(PhyUE phy, uint slotnr)
 {
     TIMECHECK_INIT(check_demod,"ue.rx_slot.demod",10000);
     TIMECHECK_INIT(check_fec,"ue.rx_slot.fec",10000);
-    TIMECHECK_INIT(check_interl,"ue.rx_slot.interleaver",10000);
     TIMECHECK_INIT(timecheck_ue_rx,"ue.rx_slot",10000);
 
 	PhyCommon common = phy->common;
-	assignment_t slot_type = phy->dlslot_assignments[common->rx_subframe%2][slotnr];
+	uint rx_sfn = common->rx_subframe;
+	assignment_t slot_type = phy->dlslot_assignments[rx_sfn%2][slotnr];
+	// once per subframe, in the thread that passes the DL data to the MAC
+	if (slotnr==0)
+		mac_ue_rx_arq_update(phy->mac);
+	phy_ue_proc_mini_slot(phy, slotnr);
 	if (slot_type != NOT_ASSIGNED) {
         TIMECHECK_START(timecheck_ue_rx);
 
-        // MCS0 is used for Broadcast. For UE specific traffic use the set mcs
-		uint mcs = (slot_type == UE_ASSIGNED) ? phy->mcs_dl : 0;
+        // Broadcast slots use the MCS signaled in the DL ctrl slot. For UE specific traffic use the set mcs
+		uint mcs = (slot_type == UE_ASSIGNED) ? phy->mcs_dl : phy->mcs_bcast[rx_sfn%2];
 		uint32_t blocksize = get_tbs_size(common, mcs);
 
-		uint buf_len = 8*fec_get_enc_msg_length(common->mcs_fec_scheme[mcs],blocksize/8);
+		uint buf_len = common->mcs_llr_len[mcs];
 		uint8_t* demod_buf = malloc(buf_len);
 
 		// demodulate signal
 		uint written_samps = 0;
-		uint first_symb = DLCTRL_LEN+2+(SLOT_LEN+1)*slotnr;
-		uint last_symb = DLCTRL_LEN+2+(SLOT_LEN+1)*(slotnr+1)-2;
+		uint first_symb = DL_SLOT_START+(SLOT_LEN+1)*slotnr;
+		uint last_symb = DL_SLOT_START+(SLOT_LEN+1)*(slotnr+1)-2;
 		TIMECHECK_START(check_demod);
+		if (chan_est) {
+			chan_est_s est;
+			phy_chan_est_slot(common, first_symb, last_symb, &est);
+		}
 		phy_demod_soft(common, 0, nfft-1, first_symb, last_symb, mcs,
 					   demod_buf, buf_len, &written_samps);
         TIMECHECK_STOP(check_demod);
-		//deinterleaving
-		uint8_t* deinterleaved_b = malloc(buf_len);
-        TIMECHECK_START(check_interl);
-		interleaver_decode_soft(common->mcs_interlvr[mcs],demod_buf,deinterleaved_b);
-        TIMECHECK_STOP(check_interl);
+		// deinterleaving and decoding. Unicast slots are combined with previous receptions of the block
         TIMECHECK_START(check_fec);
-		// decoding
+		harq_rx_proc_s* harq = (slot_type == UE_ASSIGNED) ? &phy->harq_dl[HARQ_PROC(rx_sfn, slotnr)] : NULL;
 		LogicalChannel chan = lchan_create(blocksize/8,CRC16);
-		fec_decode_soft(common->mcs_fec[mcs], blocksize/8, deinterleaved_b, chan->data);
+		uint num_rx;
+		int crc_ok = phy_harq_decode(common, harq, mcs, demod_buf, phy->mac->subframe_cnt, chan, &num_rx);
         TIMECHECK_STOP(check_fec);
 
 #ifdef PHY_TEST_BER
@@ -291,23 +405,23 @@ void phy_ue_proc_slot(PhyUE phy, uint slotnr)
 	// we start calculating ber after subframe 50 to wait that MCS switch happened
 	if (global_sfn>50) {
 		for (int i=0; i<chan->payload_len;i++)
-			num_biterr += liquid_count_ones(phy_dl[common->rx_subframe%2][slotnr][i]^chan->data[i]);
+			num_biterr += liquid_count_ones(phy_dl[rx_sfn%2][slotnr][i]^chan->data[i]);
 		phy_dl_tot_bits += chan->payload_len*8;
 		phy_dl_biterr += num_biterr;
 	}
 #endif
 
 		// pass to upper layer
+		if (slot_type == UE_ASSIGNED)
+			mac_ue_harq_result(phy->mac, rx_sfn, slotnr, crc_ok, num_rx);
         phy->mac_rx_cb(phy->mac, chan, (slot_type==BRCST_ASSIGNED) ? 1:0);
 
-		free(deinterleaved_b);
 		free(demod_buf);
 
         TIMECHECK_STOP_CHECK(timecheck_ue_rx,3500);
         TIMECHECK_INFO(timecheck_ue_rx);
         TIMECHECK_INFO(check_demod);
         TIMECHECK_INFO(check_fec);
-        TIMECHECK_INFO(check_interl);
 	}
 }
 
@@ -351,21 +465,19 @@ int phy_ue_proc_sync_info(PhyUE phy)
     return 0;
 }
 
-// callback for OFDM receiver
-// is called for every symbol that is received
-int _ue_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd)
+// Advance the rx symbol counter and process slots that have been received completely.
+// Called for every received symbol and for every skipped symbol
+static void phy_ue_symbol_done(PhyUE phy)
 {
-	PhyUE phy = (PhyUE)userd;
 	PhyCommon common = phy->common;
-
-	memcpy(common->rxdata_f[common->rx_symbol++],X,sizeof(float complex)*nfft);
+	common->rx_symbol++;
 
 	switch (common->rx_symbol) {
 	case DLCTRL_LEN:
 		// finished receiving DLCTRL slot
 		phy_ue_proc_dlctrl(phy);
 		break;
-	case DLCTRL_LEN+1+(SLOT_LEN+1):
+	case DL_SLOT_START-1+(SLOT_LEN+1):
 		// finished receiving one of the dl data slots
 #ifdef USE_RX_SLOT_THREAD
 		phy->rx_slot_nr = 0;
@@ -375,7 +487,7 @@ int _ue_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd)
 #endif
             phy_ue_proc_slot(phy,0);
 		break;
-	case DLCTRL_LEN+1+(SLOT_LEN+1)*2:
+	case DL_SLOT_START-1+(SLOT_LEN+1)*2:
 		// finished receiving one of the dl data slots
 #ifdef USE_RX_SLOT_THREAD
 		phy->rx_slot_nr = 1;
@@ -385,7 +497,7 @@ int _ue_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd)
 #endif
             phy_ue_proc_slot(phy,1);
 		break;
-	case DLCTRL_LEN+1+(SLOT_LEN+1)*3:
+	case DL_SLOT_START-1+(SLOT_LEN+1)*3:
 		// finished receiving one of the dl data slots
 #ifdef USE_RX_SLOT_THREAD
 		phy->rx_slot_nr = 2;
@@ -395,7 +507,7 @@ int _ue_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd)
 #endif
             phy_ue_proc_slot(phy,2);
 		break;
-	case DLCTRL_LEN+1+(SLOT_LEN+1)*4:
+	case DL_SLOT_START-1+(SLOT_LEN+1)*4:
 		// finished receiving one of the dl data slots
 		// if subframe==0, it is the sync info slot
 		if (common->rx_subframe==0) {
@@ -421,13 +533,15 @@ int _ue_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd)
     }
 	// sync sequence will follow. Reset framesync and adjust gain
 	if ((common->rx_subframe == 0) &&
-			(common->rx_symbol == DLCTRL_LEN+1+(SLOT_LEN+1)*3)) {
+			(common->rx_symbol == DL_SLOT_START-1+(SLOT_LEN+1)*3)) {
         // set new gain value
         phy->rssi = (1-agc_rssi_filt_param)*phy->rssi + agc_rssi_filt_param*ofdmframesync_get_rssi(phy->fs);
         // store old cfo estimation
 		phy->prev_cfo = ofdmframesync_get_cfo(phy->fs);
 		ofdmframesync_reset(phy->fs);
         ofdmframesync_set_cfo(phy->fs,0);
+        phy_sync_reset(phy->sync);
+        phy->rx_rot = 1;
 	}
 
 	// Debug log
@@ -440,7 +554,41 @@ int _ue_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd)
 		common->rx_symbol = 0;
 		common->rx_subframe = (common->rx_subframe + 1) % FRAME_LEN;
 	}
+}
+
+// callback for OFDM receiver
+// is called for every symbol that is received
+int _ue_rx_symbol_cb(float complex* X,unsigned char* p, uint M, void* userd)
+{
+	PhyUE phy = (PhyUE)userd;
+	PhyCommon common = phy->common;
 
+	memcpy(common->rxdata_f[common->rx_symbol],X,sizeof(float complex)*nfft);
+	phy_ue_symbol_done(phy);
+	return 0;
+}
+
+// returns 1 if the current rx symbol has to be received, 0 if it can be skipped.
+// The DL assignments of the subframe are known from the DL ctrl slot
+static int phy_ue_rx_symbol_needed(PhyUE phy)
+{
+	PhyCommon common = phy->common;
+	uint symb = common->rx_symbol;
+
+	if (!rx_gating || symb < DLCTRL_LEN)
+		return 1;
+	// sync info symbol
+	if (common->rx_subframe == 0 && symb == SUBFRAME_LEN-2)
+		return 1;
+	for (int i=0; i<NUM_SLOT; i++) {
+		uint first_symb = DL_SLOT_START+(SLOT_LEN+1)*i;
+		if (symb >= first_symb && symb < first_symb+SLOT_LEN) {
+			uint mini = (symb-first_symb)/MINI_SLOT_LEN;
+			return phy->dlslot_assignments[common->rx_subframe%2][i] != NOT_ASSIGNED ||
+				   phy->dlmini_assignments[common->rx_subframe%2][i*NUM_MINI_SLOT+mini] == UE_ASSIGNED;
+		}
+	}
+	// guard symbols
 	return 0;
 }
 
@@ -517,8 +665,9 @@ void phy_ue_write_symbol(PhyUE phy, float complex* txbuf_time)
 		if(!mac_ue_is_associated(phy->mac)) {
 			// Not associated yet. Use Random Access slot to get association
             if (common->tx_subframe == 0 && tx_symb == SUBFRAME_LEN-SLOT_LEN-1) {
-                // set ptt signal one symbol before tx starts
-                phy->platform->ptt_set_tx(phy->platform);
+                // set ptt signal, so that tx is active when the next symbol starts
+                memset(txbuf_time, 0, sizeof(float complex)*(nfft+cp_len));
+                phy->platform->ptt_set_tx(phy->platform, phy->tx_sample+nfft+cp_len);
             } else if (common->tx_subframe == 0 && tx_symb == SUBFRAME_LEN-SLOT_LEN) {
 				ofdmframegen_reset(phy->fg);
 				ofdmframegen_write_S0a(phy->fg, txbuf_time);
@@ -530,25 +679,34 @@ void phy_ue_write_symbol(PhyUE phy, float complex* txbuf_time)
 			} else if (common->tx_subframe == 0 && tx_symb == SUBFRAME_LEN-SLOT_LEN+3) {
 				phy_ue_create_assoc_request(phy, txbuf_time);
             } else if (common->tx_subframe == 0 && tx_symb == SUBFRAME_LEN-SLOT_LEN+4) {
-                phy->platform->ptt_set_rx(phy->platform);
+                // release ptt as soon as the assoc request was sent
+                memset(txbuf_time, 0, sizeof(float complex)*(nfft+cp_len));
+                phy->platform->ptt_set_rx(phy->platform, phy->tx_sample);
             } else {
 				// send zeros
 				memset(txbuf_time, 0, sizeof(float complex)*(nfft+cp_len));
 			}
 		} else if (phy->ul_symbol_alloc[sfn][tx_symb]==DATA){
 			// MAC is associated and have data to send.
-			if (common->pilot_symbols_tx[tx_symb] == PILOT) {
-				ofdmframegen_reset(phy->fg); // TODO we use the same msequence in every pilot symbol sent. Fix this
+			if (common->pilot_symbols_tx[sfn][tx_symb] == PILOT) {
+				// all pilot symbols carry the same pilots, see phy_chan_est_slot()
+				ofdmframegen_reset(phy->fg);
 				ofdmframegen_writesymbol(phy->fg, common->txdata_f[sfn][tx_symb],txbuf_time);
 			} else {
 				ofdmframegen_writesymbol_nopilot(phy->fg, common->txdata_f[sfn][tx_symb],txbuf_time);
 			}
+		} else if (phy->ul_symbol_alloc[sfn][tx_symb]==DATA_RB) {
+			// resource block of a split slot. Pilots are set by phy_map_ulrb()
+			ofdmframegen_writesymbol_nopilot(phy->fg, common->txdata_f[sfn][tx_symb],txbuf_time);
 		} else if (phy->ul_symbol_alloc[sfn][tx_symb] == PTT_UP) {
+            // PTT edge is placed just before the start of the next (data) symbol.
+            // The guard time is defined by the platform
             memset(txbuf_time,0,sizeof(float complex)*(nfft+cp_len));
-            phy->platform->ptt_set_tx(phy->platform);
+            phy->platform->ptt_set_tx(phy->platform, phy->tx_sample+nfft+cp_len);
         } else if (phy->ul_symbol_alloc[sfn][tx_symb] == PTT_DOWN) {
+            // PTT is released right after the end of the previous (data) symbol
             memset(txbuf_time,0,sizeof(float complex)*(nfft+cp_len));
-            phy->platform->ptt_set_rx(phy->platform);
+            phy->platform->ptt_set_rx(phy->platform, phy->tx_sample);
 		} else {
 			// associated but no data to send. Set zero
 			memset(txbuf_time,0,sizeof(float complex)*(nfft+cp_len));
@@ -556,6 +714,7 @@ void phy_ue_write_symbol(PhyUE phy, float complex* txbuf_time)
 	}
 
 	// Update subframe and symbol counter
+	phy->tx_sample += nfft+cp_len;
 	common->tx_symbol++;
 	if (common->tx_symbol>=SUBFRAME_LEN) {
 		common->tx_symbol = 0;
@@ -582,17 +741,43 @@ void phy_ue_do_rx(PhyUE phy, float complex* rxbuf_time, uint num_samples)
 				remaining_samps = 0;
 			}
 		} else {
-			// receive symbols
-			uint rx_sym = fmin(nfft+cp_len,remaining_samps);
-			if (common->pilot_symbols_rx[common->rx_symbol] == PILOT ||
+			// receive symbols. Samples are passed up to the end of the current symbol,
+			// so the decision whether a symbol is skipped is made at its start
+			uint sym_len = nfft+cp_len;
+			uint rx_sym = fmin(sym_len-phy->rx_symbol_pos,remaining_samps);
+			if (phy->rx_symbol_pos == 0)
+				phy->rx_skip = !phy_ue_rx_symbol_needed(phy);
+
+			float complex* rx_samps = rxbuf_time;
+			if (!phy->rx_skip && phy->rx_rot != 1) {
+				for (int i=0; i<rx_sym; i++)
+					phy->rx_rot_buf[i] = rxbuf_time[i]*phy->rx_rot;
+				rx_samps = phy->rx_rot_buf;
+			}
+			if (phy->rx_skip) {
+				// fs does not see these samples
+			} else if (common->pilot_symbols_rx[common->rx_symbol] == PILOT ||
                     (common->rx_subframe==0 && common->rx_symbol==SUBFRAME_LEN-2)) {
-				ofdmframesync_execute(phy->fs,rxbuf_time,rx_sym);
+				// the BS resets its pilot sequence before each pilot symbol
+				ofdmframesync_reset_msequence(phy->fs);
+				ofdmframesync_execute(phy->fs,rx_samps,rx_sym);
 				LOG(TRACE,"[PHY UE] cfo updated: %.3f Hz\n",ofdmframesync_get_cfo(phy->fs)*samplerate/6.28);
 			} else {
-				ofdmframesync_execute_nopilot(phy->fs,rxbuf_time,rx_sym);
+				ofdmframesync_execute_nopilot(phy->fs,rx_samps,rx_sym);
 			}
 			remaining_samps -= rx_sym;
 			rxbuf_time += rx_sym;
+
+			phy->rx_symbol_pos += rx_sym;
+			if (phy->rx_symbol_pos == sym_len) {
+				phy->rx_symbol_pos = 0;
+				if (phy->rx_skip) {
+					// The NCO of fs derotates the CFO of each sample it receives. Rotate the
+					// following samples by the phase it would have applied to the skipped ones
+					phy->rx_rot *= cexpf(-_Complex_I*ofdmframesync_get_cfo(phy->fs)*sym_len);
+					phy_ue_symbol_done(phy);
+				}
+			}
 		}
 	}
 }
@@ -634,6 +819,8 @@ int phy_map_ulctrl(PhyUE phy, LogicalChannel chan, uint subframe, uint8_t slot_n
 	// activate used OFDM symbols in resource allocation
 	if (phy->ul_symbol_alloc[sfn][first_symb-2]==NOT_USED)
 	    phy->ul_symbol_alloc[sfn][first_symb-1] = PTT_UP; // indicate PTT, slot before isnt used
+	else
+	    phy->ul_symbol_alloc[sfn][first_symb-1] = NOT_USED; // previous slot in use. Keep PTT active
 	phy->ul_symbol_alloc[sfn][first_symb] = DATA;
 	if (phy->ul_symbol_alloc[sfn][first_symb+2]==NOT_USED)
 	    phy->ul_symbol_alloc[sfn][first_symb+1] = PTT_DOWN; // next slot is not used, end PTT here
@@ -686,12 +873,138 @@ int phy_map_ulslot(PhyUE phy, LogicalChannel chan, uint subframe, uint8_t slot_n
 
 	// modulate signal
 	uint sfn = subframe % 2;
+	phy_set_slot_pilots(common, common->pilot_symbols_tx[sfn], first_symb, mcs);
 	phy_mod(phy->common,sfn, 0,nfft-1,first_symb,last_symb, mcs, repacked_b, num_repacked, &total_samps);
 
 	// activate used OFDM symbols in resource allocation
-	memset(&phy->ul_symbol_alloc[sfn][first_symb],DATA,last_symb-first_symb+1);
+	phy_ue_alloc_ul_slot(phy, sfn, first_symb, last_symb, DATA);
+    free(interleaved_b);
+	free(enc_b);
+	free(repacked_b);
+	return 0;
+}
+
+// create a resource block of the split UL slot in frequency domain. The subcarriers
+// of the other resource blocks stay empty, they are used by other users
+int phy_map_ulrb(PhyUE phy, LogicalChannel chan, uint subframe, uint rb, uint mcs)
+{
+	PhyCommon common = phy->common;
+
+	uint8_t* repacked_b;
+	uint bytes_written=0;
+	uint32_t blocksize = get_rb_tbs_size(phy->common, mcs);
+
+	if (blocksize/8 != chan->payload_len) {
+		printf("Error: Wrong TBS\n");
+		return -1;
+	}
+
+	// encode channel
+	uint enc_len = fec_get_enc_msg_length(common->mcs_fec_scheme[mcs],chan->payload_len);
+	uint8_t* enc_b = malloc(enc_len);
+	fec_encode(common->mcs_fec[mcs], blocksize/8, chan->data, enc_b);
+
+	//interleaving
+	uint8_t* interleaved_b = malloc(enc_len);
+	interleaver_encode(common->rb_interlvr[mcs],enc_b, interleaved_b);
+
+	// repack bytes so that each array entry can be mapped to one symbol
+	int num_repacked = ceil(enc_len*8.0/modem_get_bps(common->mcs_modem[mcs]));
+	repacked_b = malloc(num_repacked);
+	liquid_repack_bytes(interleaved_b,8,enc_len,repacked_b,modem_get_bps(common->mcs_modem[mcs]),num_repacked,&bytes_written);
+
+	uint total_samps = 0;
+	uint sfn = subframe % 2;
+	uint first_symb = (SLOT_LEN+1)*UL_RB_SLOT + (UL_RB_SLOT>=2 ? 4 : 0);
+	uint last_symb = first_symb+SLOT_LEN-1;
+
+	// the first block of the slot clears it, since the subcarriers of
+	// the other blocks still hold the data of a previous subframe
+	if (phy->ul_symbol_alloc[sfn][first_symb] != DATA_RB) {
+		for (int i=first_symb; i<=last_symb; i++)
+			memset(common->txdata_f[sfn][i], 0, sizeof(float complex)*nfft);
+		memcpy(&common->pilot_symbols_tx[sfn][first_symb], common->slot_pilots[UL_RB_PILOTS], SLOT_LEN);
+	}
+
+	// modulate signal
+	uint first_sc = common->rb_first_sc[rb];
+	uint last_sc = common->rb_last_sc[rb];
+	phy_mod(common, sfn, first_sc, last_sc, first_symb, last_symb, mcs, repacked_b, num_repacked, &total_samps);
+
+	// ofdmframegen would write the pilots of all blocks. The symbols are written without
+	// pilots, so the pilots of this block are set here
+	for (int i=first_symb; i<=last_symb; i++) {
+		if (common->pilot_symbols_tx[sfn][i] != PILOT)
+			continue;
+		for (int k=first_sc; k<=last_sc; k++) {
+			if (common->pilot_sc[k] == OFDMFRAME_SCTYPE_PILOT)
+				common->txdata_f[sfn][i][k] = common->pilot_ref[k];
+		}
+	}
+
+	// activate used OFDM symbols in resource allocation
+	phy_ue_alloc_ul_slot(phy, sfn, first_symb, last_symb, DATA_RB);
+	free(interleaved_b);
+	free(enc_b);
+	free(repacked_b);
+	return 0;
+}
+
+// create mini-slot mini of the split UL slot slot_nr in frequency domain.
+// The other half of the slot is sent by another user
+int phy_map_ulmini(PhyUE phy, LogicalChannel chan, uint subframe, uint8_t slot_nr, uint mini, uint mcs)
+{
+	PhyCommon common = phy->common;
+
+	uint8_t* repacked_b;
+	uint bytes_written=0;
+	uint32_t blocksize = get_mini_tbs_size(phy->common, mcs);
+
+	if (blocksize/8 != chan->payload_len) {
+		printf("Error: Wrong TBS\n");
+		return -1;
+	}
+
+	// encode channel
+	uint enc_len = fec_get_enc_msg_length(common->mcs_fec_scheme[mcs],chan->payload_len);
+	uint8_t* enc_b = malloc(enc_len);
+	fec_encode(common->mcs_fec[mcs], blocksize/8, chan->data, enc_b);
+
+	//interleaving
+	uint8_t* interleaved_b = malloc(enc_len);
+	interleaver_encode(common->mini_interlvr[mcs],enc_b, interleaved_b);
+
+	// repack bytes so that each array entry can be mapped to one symbol
+	int num_repacked = ceil(enc_len*8.0/modem_get_bps(common->mcs_modem[mcs]));
+	repacked_b = malloc(num_repacked);
+	liquid_repack_bytes(interleaved_b,8,enc_len,repacked_b,modem_get_bps(common->mcs_modem[mcs]),num_repacked,&bytes_written);
+
+	uint total_samps = 0;
+	uint sfn = subframe % 2;
+	uint slot_start = (SLOT_LEN+1)*slot_nr + (slot_nr>=2 ? 4 : 0);
+	uint first_symb = slot_start+mini*MINI_SLOT_LEN;
+	uint last_symb = first_symb+MINI_SLOT_SYMBOLS(mini)-1;
+
+	// modulate signal
+	phy_set_mini_pilots(common, common->pilot_symbols_tx[sfn], slot_start, mini);
+	phy_mod(common, sfn, 0, nfft-1, first_symb, last_symb, mcs, repacked_b, num_repacked, &total_samps);
+
+	// activate used OFDM symbols in resource allocation. The PTT edges next to the
+	// other half of the slot lie within the guard symbol between the halves
+	phy_ue_alloc_ul_slot(phy, sfn, first_symb, last_symb, DATA);
+	free(interleaved_b);
+	free(enc_b);
+	free(repacked_b);
+	return 0;
+}
+
+// Mark the symbols of an UL data slot or mini-slot as used with the given type (DATA or DATA_RB)
+// and set the PTT signal around the slot
+static void phy_ue_alloc_ul_slot(PhyUE phy, uint sfn, uint first_symb, uint last_symb, uint type)
+{
+	memset(&phy->ul_symbol_alloc[sfn][first_symb],type,last_symb-first_symb+1);
     // if the previous slot is not used, we have to set the PTT signal before this data slot
-	if (slot_nr==0) {
+	if (first_symb==0) {
 	    if (phy->ul_symbol_alloc[(sfn-1)%2][SUBFRAME_LEN-2]==NOT_USED)
             phy->ul_symbol_alloc[(sfn-1)%2][SUBFRAME_LEN-1] = PTT_UP; // indicate PTT, slot before isnt used
         else
@@ -703,7 +1016,7 @@ int phy_map_ulslot(PhyUE phy, LogicalChannel chan, uint subframe, uint8_t slot_n
             phy->ul_symbol_alloc[sfn][first_symb-1] = DATA; //previous slot already in use. concat them
 	}
     // if the next slot is not used we have to turn off PTT signal after this slot
-    if (slot_nr==NUM_SLOT-1) {
+    if (last_symb+2 >= SUBFRAME_LEN) {
         // for the last slot within a subframe we simply assume that the next slot is unused.
         // if it is used, the property can be overwritten in the next subframe assignment
         phy->ul_symbol_alloc[sfn][last_symb + 1] = PTT_DOWN; // next slot is not used, end PTT here
@@ -711,8 +1024,4 @@ int phy_map_ulslot(PhyUE phy, LogicalChannel chan, uint subframe, uint8_t slot_n
         if (phy->ul_symbol_alloc[sfn][last_symb + 2] == NOT_USED)
             phy->ul_symbol_alloc[sfn][last_symb + 1] = PTT_DOWN; // next slot is not used, end PTT here
     }
-    free(interleaved_b);
-	free(enc_b);
-	free(repacked_b);
-	return 0;
 }
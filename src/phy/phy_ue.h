@@ -20,6 +20,7 @@
 #define PHY_UE_H_
 
 #include "phy_common.h"
+#include "phy_sync.h"
 #include "../platform/platform.h"
 #include <pthread.h>
 
@@ -35,6 +36,7 @@ struct PhyUE_s {
 	PhyCommon common;	// pointer to common phy objects
 	ofdmframegen fg;	// OFDM frame generator object
 	ofdmframesync fs;	// OFDM frame receiver object
+	PhySync sync;		// coarse detector of the sync sequence
 
 	// Variables to store the decoded slot assignments.
 	// Set to 1 if the corresponding slot is allocated for this client, 0 otherwise
@@ -43,6 +45,11 @@ struct PhyUE_s {
 	uint8_t** dlslot_assignments;
 	uint8_t** ulslot_assignments;
 	uint8_t** ulctrl_assignments;
+	uint8_t** ulrb_assignments;		// resource blocks of the split UL slot UL_RB_SLOT
+	// mini-slots of the DL/UL slots split in time. 2. index: slot*NUM_MINI_SLOT+mini.
+	// The slot itself is NOT_ASSIGNED if it is split
+	uint8_t** dlmini_assignments;
+	uint8_t** ulmini_assignments;
 
 	// store resource allocation on OFDM symbol basis
 	// UE has to refrain from sending if no data is allocated
@@ -52,6 +59,10 @@ struct PhyUE_s {
 
 	// Currently used modulation scheme for RX
 	uint mcs_dl;
+	// MCS of the broadcast slots signaled in the DL ctrl slot. Index: even/uneven subframe
+	uint mcs_bcast[2];
+	// soft bits of failed unicast DL slots for HARQ combining
+	harq_rx_proc_s harq_dl[HARQ_PROCESSES];
 
 	// MAC layer function that will be called when a slot was received
     void (*mac_rx_cb)(struct MacUE_s*, LogicalChannel, uint is_broadcast);
@@ -59,6 +70,9 @@ struct PhyUE_s {
 
 	// Pointer to platform object
 	struct platform_s* platform;
+	// absolute TX sample index of the next symbol written by phy_ue_write_symbol.
+	// Has to be set by the runtime based on the platform's tx_sample_cnt
+	unsigned long long tx_sample;
 
 	// old cfo estimate for filtering
 	float prev_cfo;
@@ -83,6 +97,12 @@ struct PhyUE_s {
     int8_t bs_rxgain;
     int8_t bs_txgain;
     float rssi; // client rssi
+
+    // RX gating: symbols that are not needed are skipped without passing them to fs
+    uint rx_symbol_pos;         // samples of the current rx symbol that have been processed
+    uint rx_skip;               // current rx symbol is skipped
+    float complex rx_rot;       // compensates the NCO phase fs did not advance for skipped samples
+    float complex* rx_rot_buf;  // rotated samples of one symbol
 };
 
 typedef struct PhyUE_s* PhyUE;
@@ -103,6 +123,8 @@ void phy_ue_reset_symbol_allocation(PhyUE phy, uint subframe);
 // PHY data mapping
 int phy_map_ulslot(PhyUE phy, LogicalChannel chan, uint subframe, uint8_t slot_nr, uint mcs);
 int phy_map_ulctrl(PhyUE phy, LogicalChannel chan, uint subframe, uint8_t slot_nr);
+int phy_map_ulrb(PhyUE phy, LogicalChannel chan, uint subframe, uint rb, uint mcs);
+int phy_map_ulmini(PhyUE phy, LogicalChannel chan, uint subframe, uint8_t slot_nr, uint mini, uint mcs);
 
 // PHY slot processing
 int phy_ue_proc_dlctrl(PhyUE phy);
@@ -25,7 +25,8 @@
  *			using the specified buffer size.
  *
  *	tx_push(platform):
- *			release the TX samples
+ *			release the TX samples. The platform counts the released
+ *			samples in tx_sample_cnt
  *
  *	tx_prep(platform, float complex*, uint offset, num_samples):
  *			prepare the tx buf by writing num_samples samples starting
@@ -39,8 +40,12 @@
  *
  *	Optional a manual PTT signal can be generated, e.g. at a GPIO pin
  *	to use this feature, implement handlers for
- *	ptt_set_tx(platform)
- *	ptt_set_rx(platform)
+ *	ptt_set_tx(platform, tx_sample)
+ *	ptt_set_rx(platform, tx_sample)
+ *	The PTT transitions are requested at an absolute TX sample index, i.e.
+ *	tx_sample_cnt at the time the buffer is prepared plus the offset within it.
+ *	ptt_set_tx keys the transmitter before sample tx_sample is sent,
+ *	ptt_set_rx releases it after sample tx_sample-1 was sent.
  *
  *	If you do not want to use this, implement dummy functions for these handlers.
  */
@@ -55,8 +60,9 @@ struct platform_s {
 	int (*platform_tx_prep)(struct platform_s*, float complex*, unsigned int offset, unsigned int num_samples);
 	int (*platform_rx)(struct platform_s*, float complex*);
 	void (*end)(struct platform_s*);
-	void (*ptt_set_tx)(struct platform_s*);
-	void (*ptt_set_rx)(struct platform_s*);
+	void (*ptt_set_tx)(struct platform_s*, unsigned long long tx_sample);
+	void (*ptt_set_rx)(struct platform_s*, unsigned long long tx_sample);
+	unsigned long long tx_sample_cnt;	// number of TX samples released by tx_push so far
 	void* data;	// Pointer to store some data if necessary for some platform
 };
 
@@ -67,18 +67,19 @@ int simulation_tx(platform p)
 	if (data->tx_dest) {
 		channel_cccf_execute_block(data->tx_channel, data->tx_prep_buf, data->buflen, data->tx_dest);
 	}
+	p->tx_sample_cnt += data->buflen;
 #if TX_ENABLE_FILE_LOG
 	log_bin((uint8_t*)data->tx_prep_buf,sizeof(float complex)*data->buflen, "dldata.bin","a");
 #endif
 	return 1;
 }
 
-void sim_ptt_tx_dummy(platform p)
+void sim_ptt_tx_dummy(platform p, unsigned long long tx_sample)
 {
 
 }
 
-void sim_ptt_rx_dummy(platform p)
+void sim_ptt_rx_dummy(platform p, unsigned long long tx_sample)
 {
 
 }
@@ -118,6 +119,7 @@ platform platform_init_simulation(uint buflen, float snr, float cfo)
 	sim->end = sim_end;
 	sim->ptt_set_tx = sim_ptt_tx_dummy;
 	sim->ptt_set_rx = sim_ptt_rx_dummy;
+	sim->tx_sample_cnt = 0;
 	sim->data = sim_data;
 
 	// Generate buffers
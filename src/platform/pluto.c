@@ -80,9 +80,11 @@ struct pluto_data_s {
 
     // Variables to generate a ptt signal
     int enable_ptt;         // set to 1 if ptt is enabled
-    uint ptt_delay;         // total delay until the pin is written [usec]
-    int ptt_delay_comp;    // additional user specified delay adjustment [usec]
+    int ptt_delay_comp;     // additional user specified delay adjustment [usec]
+    int ptt_lead;           // time the PTT is set before the first TX sample [usec]
+    int ptt_tail;           // time the PTT is held after the last TX sample [usec]
     gpio_pin gpio_MIO0;     // GPIO pin structure
+    sample_clock tx_clock;  // mapping of the TX sample counter to system time
 };
 typedef struct  pluto_data_s* pluto_data;
 
@@ -105,6 +107,7 @@ void shutdown(platform hw)
 	if (pluto->ctx) { iio_context_destroy(pluto->ctx); }
 
     if (pluto->gpio_MIO0) { pluto_gpio_destroy(pluto->gpio_MIO0); }
+    if (pluto->tx_clock) { sample_clock_destroy(pluto->tx_clock); }
 }
 
 
@@ -237,6 +240,13 @@ int pluto_transmit(platform hw)
 	// Schedule TX buffer
 	nbytes_tx = iio_buffer_push(pluto->txbuf);
 	if (nbytes_tx < 0) { printf("Error pushing buf %d\n", (int) nbytes_tx); }
+	hw->tx_sample_cnt += pluto->buflen;
+
+	// The push returns as soon as the DMA released a kernel buffer. At this point
+	// the oldest of the KERNEL_BUF_TX queued buffers starts to be transmitted.
+	// The first pushes do not block, thus do not use them for clock estimation
+	if (pluto->tx_clock && hw->tx_sample_cnt > 2*KERNEL_BUF_TX*pluto->buflen)
+	    sample_clock_update(pluto->tx_clock, hw->tx_sample_cnt - KERNEL_BUF_TX*pluto->buflen);
 	return nbytes_tx;
 }
 
@@ -276,6 +286,7 @@ void pluto_print(platform hw)
     printf("RX bandwidth:  %lld\n", pluto->rxcfg.bw_hz);
     printf("PTT enabled:   %d\n",pluto->enable_ptt);
     printf("PTT delay comp:%dus\n",pluto->ptt_delay_comp);
+    printf("PTT lead/tail: %dus/%dus\n",pluto->ptt_lead,pluto->ptt_tail);
 
 }
 void init_generic(platform hw, uint buf_len, char* config_file)
@@ -295,6 +306,8 @@ void init_generic(platform hw, uint buf_len, char* config_file)
     pluto->txcfg.rfport = "A"; // port A (select for rf freq.)
 
     pluto->ptt_delay_comp = DEFAULT_PTT_DELAY_COMP;
+    pluto->ptt_lead = DEFAULT_PTT_LEAD;
+    pluto->ptt_tail = DEFAULT_PTT_TAIL;
     pluto->enable_ptt = 0;
 
     if (config_file!=NULL) {
@@ -319,7 +332,9 @@ void init_generic(platform hw, uint buf_len, char* config_file)
             config_setting_lookup_int64(platform_settings, "tx_bandwdith",&pluto->txcfg.bw_hz);
             config_setting_lookup_int64(platform_settings, "rx_bandwdith",&pluto->rxcfg.bw_hz);
             config_setting_lookup_int(platform_settings,"enable_ptt",&pluto->enable_ptt);
-            config_setting_lookup_int(platform_settings,"ptt_delay_comp",&pluto->ptt_delay_comp);
+            config_setting_lookup_int(platform_settings,"ptt_delay_comp_us",&pluto->ptt_delay_comp);
+            config_setting_lookup_int(platform_settings,"ptt_lead_us",&pluto->ptt_lead);
+            config_setting_lookup_int(platform_settings,"ptt_tail_us",&pluto->ptt_tail);
         }
     }
 
@@ -327,6 +342,8 @@ void init_generic(platform hw, uint buf_len, char* config_file)
 
     pluto->buflen = buf_len;
     pluto->gpio_MIO0 = NULL;
+    pluto->tx_clock = NULL;
+    hw->tx_sample_cnt = 0;
 
 	printf("* Acquiring AD9361 streaming devices\n");
 	ASSERT(get_ad9361_stream_dev(pluto->ctx, TX, &pluto->tx) && "No tx dev found");
@@ -392,11 +409,8 @@ void init_generic(platform hw, uint buf_len, char* config_file)
 		shutdown(hw);
 	}
 
-    if (pluto->enable_ptt) {
+    if (pluto->enable_ptt)
         pluto_enable_ptt(hw);
-        pluto_ptt_set_rx(hw);
-    }
-    pluto->ptt_delay= (int) (buf_len * (KERNEL_BUF_TX - 1) * 1000000.0 / samplerate);
 
 
     pluto_print(hw);
@@ -474,28 +488,31 @@ int pluto_enable_ptt(platform hw)
 {
     pluto_data pluto = (pluto_data)hw->data;
     pluto->enable_ptt = 1;
-    pluto->gpio_MIO0 = pluto_gpio_init(PIN_MIO0,OUT);
+    if (pluto->gpio_MIO0==NULL) {
+        pluto->gpio_MIO0 = pluto_gpio_init(PIN_MIO0,OUT);
+        pluto->tx_clock = sample_clock_create(pluto->txcfg.fs_hz);
+    }
+    pluto_gpio_pin_write(pluto->gpio_MIO0,LOW);
     return 0;
 }
 
-void pluto_ptt_set_tx(platform hw)
+// Set the PTT signal, so that the transmitter is keyed when
+// the TX sample with index tx_sample is sent
+void pluto_ptt_set_tx(platform hw, unsigned long long tx_sample)
 {
     pluto_data pluto = (pluto_data)hw->data;
     if (pluto->enable_ptt)
-        pluto_gpio_pin_write_delayed(pluto->gpio_MIO0,HIGH,pluto->ptt_delay);
+        pluto_gpio_pin_write_at_sample(pluto->gpio_MIO0,HIGH,pluto->tx_clock,tx_sample,
+                                       -(pluto->ptt_lead+pluto->ptt_delay_comp));
 }
 
-void pluto_ptt_set_rx(platform hw)
+// Release the PTT signal after the TX sample with index tx_sample-1 was sent
+void pluto_ptt_set_rx(platform hw, unsigned long long tx_sample)
 {
     pluto_data pluto = (pluto_data)hw->data;
     if (pluto->enable_ptt)
-        pluto_gpio_pin_write_delayed(pluto->gpio_MIO0,LOW,pluto->ptt_delay);
-}
-
-void pluto_ptt_set_switch_delay(platform hw, int delay_us)
-{
-    pluto_data pluto = (pluto_data)hw->data;
-    pluto->ptt_delay = delay_us-pluto->ptt_delay_comp;
+        pluto_gpio_pin_write_at_sample(pluto->gpio_MIO0,LOW,pluto->tx_clock,tx_sample,
+                                       pluto->ptt_tail-pluto->ptt_delay_comp);
 }
 
 // Initialize a pluto network context
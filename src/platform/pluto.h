@@ -32,11 +32,15 @@
 #define KERNEL_BUF_TX 4
 #define KERNEL_BUF_RX 6
 
-// adjust the delay between generation of the signal in software and
-// the hardware toggle. A default delay is calculated from the kernel buffer
-// length, this variable can be used for fine tuning
+// adjust the delay between the release of a sample by the DMA and
+// the hardware toggle. The PTT time is derived from the TX sample counter,
+// this variable can be used for fine tuning
 #define DEFAULT_PTT_DELAY_COMP 200 // [usec]
 
+// Guard time between the PTT edges and the first/last transmitted sample
+#define DEFAULT_PTT_LEAD 100 // [usec] PTT is set before the first sample
+#define DEFAULT_PTT_TAIL 50  // [usec] PTT is released after the last sample
+
 // Pluto Platform hardware abstraction
 // use init pluto platform, to generate a platform
 // abstraction. See platform.h on how to use it
@@ -53,9 +57,8 @@ int pluto_set_tx_freq(platform hw, long long txfreq);
 
 // Duplex mode config
 int pluto_enable_ptt(platform hw);
-void pluto_ptt_set_tx(platform hw);
-void pluto_ptt_set_rx(platform hw);
-void pluto_ptt_set_switch_delay(platform hw, int delay_us);
+void pluto_ptt_set_tx(platform hw, unsigned long long tx_sample);
+void pluto_ptt_set_rx(platform hw, unsigned long long tx_sample);
 
 // --------------- Read device config ----------------- //
 long long pluto_get_rxgain(platform hw);
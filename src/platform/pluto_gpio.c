@@ -30,9 +30,16 @@
 #include <signal.h>
 #include <time.h>
 #include <errno.h>
+#include <math.h>
 
 #define EVENT_QUEUE_LEN 8
 
+// sample clock estimation parameters
+#define SAMPLE_CLOCK_WINDOW 32          // number of observations over which the minimum delay is taken
+#define SAMPLE_CLOCK_FILT_PARAM 0.25    // exponential filter parameter for the offset estimate
+#define SAMPLE_CLOCK_RATE_FILT_PARAM 0.02 // exponential filter parameter for the sample period estimate
+#define SAMPLE_CLOCK_RESYNC_NS 1000000  // re-anchor the mapping if the error exceeds this value [nsec]
+
 #define PLUTO_GPIO_WORKER_TH_CPUID 1
 #define PLUTO_GPIO_WORKER_TH_PRIO 3
 
@@ -65,6 +72,22 @@ struct gpio_pin_s {
     int num_events_queued;
 };
 
+// Linear mapping sample_idx -> CLOCK_MONOTONIC
+// time(idx) = ref_ns + (idx-ref_idx)*ns_per_sample
+// Observations are taken when a buffer is released by the hardware. Since the
+// observing thread wakes up with a varying delay, the minimum residual within
+// a window is used to update the mapping.
+struct sample_clock_s {
+    double ns_per_sample;           // estimated sample period [nsec]
+    double ref_ns;                  // CLOCK_MONOTONIC time of the reference sample [nsec]
+    unsigned long long ref_idx;     // reference sample index
+    double win_min_res;             // minimum residual within the current window [nsec]
+    unsigned long long win_start;   // sample index of the first observation in the window
+    uint win_cnt;                   // number of observations in the current window
+    int valid;                      // 1 if mapping was estimated at least once
+    pthread_mutex_t mutex;
+};
+
 
 int gpio_event_cmp(const void* elem1, const void* elem2)
 {
@@ -115,7 +138,12 @@ gpio_pin pluto_gpio_init(int pin_id, int direction)
     pin->num_events_queued = 0;
 
     pin->thread_stop_signal = 0;
-    pthread_cond_init(&pin->cond,NULL);
+    // events are scheduled on CLOCK_MONOTONIC so that they are not affected by wall-clock changes
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pin->cond,&cond_attr);
+    pthread_condattr_destroy(&cond_attr);
     pthread_mutex_init(&pin->mutex,NULL);
     pthread_create(&pin->pin_thread, NULL, pin_ctrl_thread, pin);
 
@@ -163,16 +191,35 @@ void pluto_gpio_pin_write(gpio_pin pin, int level)
 }
 
 void pluto_gpio_pin_write_delayed(gpio_pin pin, int level, int delay_us) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC,&time);
+    time.tv_nsec += delay_us*1000;
+    while (time.tv_nsec>=1000000000) {
+        time.tv_sec++;
+        time.tv_nsec-=1000000000;
+    }
+    while (time.tv_nsec<0) {
+        time.tv_sec--;
+        time.tv_nsec+=1000000000;
+    }
+    pluto_gpio_pin_write_at(pin, level, &time);
+}
+
+// Schedule a pin write at the absolute time (CLOCK_MONOTONIC) given in time.
+// Events in the past are executed immediately.
+void pluto_gpio_pin_write_at(gpio_pin pin, int level, struct timespec* time)
+{
     if (pin->direction != OUT) {
         LOG(WARN,"[Platform] pin %d is not configured for output!\n",pin->id);
         return;
     }
 
+    pthread_mutex_lock(&pin->mutex);
     if (pin->num_events_queued==EVENT_QUEUE_LEN) {
+        pthread_mutex_unlock(&pin->mutex);
         LOG(WARN,"[Platform] cannot enqueue gpio pin %d event! queue full\n",pin->id);
         return;
     }
-    pthread_mutex_lock(&pin->mutex);
 
     struct gpio_event* new_event = &pin->event_q[pin->num_events_queued];
     if (level==LOW)
@@ -180,20 +227,120 @@ void pluto_gpio_pin_write_delayed(gpio_pin pin, int level, int delay_us) {
     else
         new_event->value = '1';
     new_event->fd = pin->value_fd;
-    struct timespec time;
-    clock_gettime(CLOCK_REALTIME,&time);
-    time.tv_nsec += delay_us*1000;
-    if (time.tv_nsec>1000000000) {
-        time.tv_sec++;
-        time.tv_nsec-=1000000000;
-    }
-    new_event->sched_time = time;
+    new_event->sched_time = *time;
     pin->num_events_queued++;
     TIMECHECK_START(thread_wakeup_mon);
     pthread_cond_signal(&pin->cond);
     pthread_mutex_unlock(&pin->mutex);
 }
 
+// Schedule a pin write at the time the TX sample sample_idx is released by the hardware.
+// offset_us is added to the estimated time, i.e. to compensate for hardware delays.
+// Edges cannot be placed before the sample clock mapping is established, so they are dropped
+// and the pin keeps its level. A HIGH edge whose time has already passed is dropped as well,
+// since it would key the transmitter in the middle of the transmission. LOW edges in the past
+// are written immediately, so that the pin is never left HIGH
+void pluto_gpio_pin_write_at_sample(gpio_pin pin, int level, sample_clock clk,
+                                    unsigned long long sample_idx, int offset_us)
+{
+    struct timespec time, now;
+    if (!sample_clock_get_time(clk, sample_idx, &time)) {
+        LOG(DEBUG,"[Platform] sample clock not synced yet. Drop pin %d event\n",pin->id);
+        return;
+    }
+    time.tv_nsec += offset_us*1000;
+    while (time.tv_nsec>=1000000000) {
+        time.tv_sec++;
+        time.tv_nsec-=1000000000;
+    }
+    while (time.tv_nsec<0) {
+        time.tv_sec--;
+        time.tv_nsec+=1000000000;
+    }
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    if (level==HIGH && (time.tv_sec<now.tv_sec ||
+                        (time.tv_sec==now.tv_sec && time.tv_nsec<now.tv_nsec))) {
+        LOG(DEBUG,"[Platform] pin %d event is %ldus late. Drop it\n",pin->id,
+            (now.tv_sec-time.tv_sec)*1000000+(now.tv_nsec-time.tv_nsec)/1000);
+        return;
+    }
+    pluto_gpio_pin_write_at(pin, level, &time);
+}
+
+sample_clock sample_clock_create(uint samplerate)
+{
+    sample_clock clk = calloc(sizeof(struct sample_clock_s),1);
+    clk->ns_per_sample = 1000000000.0/samplerate;
+    clk->win_min_res = INFINITY;
+    pthread_mutex_init(&clk->mutex,NULL);
+    return clk;
+}
+
+void sample_clock_destroy(sample_clock clk)
+{
+    pthread_mutex_destroy(&clk->mutex);
+    free(clk);
+}
+
+// Add a new observation: the sample with index sample_idx is released by the hardware now.
+void sample_clock_update(sample_clock clk, unsigned long long sample_idx)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    double now_ns = now.tv_sec*1000000000.0 + now.tv_nsec;
+
+    pthread_mutex_lock(&clk->mutex);
+    if (!clk->valid && clk->win_cnt==0) {
+        // first observation. Anchor mapping here
+        clk->ref_ns = now_ns;
+        clk->ref_idx = sample_idx;
+    }
+    double predicted_ns = clk->ref_ns + ((double)sample_idx-(double)clk->ref_idx)*clk->ns_per_sample;
+    double res = now_ns - predicted_ns;
+    if (clk->win_cnt==0)
+        clk->win_start = sample_idx;
+    if (res < clk->win_min_res)
+        clk->win_min_res = res;
+    clk->win_cnt++;
+
+    if (clk->win_cnt == SAMPLE_CLOCK_WINDOW) {
+        double err = clk->win_min_res;
+        if (!clk->valid || fabs(err) > SAMPLE_CLOCK_RESYNC_NS) {
+            // (re)anchor the mapping, i.e. after a buffer underflow
+            if (clk->valid)
+                LOG(INFO,"[Platform] sample clock resync. error: %.0fns\n",err);
+            clk->ref_ns = predicted_ns + err;
+            clk->valid = 1;
+        } else {
+            clk->ref_ns = predicted_ns + SAMPLE_CLOCK_FILT_PARAM*err;
+            // a remaining error across the window indicates a deviation of the sample period
+            if (sample_idx > clk->win_start)
+                clk->ns_per_sample += SAMPLE_CLOCK_RATE_FILT_PARAM*err/(sample_idx-clk->win_start);
+        }
+        clk->ref_idx = sample_idx;
+        clk->win_cnt = 0;
+        clk->win_min_res = INFINITY;
+    }
+    pthread_mutex_unlock(&clk->mutex);
+}
+
+// Convert a sample index to CLOCK_MONOTONIC time
+// returns 1 on success, 0 if the mapping is not established yet
+int sample_clock_get_time(sample_clock clk, unsigned long long sample_idx, struct timespec* time)
+{
+    pthread_mutex_lock(&clk->mutex);
+    if (!clk->valid) {
+        pthread_mutex_unlock(&clk->mutex);
+        return 0;
+    }
+    double t_ns = clk->ref_ns + ((double)sample_idx-(double)clk->ref_idx)*clk->ns_per_sample;
+    pthread_mutex_unlock(&clk->mutex);
+
+    time->tv_sec = (time_t)(t_ns/1000000000.0);
+    time->tv_nsec = (long)(t_ns - time->tv_sec*1000000000.0);
+    return 1;
+}
+
 // Main Event thread for timed GPIO pin control.
 // Adds incoming events to a queue and works off events at their scheduled time
 // This thread mainly operates on a pthread_cond_timedwait().
@@ -203,14 +350,14 @@ void* pin_ctrl_thread(void* arg)
 {
     gpio_pin pin = arg;
     struct timespec next_event_time;
-    clock_gettime(CLOCK_REALTIME,&next_event_time);
+    clock_gettime(CLOCK_MONOTONIC,&next_event_time);
     next_event_time.tv_sec += 3600; //  no events scheduled initially. expire long time in future
 
     while (!pin->thread_stop_signal) {
         pthread_mutex_lock(&pin->mutex);
         int ret = pthread_cond_timedwait(&pin->cond,&pin->mutex,&next_event_time);
 
-        if (ret==ETIMEDOUT) {
+        if (ret==ETIMEDOUT && pin->num_events_queued>0) {
             // thread woke up due to upcoming event. Handle it
             struct gpio_event* event =  &pin->event_q[pin->num_events_queued-1];
             pin->num_events_queued--;
@@ -231,7 +378,7 @@ void* pin_ctrl_thread(void* arg)
             // next event is last element in the list
             next_event_time = pin->event_q[pin->num_events_queued - 1].sched_time;
         } else {
-            clock_gettime(CLOCK_REALTIME,&next_event_time);
+            clock_gettime(CLOCK_MONOTONIC,&next_event_time);
             next_event_time.tv_sec += 3600; //  no events scheduled. set expire to long time in future
         }
         pthread_mutex_unlock(&pin->mutex);
@@ -20,6 +20,7 @@
 #define TRANSCEIVER_PLUTO_GPIO_H
 
 #include <pthread.h>
+#include <time.h>
 
 enum pin_level {LOW=0, HIGH=1};
 enum pin_direction {IN=0, OUT=1};
@@ -32,6 +33,12 @@ enum pin_direction {IN=0, OUT=1};
 struct gpio_pin_s;
 typedef struct gpio_pin_s* gpio_pin;
 
+// Mapping of the TX sample counter to CLOCK_MONOTONIC.
+// Is fed with the time at which a known sample is released by the hardware
+// and continuously estimates offset and sample period from these observations
+struct sample_clock_s;
+typedef struct sample_clock_s* sample_clock;
+
 // initializer
 gpio_pin pluto_gpio_init(int pin_id, int direction);
 void pluto_gpio_destroy(gpio_pin gpio);
@@ -39,6 +46,15 @@ void pluto_gpio_destroy(gpio_pin gpio);
 // pin write functions
 void pluto_gpio_pin_write(gpio_pin gpio, int level);
 void pluto_gpio_pin_write_delayed(gpio_pin gpio, int level, int delay_us);
+void pluto_gpio_pin_write_at(gpio_pin gpio, int level, struct timespec* time);
+void pluto_gpio_pin_write_at_sample(gpio_pin gpio, int level, sample_clock clk,
+                                    unsigned long long sample_idx, int offset_us);
+
+// sample clock functions
+sample_clock sample_clock_create(unsigned int samplerate);
+void sample_clock_destroy(sample_clock clk);
+void sample_clock_update(sample_clock clk, unsigned long long sample_idx);
+int sample_clock_get_time(sample_clock clk, unsigned long long sample_idx, struct timespec* time);
 
 
 #endif //TRANSCEIVER_PLUTO_GPIO_H
@@ -243,7 +243,7 @@ void* thread_mac_bs_scheduler(void* arg)
 
 int main(int argc,char *argv[])
 {
-	pthread_t bs_phy_rx_slot_th, bs_phy_rx_th, bs_phy_tx_th, bs_mac_th, bs_tap_th;
+	pthread_t bs_phy_rx_slot_th, bs_phy_rx_th, bs_phy_tx_th, bs_mac_th, bs_tap_th, bs_tap_tx_th;
 
 	// load default configuration
 	phy_config_default_64();
@@ -316,6 +316,11 @@ int main(int argc,char *argv[])
     // Init phy and mac layer
 	PhyBS phy = phy_bs_init();
 	MacBS mac = mac_bs_init();
+	// TAP device or AF_PACKET ring, see net section of the config file
+	mac->tapdevice = tap_init_config(config_file);
+	mac_frag_config_load(config_file);
+	mac_la_config_load(config_file);
+	mac_harq_config_load(config_file);
 	phy->rxgain = rxgain;
 	phy->txgain = txgain;
 
@@ -421,6 +426,23 @@ int main(int argc,char *argv[])
     pthread_setaffinity_np(bs_tap_th,sizeof(cpu_set_t),&cpu_set);
     //pthread_setschedparam(bs_tap_th, SCHED_FIFO, &prio_rt_normal);
 
+	// start TAP egress thread. Runs without RT priority. The scheduling policy is set
+	// explicitly, otherwise the thread inherits the RT policy of the main thread
+	pthread_attr_t tap_tx_attr;
+	struct sched_param prio_other = {.sched_priority = 0};
+	pthread_attr_init(&tap_tx_attr);
+	pthread_attr_setinheritsched(&tap_tx_attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&tap_tx_attr, SCHED_OTHER);
+	pthread_attr_setschedparam(&tap_tx_attr, &prio_other);
+	if (pthread_create(&bs_tap_tx_th, &tap_tx_attr, tap_tx_th, mac->tapdevice) !=0) {
+		LOG(ERR,"could not create TAP egress thread. Abort!\n");
+		exit(EXIT_FAILURE);
+	} else {
+		LOG(INFO,"created TAP egress thread.\n");
+	}
+	pthread_attr_destroy(&tap_tx_attr);
+    pthread_setaffinity_np(bs_tap_tx_th,sizeof(cpu_set_t),&cpu_set);
+
 	// printf affinities
 	pthread_getaffinity_np(bs_phy_rx_th,sizeof(cpu_set_t),&cpu_set);
 	printf("RX Thread CPU mask: ");
@@ -444,7 +466,7 @@ int main(int argc,char *argv[])
 	printf("\n");
 
     // main thread: regularly show statistics:
-    char stats_buf[512];
+    char stats_buf[1024];
     while (1) {
         sleep(60);
         int num_user = 0;
@@ -453,15 +475,38 @@ int main(int argc,char *argv[])
                 num_user++;
                 LOG(INFO, "User %2d stats:\n", userid);
                 SYSLOG(LOG_INFO, "User %2d stats:\n", userid);
-                mac_stats_print(stats_buf, 512, &mac->UE[userid]->stats);
+                mac_stats_print(stats_buf, sizeof(stats_buf), &mac->UE[userid]->stats);
                 LOG(INFO, "%s", stats_buf);
                 SYSLOG(LOG_INFO, "%s", stats_buf);
                 LOG(INFO, "UL mcs %d DL mcs %d\n", mac->UE[userid]->ul_mcs, mac->UE[userid]->dl_mcs);
                 SYSLOG(LOG_INFO, "UL mcs %d DL mcs %d\n", mac->UE[userid]->ul_mcs, mac->UE[userid]->dl_mcs);
+                mac_bs_sched_stats_print(stats_buf, sizeof(stats_buf), mac, userid);
+                LOG(INFO, "%s", stats_buf);
+                SYSLOG(LOG_INFO, "%s", stats_buf);
+                mac_frag_stats_print(stats_buf, sizeof(stats_buf), mac->UE[userid]->fragmenter);
+                LOG(INFO, "%s", stats_buf);
+                SYSLOG(LOG_INFO, "%s", stats_buf);
+                mac_assmbl_stats_print(stats_buf, sizeof(stats_buf), mac->UE[userid]->reassembler);
+                LOG(INFO, "%s", stats_buf);
+                SYSLOG(LOG_INFO, "%s", stats_buf);
+                mac_hc_stats_print(stats_buf, sizeof(stats_buf), mac->UE[userid]->hc);
+                LOG(INFO, "%s", stats_buf);
+                SYSLOG(LOG_INFO, "%s", stats_buf);
             }
         }
+        LOG(INFO, "Broadcast queue stats:\n");
+        SYSLOG(LOG_INFO, "Broadcast queue stats:\n");
+        mac_frag_stats_print(stats_buf, sizeof(stats_buf), mac->broadcast_data_fragmenter);
+        LOG(INFO, "%s", stats_buf);
+        SYSLOG(LOG_INFO, "%s", stats_buf);
+        mac_bs_bcast_stats_print(stats_buf, sizeof(stats_buf), mac);
+        LOG(INFO, "%s", stats_buf);
+        SYSLOG(LOG_INFO, "%s", stats_buf);
         LOG(INFO,"Num connected users: %d\n",num_user);
         SYSLOG(LOG_INFO,"Num connected users: %d\n",num_user);
+        tap_stats_print(stats_buf, sizeof(stats_buf), mac->tapdevice);
+        LOG(INFO, "%s", stats_buf);
+        SYSLOG(LOG_INFO, "%s", stats_buf);
     }
 
 	static void* ret[4];
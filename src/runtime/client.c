@@ -65,8 +65,8 @@ Options:\n \
    --rxgain -g:    fix the rxgain to a value [-1 73]\n \
    --txgain -t:    fix the txgain to a value [-89 0]\n \
    --frequency -f: tune to a specific (DL) frequency\n \
-   --ul-mcs -u:    use given mcs in UL. Default: 0.\n \
-   --dl-mcs -d:    use given mcs in DL. Default: 0.\n \
+   --ul-mcs -u:    use given fixed mcs in UL. Default: set by the BS link adaptation.\n \
+   --dl-mcs -d:    use given fixed mcs in DL. Default: set by the BS link adaptation.\n \
    --config -c     specify a configuration file\n \
    --log -l        specify the log level. Default: 2.\n \
                    0=TRACE 1=DEBUG 2=INFO 3=WARN 4=ERR 5=NONE\n";
@@ -77,8 +77,8 @@ int txgain = -100;
 int enable_agc = 0;
 long long int dl_frequency = -1;
 long long int ul_frequency = -1;
-int ul_mcs = 0;
-int dl_mcs = 0;
+int ul_mcs = -1;	// -1: no fixed MCS
+int dl_mcs = -1;
 char* config_file=NULL;      // configuration file string
 // struct holds arguments for RX thread
 struct rx_th_data_s {
@@ -184,7 +184,8 @@ void* thread_phy_ue_tx(void* arg)
 		// create tx time data
 		// first add the last samples from the previous generated symbol
 		hw->platform_tx_prep(hw, ul_data_tx+num_samples, 0, tx_shift);
-		// create new symbol
+		// create new symbol. First symbol starts at tx_shift within the buffer
+		phy->tx_sample = hw->tx_sample_cnt + tx_shift;
 		phy_ue_write_symbol(phy, ul_data_tx);
 		phy_ue_write_symbol(phy, ul_data_tx+(nfft+cp_len));
 
@@ -224,10 +225,6 @@ void* thread_phy_ue_tx(void* arg)
 				rx_offset = phy->rx_offset;
 				timing_advance = phy->mac->timing_advance;
 				num_samples = buflen - tx_shift;
-
-                // set PTT signal delay
-                pluto_ptt_set_switch_delay(hw,
-                        (int) ((buflen * KERNEL_BUF_TX + tx_shift) * 1000000.0 / samplerate));
 			}
 		}
 	}
@@ -243,9 +240,9 @@ void* thread_mac_ue_scheduler(void* arg)
 	TIMECHECK_INIT(timecheck_ue_sched,"ue.scheduler",1000);
 	uint sched_rounds=0;
 
-    if (ul_mcs>0)
+    if (ul_mcs>=0)
         mac_ue_req_mcs_change(mac,ul_mcs,1);
-    if (dl_mcs>0)
+    if (dl_mcs>=0)
         mac_ue_req_mcs_change(mac,dl_mcs,0);
 
 	while (1) {
@@ -354,7 +351,7 @@ int main(int argc,char *argv[])
     prio.sched_priority = 3;
     sched_setscheduler(0,SCHED_FIFO, &prio);
 
-    pthread_t ue_phy_rx_th, ue_phy_tx_th, ue_mac_th, ue_phy_rx_slot_th, ue_tap_th;
+    pthread_t ue_phy_rx_th, ue_phy_tx_th, ue_mac_th, ue_phy_rx_slot_th, ue_tap_th, ue_tap_tx_th;
 
 	// start by loading default config.
 	phy_config_default_64();
@@ -466,6 +463,9 @@ int main(int argc,char *argv[])
 	// Init phy and mac layer
 	PhyUE phy = phy_ue_init();
 	MacUE mac = mac_ue_init();
+	// TAP device or AF_PACKET ring, see net section of the config file
+	mac->tapdevice = tap_init_config(config_file);
+	mac_frag_config_load(config_file);
 
 	phy_ue_set_mac_interface(phy, mac_ue_rx_channel, mac);
 	mac_ue_set_phy_interface(mac, phy);
@@ -579,6 +579,23 @@ int main(int argc,char *argv[])
 	CPU_SET(UE_TAP_CPUID,&cpu_set);
 	pthread_setaffinity_np(ue_tap_th,sizeof(cpu_set_t),&cpu_set);
 
+	// start TAP egress thread. Runs without RT priority. The scheduling policy is set
+	// explicitly, otherwise the thread inherits the RT policy of the main thread
+	pthread_attr_t tap_tx_attr;
+	struct sched_param prio_other = {.sched_priority = 0};
+	pthread_attr_init(&tap_tx_attr);
+	pthread_attr_setinheritsched(&tap_tx_attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&tap_tx_attr, SCHED_OTHER);
+	pthread_attr_setschedparam(&tap_tx_attr, &prio_other);
+	if (pthread_create(&ue_tap_tx_th, &tap_tx_attr, tap_tx_th, mac->tapdevice) != 0) {
+		LOG(ERR,"could not create TAP egress thread. Abort!\n");
+		exit(EXIT_FAILURE);
+	} else {
+		LOG(INFO,"created TAP egress thread.\n");
+	}
+	pthread_attr_destroy(&tap_tx_attr);
+	pthread_setaffinity_np(ue_tap_tx_th,sizeof(cpu_set_t),&cpu_set);
+
 	// printf affinities
 	pthread_getaffinity_np(ue_phy_rx_th,sizeof(cpu_set_t),&cpu_set);
 	printf("RX Thread CPU mask: ");
@@ -602,18 +619,27 @@ int main(int argc,char *argv[])
 	printf("\n");
 
 	// main thread: regulary show statistics:
-	char stats_buf[512];
+	char stats_buf[1024];
 	while (1) {
         sleep(60);
         LOG(INFO,"MAC UE status: is associated: %d\n",mac->is_associated);
         SYSLOG(LOG_INFO,"MAC UE status: is associated: %d\n",mac->is_associated);
         if (mac->is_associated) {
-            mac_stats_print(stats_buf, 512, &mac->stats);
+            mac_stats_print(stats_buf, sizeof(stats_buf), &mac->stats);
             LOG(INFO, "%s",stats_buf);
             SYSLOG(LOG_INFO,"%s",stats_buf);
             LOG(INFO,"UL mcs %d DL mcs %d\n",mac->ul_mcs, mac->dl_mcs);
             SYSLOG(LOG_INFO,"UL mcs %d DL mcs %d\n",mac->ul_mcs, mac->dl_mcs);
+            mac_frag_stats_print(stats_buf, sizeof(stats_buf), mac->fragmenter);
+            LOG(INFO, "%s",stats_buf);
+            SYSLOG(LOG_INFO,"%s",stats_buf);
+            mac_hc_stats_print(stats_buf, sizeof(stats_buf), mac->hc);
+            LOG(INFO, "%s",stats_buf);
+            SYSLOG(LOG_INFO,"%s",stats_buf);
         }
+        tap_stats_print(stats_buf, sizeof(stats_buf), mac->tapdevice);
+        LOG(INFO, "%s",stats_buf);
+        SYSLOG(LOG_INFO,"%s",stats_buf);
 	}
 	static void* ret[4];
 	pthread_join(ue_phy_rx_th, &ret[0]);
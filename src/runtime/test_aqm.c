@@ -0,0 +1,257 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+// Simulation of a TCP like bulk flow over one MAC queue. Compares the queue
+// with a plain frame limit to the byte limited queue with CoDel. A small ping
+// like flow shares the queue and shows the latency seen by other traffic.
+// The link is modelled as a fixed number of slots per subframe, no PHY is used.
+
+#include "../mac/mac_fragmentation.h"
+#include "../phy/phy_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_SLOT_BYTES 62		// payload per slot (MCS 0)
+#define DEFAULT_SLOTS_PER_SUBFRAME 2
+#define SIM_DURATION_S 300
+#define SIM_BASE_RTT_US 300000		// RTT without queueing, incl. the ACK path
+#define SIM_RTO_US 3000000			// retransmission timeout
+#define SIM_MSS 1448
+#define SIM_FRAME_SIZE 1514
+#define SIM_PING_SIZE 98
+#define SIM_PING_INTERVAL_US 500000
+#define SIM_MAX_SEQ (1<<20)
+#define PING_FLAG 0x80000000
+
+enum {SEG_UNSENT=0, SEG_INFLIGHT, SEG_DELIVERED, SEG_ACKED, SEG_LOST};
+
+static uint64_t sim_time;
+static uint64_t sim_clock(void)
+{
+	return sim_time;
+}
+
+typedef struct {
+	uint8_t seg_state[SIM_MAX_SEQ];
+	uint64_t ack_time[SIM_MAX_SEQ];	// time the ACK arrives at the sender
+	uint64_t send_time[SIM_MAX_SEQ];
+	uint next_seq;			// next new segment
+	uint snd_una;			// oldest segment not acked/lost
+	uint inflight;
+	double cwnd;			// [segments]
+	double ssthresh;
+	uint recover;			// no further window reduction until this seq is acked
+	uint64_t last_progress;
+	uint delivered;
+	uint lost;				// lost segments
+	uint losses;			// loss events
+	double rtt_sum;
+	uint rtt_cnt;
+} tcp_sim_s;
+
+typedef struct {
+	uint64_t ping_sent[SIM_MAX_SEQ];
+	uint num_sent;
+	uint num_rcvd;
+	double rtt_sum;
+	uint64_t rtt_max;
+} ping_sim_s;
+
+static tcp_sim_s tcp;
+static ping_sim_s ping;
+
+static MacDataFrame create_frame(uint size, uint id, uint tclass)
+{
+	MacDataFrame frame = dataframe_create(size);
+	memset(frame->data, 0, size);
+	memcpy(frame->data, &id, sizeof(uint));
+	frame->tclass = tclass;
+	return frame;
+}
+
+// window reduction on loss, once per window
+static void tcp_on_loss(uint seq)
+{
+	tcp.losses++;
+	if (seq >= tcp.recover) {
+		tcp.ssthresh = tcp.cwnd/2 > 2 ? tcp.cwnd/2 : 2;
+		tcp.cwnd = tcp.ssthresh;
+		tcp.recover = tcp.next_seq;
+	}
+}
+
+static void tcp_process_acks()
+{
+	while (tcp.snd_una < tcp.next_seq) {
+		uint seq = tcp.snd_una;
+		if (tcp.seg_state[seq]==SEG_DELIVERED && tcp.ack_time[seq]<=sim_time) {
+			tcp.seg_state[seq] = SEG_ACKED;
+			tcp.rtt_sum += tcp.ack_time[seq] - tcp.send_time[seq];
+			tcp.rtt_cnt++;
+			tcp.inflight--;
+			tcp.last_progress = sim_time;
+			if (tcp.cwnd < tcp.ssthresh)
+				tcp.cwnd += 1;
+			else
+				tcp.cwnd += 1/tcp.cwnd;
+			tcp.snd_una++;
+			continue;
+		}
+		// segment was dropped. It is detected when an ACK of a
+		// later segment arrives (duplicate ACKs) or by the timeout
+		int later_acked = 0;
+		for (uint s=seq+1; s<tcp.next_seq && s<seq+64; s++) {
+			if (tcp.seg_state[s]==SEG_DELIVERED && tcp.ack_time[s]<=sim_time) {
+				later_acked = 1;
+				break;
+			}
+		}
+		if (tcp.seg_state[seq]==SEG_INFLIGHT && later_acked) {
+			tcp.seg_state[seq] = SEG_LOST;
+			tcp.inflight--;
+			tcp.lost++;
+			tcp_on_loss(seq);
+			tcp.snd_una++;
+		} else if (tcp.seg_state[seq]==SEG_INFLIGHT && sim_time-tcp.last_progress > SIM_RTO_US) {
+			// timeout: all outstanding segments are lost
+			for (uint s=seq; s<tcp.next_seq; s++) {
+				if (tcp.seg_state[s]==SEG_INFLIGHT) {
+					tcp.seg_state[s] = SEG_LOST;
+					tcp.inflight--;
+					tcp.lost++;
+				}
+			}
+			tcp.losses++;
+			tcp.ssthresh = tcp.cwnd/2 > 2 ? tcp.cwnd/2 : 2;
+			tcp.cwnd = 1;
+			tcp.recover = tcp.next_seq;
+			tcp.last_progress = sim_time;
+		} else {
+			break;
+		}
+	}
+}
+
+static void tcp_send(MacFrag frag)
+{
+	while (tcp.inflight < (uint)tcp.cwnd && tcp.next_seq < SIM_MAX_SEQ) {
+		uint seq = tcp.next_seq++;
+		tcp.seg_state[seq] = SEG_INFLIGHT;
+		tcp.send_time[seq] = sim_time;
+		tcp.inflight++;
+		MacDataFrame frame = create_frame(SIM_FRAME_SIZE, seq, TCLASS_BEST_EFFORT);
+		if (!mac_frag_add_frame(frag, frame))
+			dataframe_destroy(frame);
+	}
+}
+
+// called for every frame that was completely sent over the link
+static void frame_delivered(uint id)
+{
+	if (id & PING_FLAG) {
+		uint nr = id & ~PING_FLAG;
+		uint64_t rtt = sim_time - ping.ping_sent[nr] + SIM_BASE_RTT_US;
+		ping.num_rcvd++;
+		ping.rtt_sum += rtt;
+		if (rtt > ping.rtt_max)
+			ping.rtt_max = rtt;
+	} else if (tcp.seg_state[id]==SEG_INFLIGHT) {
+		tcp.seg_state[id] = SEG_DELIVERED;
+		tcp.ack_time[id] = sim_time + SIM_BASE_RTT_US;
+		tcp.delivered++;
+	}
+}
+
+void run_simulation(uint aqm, uint slot_bytes, uint slots_per_subframe)
+{
+	uint subframe_us = (uint64_t)SUBFRAME_LEN*(nfft+cp_len)*1000000/samplerate;
+	uint num_subframes = (uint64_t)SIM_DURATION_S*1000000/subframe_us;
+	uint frame_id = 0;
+	uint64_t next_ping = 0;
+	char buf[1024];
+
+	memset(&tcp, 0, sizeof(tcp));
+	memset(&ping, 0, sizeof(ping));
+	tcp.cwnd = 2;
+	tcp.ssthresh = 1000;
+	sim_time = 0;
+
+	MacFrag frag = mac_frag_init();
+	mac_frag_set_aqm(frag, aqm);
+
+	for (uint sfn=0; sfn<num_subframes; sfn++) {
+		sim_time = (uint64_t)sfn*subframe_us;
+		tcp_process_acks();
+		tcp_send(frag);
+		if (sim_time >= next_ping) {
+			ping.ping_sent[ping.num_sent] = sim_time;
+			MacDataFrame frame = create_frame(SIM_PING_SIZE, ping.num_sent++ | PING_FLAG, TCLASS_BEST_EFFORT);
+			if (!mac_frag_add_frame(frag, frame))
+				dataframe_destroy(frame);
+			next_ping += SIM_PING_INTERVAL_US;
+		}
+
+		// transmit the assigned slots
+		for (uint slot=0; slot<slots_per_subframe && mac_frag_has_fragment(frag); slot++) {
+			MacMessage msg = mac_frag_get_fragment(frag, slot_bytes, 0);
+			if (msg == NULL)
+				break;
+			if (msg->hdr.DLdata.first_flag)
+				memcpy(&frame_id, msg->data, sizeof(uint));
+			if (msg->hdr.DLdata.final_flag)
+				frame_delivered(frame_id);
+			mac_msg_destroy(msg);
+		}
+	}
+
+	double duration = (double)num_subframes*subframe_us/1e6;
+	printf("AQM %s:\n", aqm ? "on (byte limit + CoDel)" : "off (frame limit)");
+	printf("TCP goodput: %.1f kbit/s link: %.1f kbit/s segments lost: %d loss events: %d\n",
+		   8.0*tcp.delivered*SIM_MSS/duration/1000,
+		   8.0*slot_bytes*slots_per_subframe*1000/subframe_us, tcp.lost,
+		   tcp.losses);
+	printf("TCP RTT avg: %.0fms\n", tcp.rtt_cnt ? tcp.rtt_sum/tcp.rtt_cnt/1000 : 0);
+	printf("Ping RTT avg/max: %.0f/%.0fms received %d/%d\n",
+		   ping.num_rcvd ? ping.rtt_sum/ping.num_rcvd/1000 : 0, ping.rtt_max/1000.0, ping.num_rcvd, ping.num_sent);
+	mac_frag_stats_print(buf, sizeof(buf), frag);
+	printf("%s\n", buf);
+	mac_frag_destroy(frag);
+}
+
+int main(int argc, char* argv[])
+{
+	// load default configuration
+	phy_config_default_64();
+
+	uint slot_bytes = DEFAULT_SLOT_BYTES;
+	uint slots_per_subframe = DEFAULT_SLOTS_PER_SUBFRAME;
+	if (argc>=2)
+		slot_bytes = strtol(argv[1], NULL, 10);
+	if (argc>=3)
+		slots_per_subframe = strtol(argv[2], NULL, 10);
+
+	printf("Simulating one TCP flow and a ping for %ds. %d slots of %d bytes per subframe\n\n",
+		   SIM_DURATION_S, slots_per_subframe, slot_bytes);
+
+	mac_frag_set_clock(sim_clock);
+	run_simulation(0, slot_bytes, slots_per_subframe);
+	run_simulation(1, slot_bytes, slots_per_subframe);
+	return 0;
+}
@@ -0,0 +1,332 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+// Link level simulation of the UL data slot receiver in a time variant GSM typical urban
+// channel. Slots are modulated and OFDM modulated like the UE does, sent through the TU
+// channel of platform_simulation.c with a Doppler shift per tap, a CFO and noise, and are
+// received like the BS does. A sync sequence is only sent every SIM_SLOTS_PER_SYNC slots, so
+// the channel changes after ofdmframesync has estimated it, like after the association of a
+// user. For MCS 4-6 and every SNR, the EVM of the equalized data symbols and the block error
+// rate are printed with the pilot based channel estimation (chan_est) disabled and enabled.
+// Then the throughput of the high MCS at high SNR is compared for the pilot patterns.
+// Usage: test_chest [slots per point] [Doppler frequency in Hz]
+
+#include "../phy/phy_common.h"
+#include "../phy/phy_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SIM_SNR_MIN 10
+#define SIM_SNR_MAX 30
+#define SIM_SNR_STEP 4
+#define SIM_MCS_MIN 4
+#define SIM_MCS_MAX 6
+#define SIM_HIGH_MCS_MIN 8	// MCS and SNR range of the pilot pattern comparison
+#define SIM_HIGH_SNR_MIN 18
+#define SIM_NUM_SLOTS 256
+#define SIM_SLOTS_PER_SYNC 32
+#define SIM_DOPPLER 5.0f	// maximum Doppler shift [Hz]
+#define SIM_CFO 100.0f		// carrier frequency offset [Hz]
+#define SIM_EVM_MAX 2.0f	// error vectors are limited to this magnitude in the EVM
+
+// GSM typical urban 12 tap scenario 1, as in platform_simulation.c
+static const float complex gsmTUx12c1[] = {
+	 0.0010 + 0.0013*_Complex_I,  0.0020 + 0.0079*_Complex_I, -0.0092 - 0.0218*_Complex_I,
+	 0.0111 + 0.0325*_Complex_I, -0.0154 - 0.0500*_Complex_I,  0.0226 + 0.0807*_Complex_I,
+	-0.0373 - 0.1543*_Complex_I,  0.1526 + 0.9226*_Complex_I,  0.8225 + 0.4973*_Complex_I,
+	-0.0054 - 0.0771*_Complex_I,  0.0166 + 0.0542*_Complex_I, -0.0130 - 0.0359*_Complex_I,
+	 0.0098 + 0.0238*_Complex_I, -0.0072 - 0.0154*_Complex_I,  0.0052 + 0.0095*_Complex_I,
+	-0.0035 - 0.0054*_Complex_I, -0.0012 - 0.0006*_Complex_I,  0.0000 + 0.0000*_Complex_I
+};
+#define TU_LEN (sizeof(gsmTUx12c1)/sizeof(gsmTUx12c1[0]))
+
+// time variant channel. Each tap rotates with its own Doppler shift
+typedef struct {
+	float tap_dphi[TU_LEN];	// phase increment per sample of each tap
+	float tap_phi[TU_LEN];
+	float cfo_phi;
+	float complex hist[TU_LEN];
+	unsigned long long n;
+} sim_channel_s;
+
+// receiver state, the callback stores the received symbols in rxdata_f
+typedef struct {
+	PhyCommon rx;
+	uint symbol;
+} sim_rx_s;
+
+static int sim_rx_symbol_cb(float complex* X, unsigned char* p, uint M, void* userd)
+{
+	sim_rx_s* s = (sim_rx_s*)userd;
+	memcpy(s->rx->rxdata_f[s->symbol], X, sizeof(float complex)*nfft);
+	return 0;
+}
+
+static void sim_channel_init(sim_channel_s* ch, float doppler)
+{
+	memset(ch, 0, sizeof(sim_channel_s));
+	for (int i=0; i<TU_LEN; i++) {
+		// uniformly distributed angle of arrival
+		ch->tap_dphi[i] = 2*M_PI*doppler*cosf(2*M_PI*rand()/RAND_MAX)/samplerate;
+		ch->tap_phi[i] = 2*M_PI*rand()/RAND_MAX;
+	}
+}
+
+static void sim_channel_execute(sim_channel_s* ch, float complex* in, float complex* out, uint len, float nstd)
+{
+	for (int i=0; i<len; i++) {
+		memmove(&ch->hist[1], &ch->hist[0], sizeof(float complex)*(TU_LEN-1));
+		ch->hist[0] = in[i];
+		float complex y = 0;
+		for (int l=0; l<TU_LEN; l++)
+			y += gsmTUx12c1[l]*cexpf(_Complex_I*(ch->tap_phi[l] + ch->tap_dphi[l]*ch->n))*ch->hist[l];
+		y *= cexpf(_Complex_I*ch->cfo_phi);
+		ch->cfo_phi = fmodf(ch->cfo_phi + 2*M_PI*SIM_CFO/samplerate, 2*M_PI);
+		out[i] = y + nstd*(randnf() + _Complex_I*randnf())*M_SQRT1_2;
+		ch->n++;
+	}
+}
+
+// Simulate SIM_SLOTS_PER_SYNC slots after one sync sequence
+// adds the squared error vectors, the number of symbols and the number of failed slots
+static void sim_frame(PhyCommon tx, PhyCommon rx, ofdmframegen fg, ofdmframesync fs, sim_rx_s* rx_state,
+					  sim_channel_s* ch, uint mcs, float snr, uint use_chan_est,
+					  double* evm_sum, uint* num_symbols, uint* errors)
+{
+	uint sym_len = nfft+cp_len;
+	uint frame_symbols = 1+3+SIM_SLOTS_PER_SYNC*(SLOT_LEN+1);
+	float complex* tx_buf = calloc(frame_symbols*sym_len, sizeof(float complex));
+	float complex* rx_buf = malloc(frame_symbols*sym_len*sizeof(float complex));
+	uint tbs = tx->mcs_tbs[mcs];
+	uint enc_len = tx->mcs_enc_len[mcs];
+	uint bps = modem_get_bps(tx->mcs_modem[mcs]);
+	uint num_repacked = tx->mcs_llr_len[mcs]/bps;
+	uint8_t* data = malloc(SIM_SLOTS_PER_SYNC*tbs);
+	uint8_t* buf_a = malloc(rx->mcs_llr_len[mcs]);
+	uint8_t* buf_b = malloc(rx->mcs_llr_len[mcs]);
+	float complex* tx_f = malloc(SIM_SLOTS_PER_SYNC*SLOT_LEN*nfft*sizeof(float complex));
+
+	// one empty symbol, the sync sequence and the slots, each followed by a guard symbol
+	float complex* p = tx_buf + sym_len;
+	ofdmframegen_reset(fg);
+	ofdmframegen_write_S0a(fg, p);
+	ofdmframegen_write_S0b(fg, p+sym_len);
+	ofdmframegen_write_S1(fg, p+2*sym_len);
+	p += 3*sym_len;
+	double tx_pow = 0;
+	for (int slot=0; slot<SIM_SLOTS_PER_SYNC; slot++) {
+		// encode, interleave and modulate like phy_map_ulslot()
+		for (int i=0; i<tbs; i++)
+			data[slot*tbs+i] = rand() & 0xff;
+		fec_encode(tx->mcs_fec[mcs], tbs, &data[slot*tbs], buf_a);
+		interleaver_encode(tx->mcs_interlvr[mcs], buf_a, buf_b);
+		uint written = 0;
+		liquid_repack_bytes(buf_b, 8, enc_len, buf_a, bps, num_repacked, &written);
+		for (int s=0; s<SLOT_LEN; s++)
+			memset(tx->txdata_f[0][s], 0, sizeof(float complex)*nfft);
+		phy_mod(tx, 0, 0, nfft-1, 0, SLOT_LEN-1, mcs, buf_a, num_repacked, &written);
+
+		for (int s=0; s<SLOT_LEN; s++) {
+			memcpy(&tx_f[(slot*SLOT_LEN+s)*nfft], tx->txdata_f[0][s], sizeof(float complex)*nfft);
+			if (tx->pilot_symbols_tx[0][s] == PILOT) {
+				ofdmframegen_reset(fg);
+				ofdmframegen_writesymbol(fg, tx->txdata_f[0][s], p);
+			} else {
+				ofdmframegen_writesymbol_nopilot(fg, tx->txdata_f[0][s], p);
+			}
+			for (int i=0; i<sym_len; i++)
+				tx_pow += crealf(p[i]*conjf(p[i]));
+			p += sym_len;
+		}
+		p += sym_len;
+	}
+	tx_pow /= SIM_SLOTS_PER_SYNC*SLOT_LEN*sym_len;
+
+	// SNR per used subcarrier
+	uint num_used = 0;
+	for (int i=0; i<nfft; i++)
+		num_used += rx->pilot_sc[i] != OFDMFRAME_SCTYPE_NULL;
+	float nstd = sqrtf(tx_pow*nfft/num_used*powf(10.0f, -snr/10.0f));
+	sim_channel_execute(ch, tx_buf, rx_buf, frame_symbols*sym_len, nstd);
+
+	// find the sync sequence
+	ofdmframesync_reset(fs);
+	int offset = -1;
+	uint pos = 0;
+	while (offset==-1 && pos+sym_len <= 5*sym_len) {
+		offset = ofdmframesync_find_data_start(fs, rx_buf+pos, sym_len);
+		if (offset==-1)
+			pos += sym_len;
+	}
+	if (offset==-1) {
+		*errors += SIM_SLOTS_PER_SYNC;
+		goto out;
+	}
+	pos += offset;
+
+	float ul_cfo = ofdmframesync_get_cfo(fs);
+	for (int slot=0; slot<SIM_SLOTS_PER_SYNC && pos+(SLOT_LEN+1)*sym_len <= frame_symbols*sym_len; slot++) {
+		// receive like phy_bs_rx_symbol()
+		ofdmframesync_reset_soft(fs);
+		if (use_chan_est)
+			ofdmframesync_set_cfo(fs, ul_cfo);
+		for (int s=0; s<=SLOT_LEN; s++) {
+			rx_state->symbol = s;
+			if (s<SLOT_LEN && rx->pilot_symbols_rx[s] == PILOT) {
+				ofdmframesync_reset_msequence(fs);
+				ofdmframesync_execute(fs, rx_buf+pos, sym_len);
+			} else {
+				ofdmframesync_execute_nopilot(fs, rx_buf+pos, sym_len);
+			}
+			pos += sym_len;
+		}
+
+		chan_est_s est = {0};
+		if (use_chan_est)
+			phy_chan_est_slot(rx, 0, SLOT_LEN-1, &est);
+
+		// EVM of the data symbols
+		for (int s=0; s<SLOT_LEN; s++) {
+			for (int i=0; i<nfft; i++) {
+				float complex x = tx_f[(slot*SLOT_LEN+s)*nfft+i];
+				if (x==0 || (rx->pilot_symbols_rx[s] == PILOT && rx->pilot_sc[i] != OFDMFRAME_SCTYPE_DATA))
+					continue;
+				float e = fminf(cabsf(rx->rxdata_f[s][i]-x), SIM_EVM_MAX);
+				*evm_sum += e*e;
+				(*num_symbols)++;
+			}
+		}
+
+		uint written = 0;
+		phy_demod_soft(rx, 0, nfft-1, 0, SLOT_LEN-1, mcs, buf_a, rx->mcs_llr_len[mcs], &written);
+		LogicalChannel chan = lchan_create(tbs, CRC16);
+		phy_decode_slot(rx, mcs, buf_a, chan);
+		uint ok = memcmp(chan->data, &data[slot*tbs], tbs) == 0;
+		*errors += !ok;
+		lchan_destroy(chan);
+
+		// CFO tracking like phy_bs_track_cfo()
+		if (ok && est.num_pilot_symbols>1)
+			ul_cfo = ofdmframesync_get_cfo(fs) + est.phase_drift/sym_len;
+	}
+
+out:
+	free(tx_buf);
+	free(rx_buf);
+	free(data);
+	free(buf_a);
+	free(buf_b);
+	free(tx_f);
+}
+
+// Simulate num_frames sync periods with the same channel realizations for each call
+// returns the EVM [dB] and the block error rate
+static void sim_point(PhyCommon tx, PhyCommon rx, uint mcs, float snr, uint use_chan_est, float doppler,
+					  uint num_frames, float* evm, float* bler)
+{
+	sim_rx_s rx_state = {rx, 0};
+	ofdmframegen fg = ofdmframegen_create(nfft, cp_len, 0, tx->pilot_sc);
+	ofdmframesync fs = ofdmframesync_create(nfft, cp_len, 0, rx->pilot_sc, sim_rx_symbol_cb, &rx_state);
+	phy_set_slot_pilots(tx, tx->pilot_symbols_tx[0], 0, mcs);
+	phy_set_slot_pilots(rx, rx->pilot_symbols_rx, 0, mcs);
+
+	srand(snr);
+	sim_channel_s ch;
+	sim_channel_init(&ch, doppler);
+	double evm_sum = 0;
+	uint num_symbols = 0, errors = 0;
+	for (int f=0; f<num_frames; f++)
+		sim_frame(tx, rx, fg, fs, &rx_state, &ch, mcs, snr, use_chan_est, &evm_sum, &num_symbols, &errors);
+	*evm = num_symbols ? 10*log10f(evm_sum/num_symbols) : NAN;
+	*bler = (float)errors/(num_frames*SIM_SLOTS_PER_SYNC);
+
+	ofdmframegen_destroy(fg);
+	ofdmframesync_destroy(fs);
+}
+
+int main(int argc, char* argv[])
+{
+	// load default configuration
+	phy_config_default_64();
+	uint num_slots = SIM_NUM_SLOTS;
+	float doppler = SIM_DOPPLER;
+	if (argc>=2)
+		num_slots = strtol(argv[1], NULL, 10);
+	if (argc>=3)
+		doppler = strtof(argv[2], NULL);
+	uint num_frames = (num_slots+SIM_SLOTS_PER_SYNC-1)/SIM_SLOTS_PER_SYNC;
+	double subframe_s = (double)SUBFRAME_LEN*(nfft+cp_len)/samplerate;
+
+	// UE transmitter and BS receiver
+	PhyCommon tx = phy_common_init();
+	PhyCommon rx = phy_common_init();
+	gen_pilot_symbols(tx, 0);
+	gen_pilot_symbols(rx, 1);
+
+	printf("UL slots in TU channel, %.1f Hz Doppler, %.0f Hz CFO, sync every %d slots, %d slots per point\n",
+		   doppler, SIM_CFO, SIM_SLOTS_PER_SYNC, num_frames*SIM_SLOTS_PER_SYNC);
+	printf("MCS chan_est |");
+	for (int snr=SIM_SNR_MIN; snr<=SIM_SNR_MAX; snr+=SIM_SNR_STEP)
+		printf("   %3d dB EVM/BLER", snr);
+	printf("\n");
+	for (int mcs=SIM_MCS_MIN; mcs<=SIM_MCS_MAX && mcs<NUM_MCS_SCHEMES; mcs++) {
+		for (int use_chan_est=0; use_chan_est<=1; use_chan_est++) {
+			printf("%3d %8s |", mcs, use_chan_est ? "on" : "off");
+			for (int snr=SIM_SNR_MIN; snr<=SIM_SNR_MAX; snr+=SIM_SNR_STEP) {
+				float evm, bler;
+				sim_point(tx, rx, mcs, snr, use_chan_est, doppler, num_frames, &evm, &bler);
+				printf("   %6.1f dB %5.3f", evm, bler);
+				fflush(stdout);
+			}
+			printf("\n");
+		}
+	}
+	phy_common_destroy(tx);
+	phy_common_destroy(rx);
+
+	// The slot sizes depend on the pilot pattern, so the PHY is set up again for every pattern
+	const char* pattern_names[NUM_PILOT_PATTERNS] = {"default", "sparse", "dense"};
+	printf("\nThroughput [kbit/s] of %d data slots per subframe with each pilot pattern and chan_est\n", NUM_SLOT);
+	printf("MCS pattern  TBS |");
+	for (int snr=SIM_HIGH_SNR_MIN; snr<=SIM_SNR_MAX; snr+=SIM_SNR_STEP)
+		printf(" %5d dB", snr);
+	printf("\n");
+	for (int mcs=SIM_HIGH_MCS_MIN; mcs<NUM_MCS_SCHEMES; mcs++) {
+		for (int pattern=0; pattern<NUM_PILOT_PATTERNS; pattern++) {
+			mcs_pilots[mcs] = pattern;
+			tx = phy_common_init();
+			rx = phy_common_init();
+			gen_pilot_symbols(tx, 0);
+			gen_pilot_symbols(rx, 1);
+			printf("%3d %7s %4d |", mcs, pattern_names[pattern], tx->mcs_tbs[mcs]);
+			for (int snr=SIM_HIGH_SNR_MIN; snr<=SIM_SNR_MAX; snr+=SIM_SNR_STEP) {
+				float evm, bler;
+				sim_point(tx, rx, mcs, snr, 1, doppler, num_frames, &evm, &bler);
+				printf(" %8.1f", (1-bler)*8*tx->mcs_tbs[mcs]*NUM_SLOT/subframe_s/1000);
+				fflush(stdout);
+			}
+			printf("\n");
+			phy_common_destroy(tx);
+			phy_common_destroy(rx);
+		}
+	}
+	return 0;
+}
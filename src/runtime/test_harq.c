@@ -0,0 +1,144 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+// Link level simulation of HARQ with Chase combining over an AWGN channel. Like test_mcs,
+// every block is encoded, interleaved and modulated like a data slot. Blocks with CRC error are
+// sent again HARQ_RTT subframes later, up to HARQ_MAX_TX times, and decoded with
+// phy_harq_decode(). Prints the block error rate after the first transmission and the residual
+// block error rate after all retransmissions, and the DL goodput with and without HARQ.
+// Retransmissions use the slots of new blocks, so the goodput accounts for their cost.
+
+#include "../phy/phy_common.h"
+#include "../phy/phy_config.h"
+#include "../mac/mac_channels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SIM_SNR_MIN 0
+#define SIM_SNR_MAX 30
+#define SIM_SNR_STEP 2
+#define SIM_NUM_BLOCKS 300
+
+// Encode and modulate the block, add noise and demodulate to soft bits
+static void sim_channel(PhyCommon common, uint mcs, float snr, uint8_t* data, uint8_t* buf_a,
+						uint8_t* llr)
+{
+	uint tbs = common->mcs_tbs[mcs];
+	uint enc_len = common->mcs_enc_len[mcs];
+	uint bps = modem_get_bps(common->mcs_modem[mcs]);
+	uint num_symbols = common->mcs_llr_len[mcs]/bps;
+	float nstd = powf(10.0f, -snr/20.0f);
+
+	fec_encode(common->mcs_fec[mcs], tbs, data, buf_a);
+	interleaver_encode(common->mcs_interlvr[mcs], buf_a, llr);
+	uint written = 0;
+	liquid_repack_bytes(llr, 8, enc_len, buf_a, bps, num_symbols, &written);
+
+	for (int i=0; i<num_symbols; i++) {
+		float complex x;
+		uint symbol;
+		modem_modulate(common->mcs_modem[mcs], buf_a[i], &x);
+		x += nstd*(randnf() + _Complex_I*randnf())*M_SQRT1_2;
+		modem_demodulate_soft(common->mcs_modem[mcs], x, &symbol, &llr[i*bps]);
+	}
+}
+
+// Send one block until it is received or HARQ_MAX_TX is reached
+// returns the number of transmissions, or 0 if the block was lost
+static uint sim_block(PhyCommon common, uint mcs, float snr, harq_rx_proc_s* proc,
+					  long long unsigned int* now, uint8_t* buf_a, uint8_t* llr)
+{
+	uint tbs = common->mcs_tbs[mcs];
+	LogicalChannel tx = lchan_create(tbs, CRC16);
+	LogicalChannel rx = lchan_create(tbs, CRC16);
+	// random payload, a constant block would give the same code word every time
+	for (int i=0; i<tbs-CRC16_LEN; i++)
+		tx->data[i] = rand() & 0xff;
+	tx->writepos = tbs-CRC16_LEN;
+	lchan_calc_crc(tx);
+
+	uint result = 0;
+	phy_harq_reset(proc);
+	for (int n=1; n<=HARQ_MAX_TX; n++) {
+		sim_channel(common, mcs, snr, tx->data, buf_a, llr);
+		uint num_rx;
+		if (phy_harq_decode(common, proc, mcs, llr, *now, rx, &num_rx) &&
+				memcmp(tx->data, rx->data, tbs)==0) {
+			result = n;
+			break;
+		}
+		*now += HARQ_RTT;
+	}
+	*now += HARQ_RTT;
+	lchan_destroy(tx);
+	lchan_destroy(rx);
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	// load default configuration
+	phy_config_default_64();
+	PhyCommon common = phy_common_init();
+	double subframe_s = (double)SUBFRAME_LEN*(nfft+cp_len)/samplerate;
+	uint num_blocks = SIM_NUM_BLOCKS;
+	if (argc>=2)
+		num_blocks = strtol(argv[1], NULL, 10);
+
+	uint max_llr = 0;
+	for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++)
+		max_llr = common->mcs_llr_len[mcs] > max_llr ? common->mcs_llr_len[mcs] : max_llr;
+	uint8_t* buf_a = malloc(max_llr);
+	uint8_t* llr = malloc(max_llr);
+	harq_rx_proc_s proc;
+	memset(&proc, 0, sizeof(proc));
+	long long unsigned int now = 0;
+
+	printf("HARQ with up to %d transmissions, %d blocks per point, %d data slots per subframe\n",
+		   HARQ_MAX_TX, num_blocks, NUM_SLOT);
+	printf("per SNR [dB]: BLER of the first transmission / residual BLER, goodput without / with HARQ [kbit/s]\n");
+	for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++) {
+		double block_kbit = 8.0*common->mcs_tbs[mcs]*NUM_SLOT/subframe_s/1000;
+		printf("MCS %d, TBS %d\n", mcs, common->mcs_tbs[mcs]);
+		for (int snr=SIM_SNR_MIN; snr<=SIM_SNR_MAX; snr+=SIM_SNR_STEP) {
+			uint first_ok = 0, lost = 0, num_tx = 0;
+			for (int i=0; i<num_blocks; i++) {
+				uint n = sim_block(common, mcs, snr, &proc, &now, buf_a, llr);
+				first_ok += (n==1);
+				lost += (n==0);
+				num_tx += n ? n : HARQ_MAX_TX;
+			}
+			float bler = 1-(float)first_ok/num_blocks;
+			float residual = (float)lost/num_blocks;
+			printf("  %3d dB: BLER %.3f / %.3f  goodput %7.1f / %7.1f\n", snr, bler, residual,
+				   (1-bler)*block_kbit, (float)(num_blocks-lost)/num_tx*block_kbit);
+			fflush(stdout);
+			if (residual==0 && bler==0)
+				break;
+		}
+	}
+
+	phy_harq_free(&proc, 1);
+	free(buf_a);
+	free(llr);
+	phy_common_destroy(common);
+	return 0;
+}
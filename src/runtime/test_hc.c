@@ -0,0 +1,244 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+// Simulation of the header and payload compression over a lossy link. Typical frames
+// (voice over UDP, TCP ACKs, TCP data, text over TCP, short UDP requests of many flows)
+// are sent through fragmenter, reassembler and decompressor. Each fragment uses one slot
+// and is lost with a given probability. Compares the slots needed without compression,
+// with header compression and with header and payload compression and checks that every
+// delivered frame equals the original.
+
+#include "../mac/mac_fragmentation.h"
+#include "../mac/mac_hc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_SLOT_BYTES 62		// slot payload at MCS 0
+#define DEFAULT_LOSS 0.01			// fragment loss probability
+#define SIM_NUM_FRAMES 20000
+#define SIM_MAX_PENDING 64
+
+enum {TRAFFIC_VOICE=0, TRAFFIC_TCP_ACK, TRAFFIC_TCP_DATA, TRAFFIC_TEXT, TRAFFIC_UDP_REQ, NUM_TRAFFIC};
+static const char* traffic_name[NUM_TRAFFIC] = {"voice/UDP", "TCP ACK", "TCP data", "text/TCP", "UDP req"};
+
+typedef struct {
+	uint frames;
+	uint slots;
+	uint64_t bytes;			// frame bytes before compression
+	uint64_t bytes_air;		// bytes sent as fragment payload
+} traffic_stat_s;
+
+static uint16_t ip_id = 0;
+
+static void put16(uint8_t* p, uint v)
+{
+	p[0] = v>>8;
+	p[1] = v & 0xff;
+}
+
+// Build an Ethernet/IPv4/UDP or TCP frame with valid IP checksum
+static MacDataFrame create_ip_frame(uint proto, uint flow, uint l4_hdr_len, uint payload_len, uint32_t seq)
+{
+	uint size = 14 + 20 + l4_hdr_len + payload_len;
+	MacDataFrame frame = dataframe_create(size);
+	uint8_t* d = frame->data;
+	memset(d, 0, size);
+	uint8_t dst[6] = {0x02,0x00,0x00,0x00,0x00,0x01};
+	uint8_t src[6] = {0x02,0x00,0x00,0x00,0x00,0x02};
+	memcpy(d, dst, 6);
+	memcpy(d+6, src, 6);
+	d[12] = 0x08;
+	uint8_t* ip = d+14;
+	ip[0] = 0x45;
+	put16(ip+2, 20+l4_hdr_len+payload_len);
+	put16(ip+4, ip_id++);
+	ip[6] = 0x40;
+	ip[8] = 64;
+	ip[9] = proto;
+	ip[12] = 44; ip[13] = 1; ip[14] = 0; ip[15] = 1;
+	ip[16] = 44; ip[17] = 1; ip[18] = flow>>8; ip[19] = 2+(flow&0xff);
+	uint32_t sum = 0;
+	for (int i=0; i<20; i+=2)
+		sum += (ip[i]<<8) | ip[i+1];
+	while (sum>>16)
+		sum = (sum & 0xffff) + (sum>>16);
+	put16(ip+10, ~sum & 0xffff);
+
+	uint8_t* l4 = ip+20;
+	put16(l4, 40000+flow);
+	put16(l4+2, proto==17 ? 5004 : 443);
+	if (proto==17) {
+		put16(l4+4, 8+payload_len);
+		put16(l4+6, rand() & 0xffff);
+	} else {
+		memcpy(l4+4, &seq, 4);
+		uint32_t ack = seq*3;
+		memcpy(l4+8, &ack, 4);
+		l4[12] = (l4_hdr_len/4)<<4;
+		l4[13] = payload_len ? 0x18 : 0x10;
+		put16(l4+14, 500);
+		put16(l4+16, rand() & 0xffff);
+		// timestamp option
+		l4[20] = 1; l4[21] = 1; l4[22] = 8; l4[23] = 10;
+		memcpy(l4+24, &seq, 4);
+	}
+	for (int i=0; i<payload_len; i++)
+		l4[l4_hdr_len+i] = rand();
+	return frame;
+}
+
+// JSON telemetry as an example of compressible payload
+static MacDataFrame create_text_frame(uint n)
+{
+	char text[1024];
+	int len = 0;
+	len += snprintf(text+len, sizeof(text)-len, "{\"node\":\"db0xyz-%d\",\"seq\":%d,\"sensors\":[", n%4, n);
+	for (int i=0; i<8; i++)
+		len += snprintf(text+len, sizeof(text)-len, "{\"id\":%d,\"type\":\"temperature\",\"value\":%d.%d,"
+						"\"unit\":\"celsius\"},", i, 15+rand()%10, rand()%10);
+	len += snprintf(text+len, sizeof(text)-len, "{}]}");
+	MacDataFrame frame = create_ip_frame(6, 4, 32, len, n);
+	memcpy(frame->data+14+20+32, text, len);
+	return frame;
+}
+
+static MacDataFrame create_traffic(uint type, uint n)
+{
+	switch (type) {
+	case TRAFFIC_VOICE:
+		return create_ip_frame(17, 0, 8, 12+32, n);
+	case TRAFFIC_TCP_ACK:
+		return create_ip_frame(6, 1, 32, 0, n);
+	case TRAFFIC_TCP_DATA:
+		return create_ip_frame(6, 2, 32, 1448, n);
+	case TRAFFIC_TEXT:
+		return create_text_frame(n);
+	default:
+		// many short lived flows
+		return create_ip_frame(17, 3+rand()%64, 8, 40, n);
+	}
+}
+
+// returns the number of slots used
+uint run_simulation(uint hc_enable, uint pc_enable, uint slot_bytes, double loss)
+{
+	traffic_stat_s stats[NUM_TRAFFIC] = {0};
+	MacDataFrame pending[SIM_MAX_PENDING];		// copies of the frames in flight
+	uint num_pending = 0;
+	uint delivered = 0, corrupted = 0;
+
+	MacFrag frag = mac_frag_init();
+	MacAssmbl assmbl = mac_assmbl_init();
+	MacHC hc_tx = mac_hc_init();
+	MacHC hc_rx = mac_hc_init();
+	mac_frag_set_hc(frag, hc_enable ? hc_tx : NULL);
+	mac_frag_set_payload_compression(pc_enable);
+	srand(1);
+	ip_id = 0;
+
+	for (uint n=0; n<SIM_NUM_FRAMES; n++) {
+		// traffic mix: mostly ACKs and voice, some data, text and requests
+		uint r = rand()%10;
+		uint type = r<4 ? TRAFFIC_TCP_ACK : r<6 ? TRAFFIC_VOICE : r<8 ? TRAFFIC_TCP_DATA :
+					r<9 ? TRAFFIC_TEXT : TRAFFIC_UDP_REQ;
+		MacDataFrame frame = create_traffic(type, n);
+		MacDataFrame copy = dataframe_create(frame->size);
+		memcpy(copy->data, frame->data, frame->size);
+		stats[type].frames++;
+		stats[type].bytes += frame->size;
+		mac_frag_add_frame(frag, frame);
+		if (num_pending == SIM_MAX_PENDING) {
+			dataframe_destroy(pending[0]);
+			num_pending--;
+			memmove(pending, pending+1, num_pending*sizeof(MacDataFrame));
+		}
+		pending[num_pending++] = copy;
+
+		while (mac_frag_has_fragment(frag)) {
+			MacMessage msg = mac_frag_get_fragment(frag, slot_bytes, 1);
+			stats[type].slots++;
+			stats[type].bytes_air += msg->payload_len;
+			MacDataFrame rx = NULL;
+			if ((double)rand()/RAND_MAX >= loss)
+				rx = mac_assmbl_reassemble(assmbl, msg);
+			mac_msg_destroy(msg);
+			if (rx)
+				rx = mac_hc_decompress(hc_rx, rx);
+			if (rx == NULL)
+				continue;
+			// find the original. Lost frames before are skipped
+			delivered++;
+			int found = 0;
+			while (num_pending>0 && !found) {
+				found = pending[0]->size==rx->size && memcmp(pending[0]->data, rx->data, rx->size)==0;
+				dataframe_destroy(pending[0]);
+				num_pending--;
+				memmove(pending, pending+1, num_pending*sizeof(MacDataFrame));
+			}
+			if (!found)
+				corrupted++;
+			dataframe_destroy(rx);
+		}
+	}
+
+	printf("Header compression %s, payload compression %s:\n", hc_enable ? "on" : "off",
+		   pc_enable ? "on" : "off");
+	uint total_slots = 0;
+	for (int t=0; t<NUM_TRAFFIC; t++) {
+		printf("%-10s frames: %5d avg size: %6.1f on air: %6.1f bytes slots/frame: %.2f\n",
+			   traffic_name[t], stats[t].frames, (double)stats[t].bytes/stats[t].frames,
+			   (double)stats[t].bytes_air/stats[t].frames, (double)stats[t].slots/stats[t].frames);
+		total_slots += stats[t].slots;
+	}
+	char buf[1024];
+	mac_hc_stats_print(buf, sizeof(buf), hc_tx);
+	printf("total slots: %d delivered: %d corrupted: %d\n%s", total_slots, delivered, corrupted, buf);
+	mac_hc_stats_print(buf, sizeof(buf), hc_rx);
+	printf("%s\n", buf);
+
+	while (num_pending>0)
+		dataframe_destroy(pending[--num_pending]);
+	mac_frag_destroy(frag);
+	mac_assmbl_destroy(assmbl);
+	mac_hc_destroy(hc_tx);
+	mac_hc_destroy(hc_rx);
+	return total_slots;
+}
+
+int main(int argc, char* argv[])
+{
+	uint slot_bytes = DEFAULT_SLOT_BYTES;
+	double loss = DEFAULT_LOSS;
+	if (argc>=2)
+		slot_bytes = strtol(argv[1], NULL, 10);
+	if (argc>=3)
+		loss = strtod(argv[2], NULL);
+
+	printf("Simulating %d frames. Slot payload %d bytes, fragment loss %.3f\n\n",
+		   SIM_NUM_FRAMES, slot_bytes, loss);
+	uint slots_plain = run_simulation(0, 0, slot_bytes, loss);
+	uint slots_hc = run_simulation(1, 0, slot_bytes, loss);
+	uint slots_pc = run_simulation(1, 1, slot_bytes, loss);
+	printf("Slots saved by header compression: %.1f%%, goodput gain: %.1f%%\n",
+		   100.0*(slots_plain-slots_hc)/slots_plain, 100.0*slots_plain/slots_hc-100);
+	printf("Slots saved by header and payload compression: %.1f%%, goodput gain: %.1f%%\n",
+		   100.0*(slots_plain-slots_pc)/slots_plain, 100.0*slots_plain/slots_pc-100);
+	return 0;
+}
@@ -0,0 +1,214 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+// Simulation of the DL link adaptation. A full buffer user gets all DL data slots.
+// The SNR of the link fluctuates around a mean value (slow fading). Slot errors are drawn
+// from a BLER model whose thresholds are higher than the thresholds of the MCS table
+// (implementation loss), so the outer loop has to correct them. The UE reports the measured
+// SNR and its CRC results with channel_quality messages, the BS adapts the MCS.
+// The goodput with link adaptation is compared to every fixed MCS over the same channel.
+// No PHY is used.
+
+#include "../mac/mac_la.h"
+#include "../mac/mac_config.h"
+#include "../mac/mac_messages.h"
+#include "../phy/phy_config.h"
+#include "../phy/phy_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SIM_SUBFRAMES 6000
+#define SIM_SLOTS 4					// DL data slots per subframe
+#define SIM_SNR_MIN 0				// range of the mean SNR [dB]
+#define SIM_SNR_MAX 30
+#define SIM_SNR_STEP 2
+#define SIM_FADING_STD 3.0			// std deviation of the slow fading [dB]
+#define SIM_FADING_CORR 0.995		// correlation of the fading between subframes
+#define SIM_MEAS_STD 1.0			// std deviation of a single SNR measurement [dB]
+#define SIM_IMPL_LOSS 2.0			// true SNR thresholds are higher by this value [dB]
+#define SIM_BLER_SLOPE 2.5			// slope of the BLER curves [1/dB]
+#define SIM_REPORT_DELAY 3			// subframes from report creation until the BS has it
+#define SIM_SWITCH_DELAY 4			// subframes until an MCS change is acked
+
+// Slot payload in bytes per MCS for the default 64 subcarrier config
+static const uint tbs_bytes[NUM_MCS_SCHEMES] = {62, 83, 93, 125, 141, 167, 188, 235, 251, 282, 314, 377, 440};
+static const float snr_threshold[NUM_MCS_SCHEMES] = MAC_LA_SNR_THRESHOLDS;
+
+// channel realization, equal for all runs
+static float chan_snr[SIM_SUBFRAMES];
+static float meas_noise[SIM_SUBFRAMES];
+static float slot_rand[SIM_SUBFRAMES][SIM_SLOTS];
+
+typedef struct {
+	uint bytes;
+	uint slots;
+	uint errors;
+	uint64_t mcs_sum;
+	uint mcs_changes;
+} sim_result_s;
+
+static float randn(void)
+{
+	float u1 = (rand()+1.0)/(RAND_MAX+2.0);
+	float u2 = (rand()+1.0)/(RAND_MAX+2.0);
+	return sqrtf(-2*logf(u1))*cosf(2*M_PI*u2);
+}
+
+// probability of a slot error at the given SNR
+static float bler(float snr, uint mcs)
+{
+	// BLER is 10% at the threshold plus implementation loss
+	float snr50 = snr_threshold[mcs] + SIM_IMPL_LOSS - logf(9)/SIM_BLER_SLOPE;
+	return 1/(1+expf(SIM_BLER_SLOPE*(snr - snr50)));
+}
+
+static void create_channel(float mean_snr, uint seed)
+{
+	srand(seed);
+	float fading = 0;
+	for (int sfn=0; sfn<SIM_SUBFRAMES; sfn++) {
+		fading = SIM_FADING_CORR*fading + sqrtf(1-SIM_FADING_CORR*SIM_FADING_CORR)*SIM_FADING_STD*randn();
+		chan_snr[sfn] = mean_snr + fading;
+		meas_noise[sfn] = SIM_MEAS_STD*randn();
+		for (int slot=0; slot<SIM_SLOTS; slot++)
+			slot_rand[sfn][slot] = (float)rand()/RAND_MAX;
+	}
+}
+
+static void run_fixed(uint mcs, sim_result_s* res)
+{
+	memset(res, 0, sizeof(sim_result_s));
+	for (int sfn=0; sfn<SIM_SUBFRAMES; sfn++) {
+		for (int slot=0; slot<SIM_SLOTS; slot++) {
+			res->slots++;
+			res->mcs_sum += mcs;
+			if (slot_rand[sfn][slot] < bler(chan_snr[sfn], mcs))
+				res->errors++;
+			else
+				res->bytes += tbs_bytes[mcs];
+		}
+	}
+}
+
+static void run_la(sim_result_s* res, link_adapt_s* la_bs)
+{
+	link_adapt_s la_ue;
+	uint crc_ok = 0, crc_fail = 0;
+	uint mcs = 0, mcs_pending = 0;
+	int pending_until = -1;
+	// reports on the way to the BS
+	uint8_t reports[SIM_REPORT_DELAY+1][2];
+	int report_sfn[SIM_REPORT_DELAY+1];
+	for (int i=0; i<=SIM_REPORT_DELAY; i++)
+		report_sfn[i] = -1;
+
+	memset(res, 0, sizeof(sim_result_s));
+	mac_la_init(&la_ue, MAC_LA_SNR_ALPHA);
+	mac_la_init(la_bs, 1.0);
+
+	for (int sfn=0; sfn<SIM_SUBFRAMES; sfn++) {
+		// MCS change is acked
+		if (pending_until == sfn) {
+			mcs = mcs_pending;
+			pending_until = -1;
+		}
+
+		// UE: measure the DL ctrl slot and receive the data slots
+		mac_la_add_snr(&la_ue, chan_snr[sfn] + meas_noise[sfn]);
+		for (int slot=0; slot<SIM_SLOTS; slot++) {
+			res->slots++;
+			res->mcs_sum += mcs;
+			if (slot_rand[sfn][slot] < bler(chan_snr[sfn], mcs)) {
+				res->errors++;
+				crc_fail++;
+			} else {
+				res->bytes += tbs_bytes[mcs];
+				crc_ok++;
+			}
+		}
+
+		// UE: send a report. Use the message encoding to include the quantization
+		if (sfn % MAC_LA_REPORT_INTERVAL == 0) {
+			MacMessage msg = mac_msg_create_channel_quality(la_ue.snr, crc_ok, crc_fail);
+			int idx = sfn % (SIM_REPORT_DELAY+1);
+			mac_msg_generate(msg, reports[idx], 2);
+			report_sfn[idx] = sfn;
+			mac_msg_destroy(msg);
+			crc_ok = 0;
+			crc_fail = 0;
+		}
+
+		// BS: process reports that arrived
+		int idx = (sfn+1) % (SIM_REPORT_DELAY+1);
+		if (report_sfn[idx] >= 0 && report_sfn[idx] + SIM_REPORT_DELAY == sfn) {
+			MacMessage msg = mac_msg_parse(reports[idx], 2, 1);
+			MacChannelQuality* cq = &msg->hdr.ChannelQuality;
+			mac_la_add_snr(la_bs, (int)cq->snr - CHANNEL_QUALITY_SNR_OFFSET);
+			if (pending_until < 0) {
+				mac_la_add_crc(la_bs, cq->crc_ok, cq->crc_fail);
+				uint new_mcs = mac_la_select(la_bs, mcs, sfn);
+				if (new_mcs != mcs) {
+					mcs_pending = new_mcs;
+					pending_until = sfn + SIM_SWITCH_DELAY;
+					res->mcs_changes++;
+				}
+			}
+			mac_msg_destroy(msg);
+			report_sfn[idx] = -1;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	// load default configuration
+	phy_config_default_64();
+	double subframe_s = (double)SUBFRAME_LEN*(nfft+cp_len)/samplerate;
+	double duration = SIM_SUBFRAMES*subframe_s;
+
+	for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++)
+		mac_la_set_tbs(mcs, 8*tbs_bytes[mcs]);
+
+	printf("DL goodput [kbit/s] vs. mean SNR. %d slots per subframe, %.0fs per SNR, fading std %.1fdB, "
+		   "implementation loss %.1fdB\n\n", SIM_SLOTS, duration, SIM_FADING_STD, SIM_IMPL_LOSS);
+	printf("SNR |   LA  BLER  MCS chg  off |");
+	for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++)
+		printf(" MCS%d ", mcs);
+	printf("| LA/best\n");
+
+	for (int snr=SIM_SNR_MIN; snr<=SIM_SNR_MAX; snr+=SIM_SNR_STEP) {
+		sim_result_s res, res_fixed;
+		link_adapt_s la;
+		create_channel(snr, 1234);
+		run_la(&res, &la);
+		printf("%3d | %5.1f %4.1f%% %4.1f %3d %4.1f |", snr, 8.0*res.bytes/duration/1000,
+			   100.0*res.errors/res.slots, (float)res.mcs_sum/res.slots, res.mcs_changes, la.offset);
+		double best = 0;
+		for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++) {
+			run_fixed(mcs, &res_fixed);
+			double rate = 8.0*res_fixed.bytes/duration/1000;
+			best = rate > best ? rate : best;
+			printf(" %5.1f", rate);
+		}
+		printf(" | %5.1f%%\n", best > 0 ? 100.0*8.0*res.bytes/duration/1000/best : 0);
+	}
+	return 0;
+}
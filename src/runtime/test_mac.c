@@ -166,6 +166,7 @@ int run_simulation(uint num_subframes, uint mcs)
 			// first add the last samples from the previous generated symbol
 			client->platform_tx_prep(client, ul_data_tx+num_samples, 0, tx_shift);
 			// create new symbol
+			phy_ue->tx_sample = client->tx_sample_cnt + tx_shift;
 			phy_ue_write_symbol(phy_ue, ul_data_tx);
 
 			// prepare first part of the new symbol
@@ -229,6 +230,24 @@ int run_simulation(uint num_subframes, uint mcs)
 	printf("MAC UE channels received:fail %d:%d\n",mac_ue->stats.chan_rx_succ,mac_ue->stats.chan_rx_fail);
 	printf("       bytes rx: %d bytes tx: %d\n",mac_ue->stats.bytes_rx, mac_ue->stats.bytes_tx);
 
+	// UL slot efficiency and delay
+	if (mac_bs->UE[2]) {
+		sched_stat_s* st = &mac_bs->UE[2]->sched_stats[UL];
+		printf("MAC UL slots granted: %d with data: %d efficiency: %.1f%%\n", st->slots, st->used,
+				st->slots ? 100.0*st->used/st->slots : 0);
+	}
+	int num_rx = 0;
+	double delay_sum = 0;
+	for (int i=0; i<packet_id && i<num_simulated_subframes; i++) {
+		if (mac_ul_timestamps[i] >= 0) {
+			delay_sum += mac_ul_timestamps[i];
+			num_rx++;
+		}
+	}
+	if (num_rx > 0)
+		printf("MAC UL frames received: %d/%d mean delay: %.2fms\n", num_rx, packet_id,
+				1000.0*delay_sum/num_rx*(nfft+cp_len)/samplerate);
+
 	return 0;
 }
 
@@ -279,11 +298,13 @@ int main(int argc, char* argv[])
 {
     // load default configuration
     phy_config_default_64();
+    // the simulation uses a fixed MCS
+    mac_la_set_enabled(0);
     buflen = nfft+cp_len;
 
 	// Arrays to store biterror rates. First index: MCS, second index: SNR
-	double biterr_ul_array[8][50]= {0};
-	double biterr_dl_array[8][50]= {0};
+	double biterr_ul_array[NUM_MCS_SCHEMES][50]= {0};
+	double biterr_dl_array[NUM_MCS_SCHEMES][50]= {0};
 	int mcs=0;
 	float cfo = 100;
 
@@ -0,0 +1,137 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+// Link level simulation of the MCS schemes over an AWGN channel. For every MCS and SNR,
+// random transport blocks are encoded, interleaved and modulated like a data slot, noise is
+// added and the block is demodulated and decoded again. Prints the block error rate, the
+// DL throughput with all data slots of a subframe and the SNR at which each MCS reaches
+// 10% block errors, which is used for MAC_LA_SNR_THRESHOLDS. OFDM, sync and channel
+// estimation are not simulated, so the results are a lower bound of the required SNR.
+
+#include "../phy/phy_common.h"
+#include "../phy/phy_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SIM_SNR_MIN 0
+#define SIM_SNR_MAX 30
+#define SIM_NUM_BLOCKS 500
+#define SIM_BLER_TARGET 0.1
+
+// returns 1 if the block was decoded correctly
+static int sim_block(PhyCommon common, uint mcs, float snr, uint8_t* data, uint8_t* buf_a, uint8_t* buf_b,
+					 uint8_t* decoded)
+{
+	uint tbs = common->mcs_tbs[mcs];
+	uint enc_len = common->mcs_enc_len[mcs];
+	uint bps = modem_get_bps(common->mcs_modem[mcs]);
+	uint num_symbols = common->mcs_llr_len[mcs]/bps;
+	float nstd = powf(10.0f, -snr/20.0f);
+
+	for (int i=0; i<tbs; i++)
+		data[i] = rand() & 0xff;
+
+	// encode, interleave and repack to symbols like phy_map_dlslot()
+	fec_encode(common->mcs_fec[mcs], tbs, data, buf_a);
+	interleaver_encode(common->mcs_interlvr[mcs], buf_a, buf_b);
+	uint written = 0;
+	liquid_repack_bytes(buf_b, 8, enc_len, buf_a, bps, num_symbols, &written);
+
+	// modulate, add noise and demodulate
+	for (int i=0; i<num_symbols; i++) {
+		float complex x;
+		uint symbol;
+		modem_modulate(common->mcs_modem[mcs], buf_a[i], &x);
+		x += nstd*(randnf() + _Complex_I*randnf())*M_SQRT1_2;
+		modem_demodulate_soft(common->mcs_modem[mcs], x, &symbol, &buf_b[i*bps]);
+	}
+
+	// deinterleave and decode
+	interleaver_decode_soft(common->mcs_interlvr[mcs], buf_b, buf_a);
+	fec_decode_soft(common->mcs_fec[mcs], tbs, buf_a, decoded);
+	return memcmp(data, decoded, tbs) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	// load default configuration
+	phy_config_default_64();
+	PhyCommon common = phy_common_init();
+	double subframe_s = (double)SUBFRAME_LEN*(nfft+cp_len)/samplerate;
+	uint num_blocks = SIM_NUM_BLOCKS;
+	if (argc>=2)
+		num_blocks = strtol(argv[1], NULL, 10);
+
+	uint max_llr = 0;
+	for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++)
+		max_llr = common->mcs_llr_len[mcs] > max_llr ? common->mcs_llr_len[mcs] : max_llr;
+	uint8_t* data = malloc(max_llr);
+	uint8_t* decoded = malloc(max_llr);
+	uint8_t* buf_a = malloc(max_llr);
+	uint8_t* buf_b = malloc(max_llr);
+
+	float bler[NUM_MCS_SCHEMES][SIM_SNR_MAX-SIM_SNR_MIN+1];
+	printf("Block error rate vs. SNR [dB], %d blocks per point\n", num_blocks);
+	printf("MCS   TBS |");
+	for (int snr=SIM_SNR_MIN; snr<=SIM_SNR_MAX; snr++)
+		printf(" %4d", snr);
+	printf("\n");
+	for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++) {
+		printf("%3d %5d |", mcs, common->mcs_tbs[mcs]);
+		for (int snr=SIM_SNR_MIN; snr<=SIM_SNR_MAX; snr++) {
+			uint errors = 0;
+			for (int i=0; i<num_blocks; i++)
+				errors += !sim_block(common, mcs, snr, data, buf_a, buf_b, decoded);
+			bler[mcs][snr-SIM_SNR_MIN] = (float)errors/num_blocks;
+			printf(" %.2f", bler[mcs][snr-SIM_SNR_MIN]);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+
+	printf("\nDL throughput [kbit/s] with %d data slots per subframe\n", NUM_SLOT);
+	printf("MCS SNR@%.0f%% |", 100*SIM_BLER_TARGET);
+	for (int snr=SIM_SNR_MIN; snr<=SIM_SNR_MAX; snr++)
+		printf(" %5d", snr);
+	printf("\n");
+	for (int mcs=0; mcs<NUM_MCS_SCHEMES; mcs++) {
+		// interpolate the SNR at the target block error rate
+		float snr_target = NAN;
+		for (int i=1; i<=SIM_SNR_MAX-SIM_SNR_MIN; i++) {
+			float b0 = bler[mcs][i-1], b1 = bler[mcs][i];
+			if (b0 > SIM_BLER_TARGET && b1 <= SIM_BLER_TARGET) {
+				snr_target = SIM_SNR_MIN + i-1 + (b0-SIM_BLER_TARGET)/(b0-b1);
+				break;
+			}
+		}
+		printf("%3d %6.1f |", mcs, snr_target);
+		for (int snr=SIM_SNR_MIN; snr<=SIM_SNR_MAX; snr++)
+			printf(" %5.1f", (1-bler[mcs][snr-SIM_SNR_MIN])*8*common->mcs_tbs[mcs]*NUM_SLOT/subframe_s/1000);
+		printf("\n");
+	}
+
+	free(data);
+	free(decoded);
+	free(buf_a);
+	free(buf_b);
+	phy_common_destroy(common);
+	return 0;
+}
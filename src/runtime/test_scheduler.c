@@ -0,0 +1,222 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+// Multi-user simulation of the BS scheduler. No PHY signal processing is done,
+// all users are saturated in DL and UL. Compares the fairness (Jain index)
+// and aggregate throughput of the round robin and the deficit round robin scheduler.
+// A second scenario with many users that only send and receive small packets compares
+// full slots with slots split into resource blocks (UL) and mini-slots (DL and UL)
+
+#include "../mac/mac_bs.h"
+#include "../phy/phy_bs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_NUM_USERS 12
+#define DEFAULT_NUM_SUBFRAMES 20000
+
+// keep this many bytes queued per user and direction
+#define SIM_BACKLOG (2*MAC_MTU)
+
+// small packet scenario: a DL and an UL packet of this size arrive at each user
+// with this probability per subframe
+#define SIM_SMALL_PACKET 10
+#define SIM_SMALL_RATE 0.25
+#define SIM_SMALL_USERS (MAX_USER-2)
+
+PhyBS phy_bs;
+MacBS mac_bs;
+
+// Jain's fairness index: 1 if all users get the same, 1/n if one user gets everything
+double jain_index(double* x, uint n)
+{
+	double sum=0, sum_sq=0;
+	for (int i=0; i<n; i++) {
+		sum += x[i];
+		sum_sq += x[i]*x[i];
+	}
+	return sum_sq>0 ? sum*sum/(n*sum_sq) : 0;
+}
+
+void setup_simulation(uint num_users, enum mac_sched_type sched_type)
+{
+	phy_bs = phy_bs_init();
+	mac_bs = mac_bs_init();
+	phy_bs_set_mac_interface(phy_bs, mac_bs);
+	mac_bs_set_phy_interface(mac_bs, phy_bs);
+	mac_bs->sched_type = sched_type;
+
+	// associate users. Alternate the MCS to have different TBS per user
+	for (int i=0; i<num_users; i++) {
+		ofdmframesync fs = ofdmframesync_create(nfft, cp_len, 0, phy_bs->common->pilot_sc, NULL, NULL);
+		mac_bs_add_new_ue(mac_bs, i, 0, fs, 0);
+		user_s* ue = mac_bs->UE[mac_bs->last_added_userid];
+		ue->dl_mcs = i%3;
+		ue->ul_mcs = i%3;
+	}
+}
+
+void clean_simulation()
+{
+	phy_bs_destroy(phy_bs);
+	mac_bs_destroy(mac_bs);
+}
+
+void run_simulation(uint num_subframes, int small_packets)
+{
+	for (uint sfn=0; sfn<num_subframes; sfn++) {
+		for (int userid=0; userid<MAX_USER; userid++) {
+			user_s* ue = mac_bs->UE[userid];
+			if (ue==NULL)
+				continue;
+			// users never become inactive
+			ue->last_seen = mac_bs->subframe_cnt;
+			if (small_packets) {
+				if (rand() < SIM_SMALL_RATE*RAND_MAX)
+					ue->ul_queue += SIM_SMALL_PACKET;
+				if (rand() < SIM_SMALL_RATE*RAND_MAX) {
+					MacDataFrame frame = dataframe_create(SIM_SMALL_PACKET);
+					memset(frame->data, 0, SIM_SMALL_PACKET);
+					if (!mac_bs_add_txdata(mac_bs, userid, frame))
+						dataframe_destroy(frame);
+				}
+				continue;
+			}
+			// saturate DL and UL queues
+			while (mac_frag_get_buffersize(ue->fragmenter) < SIM_BACKLOG) {
+				MacDataFrame frame = dataframe_create(MAC_MTU);
+				if (!mac_bs_add_txdata(mac_bs, userid, frame)) {
+					dataframe_destroy(frame);
+					break;
+				}
+			}
+			if (ue->ul_queue < SIM_BACKLOG)
+				ue->ul_queue = SIM_BACKLOG;
+		}
+		phy_bs->common->tx_subframe = sfn % FRAME_LEN;
+		phy_bs->common->tx_symbol = 0;
+		mac_bs_run_scheduler(mac_bs);
+	}
+}
+
+void print_results(uint num_subframes, const char* name)
+{
+	double tp[2][MAX_USER];
+	double total[2] = {0};
+	uint n = 0;
+	char buf[1024];
+	double duration = (double)num_subframes*SUBFRAME_LEN*(nfft+cp_len)/samplerate;
+
+	printf("Scheduler %s:\n",name);
+	for (int userid=0; userid<MAX_USER; userid++) {
+		user_s* ue = mac_bs->UE[userid];
+		if (ue==NULL)
+			continue;
+		for (int dir=DL; dir<=UL; dir++) {
+			tp[dir][n] = 8.0*ue->sched_stats[dir].bytes/duration/1000;
+			total[dir] += tp[dir][n];
+		}
+		n++;
+		mac_bs_sched_stats_print(buf, 1024, mac_bs, userid);
+		printf("User %2d mcs %d\n%s",userid,ue->dl_mcs,buf);
+	}
+	printf("DL: aggregate %.1f kbit/s Jain index %.3f\n",total[DL],jain_index(tp[DL],n));
+	printf("UL: aggregate %.1f kbit/s Jain index %.3f\n\n",total[UL],jain_index(tp[UL],n));
+}
+
+void print_small_packet_results(uint num_subframes, const char* name)
+{
+	const char* dir_name[2] = {"DL","UL"};
+	double duration = (double)num_subframes*SUBFRAME_LEN*(nfft+cp_len)/samplerate;
+
+	printf("Small packets, %s:\n",name);
+	for (int dir=DL; dir<=UL; dir++) {
+		double bytes = 0;
+		uint slots = 0, rbs = 0, minis = 0, latency_sum = 0, latency_cnt = 0, latency_max = 0;
+		for (int userid=0; userid<MAX_USER; userid++) {
+			user_s* ue = mac_bs->UE[userid];
+			if (ue==NULL)
+				continue;
+			sched_stat_s* st = &ue->sched_stats[dir];
+			// DL slots also carry message headers, count the fragment payload
+			bytes += dir==DL ? ue->stats.bytes_tx : st->bytes;
+			slots += st->slots;
+			rbs += st->rbs;
+			minis += st->minis;
+			latency_sum += st->latency_sum;
+			latency_cnt += st->latency_cnt;
+			if (st->latency_max > latency_max)
+				latency_max = st->latency_max;
+		}
+		printf("%s: %.1f packets/s %.1f kbit/s\n",dir_name[dir],bytes/SIM_SMALL_PACKET/duration,8.0*bytes/duration/1000);
+		printf("%s airtime: %.2f slots per subframe (%d slots, %d resource blocks, %d mini-slots)\n",
+			   dir_name[dir], (double)mac_bs->sched_slots[dir]/num_subframes, slots, rbs, minis);
+		printf("%s latency avg/max: %.1f/%d subframes\n",dir_name[dir],
+			   latency_cnt ? (double)latency_sum/latency_cnt : 0, latency_max);
+	}
+	printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+	// load default configuration
+	phy_config_default_64();
+	// users have fixed MCS
+	mac_la_set_enabled(0);
+	// there are no UEs that send HARQ feedback or ARQ status reports
+	mac_harq_set_enabled(0);
+	mac_frag_set_arq_enabled(0);
+
+	uint num_users = DEFAULT_NUM_USERS;
+	uint num_subframes = DEFAULT_NUM_SUBFRAMES;
+	if (argc>=2)
+		num_users = strtol(argv[1], NULL, 10);
+	if (argc>=3)
+		num_subframes = strtol(argv[2], NULL, 10);
+	if (num_users > MAX_USER-2)
+		num_users = MAX_USER-2;
+
+	printf("Simulating %d saturated users for %d subframes\n\n",num_users,num_subframes);
+
+	setup_simulation(num_users, MAC_SCHED_RR);
+	run_simulation(num_subframes, 0);
+	print_results(num_subframes, "round robin");
+	clean_simulation();
+
+	setup_simulation(num_users, MAC_SCHED_DRR);
+	run_simulation(num_subframes, 0);
+	print_results(num_subframes, "deficit round robin");
+	clean_simulation();
+
+	// many users with small packets, with and without resource blocks and mini-slots
+	const char* split_name[4] = {"full slots", "UL resource blocks", "mini-slots", "UL resource blocks and mini-slots"};
+	printf("Simulating %d users with small packets for %d subframes\n\n",SIM_SMALL_USERS,num_subframes);
+	for (int split=0; split<4; split++) {
+		ul_rb = split & 1;
+		mini_slots = split >> 1;
+		srand(1);
+		setup_simulation(SIM_SMALL_USERS, MAC_SCHED_DRR);
+		run_simulation(num_subframes, 1);
+		print_small_packet_results(num_subframes, split_name[split]);
+		clean_simulation();
+	}
+
+	return 0;
+}
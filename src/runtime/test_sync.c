@@ -0,0 +1,207 @@
+/*
+ * HNAP4PlutoSDR - HAMNET Access Protocol implementation for the Adalm Pluto SDR
+ *
+ * Copyright (C) 2020 Lukas Ostendorf <lukas.ostendorf@gmail.com>
+ *                    and the project contributors
+ *
+ * This library is free software; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by the Free Software Foundation; version 3.0.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+// Simulation of the acquisition of the sync sequence, like the UE after the receiver was
+// reset. Random OFDM data symbols are followed by the sync sequence, with a random CFO and
+// noise. The samples are searched symbol by symbol with the sample by sample search of
+// ofdmframesync only and with the coarse FFT correlator of phy_sync.c at each decimation.
+// For each SNR the detection rate, the timing error, the CPU load during the search and the
+// expected time to sync are printed. A missed sync sequence costs one frame.
+// Usage: test_sync [trials per point] [max CFO in Hz]
+
+#include "../phy/phy_common.h"
+#include "../phy/phy_sync.h"
+#include "../phy/phy_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SIM_SNR_MIN 0
+#define SIM_SNR_MAX 20
+#define SIM_SNR_STEP 4
+#define SIM_NUM_TRIALS 200
+#define SIM_CFO_MAX 3000.0f		// CFO is uniformly distributed in +-SIM_CFO_MAX [Hz]
+// symbols between the reset of the UE receiver and the sync sequence, see phy_ue_symbol_done()
+#define SIM_LEAD_SYMBOLS 11
+#define SIM_TAIL_SYMBOLS 2
+
+typedef struct {
+	const char* name;
+	int coarse_sync;
+	int decim;
+} sim_method_s;
+
+static const sim_method_s methods[] = {
+	{"ofdmframesync", 0, 1},
+	{"coarse", 1, 1},
+	{"coarse dec 2", 1, 2},
+};
+#define NUM_METHODS (sizeof(methods)/sizeof(methods[0]))
+
+typedef struct {
+	uint found;
+	double timing_err;
+	double cpu_ns;
+	double samples;
+	double found_samples;
+} sim_result_s;
+
+static int sim_rx_symbol_cb(float complex* X, unsigned char* p, uint M, void* userd)
+{
+	return 0;
+}
+
+// Writes random QPSK symbols on the used subcarriers, the sync sequence and some data symbols.
+// returns the number of samples and the index of the first sample after the sync sequence
+static uint sim_gen_stream(PhyCommon common, ofdmframegen fg, float complex* buf, uint* data_start, float* tx_pow)
+{
+	uint sym_len = nfft+cp_len;
+	float complex* X = malloc(nfft*sizeof(float complex));
+	uint pos = 0;
+	// random fraction of a symbol, so the sync sequence is not aligned to the search blocks
+	uint lead = SIM_LEAD_SYMBOLS*sym_len + rand() % sym_len;
+	uint num_symbols = (lead+sym_len-1)/sym_len + SIM_TAIL_SYMBOLS;
+	float complex* data = malloc(num_symbols*sym_len*sizeof(float complex));
+	double pow = 0;
+	for (int s=0; s<num_symbols; s++) {
+		for (int i=0; i<nfft; i++)
+			X[i] = common->pilot_sc[i]==OFDMFRAME_SCTYPE_NULL ? 0 :
+					((rand()&1 ? 1 : -1) + (rand()&1 ? 1 : -1)*_Complex_I)*M_SQRT1_2;
+		ofdmframegen_writesymbol_nopilot(fg, X, data+s*sym_len);
+	}
+	for (int i=0; i<num_symbols*sym_len; i++)
+		pow += crealf(data[i]*conjf(data[i]));
+	*tx_pow = pow/(num_symbols*sym_len);
+
+	memcpy(buf, data+(num_symbols-SIM_TAIL_SYMBOLS)*sym_len-lead, lead*sizeof(float complex));
+	pos = lead;
+	ofdmframegen_reset(fg);
+	ofdmframegen_write_S0a(fg, buf+pos);
+	ofdmframegen_write_S0b(fg, buf+pos+sym_len);
+	ofdmframegen_write_S1(fg, buf+pos+2*sym_len);
+	pos += 3*sym_len;
+	*data_start = pos;
+	memcpy(buf+pos, data+(num_symbols-SIM_TAIL_SYMBOLS)*sym_len, SIM_TAIL_SYMBOLS*sym_len*sizeof(float complex));
+	pos += SIM_TAIL_SYMBOLS*sym_len;
+
+	free(X);
+	free(data);
+	return pos;
+}
+
+static void sim_channel(float complex* in, float complex* out, uint len, float cfo, float nstd)
+{
+	float phi = 2*M_PI*rand()/RAND_MAX;
+	for (int i=0; i<len; i++) {
+		out[i] = in[i]*cexpf(_Complex_I*(phi + 2*M_PI*cfo/samplerate*i));
+		out[i] += nstd*(randnf() + _Complex_I*randnf())*M_SQRT1_2;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	// load default configuration
+	phy_config_default_64();
+	uint num_trials = SIM_NUM_TRIALS;
+	float max_cfo = SIM_CFO_MAX;
+	if (argc>=2)
+		num_trials = strtol(argv[1], NULL, 10);
+	if (argc>=3)
+		max_cfo = strtof(argv[2], NULL);
+	uint sym_len = nfft+cp_len;
+	double frame_ms = 1000.0*FRAME_LEN*SUBFRAME_LEN*sym_len/samplerate;
+
+	PhyCommon common = phy_common_init();
+	gen_pilot_symbols(common, 0);
+	ofdmframegen fg = ofdmframegen_create(nfft, cp_len, 0, common->pilot_sc);
+	ofdmframesync fs = ofdmframesync_create(nfft, cp_len, 0, common->pilot_sc, sim_rx_symbol_cb, NULL);
+	PhySync sync[NUM_METHODS];
+	for (int m=0; m<NUM_METHODS; m++) {
+		coarse_sync_decim = methods[m].decim;
+		coarse_sync_max_cfo = max_cfo;
+		sync[m] = phy_sync_init(common->pilot_sc);
+	}
+
+	uint buf_len = (SIM_LEAD_SYMBOLS+1+3+SIM_TAIL_SYMBOLS)*sym_len;
+	float complex* tx_buf = malloc(buf_len*sizeof(float complex));
+	float complex* rx_buf = malloc(buf_len*sizeof(float complex));
+
+	printf("Acquisition of the sync sequence after %d data symbols, CFO +-%.0f Hz, %d trials per point\n",
+		   SIM_LEAD_SYMBOLS, max_cfo, num_trials);
+	printf("CPU: time spent in the search per time of searched samples. Time to sync includes a frame per miss\n");
+	printf("SNR method        | detected  timing err [samples]  CPU load  time to sync\n");
+	for (int snr=SIM_SNR_MIN; snr<=SIM_SNR_MAX; snr+=SIM_SNR_STEP) {
+		sim_result_s res[NUM_METHODS];
+		memset(res, 0, sizeof(res));
+		srand(snr);
+		for (int t=0; t<num_trials; t++) {
+			uint data_start;
+			float tx_pow;
+			uint len = sim_gen_stream(common, fg, tx_buf, &data_start, &tx_pow);
+			uint num_used = 0;
+			for (int i=0; i<nfft; i++)
+				num_used += common->pilot_sc[i] != OFDMFRAME_SCTYPE_NULL;
+			// SNR per used subcarrier
+			float nstd = sqrtf(tx_pow*nfft/num_used*powf(10.0f, -snr/10.0f));
+			float cfo = max_cfo*(2.0f*rand()/RAND_MAX-1);
+			sim_channel(tx_buf, rx_buf, len, cfo, nstd);
+
+			for (int m=0; m<NUM_METHODS; m++) {
+				// search symbol by symbol like phy_ue_do_rx() with the test_mac buffers
+				coarse_sync = methods[m].coarse_sync;
+				ofdmframesync_reset(fs);
+				phy_sync_reset(sync[m]);
+				int offset = -1;
+				uint pos = 0;
+				while (offset==-1 && pos<len) {
+					uint n = fmin(sym_len, len-pos);
+					offset = phy_sync_find_data_start(sync[m], fs, rx_buf+pos, n);
+					if (offset==-1)
+						pos += n;
+				}
+				const sync_stats_s* stats = phy_sync_get_stats(sync[m]);
+				res[m].cpu_ns += stats->cpu_ns;
+				res[m].samples += stats->samples;
+				if (offset!=-1 && abs((int)(pos+offset)-(int)data_start) <= cp_len) {
+					res[m].found++;
+					res[m].timing_err += abs((int)(pos+offset)-(int)data_start);
+					res[m].found_samples += stats->samples;
+				}
+			}
+		}
+		for (int m=0; m<NUM_METHODS; m++) {
+			float pd = (float)res[m].found/num_trials;
+			double load = res[m].cpu_ns/1e9 / (res[m].samples/samplerate);
+			double t_sync = res[m].found ? 1000.0*res[m].found_samples/res[m].found/samplerate + (1/pd-1)*frame_ms : INFINITY;
+			printf("%3d %-13s | %8.3f  %20.2f  %7.2f %%  %9.1f ms\n", snr, methods[m].name, pd,
+				   res[m].found ? res[m].timing_err/res[m].found : NAN, 100*load, t_sync);
+		}
+		fflush(stdout);
+	}
+
+	for (int m=0; m<NUM_METHODS; m++)
+		phy_sync_destroy(sync[m]);
+	ofdmframegen_destroy(fg);
+	ofdmframesync_destroy(fs);
+	phy_common_destroy(common);
+	free(tx_buf);
+	free(rx_buf);
+	return 0;
+}
@@ -86,3 +86,25 @@ int ringbuf_isempty(ringbuf buf)
 		return 0;
 	}
 }
+
+uint32_t ringbuf_len(ringbuf buf)
+{
+	return (buf->writepos + buf->size - buf->readpos) % buf->size;
+}
+
+void* ringbuf_peek(ringbuf buf, uint32_t idx)
+{
+	if (idx >= ringbuf_len(buf)) {
+		return NULL;
+	}
+	return buf->data[(buf->readpos + idx) % buf->size];
+}
+
+int ringbuf_set(ringbuf buf, uint32_t idx, void* item)
+{
+	if (idx >= ringbuf_len(buf)) {
+		return 0;
+	}
+	buf->data[(buf->readpos + idx) % buf->size] = item;
+	return 1;
+}
@@ -52,4 +52,15 @@ int ringbuf_isfull(ringbuf buf);
 // Check if the buffer is full
 int ringbuf_isempty(ringbuf buf);
 
+// Get the number of items in the buffer
+uint32_t ringbuf_len(ringbuf buf);
+
+// Get the item at position idx without removing it. idx 0 is the oldest item
+// returns NULL if idx exceeds the number of items
+void* ringbuf_peek(ringbuf buf, uint32_t idx);
+
+// Replace the item at position idx. Must only be called by the consumer
+// returns 1 on success, 0 if idx exceeds the number of items
+int ringbuf_set(ringbuf buf, uint32_t idx, void* item);
+
 #endif /* UTIL_RINGBUF_H_ */